@@ -9,14 +9,6 @@
 
 #include "nat64/common/types.h"
 #include "nat64/common/xlat.h"
-/* TODO (usr) really necessary? */
-#ifdef BENCHMARK
-	#ifdef __KERNEL__
-		#include <linux/time.h>
-	#else
-		#include <time.h>
-	#endif
-#endif
 
 /** cuz sizeof(bool) is implementation-defined. */
 typedef __u8 config_bool;
@@ -55,7 +47,7 @@ enum config_mode {
 	MODE_BIB = (1 << 3),
 	/** The current message is talking about the session tables. */
 	MODE_SESSION = (1 << 4),
-	/** The current message is talking about log times for benchmark. */
+	/** The current message is talking about the latency histograms. */
 	MODE_LOGTIME = (1 << 5),
 	/** The current message is talking about the JSON configuration file */
 	MODE_PARSE_FILE = (1 << 9),
@@ -63,6 +55,8 @@ enum config_mode {
 	MODE_JOOLD = (1 << 10),
 
 	MODE_INSTANCE = (1 << 11),
+	/** The current message is talking about the translator's counters. */
+	MODE_STATS = (1 << 12),
 };
 
 /**
@@ -82,8 +76,9 @@ enum config_mode {
 #define BIB_OPS (DATABASE_OPS & ~OP_FLUSH)
 #define SESSION_OPS (OP_DISPLAY | OP_COUNT)
 #define JOOLD_OPS (OP_ADVERTISE | OP_TEST)
-#define LOGTIME_OPS (OP_DISPLAY)
+#define LOGTIME_OPS (OP_DISPLAY | OP_FLUSH)
 #define INSTANCE_OPS (OP_ADD | OP_REMOVE)
+#define STATS_OPS (OP_DISPLAY)
 /**
  * @}
  */
@@ -139,18 +134,20 @@ enum parse_section {
 #define TABLE_MODES (MODE_EAMT | MODE_BIB | MODE_SESSION)
 #define ANY_MODE 0xFFFF
 
-#define DISPLAY_MODES (MODE_GLOBAL | POOL_MODES | TABLE_MODES | MODE_LOGTIME)
+#define DISPLAY_MODES (MODE_GLOBAL | POOL_MODES | TABLE_MODES | MODE_LOGTIME \
+		| MODE_STATS)
 #define COUNT_MODES (POOL_MODES | TABLE_MODES)
 #define ADD_MODES (POOL_MODES | MODE_EAMT | MODE_BIB | MODE_INSTANCE)
 #define REMOVE_MODES (POOL_MODES | MODE_EAMT | MODE_BIB | MODE_INSTANCE)
-#define FLUSH_MODES (POOL_MODES | MODE_EAMT)
+#define FLUSH_MODES (POOL_MODES | MODE_EAMT | MODE_LOGTIME)
 #define UPDATE_MODES (MODE_GLOBAL | MODE_PARSE_FILE)
 
 #define SIIT_MODES (MODE_GLOBAL | MODE_POOL6 | MODE_BLACKLIST | MODE_RFC6791 \
-		| MODE_EAMT | MODE_LOGTIME | MODE_PARSE_FILE | MODE_INSTANCE)
+		| MODE_EAMT | MODE_LOGTIME | MODE_PARSE_FILE | MODE_INSTANCE \
+		| MODE_STATS)
 #define NAT64_MODES (MODE_GLOBAL | MODE_POOL6 | MODE_POOL4 | MODE_BIB \
 		| MODE_SESSION | MODE_LOGTIME | MODE_PARSE_FILE \
-		| MODE_INSTANCE | MODE_JOOLD)
+		| MODE_INSTANCE | MODE_JOOLD | MODE_STATS)
 /**
  * @}
  */
@@ -296,15 +293,10 @@ union request_eamt {
  * Configuration for the "Log time" module.
  */
 struct request_logtime {
-	__u8 l3_proto;
-	__u8 l4_proto;
 	union {
 		struct {
-			/**
-			 * If this is false, this is the first chunk the app is
-			 * requesting.
-			 */
-			config_bool iterate;
+			/** The histogram being requested (enum logtime_stage). */
+			__u8 stage;
 		} display;
 	};
 };
@@ -380,6 +372,11 @@ struct request_session {
 		struct {
 			/* Nothing needed here. */
 		} count;
+		/*
+		 * OP_UPDATE requests (sent by jool_fastpath, not by the jool
+		 * command) need nothing here either. They are followed by an
+		 * array of struct session_refresh_usr.
+		 */
 	};
 };
 
@@ -395,6 +392,7 @@ enum global_type {
 	RESET_TOS,
 	NEW_TOS,
 	MTU_PLATEAUS,
+	XLAT_IN_PLACE,
 
 	/* SIIT */
 	COMPUTE_UDP_CSUM_ZERO,
@@ -422,22 +420,41 @@ enum global_type {
 	SS_FLUSH_DEADLINE,
 	SS_CAPACITY,
 	SS_MAX_PAYLOAD,
+	CLEAN_BUDGET,
+	FRAGMENT_MAX_BYTES,
 };
 
-#ifdef BENCHMARK
-
 /**
- * A logtime node entry, from the eyes of userspace.
- *
- * It holds the "struct timespec" which include seconds and nanoseconds, that
- * specific how time the skb need to be translated to IPv6 -> IPv4 or
- * IPv4 -> IPv6.
+ * Translation steps whose duration the "Log time" module measures.
  */
-struct logtime_entry_usr {
-	struct timespec time;
+enum logtime_stage {
+	LOGTIME_DETERMINE_IN_TUPLE,
+	LOGTIME_FILTERING,
+	LOGTIME_COMPUTE_OUT_TUPLE,
+	LOGTIME_TRANSLATE,
+	LOGTIME_SEND,
+
+	LOGTIME_STAGE_COUNT,
 };
 
-#endif
+/**
+ * The latency histograms are log-linear: durations (in nanoseconds) below
+ * 2^LOGTIME_SUB_BITS get a bucket each, and every power of two above that is
+ * split into 2^LOGTIME_SUB_BITS equally wide buckets. Anything that takes
+ * 2^LOGTIME_MAX_BITS nanoseconds or more lands in the last bucket.
+ */
+#define LOGTIME_SUB_BITS 3
+#define LOGTIME_MAX_BITS 32
+#define LOGTIME_BUCKETS \
+	((LOGTIME_MAX_BITS - LOGTIME_SUB_BITS + 1) << LOGTIME_SUB_BITS)
+
+/**
+ * One stage's latency histogram, merged from all CPUs, from the eyes of
+ * userspace.
+ */
+struct logtime_usr {
+	__u64 buckets[LOGTIME_BUCKETS];
+};
 
 /**
  * A BIB entry, from the eyes of userspace.
@@ -471,6 +488,151 @@ struct session_entry_usr {
 	__u8 state;
 };
 
+/**
+ * Kernel's response to a session count request.
+ */
+struct session_count_usr {
+	/** Number of sessions in the table. */
+	__u64 count;
+	/**
+	 * Memory they take in the kernel, in bytes. (Not including their BIB
+	 * entries.)
+	 */
+	__u64 bytes;
+};
+
+/**
+ * Activity the BPF fast path saw on a session. (The fast path translates
+ * packets without Jool noticing, so it has to tell Jool the session is alive.)
+ */
+struct session_refresh_usr {
+	/** The session's BIB entry. */
+	struct ipv6_transport_addr src6;
+	/** The session's IPv4 remote node. */
+	struct ipv4_transport_addr dst4;
+	/** Milliseconds since the last packet the fast path translated. */
+	__u32 idle;
+};
+
+/**
+ * How well the route cache is doing.
+ */
+struct rtcache_stats_usr {
+	/** Packets whose route was found in the cache. */
+	__u64 hits;
+	/** Packets that needed a FIB lookup. (Includes @stale.) */
+	__u64 misses;
+	/** Cached routes that had been invalidated by the time they were needed. */
+	__u64 stale;
+};
+
+/**
+ * How full the (NAT64) fragment database is, and what it has been throwing
+ * away.
+ */
+struct fragdb_stats_usr {
+	/** Datagrams whose fragments are currently being tracked. */
+	__u64 entries;
+	/** Memory the database is currently charging against its limit. */
+	__u64 bytes;
+	/** Entries deleted early to stay below the memory limit. */
+	__u64 evictions;
+	/** Entries deleted because their fragments stopped arriving. */
+	__u64 timeouts;
+};
+
+/**
+ * How the layer 4 checksums of the translated packets were taken care of.
+ * (Packets not listed here had their checksums updated incrementally.)
+ */
+struct csum_stats_usr {
+	/** Packets whose checksum was left for the NIC to finish. */
+	__u64 partial;
+	/** Packets whose CHECKSUM_COMPLETE sum survived the translation. */
+	__u64 complete;
+	/** Checksums that had to be computed or validated in software. */
+	__u64 full;
+};
+
+/**
+ * Jool's own packet counters.
+ *
+ * Every packet the instance sees is counted by exactly one of the verdict
+ * counters. Most of the ones that were not translated are also counted by
+ * the reason why.
+ */
+enum jool_stat_id {
+	/* Verdicts */
+	/** Packets translated and handed to the kernel for delivery. */
+	JSTAT_SUCCESS,
+	/** Packets returned to the kernel untranslated. */
+	JSTAT_ACCEPT,
+	/** Packets dropped. */
+	JSTAT_DROP,
+	/**
+	 * (NAT64) Packets stored for later; fragments waiting for their first
+	 * fragment and TCP SYNs waiting for a Simultaneous Open.
+	 */
+	JSTAT_HELD,
+
+	/* Accept reasons */
+	/** (NAT64) The destination address did not belong to pool6. */
+	JSTAT_POOL6_MISMATCH,
+	/** (NAT64) The destination address did not belong to pool4. */
+	JSTAT_POOL4_MISMATCH,
+	/** (NAT64) IPv4 packet that did not match any BIB entry. */
+	JSTAT_BIB4_NOT_FOUND,
+	/** (SIIT) An address lacked a translation, or was blacklisted. */
+	JSTAT_UNTRANSLATABLE,
+	/** The translated packet could not be routed. */
+	JSTAT_ROUTE_FAILED,
+
+	/* Drop reasons */
+	/** The packet did not survive validation. */
+	JSTAT_MALFORMED,
+	/** The layer 4 protocol cannot be translated. */
+	JSTAT_UNKNOWN_L4,
+	/** ICMP message type that lacks a counterpart in the other protocol. */
+	JSTAT_UNKNOWN_ICMP,
+	/** ICMP error whose checksum was wrong. */
+	JSTAT_ICMP_CSUM,
+	/** The hop limit (or TTL) expired. */
+	JSTAT_HOP_LIMIT,
+	/** The translated packet exceeded the outgoing MTU. */
+	JSTAT_TOO_BIG,
+	/** Memory allocation failure. */
+	JSTAT_ENOMEM,
+	/** (NAT64) The packet came from the NAT64 prefix. */
+	JSTAT_HAIRPIN_LOOP,
+	/** (NAT64) pool4 had no transport addresses left for a new BIB entry. */
+	JSTAT_POOL4_EXHAUSTED,
+	/** (NAT64) Blocked by Address-Dependent Filtering. */
+	JSTAT_ADF,
+	/** (NAT64) Filtering and Updating refused it for any other reason. */
+	JSTAT_SESSION_REJECTED,
+	/** (NAT64) ICMPv6 info packet dropped by policy. */
+	JSTAT_PING_PROHIBITED,
+	/**
+	 * (NAT64) Fragment the fragment database refused to store, or held
+	 * fragment that turned out not to be translatable.
+	 */
+	JSTAT_FRAG_REJECTED,
+	/** The kernel refused to send the translated packet. */
+	JSTAT_XMIT_FAILED,
+
+	JSTAT_COUNT,
+};
+
+/**
+ * Kernel's response to a stats display request.
+ */
+struct stats_usr {
+	/** Indexed by enum jool_stat_id. */
+	__u64 jstats[JSTAT_COUNT];
+	struct rtcache_stats_usr rtcache;
+	struct csum_stats_usr csum;
+};
+
 /**
  * Explicit Address Mapping definition.
  * Intended to be a row in the Explicit Address Mapping Table, bind an IPv4
@@ -535,6 +697,12 @@ struct global_config_usr {
 	__u16 mtu_plateaus[PLATEAUS_MAX];
 	/** Length of the mtu_plateaus array. */
 	__u16 mtu_plateau_count;
+	/**
+	 * Rewrite the headers of the packets that allow it, instead of
+	 * copying them into new skbs?
+	 * See ttpcomm_inplace_possible().
+	 */
+	config_bool xlat_in_place;
 
 	union {
 		struct {
@@ -613,6 +781,15 @@ struct bib_config {
 	config_bool drop_external_tcp;
 
 	__u32 max_stored_pkts;
+
+	/**
+	 * Maximum number of sessions the cleaner is allowed to handle in one
+	 * shard before it has to release the shard's lock and wait for its
+	 * next turn.
+	 * The budget applies to every shard (of every table) separately, so a
+	 * single cleaner run can handle up to this many sessions per shard.
+	 */
+	__u32 clean_budget;
 };
 
 /* This has to be <= 32. */
@@ -676,6 +853,8 @@ struct joold_config {
 
 struct fragdb_config {
 	__u32 ttl;
+	/** Bytes the database can hold before it starts evicting entries. */
+	__u32 max_bytes;
 };
 
 struct full_config {
@@ -685,6 +864,15 @@ struct full_config {
 	struct fragdb_config frag;
 };
 
+/**
+ * Kernel's response to a global display request.
+ */
+struct global_display_usr {
+	struct full_config config;
+	/** Read-only; not part of the configuration. Zeroed in SIIT. */
+	struct fragdb_stats_usr fragdb;
+};
+
 struct global_value {
 	__u16 type;
 	/** Includes header (this) and payload. */
@@ -70,16 +70,20 @@
 #define DEFAULT_FILTER_ICMPV6_INFO false
 #define DEFAULT_DROP_EXTERNAL_CONNECTIONS false
 #define DEFAULT_MAX_STORED_PKTS 10
+#define DEFAULT_CLEAN_BUDGET 4096
+#define DEFAULT_FRAG_MAX_BYTES (4 * 1024 * 1024)
 #define DEFAULT_SRC_ICMP6ERRS_BETTER false
 #define DEFAULT_F_ARGS 0b1011
 #define DEFAULT_HANDLE_FIN_RCV_RST false
 #define DEFAULT_BIB_LOGGING false
 #define DEFAULT_SESSION_LOGGING false
+#define DEFAULT_BIB_SHARDS 1
 
 #define DEFAULT_INSTANCE_ENABLED true
 #define DEFAULT_RESET_TRAFFIC_CLASS false
 #define DEFAULT_RESET_TOS false
 #define DEFAULT_NEW_TOS 0
+#define DEFAULT_XLAT_IN_PLACE false
 #define DEFAULT_COMPUTE_UDP_CSUM0 false
 #define DEFAULT_EAM_HAIRPIN_MODE EAM_HAIRPIN_INTRINSIC
 #define DEFAULT_RANDOMIZE_RFC6791 true
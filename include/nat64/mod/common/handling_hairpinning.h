@@ -13,4 +13,7 @@
 bool is_hairpin(struct xlation *state);
 verdict handling_hairpinning(struct xlation *state);
 
+bool hairpin_shortcut_possible(struct xlation *state);
+verdict hairpin_shortcut(struct xlation *state);
+
 #endif /* _JOOL_MOD_HARPINNING_H */
@@ -3,36 +3,42 @@
 
 /**
  * @file
- * Log file for benchmark purposes.
+ * Per-CPU histograms of the time each translation step takes.
  *
- * This code is not used during normal translations; we link it only when we
- * want to measure stuff.
+ * Measuring is off by default, and it's toggled at runtime through the
+ * "logtime" module parameter (eg. /sys/module/jool/parameters/logtime). The
+ * check is a static key, so a disabled logtime costs a no-op per step.
  */
 
-#include "nat64/mod/common/packet.h"
-#include <linux/spinlock.h>
-#include <linux/time.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include "nat64/common/config.h"
 
-struct log_node {
-	struct timespec time;
-	struct list_head list_hook;
-};
+extern struct static_key logtime_key;
 
-#ifdef BENCHMARK
+void logtime_record(enum logtime_stage stage, u64 start);
+void logtime_query(enum logtime_stage stage, struct logtime_usr *result);
+void logtime_flush(void);
 
-void logtime(struct packet *pkt);
-int logtime_iterate_and_delete(l3_protocol l3_proto, l4_protocol l4_proto,
-		int (*func)(struct log_node *, void *), void *arg);
-int logtime_init(void);
-void logtime_destroy(void);
-
-#else /* BENCHMARK */
-
-#define logtime(pkt)
-#define logtime_iterate_and_delete(l3_proto, l4_proto, func, arg) 0
-#define logtime_init() 0
-#define logtime_destroy()
+/**
+ * Returns the timestamp the current step should be measured from, or zero if
+ * measuring is disabled.
+ */
+static inline u64 logtime_start(void)
+{
+	if (static_key_false(&logtime_key))
+		return ktime_to_ns(ktime_get());
+	return 0;
+}
 
-#endif /* BENCHMARK */
+/**
+ * Adds the time elapsed since @start to @stage's histogram.
+ */
+static inline void logtime_stop(enum logtime_stage stage, u64 start)
+{
+	/* @start is zero if logtime was enabled while the step ran. */
+	if (static_key_false(&logtime_key) && start)
+		logtime_record(stage, start);
+}
 
 #endif /* _JOOL_MOD_LOG_TIME_H */
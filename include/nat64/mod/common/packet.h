@@ -277,14 +277,6 @@ struct packet {
 	 * packet, not the one being translated. Also relevant to pkt_queue.
 	 */
 	struct packet *original_pkt;
-
-#ifdef BENCHMARK
-	/**
-	 * Log the time in epoch when this skb arrives to jool.
-	 * For benchmark purposes.
-	 */
-	struct timespec start_time;
-#endif
 };
 
 /**
@@ -303,9 +295,6 @@ static inline void pkt_fill(struct packet *pkt, struct sk_buff *skb,
 	pkt->hdr_frag = hdr_frag;
 	pkt->payload = payload;
 	pkt->original_pkt = original_pkt;
-#ifdef BENCHMARK
-	pkt->start_time = original_pkt->start_time;
-#endif
 }
 
 /**
@@ -359,6 +348,37 @@ static inline struct frag_hdr *pkt_frag_hdr(const struct packet *pkt)
 	return pkt->hdr_frag;
 }
 
+/**
+ * Is @pkt a fragment? (Of any kind; first or subsequent.)
+ */
+static inline bool pkt_is_fragment(const struct packet *pkt)
+{
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		return is_fragmented_ipv6(pkt_frag_hdr(pkt));
+	case L3PROTO_IPV4:
+		return is_fragmented_ipv4(pkt_ip4_hdr(pkt));
+	}
+
+	return false;
+}
+
+/**
+ * Does @pkt start its datagram? (ie. does it have a layer 4 header?)
+ * Unfragmented packets are also considered first fragments.
+ */
+static inline bool pkt_is_first_frag(const struct packet *pkt)
+{
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		return is_first_frag6(pkt_frag_hdr(pkt));
+	case L3PROTO_IPV4:
+		return is_first_frag4(pkt_ip4_hdr(pkt));
+	}
+
+	return true;
+}
+
 static inline void *pkt_payload(const struct packet *pkt)
 {
 	return pkt->payload;
@@ -442,6 +462,18 @@ static inline unsigned int pkt_hdrs_len(const struct packet *pkt)
 	return pkt_payload(pkt) - (void *) skb_network_header(pkt->skb);
 }
 
+/**
+ * Returns the length of the packets @pkt will become once the kernel segments
+ * it. This is what has to fit in the MTU.
+ *
+ * Same as pkt_len(), unless @pkt is a GSO packet.
+ */
+static inline unsigned int pkt_seglen(const struct packet *pkt)
+{
+	unsigned int gso_size = skb_shinfo(pkt->skb)->gso_size;
+	return gso_size ? (pkt_hdrs_len(pkt) + gso_size) : pkt_len(pkt);
+}
+
 /**
  * Returns the length of @pkt's layer-4 payload.
  * Only counts bytes actually present within @pkt. In other words, payload of
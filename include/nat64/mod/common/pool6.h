@@ -9,6 +9,15 @@
 #include "nat64/common/types.h"
 
 struct pool6;
+struct rfc6052_xlator;
+
+/**
+ * A prefix from the pool, along with the RFC 6052 routines that fit its length.
+ */
+struct pool6_entry {
+	struct ipv6_prefix prefix;
+	const struct rfc6052_xlator *xlator;
+};
 
 int pool6_init(struct pool6 **pool);
 void pool6_get(struct pool6 *pool);
@@ -19,6 +28,12 @@ int pool6_find(struct pool6 *pool, const struct in6_addr *addr,
 int pool6_peek(struct pool6 *pool, struct ipv6_prefix *result);
 bool pool6_contains(struct pool6 *pool, struct in6_addr *addr);
 
+/* RCU-bh read-side critical section required. */
+
+struct pool6_entry *pool6_find_rcu(struct pool6 *pool,
+		const struct in6_addr *addr);
+struct pool6_entry *pool6_peek_rcu(struct pool6 *pool);
+
 int pool6_add(struct pool6 *pool, struct ipv6_prefix *prefix);
 int pool6_add_str(struct pool6 *pool, char *prefix_strings[], int prefix_count);
 int pool6_rm(struct pool6 *pool, struct ipv6_prefix *prefix);
@@ -9,6 +9,19 @@
  */
 
 #include <linux/rbtree.h>
+#include "nat64/mod/common/linux_version.h"
+
+/*
+ * Searching a tree without its lock while a writer modifies it is only safe
+ * since Linux 4.2. That's when rb_link_node_rcu() appeared, and when the
+ * rotations started publishing their pointers in an order that can't trap a
+ * concurrent reader in a loop. On older kernels, tree readers need the lock.
+ */
+#if LINUX_VERSION_AT_LEAST(4, 2, 0, 9999, 0)
+#define RBTREE_LOCKLESS_READS 1
+#else
+#define RBTREE_LOCKLESS_READS 0
+#endif
 
 /**
  * rbtree_find - Stock search on a Red-Black tree.
@@ -132,6 +145,11 @@ void treeslot_init(struct tree_slot *slot,
 		struct rb_node *entry);
 /** Adds @slot's node to the tree. Also rebalances while it's at it. */
 void treeslot_commit(struct tree_slot *slot);
+/**
+ * treeslot_commit() for trees that might be searched without the lock (see
+ * RBTREE_LOCKLESS_READS) at the same time.
+ */
+void treeslot_commit_rcu(struct tree_slot *slot);
 
 /**
  * rbtree_find_node - Similar to rbtree_find(), except if it doesn't find the
@@ -17,4 +17,12 @@
 	     pos;						\
 	     pos = rcu_dereference_bh(hlist_next_rcu(pos)))
 
+/* These only exist since Linux 3.19. */
+#ifndef READ_ONCE
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#endif
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val) (ACCESS_ONCE(x) = (val))
+#endif
+
 #endif /* _JOOL_MOD_RCU_H */
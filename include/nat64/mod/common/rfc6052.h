@@ -12,6 +12,21 @@
 #include "nat64/common/types.h"
 #include "nat64/mod/common/pool6.h"
 
+/**
+ * The RFC 6052 algorithm, specialized for one prefix length.
+ *
+ * pool6 picks one of these for each prefix when the prefix is added, so the
+ * packet path doesn't have to branch on the prefix length.
+ */
+struct rfc6052_xlator {
+	/** Copies the IPv4 address embedded in @src into @dst. */
+	void (*extract)(const struct in6_addr *src, struct in_addr *dst);
+	/** Builds (in @dst) the IPv6 address that embeds @src in @prefix. */
+	void (*embed)(const struct in6_addr *prefix, struct in_addr *src,
+			struct in6_addr *dst);
+};
+
+const struct rfc6052_xlator *rfc6052_get_xlator(__u8 prefix_len);
 
 /**
  * Translates "src" into a IPv4 address and returns it as "dst".
@@ -36,4 +36,10 @@ verdict ttp46_tcp(struct xlation *state);
  */
 verdict ttp46_udp(struct xlation *state);
 
+/**
+ * Translates "state->in" by rewriting its headers. "state->out" ends up
+ * wrapping the same skb.
+ */
+verdict ttp46_inplace(struct xlation *state);
+
 #endif /* _JOOL_MOD_RFC6145_4TO6_H */
@@ -37,6 +37,12 @@ verdict ttp64_tcp(struct xlation *state);
  */
 verdict ttp64_udp(struct xlation *state);
 
+/**
+ * Translates "state->in" by rewriting its headers. "state->out" ends up
+ * wrapping the same skb.
+ */
+verdict ttp64_inplace(struct xlation *state);
+
 __u8 ttp64_xlat_tos(struct global_config_usr *config, struct ipv6hdr *hdr);
 __u8 ttp64_xlat_proto(struct ipv6hdr *hdr);
 
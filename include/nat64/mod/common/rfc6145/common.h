@@ -2,6 +2,7 @@
 #define _JOOL_MOD_RFC6145_COMMON_H
 
 #include <linux/ip.h>
+#include <linux/udp.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/common/translation_state.h"
@@ -45,6 +46,10 @@ struct translation_steps {
 	 * Doing it differently depending on direction is more work. The code is
 	 * complicated enough as it is.
 	 *
+	 * (That said, @inplace_fn ended up implementing the workaround for
+	 * the simplest and most common packets, and skb_cow_head() takes care
+	 * of the growth. It's opt-in, though.)
+	 *
 	 * -----------------------------
 	 *
 	 * When translating a fragment chain, this only creates the first
@@ -61,6 +66,24 @@ struct translation_steps {
 	 * strong interdependence.
 	 */
 	verdict (*l3_payload_fn)(struct xlation *state);
+
+	/**
+	 * Translates the packet by rewriting its headers, instead of using the
+	 * three functions above. The result is @state->out, but its skb is
+	 * @state->in's.
+	 * Only used if ttpcomm_inplace_possible(). NULL if the protocol is not
+	 * supported.
+	 */
+	verdict (*inplace_fn)(struct xlation *state);
+};
+
+/**
+ * The portion of the layer 4 header the in-place translation rewrites.
+ * (TCP options, if any, are left alone.)
+ */
+union inplace_l4hdr {
+	struct tcphdr tcp;
+	struct udphdr udp;
 };
 
 /**
@@ -90,10 +113,22 @@ typedef enum addrxlat_verdict {
 struct translation_steps *ttpcomm_get_steps(struct packet *in);
 
 void partialize_skb(struct sk_buff *skb, unsigned int csum_offset);
+void ttpcomm_keep_complete(struct packet *in, struct packet *out);
+void ttpcomm_count_full_csum(void);
+void ttpcomm_csum_stats(struct csum_stats_usr *result);
 int copy_payload(struct xlation *state);
 bool will_need_frag_hdr(const struct iphdr *hdr);
 verdict ttpcomm_translate_inner_packet(struct xlation *state);
 
 bool must_not_translate(struct in_addr *addr, struct net *ns);
 
+unsigned int ttpcomm_xlat_gso_type(struct packet *in, l3_protocol l3_proto);
+void ttpcomm_copy_gso(struct packet *in, struct sk_buff *out,
+		l3_protocol l3_proto);
+
+bool ttpcomm_inplace_possible(struct xlation *state);
+int ttpcomm_inplace_commit(struct xlation *state, l3_protocol l3_proto,
+		void *l3_hdr, unsigned int l3_hdr_len, union inplace_l4hdr *l4_hdr);
+void ttpcomm_inplace_undo(struct xlation *state);
+
 #endif /* _JOOL_MOD_TTP_COMMON_H */
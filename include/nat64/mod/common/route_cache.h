@@ -0,0 +1,32 @@
+#ifndef _JOOL_MOD_ROUTE_CACHE_H
+#define _JOOL_MOD_ROUTE_CACHE_H
+
+/**
+ * @file
+ * A small per-CPU cache of the routes Jool's translated packets were sent
+ * through, indexed by destination. It spares established flows the FIB lookup.
+ *
+ * Entries are validated through dst_check() before they are reused, so FIB
+ * changes (which bump the kernel's route generation IDs) and PMTU/redirect
+ * exceptions invalidate them lazily. Interfaces going down or away flush every
+ * cache of their namespace, so the cache never keeps a device pinned.
+ */
+
+#include "nat64/common/config.h"
+#include "nat64/mod/common/packet.h"
+
+struct route_cache;
+
+int rtcache_init(void);
+void rtcache_destroy(void);
+
+struct route_cache *rtcache_create(void);
+void rtcache_get(struct route_cache *cache);
+void rtcache_put(struct route_cache *cache);
+
+struct dst_entry *rtcache_route(struct route_cache *cache, struct net *ns,
+		struct packet *pkt);
+void rtcache_flush(struct route_cache *cache);
+void rtcache_stats(struct route_cache *cache, struct rtcache_stats_usr *result);
+
+#endif /* _JOOL_MOD_ROUTE_CACHE_H */
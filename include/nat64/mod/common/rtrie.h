@@ -3,81 +3,120 @@
 
 /**
  * @file
- * A Radix Trie.
+ * A path-compressed, multibit Radix Trie.
  *
  * Why don't we use the kernel's radix trie instead?
  * Because it's only good for keys long-sized; we need 128-bit keys.
+ *
+ * Every node consumes RTRIE_STRIDE bits of the key, so a 128-bit lookup visits
+ * at most 128 / RTRIE_STRIDE nodes (and usually much less, since chains of
+ * single-child nodes are compressed away). Prefixes whose length is not a
+ * multiple of the stride are expanded into every slot they cover, so the
+ * lookup never needs to backtrack.
  */
 
 #include <linux/types.h>
+#include <linux/list.h>
 #include <linux/mutex.h>
 
+#define RTRIE_STRIDE 4
+#define RTRIE_FANOUT (1 << RTRIE_STRIDE)
+
 struct rtrie_key {
 	__u8 *bytes;
 	/* In bits; not bytes. */
 	__u8 len;
 };
 
-enum rtrie_color {
-	COLOR_BLACK,
-	COLOR_WHITE,
+/**
+ * A value stored in the trie.
+ *
+ * @key and @len are RCU-friendly; the hooks are not.
+ */
+struct rtrie_leaf {
+	/** The key, in host byte order and zero-trimmed. RCU-friendly. */
+	u64 key[2];
+	/** Length of @key, in bits. RCU-friendly. */
+	__u8 len;
+
+	/**
+	 * Chains the leaf to the other prefixes of the node that hosts it.
+	 * Readers can only walk this list through the RCU list primitives.
+	 */
+	struct list_head host_hook;
+	/**
+	 * This is used to foreach all the leaves.
+	 * NOT RCU-friendly.
+	 */
+	struct list_head list_hook;
+
+	/* The value hangs off end. RCU-friendly. */
 };
 
 /**
+ * All keys below a node share its first @pos bits. The node hosts the
+ * prefixes whose length ranges from @pos + 1 to @pos + RTRIE_STRIDE, and
+ * the chunk of RTRIE_STRIDE bits that follows @pos picks the slot and child.
+ *
  * Some fields here are RCU-friendly and others aren't.
  *
  * RCU-friendly fields can be dereferenced in RCU-protected areas happily,
- * and of course MUST NOT BE EDITED while the node is in the trie.
+ * and (except for the arrays) MUST NOT BE EDITED while the node is in the
+ * trie.
  *
  * RCU-unfriendly fields must not be touched outside the domain of the trie's
  * lock.
  */
 struct rtrie_node {
-	/** RCU-friendly. */
-	struct rtrie_node __rcu *left;
-	/** RCU-friendly. */
-	struct rtrie_node __rcu *right;
-	/** NOT RCU-friendly. */
-	struct rtrie_node *parent;
+	/** RCU-friendly. Only the first @pos bits are meaningful. */
+	u64 key[2];
+	/** RCU-friendly. Always a multiple of RTRIE_STRIDE. */
+	unsigned int pos;
 
+	/** RCU-friendly. */
+	struct rtrie_node __rcu *children[RTRIE_FANOUT];
 	/**
 	 * RCU-friendly.
-	 *
-	 * If you want to assign a different value here, consider:
-	 *
-	 * - Black nodes cannot be upgraded into white nodes since white nodes
-	 *   are supposed to contain a value (black nodes only need a key).
-	 * - White nodes can be downgraded into black nodes as long as they're
-	 *   not attached to tries.
+	 * The longest hosted prefix that covers each chunk, if any.
 	 */
-	enum rtrie_color color;
-	/** RCU-friendly. */
-	struct rtrie_key key;
+	struct rtrie_leaf __rcu *slots[RTRIE_FANOUT];
 
-	/**
-	 * This is used to foreach all the nodes (whether black or white).
-	 *
-	 * NOT RCU-friendly.
-	 */
+	/** The leaves this node hosts. RCU list. */
+	struct list_head hosted;
+	/** NOT RCU-friendly. */
+	struct rtrie_node *parent;
+	/** NOT RCU-friendly. */
 	struct list_head list_hook;
-
-	/* The value hangs off end. RCU-friendly. */
 };
 
 struct rtrie {
 	/** The tree. */
 	struct rtrie_node __rcu *root;
-	/** @root's nodes chained to ease foreaching. */
+	/** The zero-length prefix, if any. (It doesn't fit in any node.) */
+	struct rtrie_leaf __rcu *dflt;
+	/** The leaves, chained to ease foreaching. */
 	struct list_head list;
+	/** @root's nodes, chained to ease freeing. */
+	struct list_head nodes;
 	/** Size of the values being stored (in bytes). */
 	size_t value_size;
 };
 
+/**
+ * Leaves and nodes that have been unlinked from a trie, but that readers
+ * might still be looking at.
+ */
+struct rtrie_garbage {
+	struct list_head leaves;
+	struct list_head nodes;
+};
+
 void rtrie_init(struct rtrie *trie, size_t size);
 void rtrie_destroy(struct rtrie *trie);
 
 /* Safe-to-use-during-packet-translation functions */
 
+void *rtrie_find(struct rtrie *trie, struct rtrie_key *key);
 int rtrie_get(struct rtrie *trie, struct rtrie_key *key, void *result);
 bool rtrie_contains(struct rtrie *trie, struct rtrie_key *key);
 bool rtrie_is_empty(struct rtrie *trie);
@@ -87,6 +126,10 @@ void rtrie_print(char *prefix, struct rtrie *trie);
 
 int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len);
 int rtrie_rm(struct rtrie *trie, struct rtrie_key *key);
+void rtrie_garbage_init(struct rtrie_garbage *garbage);
+int rtrie_rm_deferred(struct rtrie *trie, struct rtrie_key *key,
+		struct rtrie_garbage *garbage);
+void rtrie_garbage_free(struct rtrie_garbage *garbage);
 void rtrie_flush(struct rtrie *trie);
 int rtrie_foreach(struct rtrie *trie,
 		int (*cb)(void *, void *), void *arg,
@@ -7,8 +7,12 @@
  *
  * This exists because, based on experience, we can't really afford the assumptions that led to
  * those functions lacking argument validations.
+ *
+ * Also, Jool's own counters (see enum jool_stat_id), which say a lot more than the kernel's about
+ * what happened to the packets.
  */
 
+#include "nat64/common/config.h"
 #include "nat64/mod/common/packet.h"
 
 /**
@@ -27,4 +31,14 @@ void inc_stats_skb4(struct sk_buff *skb, int field);
  * @}
  */
 
+struct jool_stats;
+
+struct jool_stats *jstat_create(void);
+void jstat_get(struct jool_stats *stats);
+void jstat_put(struct jool_stats *stats);
+
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id id);
+void jstat_inc_verdict(struct jool_stats *stats, verdict result, bool inplace);
+void jstat_query(struct jool_stats *stats, __u64 *result);
+
 #endif /* _JOOL_MOD_STATS_H */
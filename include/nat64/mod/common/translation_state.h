@@ -5,6 +5,41 @@
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/stateful/bib/entry.h"
 
+/**
+ * Longest link layer header an in-place translation is willing to back up.
+ * (Packets whose header is longer are copied instead.)
+ */
+#define INPLACE_MAX_L2 32
+
+/**
+ * Everything an in-place translation overrides from the incoming packet, so it
+ * can be undone if the translated packet cannot be sent after all.
+ * See ttpcomm_inplace_commit() and ttpcomm_inplace_undo().
+ */
+struct inplace_backup {
+	/** Is the incoming packet currently translated in place? */
+	bool active;
+
+	/**
+	 * The original link layer, layer 3 and (base) layer 4 headers, in
+	 * that order.
+	 */
+	unsigned char hdrs[INPLACE_MAX_L2 + sizeof(struct ipv6hdr)
+			+ sizeof(struct tcphdr)];
+	/** Number of bytes from @hdrs that are in use. */
+	unsigned int len;
+	unsigned int l2_len;
+	unsigned int l3_len;
+	/** Length of the layer 4 header, including options. */
+	unsigned int l4_len;
+
+	__be16 protocol;
+	__u8 ip_summed;
+	__wsum csum;
+	struct net_device *dev;
+	unsigned int gso_type;
+};
+
 /**
  * State of the current translation.
  */
@@ -25,9 +60,14 @@ struct xlation {
 	 * to the packet being translated, so you don't have to find it again.
 	 */
 	struct bib_session entries;
+
+	/**
+	 * If the packet was translated in place, @out.skb is @in.skb, and this
+	 * is what the translation overrode.
+	 */
+	struct inplace_backup backup;
 };
 
 void xlation_init(struct xlation *state);
-void xlation_put(struct xlation *state);
 
 #endif /* _JOOL_MOD_TRANSLATION_STATE_H */
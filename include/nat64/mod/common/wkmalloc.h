@@ -1,7 +1,9 @@
 #ifndef _JOOL_MOD_KREF_ANALYZER_H
 #define _JOOL_MOD_KREF_ANALYZER_H
 
+#include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include "nat64/common/types.h"
 
 void wkmalloc_add(const char *name);
@@ -60,4 +62,44 @@ static inline void wkmem_cache_free(const char *name, struct kmem_cache *cache,
 #endif
 }
 
+/**
+ * Like __wkmalloc(), except it falls back to vmalloc() when @size is too big
+ * for kmalloc(). For big arrays that don't need to be physically contiguous.
+ *
+ * Can sleep. Release the result with __wkvfree().
+ */
+static inline void *__wkvmalloc(const char *name, size_t size)
+{
+	gfp_t flags = GFP_KERNEL | __GFP_NOWARN;
+	void *result;
+
+	if (size > PAGE_SIZE)
+		flags |= __GFP_NORETRY;
+
+	result = kmalloc(size, flags);
+	if (!result)
+		result = vmalloc(size);
+#ifdef JKMEMLEAK
+	if (result)
+		wkmalloc_add(name);
+#endif
+
+	return result;
+}
+
+/**
+ * Releases memory reserved by __wkvmalloc(). Can't be called from interrupt
+ * context (such as RCU callbacks).
+ */
+static inline void __wkvfree(const char *name, void *obj)
+{
+	if (is_vmalloc_addr(obj))
+		vfree(obj);
+	else
+		kfree(obj);
+#ifdef JKMEMLEAK
+	wkmalloc_rm(name);
+#endif
+}
+
 #endif
@@ -15,6 +15,8 @@ struct xlator {
 
 	struct global_config *global;
 	struct pool6 *pool6;
+	struct route_cache *rtcache;
+	struct jool_stats *stats;
 	union {
 		struct {
 			struct eam_table *eamt;
@@ -40,6 +42,7 @@ int xlator_rm(void);
 int xlator_replace(struct xlator *instance);
 
 int xlator_find(struct net *ns, struct xlator *result);
+int xlator_find_rcu(struct net *ns, struct xlator *result);
 int xlator_find_current(struct xlator *result);
 void xlator_put(struct xlator *instance);
 
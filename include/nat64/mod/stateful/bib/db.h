@@ -55,7 +55,7 @@ enum session_fate {
 	FATE_TIMER_SLOW,
 };
 
-int bib_init(void);
+int bib_init(unsigned int shards);
 void bib_destroy(void);
 
 struct bib *bib_create(void);
@@ -94,9 +94,13 @@ verdict bib_add_tcp4(struct bib *db, struct ipv6_transport_addr *dst6,
 
 int bib_find(struct bib *db, struct tuple *tuple,
 		struct bib_session *result);
+int bib_refresh(struct bib *db, l4_protocol proto,
+		struct ipv6_transport_addr *src6,
+		struct ipv4_transport_addr *dst4,
+		unsigned long update_time);
 int bib_add_session(struct bib *db, struct session_entry *new,
 		struct collision_cb *cb);
-void bib_clean(struct bib *db, struct net *ns);
+bool bib_clean(struct bib *db, struct net *ns);
 
 /* These are used by userspace request handling. */
 
@@ -121,6 +125,9 @@ int bib_foreach(struct bib *db, l4_protocol proto,
 int bib_foreach_session(struct bib *db, l4_protocol proto,
 		struct session_foreach_func *collision_cb,
 		struct session_foreach_offset *offset);
+int bib_foreach_session_atomic(struct bib *db, l4_protocol proto,
+		struct session_foreach_func *collision_cb,
+		struct session_foreach_offset *offset);
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result);
@@ -134,6 +141,7 @@ void bib_rm_range(struct bib *db, l4_protocol proto, struct ipv4_range *range);
 void bib_flush(struct bib *db);
 int bib_count(struct bib *db, l4_protocol proto, __u64 *count);
 int bib_count_sessions(struct bib *db, l4_protocol proto, __u64 *count);
+int bib_session_bytes(struct bib *db, l4_protocol proto, __u64 *bytes);
 
 void bib_print(struct bib *db);
 
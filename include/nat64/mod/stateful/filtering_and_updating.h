@@ -11,6 +11,7 @@
 #include "nat64/mod/stateful/bib/entry.h"
 
 verdict filtering_and_updating(struct xlation *state);
+verdict filtering_and_updating_hairpin(struct xlation *state);
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg);
 
 #endif /* _JOOL_MOD_FILTERING_H */
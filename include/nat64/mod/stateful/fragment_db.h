@@ -13,6 +13,15 @@
  * This module queues these fragments in skb_shinfo(skb)->frag_list so the rest
  * of Jool doesn't have to worry about handling fragments differently depending
  * on kernel version.
+ *
+ * Alternatively, if the module is inserted with virtual_reassembly, nothing is
+ * reassembled at all (and nf_defrag is left alone). Each fragment is translated
+ * as soon as it arrives, using the ports of its datagram's first fragment.
+ * Only fragments that arrive before their first one are buffered, and only
+ * until it shows up.
+ *
+ * Either way, whatever is stored is charged against a byte limit; the oldest
+ * entries are evicted when it is reached.
  */
 
 #include "nat64/common/config.h"
@@ -20,7 +29,7 @@
 
 struct fragdb;
 
-int fragdb_init(void);
+int fragdb_init(bool virtual_reassembly);
 void fragdb_destroy(void);
 
 struct fragdb *fragdb_create(void);
@@ -29,8 +38,12 @@ void fragdb_put(struct fragdb *db);
 
 void fragdb_config_copy(struct fragdb *db, struct fragdb_config *config);
 void fragdb_config_set(struct fragdb *db, struct fragdb_config *config);
+void fragdb_stats(struct fragdb *db, struct fragdb_stats_usr *result);
 
-verdict fragdb_handle(struct fragdb *db, struct packet *pkt);
+verdict fragdb_handle(struct fragdb *db, struct packet *pkt,
+		struct sk_buff **held);
+void fragdb_filtered(struct fragdb *db, struct packet *pkt, verdict result,
+		struct sk_buff **held);
 void fragdb_clean(struct fragdb *db);
 
 #endif /* _JOOL_MOD_FRAGMENT_DB_H */
@@ -41,14 +41,44 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 		int (*cb)(struct pool4_sample *, void *), void *arg,
 		struct pool4_sample *offset);
 
-struct mask_domain;
+/**
+ * The set of IPv4 transport addresses a new connection can be masked with,
+ * along with a cursor that iterates over them.
+ *
+ * Fields are private; use the mask_domain_*() functions.
+ */
+struct mask_domain {
+	unsigned int taddr_count;
+	unsigned int taddr_counter;
+
+	/** Not owned; lives in the pool4 snapshot, or in @dynamic_range. */
+	const struct pool4_range *ranges;
+	unsigned int range_count;
+	const struct pool4_range *current_range;
+	int current_port;
+
+	/**
+	 * A "dynamic" domain is one that was generated on the fly - that is,
+	 * Jool queried the interface addresses, picked one and used it to
+	 * improvise a domain.
+	 *
+	 * A "static" domain is one the user predefined.
+	 *
+	 * Empty pool4 generates dynamic domains and populated ones generate
+	 * static domains.
+	 */
+	bool dynamic;
+	/** Storage for the only range of dynamic domains. */
+	struct pool4_range dynamic_range;
+};
 
-struct mask_domain *mask_domain_find(struct pool4 *pool, struct tuple *tuple6,
-		__u8 f_args, struct route4_args *route_args);
+int mask_domain_find(struct pool4 *pool, struct tuple *tuple6,
+		__u8 f_args, struct route4_args *route_args,
+		struct mask_domain *masks);
 void mask_domain_put(struct mask_domain *masks);
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive);
+		struct ipv4_transport_addr *first,
+		__u16 *last);
 bool mask_domain_matches(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr);
 bool mask_domain_is_dynamic(struct mask_domain *masks);
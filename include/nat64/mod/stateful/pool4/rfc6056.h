@@ -6,6 +6,7 @@
 
 int rfc6056_init(void);
 void rfc6056_destroy(void);
+void rfc6056_clean(void);
 
 int rfc6056_f(const struct tuple *tuple6, __u8 fields, unsigned int *result);
 
@@ -4,11 +4,18 @@
 /**
  * @file
  * Pool of banned IPv4 addresses; Jool will refuse to translate these addresses.
+ *
+ * Also, a per-namespace set of the addresses owned by the interfaces, which are
+ * implicitly banned. It is kept up to date by device and address events, so
+ * the packet path only has to probe it once per address.
  */
 
 #include <net/net_namespace.h>
 #include "nat64/mod/stateless/pool.h"
 
+int ifaddrs_init(void);
+void ifaddrs_destroy(void);
+
 int blacklist_init(struct addr4_pool **pool);
 void blacklist_get(struct addr4_pool *pool);
 void blacklist_put(struct addr4_pool *pool);
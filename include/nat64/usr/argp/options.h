@@ -30,6 +30,7 @@ enum argp_flags {
 	ARGP_GLOBAL = 'g',
 	ARGP_PARSE_FILE = 'p',
 	ARGP_INSTANCE = 7001,
+	ARGP_STATS = 7003,
 
 	/* Operations */
 	ARGP_DISPLAY = 'd',
@@ -65,6 +66,7 @@ enum argp_flags {
 	ARGP_RESET_TOS = RESET_TOS,
 	ARGP_NEW_TOS = NEW_TOS,
 	ARGP_PLATEAUS = MTU_PLATEAUS,
+	ARGP_XLAT_IN_PLACE = XLAT_IN_PLACE,
 	ARGP_COMPUTE_CSUM_ZERO = COMPUTE_UDP_CSUM_ZERO,
 	ARGP_RANDOMIZE_RFC6791 = RANDOMIZE_RFC6791,
 	ARGP_EAM_HAIRPIN_MODE = EAM_HAIRPINNING_MODE,
@@ -82,6 +84,8 @@ enum argp_flags {
 	ARGP_BIB_LOGGING = BIB_LOGGING,
 	ARGP_SESSION_LOGGING = SESSION_LOGGING,
 	ARGP_STORED_PKTS = MAX_PKTS,
+	ARGP_CLEAN_BUDGET = CLEAN_BUDGET,
+	ARGP_FRAG_MAX_BYTES = FRAGMENT_MAX_BYTES,
 	ARGP_SS_ENABLED = SS_ENABLED,
 	ARGP_SS_FLUSH_ASAP = SS_FLUSH_ASAP,
 	ARGP_SS_FLUSH_DEADLINE = SS_FLUSH_DEADLINE,
@@ -0,0 +1,76 @@
+#ifndef _JOOL_USR_FASTPATH_MAPS_H
+#define _JOOL_USR_FASTPATH_MAPS_H
+
+/**
+ * The maps jool_fastpath shares with its BPF program (usr/fastpath/xlat.bpf.c).
+ *
+ * This is included by BPF code, so it has to stick to <linux/types.h>.
+ * Everything is in network byte order, unless it says otherwise. BPF keys are
+ * compared byte by byte, so the padding has to be zeroed.
+ */
+
+#include <linux/types.h>
+
+/** Size of each of the session maps. */
+#define FASTPATH_MAX_SESSIONS 1048576
+
+/** An IPv6 TCP or UDP flow, as seen on the wire. */
+struct fastpath_flow6 {
+	__be32 src[4];
+	__be32 dst[4];
+	__be16 sport;
+	__be16 dport;
+	/** IPPROTO_TCP or IPPROTO_UDP. */
+	__u8 proto;
+	__u8 pad[3];
+};
+
+/** An IPv4 TCP or UDP flow, as seen on the wire. */
+struct fastpath_flow4 {
+	__be32 src;
+	__be32 dst;
+	__be16 sport;
+	__be16 dport;
+	/** IPPROTO_TCP or IPPROTO_UDP. */
+	__u8 proto;
+	__u8 pad[3];
+};
+
+/**
+ * Value of the "sessions6" map, whose key is the struct fastpath_flow6 of the
+ * packets the IPv6 node sends.
+ */
+struct fastpath_session6 {
+	/** What the packet has to look like once it's translated. */
+	struct fastpath_flow4 xlat;
+	/** Sync cycle that last saw the session in Jool. Host byte order. */
+	__u32 gen;
+	__u32 pad;
+	/** bpf_ktime_get_ns() of the last translated packet. 0 = never. */
+	__u64 last_seen;
+};
+
+/**
+ * Value of the "sessions4" map, whose key is the struct fastpath_flow4 of the
+ * packets the IPv4 node sends.
+ */
+struct fastpath_session4 {
+	struct fastpath_flow6 xlat;
+	__u32 gen;
+	__u32 pad;
+	__u64 last_seen;
+};
+
+/**
+ * The only value of the "config" array map. It mirrors the parts of Jool's
+ * global configuration the BPF program needs.
+ */
+struct fastpath_config {
+	/** Is Jool translating? If not, neither is the fast path. */
+	__u8 enabled;
+	__u8 reset_traffic_class;
+	__u8 reset_tos;
+	__u8 new_tos;
+};
+
+#endif /* _JOOL_USR_FASTPATH_MAPS_H */
@@ -0,0 +1,16 @@
+#ifndef _JOOL_USR_FASTPATH_SYNC_H
+#define _JOOL_USR_FASTPATH_SYNC_H
+
+/**
+ * This is the part of jool_fastpath that keeps the BPF maps and Jool's session
+ * database in sync.
+ */
+
+#include <bpf/libbpf.h>
+
+int sync_init(struct bpf_object *obj);
+void sync_destroy(void);
+
+int sync_cycle(void);
+
+#endif
@@ -11,6 +11,7 @@
 #define OPTNAME_PARSE_FILE		"parse-file"
 #define OPTNAME_TOS			"tos"
 #define OPTNAME_MTU_PLATEAUS		"mtu-plateaus"
+#define OPTNAME_XLAT_IN_PLACE		"translate-in-place"
 
 /* SIIT-only flags */
 #define OPTNAME_AMEND_UDP_CSUM		"amend-udp-checksum-zero"
@@ -27,12 +28,14 @@
 #define OPTNAME_TCPEST_TIMEOUT		"tcp-est-timeout"
 #define OPTNAME_TCPTRANS_TIMEOUT	"tcp-trans-timeout"
 #define OPTNAME_FRAG_TIMEOUT		"fragment-arrival-timeout"
+#define OPTNAME_FRAG_MAX_BYTES		"fragment-memory-limit"
 #define OPTNAME_MAX_SO			"maximum-simultaneous-opens"
 #define OPTNAME_SRC_ICMP6E_BETTER	"source-icmpv6-errors-better"
 #define OPTNAME_HANDLE_FIN_RCV_RST	"handle-rst-during-fin-rcv"
 #define OPTNAME_F_ARGS			"f-args"
 #define OPTNAME_BIB_LOGGING		"logging-bib"
 #define OPTNAME_SESSION_LOGGING		"logging-session"
+#define OPTNAME_CLEAN_BUDGET		"session-clean-budget"
 
 /* Synchronization flags */
 #define OPTNAME_SS_ENABLED		"ss-enabled"
@@ -1,17 +1,7 @@
 #ifndef _JOOL_USR_LOG_TIME_H
 #define _JOOL_USR_LOG_TIME_H
 
-#ifdef BENCHMARK
-
 int logtime_display(void);
-
-#else /* BENCHMARK */
-
-int logtime_display(void)
-{
-	return 0;
-}
-
-#endif
+int logtime_flush(void);
 
 #endif /* _JOOL_USR_LOG_TIME_H */
@@ -0,0 +1,6 @@
+#ifndef _JOOL_USR_STATS_H
+#define _JOOL_USR_STATS_H
+
+int stats_display(void);
+
+#endif /* _JOOL_USR_STATS_H */
@@ -27,6 +27,7 @@ int config_init(struct global_config **result)
 	config->reset_traffic_class = DEFAULT_RESET_TRAFFIC_CLASS;
 	config->reset_tos = DEFAULT_RESET_TOS;
 	config->new_tos = DEFAULT_NEW_TOS;
+	config->xlat_in_place = DEFAULT_XLAT_IN_PLACE;
 
 	if (xlat_is_siit()) {
 		config->siit.compute_udp_csum_zero = DEFAULT_COMPUTE_UDP_CSUM0;
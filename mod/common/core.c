@@ -1,41 +1,88 @@
 #include "nat64/mod/common/core.h"
 
+#include <linux/netdevice.h>
+
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/handling_hairpinning.h"
+#include "nat64/mod/common/log_time.h"
 #include "nat64/mod/common/xlator.h"
 #include "nat64/mod/common/translation_state.h"
+#include "nat64/mod/common/rfc6145/common.h"
 #include "nat64/mod/common/rfc6145/core.h"
 #include "nat64/mod/stateful/compute_outgoing_tuple.h"
 #include "nat64/mod/stateful/determine_incoming_tuple.h"
 #include "nat64/mod/stateful/filtering_and_updating.h"
 #include "nat64/mod/stateful/fragment_db.h"
 #include "nat64/mod/common/send_packet.h"
+#include "nat64/mod/common/stats.h"
 
+/**
+ * Adds @result to @state's instance's verdict counters, and returns it.
+ */
+static verdict account(struct xlation *state, verdict result)
+{
+	jstat_inc_verdict(state->jool.stats, result, state->backup.active);
+	return result;
+}
 
-static verdict core_common(struct xlation *state)
+/**
+ * @held: Fragments the fragment database was holding until the first one
+ *	passed Filtering and Updating will be returned here. (See
+ *	fragdb_filtered().)
+ */
+static verdict core_common(struct xlation *state, struct sk_buff **held)
 {
+	bool hairpin = false;
+	bool shortcut = false;
 	verdict result;
+	u64 start;
 
 	if (xlat_is_nat64()) {
+		start = logtime_start();
 		result = determine_in_tuple(state);
+		logtime_stop(LOGTIME_DETERMINE_IN_TUPLE, start);
+		if (result == VERDICT_CONTINUE) {
+			start = logtime_start();
+			result = filtering_and_updating(state);
+			logtime_stop(LOGTIME_FILTERING, start);
+		}
+		/* The rest of the fragments follow the first one's fate. */
+		fragdb_filtered(state->jool.nat64.frag, &state->in, result,
+				held);
 		if (result != VERDICT_CONTINUE)
 			goto end;
-		result = filtering_and_updating(state);
-		if (result != VERDICT_CONTINUE)
-			goto end;
+		start = logtime_start();
 		result = compute_out_tuple(state);
+		logtime_stop(LOGTIME_COMPUTE_OUT_TUPLE, start);
 		if (result != VERDICT_CONTINUE)
 			goto end;
+		/* NAT64 hairpins can be recognized from the tuple alone. */
+		hairpin = is_hairpin(state);
+		shortcut = hairpin && hairpin_shortcut_possible(state);
 	}
-	result = translating_the_packet(state);
+
+	start = logtime_start();
+	result = shortcut
+			? hairpin_shortcut(state)
+			: translating_the_packet(state);
+	logtime_stop(LOGTIME_TRANSLATE, start);
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (is_hairpin(state)) {
+	if (!xlat_is_nat64())
+		hairpin = is_hairpin(state);
+
+	if (hairpin && !shortcut) {
 		result = handling_hairpinning(state);
-		kfree_skb(state->out.skb); /* Put this inside of hh()? */
+		/* Put this inside of hh()? */
+		if (state->out.skb == state->in.skb)
+			ttpcomm_inplace_undo(state);
+		else
+			kfree_skb(state->out.skb);
 	} else {
+		start = logtime_start();
 		result = sendpkt_send(state);
+		logtime_stop(LOGTIME_SEND, start);
 		/* sendpkt_send() releases out's skb regardless of verdict. */
 	}
 
@@ -50,43 +97,130 @@ static verdict core_common(struct xlation *state)
 	 * Sending a replacing & translated version of the packet should not
 	 * count as an error, so we free the incoming packet ourselves and
 	 * return NF_STOLEN on success.
+	 *
+	 * (Unless it was translated in place, in which case it *was* the new
+	 * packet.)
 	 */
-	kfree_skb(state->in.skb);
-	result = VERDICT_STOLEN;
-	/* Fall through. */
+	if (!state->backup.active)
+		kfree_skb(state->in.skb);
+	jstat_inc(state->jool.stats, JSTAT_SUCCESS);
+	return VERDICT_STOLEN;
 
 end:
 	if (result == VERDICT_ACCEPT)
 		log_debug("Returning the packet to the kernel.");
-	return result;
+	return account(state, result);
+}
+
+/**
+ * Runs @skb through the whole pipeline. @state->jool has to be initialized
+ * already.
+ */
+static verdict core_xlat(struct xlation *state, struct sk_buff *skb,
+		int (*init_fn)(struct packet *, struct sk_buff *),
+		struct sk_buff **held)
+{
+	verdict result;
+
+	/* Reminder: This function might change pointers. */
+	if (init_fn(&state->in, skb) != 0) {
+		jstat_inc(state->jool.stats, JSTAT_MALFORMED);
+		jstat_inc(state->jool.stats, JSTAT_DROP);
+		return VERDICT_DROP;
+	}
+
+	if (xlat_is_nat64()) {
+		result = fragdb_handle(state->jool.nat64.frag, &state->in, held);
+		if (result == VERDICT_DROP)
+			jstat_inc(state->jool.stats, JSTAT_FRAG_REJECTED);
+		if (result != VERDICT_CONTINUE)
+			return account(state, result);
+	}
+
+	return core_common(state, held);
+}
+
+/**
+ * Translates the fragments the fragment database was holding until their first
+ * fragment was filtered. (Which it just was, and translated as well.)
+ *
+ * Jool stole them from the kernel while they were traversing PREROUTING, and
+ * there is no way to hand a stolen packet back to the hook. So the ones that
+ * turn out not to be Jool's business after all (VERDICT_ACCEPT) are dropped
+ * and counted as rejected fragments. (Their first fragment was accepted, so
+ * this only happens if the configuration changed in the meantime.)
+ *
+ * Has to be called within the same RCU section that found @jool.
+ */
+static void translate_held(struct xlator *jool, struct sk_buff *held,
+		const struct net_device *dev,
+		int (*init_fn)(struct packet *, struct sk_buff *))
+{
+	struct xlation state;
+	struct sk_buff *next;
+	struct sk_buff *more;
+	struct sk_buff *tail;
+
+	for (; held; held = next) {
+		next = held->next;
+		held->next = NULL;
+		held->dev = (struct net_device *)dev;
+
+		xlation_init(&state);
+		state.jool = *jool;
+		more = NULL;
+
+		switch (core_xlat(&state, held, init_fn, &more)) {
+		case VERDICT_STOLEN:
+			break;
+		case VERDICT_ACCEPT:
+			log_debug("Held fragment is not ours; dropping it.");
+			jstat_inc(jool->stats, JSTAT_FRAG_REJECTED);
+			/* Fall through. */
+		default:
+			kfree_skb(held);
+		}
+
+		/* Whatever that released goes next. */
+		if (more) {
+			for (tail = more; tail->next; tail = tail->next)
+				;
+			tail->next = next;
+			next = more;
+		}
+	}
 }
 
 unsigned int core_4to6(struct sk_buff *skb, const struct net_device *dev)
 {
 	struct xlation state;
 	struct iphdr *hdr = ip_hdr(skb);
+	struct sk_buff *held = NULL;
 	verdict result;
 
 	xlation_init(&state);
 
-	if (xlator_find(dev_net(dev), &state.jool))
-		return NF_ACCEPT;
-	if (!state.jool.global->cfg.enabled) {
-		xlation_put(&state);
-		return NF_ACCEPT;
+	/*
+	 * The instance is only guaranteed to stay alive while we're in this
+	 * section, so don't leave it until the packet is done.
+	 */
+	rcu_read_lock_bh();
+
+	if (xlator_find_rcu(dev_net(dev), &state.jool)
+			|| !state.jool.global->cfg.enabled) {
+		result = NF_ACCEPT;
+		goto end;
 	}
 
 	log_debug("===============================================");
 	log_debug("Catching IPv4 packet: %pI4->%pI4", &hdr->saddr, &hdr->daddr);
 
-	/* Reminder: This function might change pointers. */
-	if (pkt_init_ipv4(&state.in, skb) != 0) {
-		xlation_put(&state);
-		return NF_DROP;
-	}
+	result = core_xlat(&state, skb, pkt_init_ipv4, &held);
+	translate_held(&state.jool, held, dev, pkt_init_ipv4);
+	/* Fall through. */
 
-	result = core_common(&state);
-	xlation_put(&state);
+end:
+	rcu_read_unlock_bh();
 	return result;
 }
 
@@ -94,36 +228,29 @@ unsigned int core_6to4(struct sk_buff *skb, const struct net_device *dev)
 {
 	struct xlation state;
 	struct ipv6hdr *hdr = ipv6_hdr(skb);
+	struct sk_buff *held = NULL;
 	verdict result;
 
 	xlation_init(&state);
 
-	if (xlator_find(dev_net(dev), &state.jool))
-		return NF_ACCEPT;
-	if (!state.jool.global->cfg.enabled) {
-		xlation_put(&state);
-		return NF_ACCEPT;
+	/* See core_4to6(). */
+	rcu_read_lock_bh();
+
+	if (xlator_find_rcu(dev_net(dev), &state.jool)
+			|| !state.jool.global->cfg.enabled) {
+		result = NF_ACCEPT;
+		goto end;
 	}
 
 	log_debug("===============================================");
 	log_debug("Catching IPv6 packet: %pI6c->%pI6c", &hdr->saddr,
 			&hdr->daddr);
 
-	/* Reminder: This function might change pointers. */
-	if (pkt_init_ipv6(&state.in, skb) != 0) {
-		xlation_put(&state);
-		return NF_DROP;
-	}
-
-	if (xlat_is_nat64()) {
-		result = fragdb_handle(state.jool.nat64.frag, &state.in);
-		if (result != VERDICT_CONTINUE)
-			goto end;
-	}
-
-	result = core_common(&state);
+	result = core_xlat(&state, skb, pkt_init_ipv6, &held);
+	translate_held(&state.jool, held, dev, pkt_init_ipv6);
 	/* Fall through. */
+
 end:
-	xlation_put(&state);
+	rcu_read_unlock_bh();
 	return result;
 }
@@ -197,19 +197,24 @@ static int update_plateaus(struct global_config_usr *config,
 
 static int handle_global_display(struct xlator *jool, struct genl_info *info)
 {
-	struct full_config config;
+	struct global_display_usr result;
 	bool pools_empty;
 
 	log_debug("Returning 'Global' options.");
 
-	xlator_copy_config(jool, &config);
+	xlator_copy_config(jool, &result.config);
 
 	pools_empty = pool6_is_empty(jool->pool6);
 	if (xlat_is_siit())
 		pools_empty &= eamt_is_empty(jool->siit.eamt);
-	prepare_config_for_userspace(&config, pools_empty);
+	prepare_config_for_userspace(&result.config, pools_empty);
 
-	return nlcore_respond_struct(info, &config, sizeof(config));
+	if (xlat_is_nat64())
+		fragdb_stats(jool->nat64.frag, &result.fragdb);
+	else
+		memset(&result.fragdb, 0, sizeof(result.fragdb));
+
+	return nlcore_respond_struct(info, &result, sizeof(result));
 }
 
 static int massive_switch(struct full_config *cfg, struct global_value *chunk,
@@ -237,6 +242,8 @@ static int massive_switch(struct full_config *cfg, struct global_value *chunk,
 		return parse_u8(&cfg->global.new_tos, chunk, size);
 	case MTU_PLATEAUS:
 		return update_plateaus(&cfg->global, chunk, size);
+	case XLAT_IN_PLACE:
+		return parse_bool(&cfg->global.xlat_in_place, chunk, size);
 	case COMPUTE_UDP_CSUM_ZERO:
 		error = ensure_siit(OPTNAME_AMEND_UDP_CSUM);
 		return error ? : parse_bool(&cfg->global.siit.compute_udp_csum_zero, chunk, size);
@@ -291,6 +298,19 @@ static int massive_switch(struct full_config *cfg, struct global_value *chunk,
 	case MAX_PKTS:
 		error = ensure_nat64(OPTNAME_MAX_SO);
 		return error ? : parse_u32(&cfg->bib.max_stored_pkts, chunk, size);
+	case CLEAN_BUDGET:
+		error = ensure_nat64(OPTNAME_CLEAN_BUDGET);
+		if (error)
+			return error;
+		error = parse_u32(&cfg->bib.clean_budget, chunk, size);
+		if (!error && cfg->bib.clean_budget == 0) {
+			log_err("The session clean budget cannot be zero.");
+			return -EINVAL;
+		}
+		return error;
+	case FRAGMENT_MAX_BYTES:
+		error = ensure_nat64(OPTNAME_FRAG_MAX_BYTES);
+		return error ? : parse_u32(&cfg->frag.max_bytes, chunk, size);
 	case SS_ENABLED:
 		error = ensure_nat64(OPTNAME_SS_ENABLED);
 		return error ? : parse_bool(&cfg->joold.enabled, chunk, size);
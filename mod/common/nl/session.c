@@ -64,16 +64,62 @@ static int handle_session_display(struct bib *db, struct genl_info *info,
 static int handle_session_count(struct bib *db, struct genl_info *info,
 		struct request_session *request)
 {
+	struct session_count_usr result;
 	int error;
-	__u64 count;
 
 	log_debug("Returning session count.");
 
-	error = bib_count_sessions(db, request->l4_proto, &count);
+	error = bib_count_sessions(db, request->l4_proto, &result.count);
 	if (error)
 		return nlcore_respond(info, error);
+	error = bib_session_bytes(db, request->l4_proto, &result.bytes);
+	if (error)
+		return nlcore_respond(info, error);
+
+	return nlcore_respond_struct(info, &result, sizeof(result));
+}
+
+static int handle_session_refresh(struct bib *db, struct genl_info *info,
+		struct request_session *request)
+{
+	struct session_refresh_usr *entries;
+	unsigned long now;
+	size_t len;
+	unsigned int count;
+	unsigned int gone;
+	unsigned int i;
+	int error;
+
+	if (verify_superpriv())
+		return nlcore_respond(info, -EPERM);
+
+	len = nla_len(info->attrs[ATTR_DATA]) - sizeof(struct request_hdr)
+			- sizeof(*request);
+	if (len % sizeof(*entries) != 0) {
+		log_err("The Netlink packet seems corrupted.");
+		return nlcore_respond(info, -EINVAL);
+	}
+
+	entries = (struct session_refresh_usr *)(request + 1);
+	count = len / sizeof(*entries);
+	now = jiffies;
+	gone = 0;
+
+	for (i = 0; i < count; i++) {
+		error = bib_refresh(db, request->l4_proto, &entries[i].src6,
+				&entries[i].dst4,
+				now - msecs_to_jiffies(entries[i].idle));
+		if (error == -ESRCH) {
+			/* It died before userspace could tell us. */
+			gone++;
+			continue;
+		}
+		if (error)
+			return nlcore_respond(info, error);
+	}
 
-	return nlcore_respond_struct(info, &count, sizeof(count));
+	log_debug("Refreshed %u sessions (%u were gone).", count - gone, gone);
+	return nlcore_respond(info, 0);
 }
 
 int handle_session_config(struct xlator *jool, struct genl_info *info)
@@ -99,6 +145,8 @@ int handle_session_config(struct xlator *jool, struct genl_info *info)
 		return handle_session_display(jool->nat64.bib, info, request);
 	case OP_COUNT:
 		return handle_session_count(jool->nat64.bib, info, request);
+	case OP_UPDATE:
+		return handle_session_refresh(jool->nat64.bib, info, request);
 	}
 
 	log_err("Unknown operation: %u", be16_to_cpu(hdr->operation));
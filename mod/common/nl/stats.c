@@ -0,0 +1,31 @@
+#include "nat64/mod/common/nl/stats.h"
+
+#include "nat64/mod/common/route_cache.h"
+#include "nat64/mod/common/stats.h"
+#include "nat64/mod/common/nl/nl_common.h"
+#include "nat64/mod/common/nl/nl_core2.h"
+#include "nat64/mod/common/rfc6145/common.h"
+
+static int handle_stats_display(struct xlator *jool, struct genl_info *info)
+{
+	struct stats_usr result;
+
+	log_debug("Returning the counters.");
+	jstat_query(jool->stats, result.jstats);
+	rtcache_stats(jool->rtcache, &result.rtcache);
+	ttpcomm_csum_stats(&result.csum);
+	return nlcore_respond_struct(info, &result, sizeof(result));
+}
+
+int handle_stats_config(struct xlator *jool, struct genl_info *info)
+{
+	struct request_hdr *hdr = get_jool_hdr(info);
+
+	switch (be16_to_cpu(hdr->operation)) {
+	case OP_DISPLAY:
+		return handle_stats_display(jool, info);
+	}
+
+	log_err("Unknown operation: %u", be16_to_cpu(hdr->operation));
+	return nlcore_respond(info, -EINVAL);
+}
@@ -280,10 +280,6 @@ int pkt_init_ipv6(struct packet *pkt, struct sk_buff *skb)
 	 * change pointers, so you generally don't want to store them.
 	 */
 
-#ifdef BENCHMARK
-	getnstimeofday(&pkt->start_time);
-#endif
-
 	error = fail_if_shared(skb);
 	if (error)
 		return error;
@@ -447,10 +443,6 @@ int pkt_init_ipv4(struct packet *pkt, struct sk_buff *skb)
 	 * change pointers, so you generally don't want to store them.
 	 */
 
-#ifdef BENCHMARK
-	getnstimeofday(&pkt->start_time);
-#endif
-
 	error = fail_if_shared(skb);
 	if (error)
 		return error;
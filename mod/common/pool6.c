@@ -6,23 +6,41 @@
 #include "nat64/common/types.h"
 #include "nat64/mod/common/address.h"
 #include "nat64/mod/common/rcu.h"
+#include "nat64/mod/common/rfc6052.h"
+#include "nat64/mod/common/rtrie.h"
 #include "nat64/mod/common/tags.h"
 #include "nat64/mod/common/wkmalloc.h"
 
-struct pool6 {
-	struct list_head __rcu *list;
-	struct kref refcount;
-};
-
 /**
  * A prefix within the pool.
  */
 struct pool_entry {
-	struct ipv6_prefix prefix;
-	/** The thing that connects this object to its pool6->list list. */
+	struct pool6_entry entry;
+	/** The thing that connects this object to its pool6_table's list. */
 	struct list_head list_hook;
 };
 
+/**
+ * The pool's prefixes, indexed twice.
+ *
+ * @list keeps them in insertion order, which is what foreach and peek need.
+ * @trie finds the prefix that contains a given address without walking the
+ * list, so the pool can hold plenty of prefixes.
+ *
+ * The first prefix is the default one for the IPv4-to-IPv6 direction. (NAT64
+ * sessions remember the prefix their IPv6 node used, so they only need it
+ * when there is no such knowledge.)
+ */
+struct pool6_table {
+	struct list_head list;
+	struct rtrie trie;
+};
+
+struct pool6 {
+	struct pool6_table __rcu *table;
+	struct kref refcount;
+};
+
 /**
  * This protects all pool6 updates (across all namespaces).
  * Each pool6 cannot hold a different mutex because I'd need to dereference
@@ -78,33 +96,35 @@ static int validate_prefix(struct ipv6_prefix *prefix)
 	}
 }
 
-static int create_list(struct list_head **list)
+static int create_table(struct pool6_table **table)
 {
-	struct list_head *result;
+	struct pool6_table *result;
 
-	result = __wkmalloc("pool6 list", sizeof(struct list_head), GFP_KERNEL);
+	result = wkmalloc(struct pool6_table, GFP_KERNEL);
 	if (!result)
 		return -ENOMEM;
-	INIT_LIST_HEAD(result);
+	INIT_LIST_HEAD(&result->list);
+	rtrie_init(&result->trie, sizeof(struct pool6_entry));
 
-	*list = result;
+	*table = result;
 	return 0;
 }
 
 /**
- * Assumes it has exclusive access to @list.
+ * Assumes it has exclusive access to @table.
  */
-static void destroy_list(struct list_head *list)
+static void destroy_table(struct pool6_table *table)
 {
 	struct list_head *node;
 	struct list_head *tmp;
 
-	list_for_each_safe(node, tmp, list) {
+	list_for_each_safe(node, tmp, &table->list) {
 		list_del(node);
 		wkfree(struct pool_entry, get_entry(node));
 	}
 
-	__wkfree("pool6 list", list);
+	rtrie_destroy(&table->trie);
+	wkfree(struct pool6_table, table);
 }
 
 /**
@@ -117,20 +137,20 @@ RCUTAG_USR
 int pool6_init(struct pool6 **pool)
 {
 	struct pool6 *result;
-	struct list_head *list;
+	struct pool6_table *table;
 	int error;
 
 	result = wkmalloc(struct pool6, GFP_KERNEL);
 	if (!result)
 		return -ENOMEM;
 
-	error = create_list(&list);
+	error = create_table(&table);
 	if (error) {
 		wkfree(struct pool6, result);
 		return error;
 	}
 
-	RCU_INIT_POINTER(result->list, list);
+	RCU_INIT_POINTER(result->table, table);
 	kref_init(&result->refcount);
 
 	*pool = result;
@@ -146,7 +166,7 @@ static void destroy_pool6(struct kref *ref)
 {
 	struct pool6 *pool;
 	pool = container_of(ref, struct pool6, refcount);
-	destroy_list(rcu_dereference_raw(pool->list));
+	destroy_table(rcu_dereference_raw(pool->table));
 	wkfree(struct pool6, pool);
 }
 
@@ -161,24 +181,45 @@ void pool6_put(struct pool6 *pool)
 RCUTAG_USR
 int pool6_flush(struct pool6 *pool)
 {
-	struct list_head *old;
-	struct list_head *new;
+	struct pool6_table *old;
+	struct pool6_table *new;
 	int error;
 
-	error = create_list(&new);
+	error = create_table(&new);
 	if (error)
 		return error;
 
 	mutex_lock(&lock);
-	old = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	rcu_assign_pointer(pool->list, new);
+	old = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
+	rcu_assign_pointer(pool->table, new);
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
-	destroy_list(old);
+	destroy_table(old);
 	return 0;
 }
 
+/**
+ * pool6_find_rcu - Returns @pool's most specific prefix that contains @addr,
+ * or NULL if there's none.
+ *
+ * The result is only valid until you unlock RCU reads, so you need to "lock"
+ * them before calling.
+ */
+RCUTAG_PKT
+struct pool6_entry *pool6_find_rcu(struct pool6 *pool,
+		const struct in6_addr *addr)
+{
+	struct pool6_table *table;
+	struct rtrie_key key;
+
+	key.bytes = (__u8 *) addr;
+	key.len = 8 * sizeof(*addr);
+
+	table = rcu_dereference_bh(pool->table);
+	return rtrie_find(&table->trie, &key);
+}
+
 /**
  * pool6_find - Returns (in @result) @pool's prefix corresponding to @addr.
  *
@@ -188,36 +229,42 @@ RCUTAG_PKT
 int pool6_find(struct pool6 *pool, const struct in6_addr *addr,
 		struct ipv6_prefix *result)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct ipv6_prefix *prefix;
+	struct pool6_entry *entry;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool->list);
-
-	/*
-	 * This seems redundant, but if you want to remove it mind that you need
-	 * to debug on callers.
-	 */
-	if (list_empty(list)) {
-		log_debug("pool6 is empty.");
-		goto not_found;
+	entry = pool6_find_rcu(pool, addr);
+	if (!entry) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
 	}
 
-	list_for_each_rcu_bh(node, list) {
-		prefix = &get_entry(node)->prefix;
-		if (ipv6_prefix_equal(&prefix->address, addr, prefix->len)) {
-			*result = *prefix;
-			rcu_read_unlock_bh();
-			return 0;
-		}
+	*result = entry->prefix;
+	rcu_read_unlock_bh();
+	return 0;
+}
+
+/**
+ * pool6_peek_rcu - Returns @pool's first prefix, or NULL if @pool is empty.
+ *
+ * The result is only valid until you unlock RCU reads, so you need to "lock"
+ * them before calling.
+ */
+RCUTAG_PKT
+struct pool6_entry *pool6_peek_rcu(struct pool6 *pool)
+{
+	struct pool6_table *table;
+	struct list_head *first;
+
+	table = rcu_dereference_bh(pool->table);
+	if (list_empty(&table->list)) {
+		log_debug("pool6 is empty.");
+		return NULL;
 	}
-	/* Fall through. */
 
-not_found:
-	rcu_read_unlock_bh();
-	return -ESRCH;
+	/* Just return the first one. */
+	first = rcu_dereference_bh(list_next_rcu(&table->list));
+	return &get_entry(first)->entry;
 }
 
 /**
@@ -226,23 +273,17 @@ not_found:
 RCUTAG_PKT
 int pool6_peek(struct pool6 *pool, struct ipv6_prefix *result)
 {
-	struct list_head *list;
-	struct pool_entry *entry;
+	struct pool6_entry *entry;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool->list);
-
-	if (list_empty(list)) {
+	entry = pool6_peek_rcu(pool);
+	if (!entry) {
 		rcu_read_unlock_bh();
-		log_debug("pool6 is empty.");
 		return -ESRCH;
 	}
 
-	/* Just return the first one. */
-	entry = get_entry(rcu_dereference_bh(list_next_rcu(list)));
 	*result = entry->prefix;
-
 	rcu_read_unlock_bh();
 	return 0;
 }
@@ -253,35 +294,36 @@ int pool6_peek(struct pool6 *pool, struct ipv6_prefix *result)
 RCUTAG_PKT
 bool pool6_contains(struct pool6 *pool, struct in6_addr *addr)
 {
-	struct ipv6_prefix throwaway;
-	return !pool6_find(pool, addr, &throwaway);
+	bool result;
+
+	rcu_read_lock_bh();
+	result = !!pool6_find_rcu(pool, addr);
+	rcu_read_unlock_bh();
+
+	return result;
 }
 
 int pool6_add(struct pool6 *pool, struct ipv6_prefix *prefix)
 {
-	struct list_head *list;
+	struct pool6_table *table;
 	struct pool_entry *entry;
+	const struct rfc6052_xlator *xlator;
 	int error;
 
 	error = validate_prefix(prefix);
 	if (error)
 		return error; /* Error msg already printed. */
 
-	mutex_lock(&lock);
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-
-	if (!list_empty(list)) {
-		mutex_unlock(&lock);
-		/*
-		 * TODO (4.0.0) remember to turn pool6 into a single global
-		 * param. This whole module being a linked list is stupid.
-		 */
-		log_err("Only one pool6 prefix can exist per Jool instance.");
+	xlator = rfc6052_get_xlator(prefix->len);
+	if (WARN(!xlator, "Validated prefix length %u has no RFC 6052 routines.",
+			prefix->len))
 		return -EINVAL;
-	}
 
-	list_for_each_entry(entry, list, list_hook) {
-		if (prefix6_equals(&entry->prefix, prefix)) {
+	mutex_lock(&lock);
+	table = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
+
+	list_for_each_entry(entry, &table->list, list_hook) {
+		if (prefix6_equals(&entry->entry.prefix, prefix)) {
 			mutex_unlock(&lock);
 			log_err("The prefix already belongs to the pool.");
 			return -EEXIST;
@@ -294,8 +336,19 @@ int pool6_add(struct pool6 *pool, struct ipv6_prefix *prefix)
 		log_err("Allocation of IPv6 pool node failed.");
 		return -ENOMEM;
 	}
-	entry->prefix = *prefix;
-	list_add_tail_rcu(&entry->list_hook, list);
+	entry->entry.prefix = *prefix;
+	entry->entry.xlator = xlator;
+
+	error = rtrie_add(&table->trie, &entry->entry,
+			offsetof(struct pool6_entry, prefix.address),
+			prefix->len);
+	if (error) {
+		mutex_unlock(&lock);
+		wkfree(struct pool_entry, entry);
+		return error;
+	}
+
+	list_add_tail_rcu(&entry->list_hook, &table->list);
 
 	mutex_unlock(&lock);
 	return 0;
@@ -322,17 +375,26 @@ int pool6_add_str(struct pool6 *pool, char *prefix_strings[], int prefix_count)
 RCUTAG_USR
 int pool6_rm(struct pool6 *pool, struct ipv6_prefix *prefix)
 {
-	struct list_head *list;
+	struct pool6_table *table;
 	struct list_head *node;
 	struct pool_entry *entry;
+	struct rtrie_key key;
+	int error;
 
 	mutex_lock(&lock);
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
+	table = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
 
-	list_for_each(node, list) {
+	list_for_each(node, &table->list) {
 		entry = get_entry(node);
-		if (prefix6_equals(&entry->prefix, prefix)) {
+		if (prefix6_equals(&entry->entry.prefix, prefix)) {
 			list_del_rcu(&entry->list_hook);
+
+			key.bytes = (__u8 *) &prefix->address;
+			key.len = prefix->len;
+			error = rtrie_rm(&table->trie, &key);
+			WARN(error, "pool6 prefix %pI6c/%u was not in the trie. (Errcode %d)",
+					&prefix->address, prefix->len, error);
+
 			mutex_unlock(&lock);
 			synchronize_rcu_bh();
 			wkfree(struct pool_entry, entry);
@@ -357,21 +419,21 @@ int pool6_foreach(struct pool6 *pool,
 		int (*cb)(struct ipv6_prefix *, void *), void *arg,
 		struct ipv6_prefix *offset)
 {
-	struct list_head *list;
+	struct pool6_table *table;
 	struct list_head *node;
 	struct pool_entry *entry;
 	int error = 0;
 
 	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool->list);
+	table = rcu_dereference_bh(pool->table);
 
-	list_for_each_rcu_bh(node, list) {
+	list_for_each_rcu_bh(node, &table->list) {
 		entry = get_entry(node);
 		if (!offset) {
-			error = cb(&entry->prefix, arg);
+			error = cb(&entry->entry.prefix, arg);
 			if (error)
 				break;
-		} else if (prefix6_equals(offset, &entry->prefix)) {
+		} else if (prefix6_equals(offset, &entry->entry.prefix)) {
 			offset = NULL;
 		}
 	}
@@ -383,14 +445,14 @@ int pool6_foreach(struct pool6 *pool,
 RCUTAG_PKT
 int pool6_count(struct pool6 *pool, __u64 *result)
 {
-	struct list_head *list;
+	struct pool6_table *table;
 	struct list_head *node;
 	__u64 count = 0;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
+	table = rcu_dereference_bh(pool->table);
+	list_for_each_rcu_bh(node, &table->list) {
 		count++;
 	}
 
@@ -403,9 +465,12 @@ int pool6_count(struct pool6 *pool, __u64 *result)
 RCUTAG_PKT
 bool pool6_is_empty(struct pool6 *pool)
 {
+	struct pool6_table *table;
 	bool result;
+
 	rcu_read_lock_bh();
-	result = list_empty(rcu_dereference_bh(pool->list));
+	table = rcu_dereference_bh(pool->table);
+	result = list_empty(&table->list);
 	rcu_read_unlock_bh();
 	return result;
 }
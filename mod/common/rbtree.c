@@ -17,6 +17,17 @@ void treeslot_commit(struct tree_slot *slot)
 	rb_insert_color(slot->entry, slot->tree);
 }
 
+void treeslot_commit_rcu(struct tree_slot *slot)
+{
+#if RBTREE_LOCKLESS_READS
+	/* Publishes the node's fields before the node itself. */
+	rb_link_node_rcu(slot->entry, slot->parent, slot->rb_link);
+#else
+	rb_link_node(slot->entry, slot->parent, slot->rb_link);
+#endif
+	rb_insert_color(slot->entry, slot->tree);
+}
+
 /*
  * Safe postorder traversal.
  *
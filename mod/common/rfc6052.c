@@ -2,6 +2,7 @@
 
 #include <linux/module.h>
 #include <linux/printk.h>
+#include <linux/rcupdate.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/pool6.h"
 
@@ -10,43 +11,173 @@ union ipv4_address {
 	__u8 as8[4];
 };
 
+static void extract32(const struct in6_addr *src, struct in_addr *dst)
+{
+	dst->s_addr = src->s6_addr32[1];
+}
+
+static void extract40(const struct in6_addr *src, struct in_addr *dst)
+{
+	union ipv4_address dst_aux;
+
+	dst_aux.as8[0] = src->s6_addr[5];
+	dst_aux.as8[1] = src->s6_addr[6];
+	dst_aux.as8[2] = src->s6_addr[7];
+	dst_aux.as8[3] = src->s6_addr[9];
+
+	dst->s_addr = dst_aux.as32;
+}
+
+static void extract48(const struct in6_addr *src, struct in_addr *dst)
+{
+	union ipv4_address dst_aux;
+
+	dst_aux.as8[0] = src->s6_addr[6];
+	dst_aux.as8[1] = src->s6_addr[7];
+	dst_aux.as8[2] = src->s6_addr[9];
+	dst_aux.as8[3] = src->s6_addr[10];
+
+	dst->s_addr = dst_aux.as32;
+}
+
+static void extract56(const struct in6_addr *src, struct in_addr *dst)
+{
+	union ipv4_address dst_aux;
+
+	dst_aux.as8[0] = src->s6_addr[7];
+	dst_aux.as8[1] = src->s6_addr[9];
+	dst_aux.as8[2] = src->s6_addr[10];
+	dst_aux.as8[3] = src->s6_addr[11];
+
+	dst->s_addr = dst_aux.as32;
+}
+
+static void extract64(const struct in6_addr *src, struct in_addr *dst)
+{
+	union ipv4_address dst_aux;
+
+	dst_aux.as8[0] = src->s6_addr[9];
+	dst_aux.as8[1] = src->s6_addr[10];
+	dst_aux.as8[2] = src->s6_addr[11];
+	dst_aux.as8[3] = src->s6_addr[12];
+
+	dst->s_addr = dst_aux.as32;
+}
+
+static void extract96(const struct in6_addr *src, struct in_addr *dst)
+{
+	dst->s_addr = src->s6_addr32[3];
+}
+
+static void embed32(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr32[1] = src->s_addr;
+	dst->s6_addr32[2] = 0;
+	dst->s6_addr32[3] = 0;
+}
+
+static void embed40(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	union ipv4_address src_aux = { .as32 = src->s_addr };
+
+	memset(dst, 0, sizeof(*dst));
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr[4] = prefix->s6_addr[4];
+	dst->s6_addr[5] = src_aux.as8[0];
+	dst->s6_addr[6] = src_aux.as8[1];
+	dst->s6_addr[7] = src_aux.as8[2];
+	dst->s6_addr[9] = src_aux.as8[3];
+}
+
+static void embed48(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	union ipv4_address src_aux = { .as32 = src->s_addr };
+
+	memset(dst, 0, sizeof(*dst));
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr[4] = prefix->s6_addr[4];
+	dst->s6_addr[5] = prefix->s6_addr[5];
+	dst->s6_addr[6] = src_aux.as8[0];
+	dst->s6_addr[7] = src_aux.as8[1];
+	dst->s6_addr[9] = src_aux.as8[2];
+	dst->s6_addr[10] = src_aux.as8[3];
+}
+
+static void embed56(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	union ipv4_address src_aux = { .as32 = src->s_addr };
+
+	memset(dst, 0, sizeof(*dst));
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr[4] = prefix->s6_addr[4];
+	dst->s6_addr[5] = prefix->s6_addr[5];
+	dst->s6_addr[6] = prefix->s6_addr[6];
+	dst->s6_addr[7] = src_aux.as8[0];
+	dst->s6_addr[9] = src_aux.as8[1];
+	dst->s6_addr[10] = src_aux.as8[2];
+	dst->s6_addr[11] = src_aux.as8[3];
+}
+
+static void embed64(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	union ipv4_address src_aux = { .as32 = src->s_addr };
+
+	memset(dst, 0, sizeof(*dst));
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr32[1] = prefix->s6_addr32[1];
+	dst->s6_addr[9] = src_aux.as8[0];
+	dst->s6_addr[10] = src_aux.as8[1];
+	dst->s6_addr[11] = src_aux.as8[2];
+	dst->s6_addr[12] = src_aux.as8[3];
+}
+
+static void embed96(const struct in6_addr *prefix, struct in_addr *src,
+		struct in6_addr *dst)
+{
+	dst->s6_addr32[0] = prefix->s6_addr32[0];
+	dst->s6_addr32[1] = prefix->s6_addr32[1];
+	dst->s6_addr32[2] = prefix->s6_addr32[2];
+	dst->s6_addr32[3] = src->s_addr;
+}
+
+/** Indexed by prefix length, divided by 8. */
+static const struct rfc6052_xlator xlators[] = {
+	[32 >> 3] = { .extract = extract32, .embed = embed32 },
+	[40 >> 3] = { .extract = extract40, .embed = embed40 },
+	[48 >> 3] = { .extract = extract48, .embed = embed48 },
+	[56 >> 3] = { .extract = extract56, .embed = embed56 },
+	[64 >> 3] = { .extract = extract64, .embed = embed64 },
+	[96 >> 3] = { .extract = extract96, .embed = embed96 },
+};
+
+/**
+ * Returns the RFC 6052 routines that fit prefixes of length @prefix_len, or
+ * NULL if RFC 6052 doesn't allow @prefix_len.
+ */
+const struct rfc6052_xlator *rfc6052_get_xlator(__u8 prefix_len)
+{
+	const struct rfc6052_xlator *result;
+
+	if ((prefix_len & 7u) || (prefix_len >> 3) >= ARRAY_SIZE(xlators))
+		return NULL;
+
+	result = &xlators[prefix_len >> 3];
+	return result->extract ? result : NULL;
+}
+
 int addr_6to4(const struct in6_addr *src, struct ipv6_prefix *prefix,
 		struct in_addr *dst)
 {
-	union ipv4_address dst_aux;
+	const struct rfc6052_xlator *xlator;
 
-	switch (prefix->len) {
-	case 32:
-		dst_aux.as32 = src->s6_addr32[1];
-		break;
-	case 40:
-		dst_aux.as8[0] = src->s6_addr[5];
-		dst_aux.as8[1] = src->s6_addr[6];
-		dst_aux.as8[2] = src->s6_addr[7];
-		dst_aux.as8[3] = src->s6_addr[9];
-		break;
-	case 48:
-		dst_aux.as8[0] = src->s6_addr[6];
-		dst_aux.as8[1] = src->s6_addr[7];
-		dst_aux.as8[2] = src->s6_addr[9];
-		dst_aux.as8[3] = src->s6_addr[10];
-		break;
-	case 56:
-		dst_aux.as8[0] = src->s6_addr[7];
-		dst_aux.as8[1] = src->s6_addr[9];
-		dst_aux.as8[2] = src->s6_addr[10];
-		dst_aux.as8[3] = src->s6_addr[11];
-		break;
-	case 64:
-		dst_aux.as8[0] = src->s6_addr[9];
-		dst_aux.as8[1] = src->s6_addr[10];
-		dst_aux.as8[2] = src->s6_addr[11];
-		dst_aux.as8[3] = src->s6_addr[12];
-		break;
-	case 96:
-		dst_aux.as32 = src->s6_addr32[3];
-		break;
-	default:
+	xlator = rfc6052_get_xlator(prefix->len);
+	if (!xlator) {
 		/*
 		 * Critical because enforcing valid prefixes is pool6's
 		 * responsibility, not ours.
@@ -55,65 +186,17 @@ int addr_6to4(const struct in6_addr *src, struct ipv6_prefix *prefix,
 		return -EINVAL;
 	}
 
-	dst->s_addr = dst_aux.as32;
+	xlator->extract(src, dst);
 	return 0;
 }
 
 int addr_4to6(struct in_addr *src, struct ipv6_prefix *prefix,
 		struct in6_addr *dst)
 {
-	union ipv4_address src_aux;
+	const struct rfc6052_xlator *xlator;
 
-	src_aux.as32 = src->s_addr;
-	memset(dst, 0, sizeof(*dst));
-
-	switch (prefix->len) {
-	case 32:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = src_aux.as32;
-		break;
-	case 40:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = src_aux.as8[0];
-		dst->s6_addr[6] = src_aux.as8[1];
-		dst->s6_addr[7] = src_aux.as8[2];
-		dst->s6_addr[9] = src_aux.as8[3];
-		break;
-	case 48:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = prefix->address.s6_addr[5];
-		dst->s6_addr[6] = src_aux.as8[0];
-		dst->s6_addr[7] = src_aux.as8[1];
-		dst->s6_addr[9] = src_aux.as8[2];
-		dst->s6_addr[10] = src_aux.as8[3];
-		break;
-	case 56:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = prefix->address.s6_addr[5];
-		dst->s6_addr[6] = prefix->address.s6_addr[6];
-		dst->s6_addr[7] = src_aux.as8[0];
-		dst->s6_addr[9] = src_aux.as8[1];
-		dst->s6_addr[10] = src_aux.as8[2];
-		dst->s6_addr[11] = src_aux.as8[3];
-		break;
-	case 64:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = prefix->address.s6_addr32[1];
-		dst->s6_addr[9] = src_aux.as8[0];
-		dst->s6_addr[10] = src_aux.as8[1];
-		dst->s6_addr[11] = src_aux.as8[2];
-		dst->s6_addr[12] = src_aux.as8[3];
-		break;
-	case 96:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = prefix->address.s6_addr32[1];
-		dst->s6_addr32[2] = prefix->address.s6_addr32[2];
-		dst->s6_addr32[3] = src_aux.as32;
-		break;
-	default:
+	xlator = rfc6052_get_xlator(prefix->len);
+	if (!xlator) {
 		/*
 		 * Critical because enforcing valid prefixes is pool6's
 		 * responsibility, not ours.
@@ -122,34 +205,56 @@ int addr_4to6(struct in_addr *src, struct ipv6_prefix *prefix,
 		return -EINVAL;
 	}
 
+	xlator->embed(&prefix->address, src, dst);
 	return 0;
 }
 
+/**
+ * Packet path version of addr_6to4(); translates @addr6 using whichever
+ * @pool prefix contains it.
+ */
 int rfc6052_6to4(struct pool6 *pool, const struct in6_addr *addr6,
 		struct in_addr *result)
 {
-	struct ipv6_prefix prefix;
-	int error;
+	struct pool6_entry *entry;
+
+	rcu_read_lock_bh();
 
-	error = pool6_find(pool, addr6, &prefix);
-	if (error) {
+	entry = pool6_find_rcu(pool, addr6);
+	if (!entry) {
+		rcu_read_unlock_bh();
 		log_debug("Could not find a prefix that matches %pI6c.", addr6);
-		return error;
+		return -ESRCH;
 	}
 
-	return addr_6to4(addr6, &prefix, result);
+	entry->xlator->extract(addr6, result);
+
+	rcu_read_unlock_bh();
+	return 0;
 }
 
+/**
+ * Packet path version of addr_4to6(); translates @addr4 using @pool's first
+ * prefix.
+ *
+ * NAT64 sessions already know their prefix, so they only fall back to this
+ * when they are being created from the IPv4 side.
+ */
 int rfc6052_4to6(struct pool6 *pool, struct in_addr *addr4,
 		struct in6_addr *result)
 {
-	struct ipv6_prefix prefix;
-	int error;
+	struct pool6_entry *entry;
 
-	error = pool6_peek(pool, &prefix);
-	if (error)
-		return error;
+	rcu_read_lock_bh();
 
-	return addr_4to6(addr4, &prefix, result);
-}
+	entry = pool6_peek_rcu(pool);
+	if (!entry) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
+	}
+
+	entry->xlator->embed(&entry->prefix.address, addr4, result);
 
+	rcu_read_unlock_bh();
+	return 0;
+}
@@ -61,6 +61,7 @@ verdict ttp46_create_skb(struct xlation *state)
 	skb = alloc_skb(reserve + total_len, GFP_ATOMIC);
 	if (!skb) {
 		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		jstat_inc(state->jool.stats, JSTAT_ENOMEM);
 		return VERDICT_DROP;
 	}
 
@@ -79,6 +80,7 @@ verdict ttp46_create_skb(struct xlation *state)
 
 	skb->mark = in->skb->mark;
 	skb->protocol = htons(ETH_P_IPV6);
+	ttpcomm_copy_gso(in, skb, L3PROTO_IPV6);
 
 	return VERDICT_CONTINUE;
 }
@@ -141,7 +143,6 @@ static int generate_saddr6_nat64(struct xlation *state)
 static addrxlat_verdict generate_addr6_siit(struct xlation *state,
 		__be32 addr4, struct in6_addr *addr6, bool enable_eam)
 {
-	struct ipv6_prefix prefix;
 	struct in_addr tmp = { .s_addr = addr4 };
 	int error;
 
@@ -164,20 +165,12 @@ static addrxlat_verdict generate_addr6_siit(struct xlation *state,
 		return ADDRXLAT_ACCEPT;
 	}
 
-	error = pool6_peek(state->jool.pool6, &prefix);
+	error = rfc6052_4to6(state->jool.pool6, &tmp, addr6);
 	if (error) {
 		log_debug("Address %pI4 lacks EAMT entry and there's no pool6 prefix.",
 				&tmp);
 		return ADDRXLAT_TRY_SOMETHING_ELSE;
 	}
-	error = addr_4to6(&tmp, &prefix, addr6);
-	if (error) {
-		/*
-		 * This is not TRY_SOMETHING_ELSE because addr_4to6() can only
-		 * fail on criticals, currently.
-		 */
-		return ADDRXLAT_DROP;
-	}
 
 	return ADDRXLAT_CONTINUE;
 }
@@ -200,11 +193,25 @@ static bool disable_dst_eam(struct packet *in, bool hairpin)
 	return hairpin && pkt_is_inner(in);
 }
 
-static verdict translate_addrs46_siit(struct xlation *state)
+/**
+ * The packet cannot be translated because of its addresses; leave it to the
+ * kernel.
+ */
+static verdict untranslatable46(struct xlation *state)
+{
+	jstat_inc(state->jool.stats, JSTAT_UNTRANSLATABLE);
+	return VERDICT_ACCEPT;
+}
+
+/**
+ * Writes @state->in's translated addresses in @hdr6.
+ * (Which is usually @state->out's header, except in ttp46_inplace().)
+ */
+static verdict translate_addrs46_siit(struct xlation *state,
+		struct ipv6hdr *hdr6)
 {
 	struct packet *in = &state->in;
 	struct iphdr *hdr4 = pkt_ip4_hdr(in);
-	struct ipv6hdr *hdr6 = pkt_ip6_hdr(&state->out);
 	enum eam_hairpinning_mode hairpin_mode;
 	bool hairpin;
 	addrxlat_verdict result;
@@ -223,10 +230,11 @@ static verdict translate_addrs46_siit(struct xlation *state)
 		if (pkt_is_icmp4_error(in)
 				&& !rfc6791_find_v6(state, &hdr6->saddr))
 			break; /* Ok, success. */
-		return VERDICT_ACCEPT;
+		return untranslatable46(state);
 	case ADDRXLAT_ACCEPT:
+		return untranslatable46(state);
 	case ADDRXLAT_DROP:
-		return (verdict)result;
+		return VERDICT_DROP;
 	}
 
 	/* Dst address. */
@@ -236,10 +244,10 @@ static verdict translate_addrs46_siit(struct xlation *state)
 	case ADDRXLAT_CONTINUE:
 		break;
 	case ADDRXLAT_TRY_SOMETHING_ELSE:
-		return VERDICT_ACCEPT;
 	case ADDRXLAT_ACCEPT:
+		return untranslatable46(state);
 	case ADDRXLAT_DROP:
-		return (verdict)result;
+		return VERDICT_DROP;
 	}
 
 	log_debug("Result: %pI6c->%pI6c", &hdr6->saddr, &hdr6->daddr);
@@ -322,7 +330,7 @@ verdict ttp46_ipv6(struct xlation *state)
 			return VERDICT_DROP;
 		hdr6->daddr = out->tuple.dst.addr6.l3;
 	} else {
-		result = translate_addrs46_siit(state);
+		result = translate_addrs46_siit(state, hdr6);
 		if (result != VERDICT_CONTINUE)
 			return result;
 	}
@@ -345,6 +353,7 @@ verdict ttp46_ipv6(struct xlation *state)
 		if (hdr4->ttl <= 1) {
 			icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
 			inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
 			return VERDICT_DROP;
 		}
 		hdr6->hop_limit = hdr4->ttl - 1;
@@ -523,6 +532,7 @@ static int icmp4_to_icmp6_dest_unreach(struct xlation *state)
 		log_debug("ICMPv4 messages type %u code %u lack an ICMPv6 counterpart.",
 				icmp4_hdr->type, icmp4_hdr->code);
 		inc_stats(&state->in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 		return -EINVAL; /* No ICMP error. */
 	}
 
@@ -613,6 +623,7 @@ static int compute_icmp6_csum(struct packet *out)
 			&out_ip6->daddr, pkt_datagram_len(out), IPPROTO_ICMPV6,
 			csum);
 	out->skb->ip_summed = CHECKSUM_NONE;
+	ttpcomm_count_full_csum();
 
 	return 0;
 }
@@ -626,6 +637,7 @@ static verdict validate_icmp4_csum(struct packet *in)
 
 	csum = csum_fold(skb_checksum(in->skb, skb_transport_offset(in->skb),
 			pkt_datagram_len(in), 0));
+	ttpcomm_count_full_csum();
 	if (csum != 0) {
 		log_debug("Checksum doesn't match.");
 		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
@@ -658,8 +670,10 @@ static verdict post_icmp6error(struct xlation *state)
 	 * so validate first.
 	 */
 	result = validate_icmp4_csum(&state->in);
-	if (result != VERDICT_CONTINUE)
+	if (result != VERDICT_CONTINUE) {
+		jstat_inc(state->jool.stats, JSTAT_ICMP_CSUM);
 		return result;
+	}
 
 	result = ttpcomm_translate_inner_packet(state);
 	if (result != VERDICT_CONTINUE)
@@ -718,6 +732,7 @@ verdict ttp46_icmp(struct xlation *state)
 		error = icmp4_to_icmp6_param_prob(icmpv4_hdr, icmpv6_hdr);
 		if (error) {
 			inc_stats(&state->in, IPSTATS_MIB_INHDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 			return VERDICT_DROP;
 		}
 		return post_icmp6error(state);
@@ -734,6 +749,7 @@ verdict ttp46_icmp(struct xlation *state)
 		log_debug("ICMPv4 messages type %u lack an ICMPv6 counterpart.",
 				icmpv4_hdr->type);
 		inc_stats(&state->in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 		return VERDICT_DROP;
 	}
 
@@ -818,6 +834,9 @@ static bool can_compute_csum(struct xlation *state)
  * to make up for lazy IPv4 nodes.
  * This is actually required in the Determine Incoming Tuple step, but it feels
  * more at home here.
+ *
+ * If the whole datagram is in a single (outer) skb, only the pseudoheader is
+ * summed; the rest is left to the NIC (or to the kernel, if the NIC can't).
  */
 static int handle_zero_csum(struct xlation *state)
 {
@@ -829,6 +848,14 @@ static int handle_zero_csum(struct xlation *state)
 	if (!can_compute_csum(state))
 		return -EINVAL;
 
+	if (!pkt_is_inner(in) && !pkt_is_fragment(in)
+			&& !skb_shinfo(in->skb)->frag_list) {
+		hdr_udp->check = ~csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr,
+				pkt_datagram_len(in), IPPROTO_UDP, 0);
+		partialize_skb(state->out.skb, offsetof(struct udphdr, check));
+		return 0;
+	}
+
 	/*
 	 * Here's the deal:
 	 * We want to compute out's checksum. **out is a packet whose fragment
@@ -853,6 +880,7 @@ static int handle_zero_csum(struct xlation *state)
 			pkt_payload_len_pkt(in), csum);
 	hdr_udp->check = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr,
 			pkt_datagram_len(in), IPPROTO_UDP, csum);
+	ttpcomm_count_full_csum();
 
 	return 0;
 }
@@ -882,6 +910,7 @@ verdict ttp46_tcp(struct xlation *state)
 				pkt_ip4_hdr(in), &tcp_copy,
 				pkt_ip6_hdr(out), tcp_out,
 				sizeof(*tcp_out));
+		ttpcomm_keep_complete(in, out);
 	} else {
 		tcp_out->check = update_csum_4to6_partial(tcp_in->check,
 				pkt_ip4_hdr(in), pkt_ip6_hdr(out));
@@ -918,16 +947,13 @@ verdict ttp46_udp(struct xlation *state)
 					pkt_ip4_hdr(in), &udp_copy,
 					pkt_ip6_hdr(out), udp_out,
 					sizeof(*udp_out));
+			ttpcomm_keep_complete(in, out);
 		} else {
 			udp_out->check = update_csum_4to6_partial(udp_in->check,
 					pkt_ip4_hdr(in), pkt_ip6_hdr(out));
 			partialize_skb(out->skb, offsetof(struct udphdr, check));
 		}
 	} else {
-		/*
-		 * TODO (performance) handling this as partial might work just
-		 * as well, or better.
-		 */
 		if (handle_zero_csum(state))
 			return VERDICT_DROP;
 	}
@@ -935,3 +961,113 @@ verdict ttp46_udp(struct xlation *state)
 	/* Payload */
 	return copy_payload(state) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
+
+/**
+ * Translates @state->in the way ttp46_create_skb(), ttp46_ipv6() and
+ * ttp46_tcp() or ttp46_udp() would, except the result stays in the same skb.
+ * Only meant for the packets ttpcomm_inplace_possible() approves.
+ *
+ * See ttp64_inplace().
+ */
+verdict ttp46_inplace(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
+	struct iphdr *hdr4 = pkt_ip4_hdr(in);
+	struct ipv6hdr hdr6;
+	union inplace_l4hdr l4_in;
+	union inplace_l4hdr l4_out;
+	verdict result;
+
+	/* Layer 3 (ttp46_ipv6(), minus what the packet cannot contain) */
+	if (xlat_is_nat64()) {
+		hdr6.saddr = out->tuple.src.addr6.l3;
+		hdr6.daddr = out->tuple.dst.addr6.l3;
+	} else {
+		result = translate_addrs46_siit(state, &hdr6);
+		if (result != VERDICT_CONTINUE)
+			return result;
+	}
+
+	hdr6.version = 6;
+	if (state->jool.global->cfg.reset_traffic_class) {
+		hdr6.priority = 0;
+		hdr6.flow_lbl[0] = 0;
+	} else {
+		hdr6.priority = hdr4->tos >> 4;
+		hdr6.flow_lbl[0] = hdr4->tos << 4;
+	}
+	hdr6.flow_lbl[1] = 0;
+	hdr6.flow_lbl[2] = 0;
+	hdr6.payload_len = cpu_to_be16(pkt_l3payload_len(in));
+	hdr6.nexthdr = hdr4->protocol;
+
+	if (hdr4->ttl <= 1) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
+		return VERDICT_DROP;
+	}
+	hdr6.hop_limit = hdr4->ttl - 1;
+
+	/* Layer 4 (ttp46_tcp() and ttp46_udp()) */
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		memcpy(&l4_in.tcp, pkt_tcp_hdr(in), sizeof(l4_in.tcp));
+		l4_out.tcp = l4_in.tcp;
+		if (xlat_is_nat64()) {
+			l4_out.tcp.source = cpu_to_be16(out->tuple.src.addr6.l4);
+			l4_out.tcp.dest = cpu_to_be16(out->tuple.dst.addr6.l4);
+		}
+
+		if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+			l4_in.tcp.check = 0;
+			l4_out.tcp.check = 0;
+			l4_out.tcp.check = update_csum_4to6(
+					pkt_tcp_hdr(in)->check,
+					hdr4, &l4_in.tcp,
+					&hdr6, &l4_out.tcp,
+					sizeof(l4_out.tcp));
+		} else {
+			l4_out.tcp.check = update_csum_4to6_partial(
+					l4_in.tcp.check, hdr4, &hdr6);
+		}
+		break;
+
+	case L4PROTO_UDP:
+		/* (Zero checksums were left to the copy path.) */
+		memcpy(&l4_in.udp, pkt_udp_hdr(in), sizeof(l4_in.udp));
+		l4_out.udp = l4_in.udp;
+		if (xlat_is_nat64()) {
+			l4_out.udp.source = cpu_to_be16(out->tuple.src.addr6.l4);
+			l4_out.udp.dest = cpu_to_be16(out->tuple.dst.addr6.l4);
+		}
+
+		if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+			l4_in.udp.check = 0;
+			l4_out.udp.check = 0;
+			l4_out.udp.check = update_csum_4to6(
+					pkt_udp_hdr(in)->check,
+					hdr4, &l4_in.udp,
+					&hdr6, &l4_out.udp,
+					sizeof(l4_out.udp));
+		} else {
+			l4_out.udp.check = update_csum_4to6_partial(
+					l4_in.udp.check, hdr4, &hdr6);
+		}
+		break;
+
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		WARN(true, "Unexpected layer 4 protocol: %u",
+				pkt_l4_proto(in));
+		return VERDICT_DROP;
+	}
+
+	/* Point of no return */
+	if (ttpcomm_inplace_commit(state, L3PROTO_IPV6, &hdr6, sizeof(hdr6),
+			&l4_out))
+		return VERDICT_DROP;
+
+	return VERDICT_CONTINUE;
+}
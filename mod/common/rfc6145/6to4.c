@@ -54,6 +54,7 @@ verdict ttp64_create_skb(struct xlation *state)
 	skb = alloc_skb(LL_MAX_HEADER + total_len, GFP_ATOMIC);
 	if (!skb) {
 		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		jstat_inc(state->jool.stats, JSTAT_ENOMEM);
 		return VERDICT_DROP;
 	}
 
@@ -69,6 +70,7 @@ verdict ttp64_create_skb(struct xlation *state)
 
 	skb->mark = in->skb->mark;
 	skb->protocol = htons(ETH_P_IP);
+	ttpcomm_copy_gso(in, skb, L3PROTO_IPV4);
 
 	return VERDICT_CONTINUE;
 }
@@ -163,13 +165,12 @@ static __be16 generate_ipv4_id(struct frag_hdr *hdr_frag)
  */
 static bool generate_df_flag(struct packet *out)
 {
-	return pkt_len(out) > 1260;
+	return pkt_seglen(out) > 1260;
 }
 
 static addrxlat_verdict generate_addr4_siit(struct xlation *state,
 		struct in6_addr *addr6, __be32 *addr4, bool *was_6052)
 {
-	struct ipv6_prefix prefix;
 	struct in_addr tmp;
 	int error;
 
@@ -181,7 +182,7 @@ static addrxlat_verdict generate_addr4_siit(struct xlation *state,
 	if (error != -ESRCH)
 		return ADDRXLAT_DROP;
 
-	error = pool6_find(state->jool.pool6, addr6, &prefix);
+	error = rfc6052_6to4(state->jool.pool6, addr6, &tmp);
 	if (error == -ESRCH) {
 		log_debug("'%pI6c' lacks both pool6 prefix and EAM.", addr6);
 		return ADDRXLAT_TRY_SOMETHING_ELSE;
@@ -189,10 +190,6 @@ static addrxlat_verdict generate_addr4_siit(struct xlation *state,
 	if (error)
 		return ADDRXLAT_DROP;
 
-	error = addr_6to4(addr6, &prefix, &tmp);
-	if (error)
-		return ADDRXLAT_DROP;
-
 	if (blacklist_contains(state->jool.siit.blacklist, &tmp)) {
 		log_debug("The resulting address (%pI4) is blacklisted.", &tmp);
 		return ADDRXLAT_ACCEPT;
@@ -212,10 +209,24 @@ success:
 	return ADDRXLAT_CONTINUE;
 }
 
-static verdict translate_addrs64_siit(struct xlation *state)
+/**
+ * The packet cannot be translated because of its addresses; leave it to the
+ * kernel.
+ */
+static verdict untranslatable64(struct xlation *state)
+{
+	jstat_inc(state->jool.stats, JSTAT_UNTRANSLATABLE);
+	return VERDICT_ACCEPT;
+}
+
+/**
+ * Writes @state->in's translated addresses in @hdr4.
+ * (Which is usually @state->out's header, except in ttp64_inplace().)
+ */
+static verdict translate_addrs64_siit(struct xlation *state,
+		struct iphdr *hdr4)
 {
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(&state->in);
-	struct iphdr *hdr4 = pkt_ip4_hdr(&state->out);
 	bool src_was_6052, dst_was_6052;
 	enum eam_hairpinning_mode hairpin_mode;
 	addrxlat_verdict result;
@@ -227,10 +238,10 @@ static verdict translate_addrs64_siit(struct xlation *state)
 	case ADDRXLAT_CONTINUE:
 		break;
 	case ADDRXLAT_TRY_SOMETHING_ELSE:
-		return VERDICT_ACCEPT;
 	case ADDRXLAT_ACCEPT:
+		return untranslatable64(state);
 	case ADDRXLAT_DROP:
-		return (verdict)result;
+		return VERDICT_DROP;
 	}
 
 	/* Src address. */
@@ -243,10 +254,11 @@ static verdict translate_addrs64_siit(struct xlation *state)
 		if (pkt_is_icmp6_error(&state->in)
 				&& !rfc6791_find(state, &hdr4->saddr))
 			break; /* Ok, success. */
-		return VERDICT_ACCEPT;
+		return untranslatable64(state);
 	case ADDRXLAT_ACCEPT:
+		return untranslatable64(state);
 	case ADDRXLAT_DROP:
-		return (verdict)result;
+		return VERDICT_DROP;
 	}
 
 	/*
@@ -328,7 +340,7 @@ verdict ttp64_ipv4(struct xlation *state)
 		hdr4->saddr = out->tuple.src.addr4.l3.s_addr;
 		hdr4->daddr = out->tuple.dst.addr4.l3.s_addr;
 	} else {
-		result = translate_addrs64_siit(state);
+		result = translate_addrs64_siit(state, hdr4);
 		if (result != VERDICT_CONTINUE)
 			return result;
 	}
@@ -342,6 +354,7 @@ verdict ttp64_ipv4(struct xlation *state)
 		if (hdr6->hop_limit <= 1) {
 			icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
 			inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
 			return VERDICT_DROP;
 		}
 		hdr4->ttl = hdr6->hop_limit - 1;
@@ -603,6 +616,7 @@ static int compute_icmp4_csum(struct packet *out)
 			skb_transport_offset(out->skb),
 			pkt_datagram_len(out), 0));
 	out->skb->ip_summed = CHECKSUM_NONE;
+	ttpcomm_count_full_csum();
 
 	return 0;
 }
@@ -621,6 +635,7 @@ static verdict validate_icmp6_csum(struct packet *in)
 	csum = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, len, NEXTHDR_ICMP,
 			skb_checksum(in->skb, skb_transport_offset(in->skb),
 					len, 0));
+	ttpcomm_count_full_csum();
 	if (csum != 0) {
 		log_debug("Checksum doesn't match.");
 		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
@@ -648,8 +663,10 @@ static verdict post_icmp4error(struct xlation *state)
 	log_debug("Translating the inner packet (6->4)...");
 
 	result = validate_icmp6_csum(&state->in);
-	if (result != VERDICT_CONTINUE)
+	if (result != VERDICT_CONTINUE) {
+		jstat_inc(state->jool.stats, JSTAT_ICMP_CSUM);
 		return result;
+	}
 
 	result = ttpcomm_translate_inner_packet(state);
 	if (result != VERDICT_CONTINUE)
@@ -696,6 +713,7 @@ verdict ttp64_icmp(struct xlation *state)
 		error = icmp6_to_icmp4_dest_unreach(icmpv6_hdr, icmpv4_hdr);
 		if (error) {
 			inc_stats(&state->in, IPSTATS_MIB_INHDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 			return VERDICT_DROP;
 		}
 		return post_icmp4error(state);
@@ -725,6 +743,7 @@ verdict ttp64_icmp(struct xlation *state)
 		error = icmp6_to_icmp4_param_prob(icmpv6_hdr, icmpv4_hdr);
 		if (error) {
 			inc_stats(&state->in, IPSTATS_MIB_INHDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 			return VERDICT_DROP;
 		}
 		return post_icmp4error(state);
@@ -737,6 +756,7 @@ verdict ttp64_icmp(struct xlation *state)
 		 */
 		log_debug("ICMPv6 messages type %u lack an ICMPv4 counterpart.",
 				icmpv6_hdr->icmp6_type);
+		jstat_inc(state->jool.stats, JSTAT_UNKNOWN_ICMP);
 		return VERDICT_DROP;
 	}
 
@@ -814,7 +834,7 @@ verdict ttp64_tcp(struct xlation *state)
 		tcp_out->check = update_csum_6to4(tcp_in->check,
 				pkt_ip6_hdr(in), &tcp_copy, sizeof(tcp_copy),
 				pkt_ip4_hdr(out), tcp_out, sizeof(*tcp_out));
-		out->skb->ip_summed = CHECKSUM_NONE;
+		ttpcomm_keep_complete(in, out);
 	} else {
 		tcp_out->check = update_csum_6to4_partial(tcp_in->check,
 				pkt_ip6_hdr(in), pkt_ip4_hdr(out));
@@ -851,7 +871,7 @@ verdict ttp64_udp(struct xlation *state)
 				pkt_ip4_hdr(out), udp_out, sizeof(*udp_out));
 		if (udp_out->check == 0)
 			udp_out->check = CSUM_MANGLED_0;
-		out->skb->ip_summed = CHECKSUM_NONE;
+		ttpcomm_keep_complete(in, out);
 	} else {
 		udp_out->check = update_csum_6to4_partial(udp_in->check,
 				pkt_ip6_hdr(in), pkt_ip4_hdr(out));
@@ -861,3 +881,116 @@ verdict ttp64_udp(struct xlation *state)
 	/* Payload */
 	return copy_payload(state) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
+
+/**
+ * Translates @state->in the way ttp64_create_skb(), ttp64_ipv4() and
+ * ttp64_tcp() or ttp64_udp() would, except the result stays in the same skb.
+ * Only meant for the packets ttpcomm_inplace_possible() approves.
+ *
+ * The new headers are built on the stack, since computing them needs the old
+ * ones. The skb is not touched until nothing else can fail.
+ */
+verdict ttp64_inplace(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
+	struct ipv6hdr *hdr6 = pkt_ip6_hdr(in);
+	struct iphdr hdr4;
+	union inplace_l4hdr l4_in;
+	union inplace_l4hdr l4_out;
+	unsigned int tot_len;
+	verdict result;
+
+	/* Layer 3 (ttp64_ipv4(), minus what the packet cannot contain) */
+	tot_len = sizeof(hdr4) + pkt_l3payload_len(in);
+
+	hdr4.version = 4;
+	hdr4.ihl = 5;
+	hdr4.tos = ttp64_xlat_tos(&state->jool.global->cfg, hdr6);
+	hdr4.tot_len = cpu_to_be16(tot_len);
+	hdr4.id = generate_ipv4_id(NULL);
+	/* Same as generate_df_flag(); GSO segments are smaller than tot_len. */
+	hdr4.frag_off = build_ipv4_frag_off_field(sizeof(hdr4) + pkt_seglen(in)
+			- pkt_l3hdr_len(in) > 1260, 0, 0);
+	hdr4.protocol = hdr6->nexthdr;
+
+	if (xlat_is_nat64()) {
+		hdr4.saddr = out->tuple.src.addr4.l3.s_addr;
+		hdr4.daddr = out->tuple.dst.addr4.l3.s_addr;
+	} else {
+		result = translate_addrs64_siit(state, &hdr4);
+		if (result != VERDICT_CONTINUE)
+			return result;
+	}
+
+	if (hdr6->hop_limit <= 1) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
+		return VERDICT_DROP;
+	}
+	hdr4.ttl = hdr6->hop_limit - 1;
+
+	hdr4.check = 0;
+	hdr4.check = ip_fast_csum(&hdr4, hdr4.ihl);
+
+	/* Layer 4 (ttp64_tcp() and ttp64_udp()) */
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		memcpy(&l4_in.tcp, pkt_tcp_hdr(in), sizeof(l4_in.tcp));
+		l4_out.tcp = l4_in.tcp;
+		if (xlat_is_nat64()) {
+			l4_out.tcp.source = cpu_to_be16(out->tuple.src.addr4.l4);
+			l4_out.tcp.dest = cpu_to_be16(out->tuple.dst.addr4.l4);
+		}
+
+		if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+			l4_in.tcp.check = 0;
+			l4_out.tcp.check = 0;
+			l4_out.tcp.check = update_csum_6to4(
+					pkt_tcp_hdr(in)->check,
+					hdr6, &l4_in.tcp, sizeof(l4_in.tcp),
+					&hdr4, &l4_out.tcp, sizeof(l4_out.tcp));
+		} else {
+			l4_out.tcp.check = update_csum_6to4_partial(
+					l4_in.tcp.check, hdr6, &hdr4);
+		}
+		break;
+
+	case L4PROTO_UDP:
+		memcpy(&l4_in.udp, pkt_udp_hdr(in), sizeof(l4_in.udp));
+		l4_out.udp = l4_in.udp;
+		if (xlat_is_nat64()) {
+			l4_out.udp.source = cpu_to_be16(out->tuple.src.addr4.l4);
+			l4_out.udp.dest = cpu_to_be16(out->tuple.dst.addr4.l4);
+		}
+
+		if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+			l4_in.udp.check = 0;
+			l4_out.udp.check = 0;
+			l4_out.udp.check = update_csum_6to4(
+					pkt_udp_hdr(in)->check,
+					hdr6, &l4_in.udp, sizeof(l4_in.udp),
+					&hdr4, &l4_out.udp, sizeof(l4_out.udp));
+			if (l4_out.udp.check == 0)
+				l4_out.udp.check = CSUM_MANGLED_0;
+		} else {
+			l4_out.udp.check = update_csum_6to4_partial(
+					l4_in.udp.check, hdr6, &hdr4);
+		}
+		break;
+
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		WARN(true, "Unexpected layer 4 protocol: %u",
+				pkt_l4_proto(in));
+		return VERDICT_DROP;
+	}
+
+	/* Point of no return */
+	if (ttpcomm_inplace_commit(state, L3PROTO_IPV4, &hdr4, sizeof(hdr4),
+			&l4_out))
+		return VERDICT_DROP;
+
+	return VERDICT_CONTINUE;
+}
@@ -1,6 +1,8 @@
 #include "nat64/mod/common/rfc6145/common.h"
+#include <linux/version.h>
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/ipv6_hdr_iterator.h"
+#include "nat64/mod/common/linux_version.h"
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/rfc6145/4to6.h"
@@ -8,6 +10,18 @@
 #include "nat64/mod/stateless/blacklist4.h"
 #include <linux/icmp.h>
 
+/**
+ * Per-CPU, so the packet path can count without synchronizing.
+ * (See struct csum_stats_usr.)
+ */
+struct csum_counters {
+	u64 partial;
+	u64 complete;
+	u64 full;
+};
+
+static DEFINE_PER_CPU(struct csum_counters, csum_counters);
+
 struct backup_skb {
 	unsigned int pulled;
 	struct {
@@ -30,11 +44,13 @@ static struct translation_steps steps[][L4_PROTO_COUNT] = {
 			.skb_create_fn = ttp64_create_skb,
 			.l3_hdr_fn = ttp64_ipv4,
 			.l3_payload_fn = ttp64_tcp,
+			.inplace_fn = ttp64_inplace,
 		},
 		{
 			.skb_create_fn = ttp64_create_skb,
 			.l3_hdr_fn = ttp64_ipv4,
 			.l3_payload_fn = ttp64_udp,
+			.inplace_fn = ttp64_inplace,
 		},
 		{
 			.skb_create_fn = ttp64_create_skb,
@@ -52,11 +68,13 @@ static struct translation_steps steps[][L4_PROTO_COUNT] = {
 			.skb_create_fn = ttp46_create_skb,
 			.l3_hdr_fn = ttp46_ipv6,
 			.l3_payload_fn = ttp46_tcp,
+			.inplace_fn = ttp46_inplace,
 		},
 		{
 			.skb_create_fn = ttp46_create_skb,
 			.l3_hdr_fn = ttp46_ipv6,
 			.l3_payload_fn = ttp46_udp,
+			.inplace_fn = ttp46_inplace,
 		},
 		{
 			.skb_create_fn = ttp46_create_skb,
@@ -258,6 +276,12 @@ verdict ttpcomm_translate_inner_packet(struct xlation *state)
 
 struct translation_steps *ttpcomm_get_steps(struct packet *in)
 {
+	/*
+	 * Subsequent fragments have no layer 4 header to translate; their
+	 * payload is opaque.
+	 */
+	if (!pkt_is_first_frag(in))
+		return &steps[pkt_l3_proto(in)][L4PROTO_OTHER];
 	return &steps[pkt_l3_proto(in)][pkt_l4_proto(in)];
 }
 
@@ -291,6 +315,148 @@ void partialize_skb(struct sk_buff *out_skb, unsigned int csum_offset)
 	out_skb->ip_summed = CHECKSUM_PARTIAL;
 	out_skb->csum_start = skb_transport_header(out_skb) - out_skb->head;
 	out_skb->csum_offset = csum_offset;
+	this_cpu_inc(csum_counters.partial);
+}
+
+/**
+ * ttpcomm_keep_complete - If @in's skb arrived with a CHECKSUM_COMPLETE sum,
+ * gives @out's skb the sum the NIC would have computed had it received @out
+ * instead. Otherwise marks @out's checksum as CHECKSUM_NONE.
+ *
+ * NICs ignore CHECKSUM_COMPLETE on the way out, but the sum spares the kernel
+ * from walking the packet if @out ends up being delivered locally.
+ *
+ * Assumes both skbs start at their network headers, and that everything past
+ * their layer 4 headers is the same. Because header lengths are always even,
+ * only the headers need to be taken out and put back in.
+ */
+void ttpcomm_keep_complete(struct packet *in, struct packet *out)
+{
+	struct sk_buff *in_skb = in->skb;
+	struct sk_buff *out_skb = out->skb;
+	__wsum csum;
+
+	/* Inner packets share the outer packet's skb, and therefore its sum. */
+	if (in_skb->ip_summed != CHECKSUM_COMPLETE || pkt_is_inner(in)
+			|| skb_shinfo(in_skb)->frag_list) {
+		out_skb->ip_summed = CHECKSUM_NONE;
+		return;
+	}
+
+	csum = csum_sub(in_skb->csum, csum_partial(in_skb->data,
+			skb_transport_offset(in_skb) + pkt_l4hdr_len(in), 0));
+	out_skb->csum = csum_add(csum, csum_partial(out_skb->data,
+			skb_transport_offset(out_skb) + pkt_l4hdr_len(out), 0));
+	out_skb->ip_summed = CHECKSUM_COMPLETE;
+	this_cpu_inc(csum_counters.complete);
+}
+
+/**
+ * Records that a checksum had to be computed (or validated) from scratch,
+ * payload included.
+ */
+void ttpcomm_count_full_csum(void)
+{
+	this_cpu_inc(csum_counters.full);
+}
+
+/**
+ * ttpcomm_csum_stats - Adds up the checksum counters of every CPU.
+ *
+ * The result is not atomic; other CPUs are not stopped while we read.
+ */
+void ttpcomm_csum_stats(struct csum_stats_usr *result)
+{
+	struct csum_counters *cpu;
+	int c;
+
+	memset(result, 0, sizeof(*result));
+	for_each_possible_cpu(c) {
+		cpu = &per_cpu(csum_counters, c);
+		result->partial += cpu->partial;
+		result->complete += cpu->complete;
+		result->full += cpu->full;
+	}
+}
+
+/**
+ * ttpcomm_xlat_gso_type - Returns the GSO type @in should have once translated
+ * into a @l3_proto packet.
+ *
+ * Returns zero if @in is not GSO, or if it is but Jool doesn't know how to keep
+ * it that way. (Such packets are translated as ordinary, oversized packets.)
+ */
+unsigned int ttpcomm_xlat_gso_type(struct packet *in, l3_protocol l3_proto)
+{
+	struct sk_buff *skb = in->skb;
+	unsigned int type = skb_shinfo(skb)->gso_type;
+	unsigned int tcp_types = SKB_GSO_TCPV4 | SKB_GSO_TCPV6;
+	unsigned int known_types;
+
+	if (!skb_is_gso(skb) || pkt_is_inner(in))
+		return 0;
+	/*
+	 * The segmentation code expects the checksum to only cover the
+	 * pseudoheader.
+	 */
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return 0;
+
+#if LINUX_VERSION_AT_LEAST(4, 6, 0, 9999, 0)
+	/* IPv6 doesn't have IDs, and new IPv4 ones are random. */
+	tcp_types |= SKB_GSO_TCP_FIXEDID;
+#endif
+	known_types = tcp_types | SKB_GSO_TCP_ECN | SKB_GSO_DODGY;
+#if LINUX_VERSION_AT_LEAST(4, 18, 0, 8, 0)
+	known_types |= SKB_GSO_UDP_L4;
+#endif
+	if (type & ~known_types)
+		return 0; /* Tunnels, UFO, etc. */
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		if (!(type & tcp_types))
+			return 0;
+		type &= ~tcp_types;
+		return type | ((l3_proto == L3PROTO_IPV4)
+				? SKB_GSO_TCPV4
+				: SKB_GSO_TCPV6);
+	case L4PROTO_UDP:
+		/* SKB_GSO_UDP_L4 is used by both IPv4 and IPv6. */
+		if (tcp_types & type)
+			return 0;
+		if (pkt_udp_hdr(in)->check == 0)
+			return 0;
+		return type;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * ttpcomm_copy_gso - If @in is a GSO packet, makes @out (its translated
+ * version) the same kind of GSO packet.
+ *
+ * This way, the kernel (or better yet, the NIC) segments the packet after
+ * translation, and Jool only has to translate the aggregate once.
+ */
+void ttpcomm_copy_gso(struct packet *in, struct sk_buff *out,
+		l3_protocol l3_proto)
+{
+	struct skb_shared_info *in_shinfo = skb_shinfo(in->skb);
+	struct skb_shared_info *out_shinfo = skb_shinfo(out);
+	unsigned int type;
+
+	type = ttpcomm_xlat_gso_type(in, l3_proto);
+	if (!type)
+		return;
+
+	out_shinfo->gso_size = in_shinfo->gso_size;
+	out_shinfo->gso_type = type;
+	out_shinfo->gso_segs = in_shinfo->gso_segs;
 }
 
 bool must_not_translate(struct in_addr *addr, struct net *ns)
@@ -298,3 +464,219 @@ bool must_not_translate(struct in_addr *addr, struct net *ns)
 	return addr4_is_scope_subnet(addr->s_addr)
 			|| interface_contains(ns, addr);
 }
+
+static unsigned int inplace_l4hdr_len(struct packet *pkt)
+{
+	return (pkt_l4_proto(pkt) == L4PROTO_TCP)
+			? sizeof(struct tcphdr)
+			: sizeof(struct udphdr);
+}
+
+static unsigned int inplace_csum_offset(struct packet *pkt)
+{
+	return (pkt_l4_proto(pkt) == L4PROTO_TCP)
+			? offsetof(struct tcphdr, check)
+			: offsetof(struct udphdr, check);
+}
+
+static int l2_len(struct sk_buff *skb)
+{
+	if (!skb_mac_header_was_set(skb))
+		return 0;
+	return skb_network_header(skb) - skb_mac_header(skb);
+}
+
+/**
+ * Returns true if @state->in can be translated by rewriting its headers
+ * (instead of copying it into a new skb).
+ *
+ * This is the boring case: an unfragmented TCP or UDP packet with no options
+ * or extension headers, whose skb nobody else is looking at. Everything else
+ * still takes the copy path, where the special cases live.
+ */
+bool ttpcomm_inplace_possible(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	int l2;
+
+	if (!state->jool.global->cfg.xlat_in_place)
+		return false;
+
+	/* Hairpins are translated from Jool's own copy. Let them copy again. */
+	if (pkt_is_inner(in) || pkt_original_pkt(in) != in)
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		break;
+	case L4PROTO_UDP:
+		/* Zero checksums might need to be computed from scratch. */
+		if (pkt_udp_hdr(in)->check == 0)
+			return false;
+		break;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		return false;
+	}
+
+	switch (pkt_l3_proto(in)) {
+	case L3PROTO_IPV6:
+		/* This also rules out fragment headers. */
+		if (pkt_l3hdr_len(in) != sizeof(struct ipv6hdr))
+			return false;
+		/* Aggregated packets can be as big as IPv6 allows. */
+		if (sizeof(struct iphdr) + pkt_l3payload_len(in) > 0xFFFFu)
+			return false;
+		break;
+	case L3PROTO_IPV4:
+		if (pkt_l3hdr_len(in) != sizeof(struct iphdr))
+			return false;
+		if (will_need_frag_hdr(pkt_ip4_hdr(in)))
+			return false;
+		break;
+	}
+
+	if (skb_cloned(skb) || skb_shared(skb))
+		return false;
+	if (skb_shinfo(skb)->frag_list)
+		return false;
+	/* The translated packet has to remain a valid GSO packet. */
+	if (skb_is_gso(skb) && !ttpcomm_xlat_gso_type(in,
+			(pkt_l3_proto(in) == L3PROTO_IPV6)
+					? L3PROTO_IPV4
+					: L3PROTO_IPV6))
+		return false;
+	if (skb_network_offset(skb) != 0)
+		return false;
+
+	l2 = l2_len(skb);
+	return 0 <= l2 && l2 <= INPLACE_MAX_L2;
+}
+
+/**
+ * ttpcomm_inplace_commit - Replaces @state->in's layer 3 header with @l3_hdr,
+ * and its base layer 4 header with @l4_hdr. Then initializes @state->out as
+ * the result.
+ *
+ * The layer 4 header and payload do not move; the difference in layer 3 header
+ * length is pushed or pulled from the front of the packet.
+ *
+ * Whatever gets overridden is stored in @state->backup, in case the caller
+ * ends up needing the original packet back. (See ttpcomm_inplace_undo().)
+ *
+ * The checksum of @l4_hdr is expected to be updated already.
+ */
+int ttpcomm_inplace_commit(struct xlation *state, l3_protocol l3_proto,
+		void *l3_hdr, unsigned int l3_hdr_len, union inplace_l4hdr *l4_hdr)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
+	struct inplace_backup *backup = &state->backup;
+	struct sk_buff *skb = in->skb;
+	unsigned int old_l3_len = pkt_l3hdr_len(in);
+	unsigned int l4_len = inplace_l4hdr_len(in);
+	__wsum old_csum = 0;
+	bool is_hairpin;
+	int error;
+
+	if (l3_hdr_len > old_l3_len) {
+		error = skb_cow_head(skb, l3_hdr_len - old_l3_len);
+		if (error) {
+			inc_stats(in, IPSTATS_MIB_INDISCARDS);
+			jstat_inc(state->jool.stats, JSTAT_ENOMEM);
+			return error;
+		}
+	}
+
+	backup->l2_len = l2_len(skb);
+	backup->l3_len = old_l3_len;
+	backup->l4_len = pkt_l4hdr_len(in);
+	backup->len = backup->l2_len + old_l3_len + inplace_l4hdr_len(in);
+	memcpy(backup->hdrs, skb_network_header(skb) - backup->l2_len,
+			backup->len);
+	backup->protocol = skb->protocol;
+	backup->ip_summed = skb->ip_summed;
+	/* (This also covers csum_start and csum_offset; they're a union.) */
+	backup->csum = skb->csum;
+	backup->dev = skb->dev;
+	backup->gso_type = skb_shinfo(skb)->gso_type;
+	backup->active = true;
+
+	/* See ttpcomm_keep_complete(); the payload does not move here. */
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		old_csum = csum_partial(skb->data, old_l3_len + l4_len, 0);
+
+	if (l3_hdr_len > old_l3_len)
+		skb_push(skb, l3_hdr_len - old_l3_len);
+	else
+		skb_pull(skb, old_l3_len - l3_hdr_len);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, l3_hdr_len);
+
+	memcpy(skb_network_header(skb), l3_hdr, l3_hdr_len);
+	memcpy(skb_transport_header(skb), l4_hdr, l4_len);
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		partialize_skb(skb, inplace_csum_offset(in));
+	} else if (skb->ip_summed == CHECKSUM_COMPLETE) {
+		skb->csum = csum_add(csum_sub(skb->csum, old_csum),
+				csum_partial(skb->data, l3_hdr_len + l4_len, 0));
+		this_cpu_inc(csum_counters.complete);
+	} else {
+		skb->ip_summed = CHECKSUM_NONE;
+	}
+	skb->protocol = htons((l3_proto == L3PROTO_IPV4) ? ETH_P_IP : ETH_P_IPV6);
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type = ttpcomm_xlat_gso_type(in, l3_proto);
+	/* It was routed as the original packet, if at all. */
+	skb_dst_drop(skb);
+
+	/* The address translation code might have already set this. */
+	is_hairpin = out->is_hairpin;
+	pkt_fill(out, skb, l3_proto, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + backup->l4_len,
+			pkt_original_pkt(in));
+	out->is_hairpin = is_hairpin;
+
+	return 0;
+}
+
+/**
+ * ttpcomm_inplace_undo - Reverts ttpcomm_inplace_commit(), so @state->in.skb
+ * becomes the original packet again.
+ *
+ * @state->out becomes garbage. Does nothing if the packet is not currently
+ * translated in place.
+ */
+void ttpcomm_inplace_undo(struct xlation *state)
+{
+	struct inplace_backup *backup = &state->backup;
+	struct sk_buff *skb = state->in.skb;
+	unsigned int l3_len;
+
+	if (!backup->active)
+		return;
+
+	l3_len = skb_transport_offset(skb);
+	if (backup->l3_len > l3_len)
+		skb_push(skb, backup->l3_len - l3_len);
+	else
+		skb_pull(skb, l3_len - backup->l3_len);
+	skb_reset_network_header(skb);
+	skb_set_mac_header(skb, -(int)backup->l2_len);
+	skb_set_transport_header(skb, backup->l3_len);
+
+	memcpy(skb_mac_header(skb), backup->hdrs, backup->len);
+	skb->protocol = backup->protocol;
+	skb->ip_summed = backup->ip_summed;
+	skb->csum = backup->csum;
+	skb->dev = backup->dev;
+	skb_shinfo(skb)->gso_type = backup->gso_type;
+	skb_dst_drop(skb);
+
+	/* skb_cow_head() might have moved the payload. */
+	state->in.payload = skb_transport_header(skb) + backup->l4_len;
+	backup->active = false;
+}
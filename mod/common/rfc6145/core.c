@@ -8,6 +8,9 @@ static verdict translate_first(struct xlation *state)
 	struct translation_steps *steps = ttpcomm_get_steps(&state->in);
 	verdict result;
 
+	if (steps->inplace_fn && ttpcomm_inplace_possible(state))
+		return steps->inplace_fn(state);
+
 	result = steps->skb_create_fn(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
@@ -25,48 +28,42 @@ revert:
 	return result;
 }
 
+/**
+ * Translates @in, which is one of the fragments that trail @state->in.
+ *
+ * Fragment list members only contain payload (the kernel writes their headers
+ * when it refragments the packet later), and the payload is the same on both
+ * sides of the translator. So instead of copying it, @out shares it with @in.
+ */
 static verdict translate_subsequent(struct xlation *state, struct sk_buff *in,
 		struct sk_buff **out)
 {
 	struct sk_buff *result;
-	unsigned int hdrs_len = 0;
 	__u16 proto = 0;
-	int error;
 
 	switch (pkt_l3_proto(&state->in)) {
 	case L3PROTO_IPV6: /* out is IPv4. */
-		hdrs_len = sizeof(struct iphdr);
 		proto = ETH_P_IP;
 		break;
 	case L3PROTO_IPV4: /* out is IPv6. */
-		hdrs_len = sizeof(struct ipv6hdr) + sizeof(struct frag_hdr);
 		proto = ETH_P_IPV6;
 		break;
 	}
 
-	result = alloc_skb(LL_MAX_HEADER + hdrs_len + in->len, GFP_ATOMIC);
+	result = skb_clone(in, GFP_ATOMIC);
 	if (!result) {
 		inc_stats(&state->in, IPSTATS_MIB_INDISCARDS);
+		jstat_inc(state->jool.stats, JSTAT_ENOMEM);
 		return VERDICT_DROP;
 	}
 
-	skb_reserve(result, LL_MAX_HEADER + hdrs_len);
-	skb_put(result, in->len);
-	result->mark = in->mark;
 	result->protocol = htons(proto);
-
-	error = skb_copy_bits(in, 0, result->data, in->len);
-	if (error) {
-		kfree_skb(result);
-		log_debug("The payload copy threw errcode %d.", error);
-		return VERDICT_DROP;
-	}
+	skb_dst_drop(result);
 
 	*out = result;
 	return VERDICT_CONTINUE;
 }
 
-
 verdict translating_the_packet(struct xlation *state)
 {
 	struct sk_buff *skb_in;
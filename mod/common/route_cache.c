@@ -0,0 +1,371 @@
+#include "nat64/mod/common/route_cache.h"
+
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/version.h>
+#include <net/dst.h>
+#include <net/ip6_fib.h>
+#include "nat64/mod/common/linux_version.h"
+#include "nat64/mod/common/route.h"
+#include "nat64/mod/common/tags.h"
+#include "nat64/mod/common/wkmalloc.h"
+#include "nat64/mod/common/xlator.h"
+
+/** Number of entries in each CPU's cache. Must be a power of two. */
+#define RTCACHE_SLOTS 256
+
+/**
+ * The fields of the outgoing packet the cache tells routes apart by.
+ *
+ * These are exactly the fields route4() and route6() hand to the FIB, so
+ * anything the FIB can select a route by (policy rules, ECMP hashing) is also
+ * part of the key, and the cache never changes a routing decision.
+ *
+ * route4() only feeds the destination, mark, TOS and protocol, so IPv4 keys
+ * leave the rest zeroized and only use the first word of @daddr. route6() also
+ * feeds the source, the flow label and the ports, which means IPv6 keys are
+ * per-flow. (The cache only helps IPv6 when a flow's packets keep landing on
+ * the same CPU, which RSS/RPS normally ensure.)
+ */
+struct rtcache_key {
+	struct in6_addr saddr;
+	struct in6_addr daddr;
+	__be32 flowlabel;
+	__u32 mark;
+	/* Ports, or ICMP type and code. */
+	__be16 sport;
+	__be16 dport;
+	__u8 tos;
+	__u8 proto;
+	__u8 l3_proto;
+	__u8 slop;
+};
+
+/*
+ * There is no FIB notifier; staleness is left to dst_check(). IPv4 routes are
+ * invalidated by the namespace's route generation ID, which the kernel bumps
+ * on every FIB and policy rule change. IPv6 routes are validated against the
+ * serial number of their FIB node (@cookie), which changes whenever the node's
+ * routes do. Device events, which can leave dsts pointing to dead devices,
+ * are handled by rtcache_netdev_event().
+ */
+struct rtcache_slot {
+	struct rtcache_key key;
+	/** NULL if the slot is empty. Otherwise, we hold a reference to it. */
+	struct dst_entry *dst;
+	/** Argument for dst_check(). Only IPv6 uses it. */
+	u32 cookie;
+};
+
+struct rtcache_cpu {
+	/*
+	 * The owner CPU is the only one that uses the slots while translating,
+	 * so this lock is never contended by the packet path. It's here for
+	 * the benefit of rtcache_flush(), which can run from any CPU.
+	 */
+	spinlock_t lock;
+	struct rtcache_slot slots[RTCACHE_SLOTS];
+
+	u64 hits;
+	u64 misses;
+	u64 stale;
+};
+
+struct route_cache {
+	struct rtcache_cpu __percpu *cpus;
+	struct kref refcount;
+};
+
+static int init_key4(struct rtcache_key *key, struct packet *pkt)
+{
+	struct iphdr *hdr = pkt_ip4_hdr(pkt);
+
+	key->daddr.s6_addr32[0] = hdr->daddr;
+	key->tos = hdr->tos;
+	key->proto = hdr->protocol;
+	return 0;
+}
+
+static int init_key6(struct rtcache_key *key, struct packet *pkt)
+{
+	struct ipv6hdr *hdr = pkt_ip6_hdr(pkt);
+	struct tcphdr *tcp;
+	struct udphdr *udp;
+	struct icmp6hdr *icmp;
+
+	key->saddr = hdr->saddr;
+	key->daddr = hdr->daddr;
+	key->flowlabel = get_flow_label(hdr);
+	key->tos = get_traffic_class(hdr);
+
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+		tcp = pkt_tcp_hdr(pkt);
+		key->proto = NEXTHDR_TCP;
+		key->sport = tcp->source;
+		key->dport = tcp->dest;
+		return 0;
+	case L4PROTO_UDP:
+		udp = pkt_udp_hdr(pkt);
+		key->proto = NEXTHDR_UDP;
+		key->sport = udp->source;
+		key->dport = udp->dest;
+		return 0;
+	case L4PROTO_ICMP:
+		icmp = pkt_icmp6_hdr(pkt);
+		key->proto = NEXTHDR_ICMP;
+		key->sport = cpu_to_be16(icmp->icmp6_type);
+		key->dport = cpu_to_be16(icmp->icmp6_code);
+		return 0;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * Returns nonzero if @pkt should not be cached. (Its route might depend on
+ * something the key doesn't include.)
+ */
+static int init_key(struct rtcache_key *key, struct packet *pkt)
+{
+	memset(key, 0, sizeof(*key));
+	key->mark = pkt->skb->mark;
+	key->l3_proto = pkt_l3_proto(pkt);
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		return init_key6(key, pkt);
+	case L3PROTO_IPV4:
+		return init_key4(key, pkt);
+	}
+
+	return -EINVAL;
+}
+
+static unsigned int hash_key(struct rtcache_key *key)
+{
+	return jhash2((u32 *)key, sizeof(*key) / sizeof(u32), 0)
+			& (RTCACHE_SLOTS - 1);
+}
+
+static u32 get_cookie(struct dst_entry *dst, l3_protocol l3_proto)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0)
+	struct rt6_info *rt;
+#endif
+
+	if (l3_proto != L3PROTO_IPV6)
+		return 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+	return rt6_get_cookie((struct rt6_info *)dst);
+#else
+	rt = (struct rt6_info *)dst;
+	return rt->rt6i_node ? rt->rt6i_node->fn_sernum : 0;
+#endif
+}
+
+static void clear_slot(struct rtcache_slot *slot)
+{
+	if (slot->dst) {
+		dst_release(slot->dst);
+		slot->dst = NULL;
+	}
+}
+
+struct route_cache *rtcache_create(void)
+{
+	struct route_cache *result;
+	struct rtcache_cpu *cpu;
+	int c;
+
+	result = wkmalloc(struct route_cache, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	result->cpus = alloc_percpu(struct rtcache_cpu);
+	if (!result->cpus) {
+		wkfree(struct route_cache, result);
+		return NULL;
+	}
+
+	for_each_possible_cpu(c) {
+		cpu = per_cpu_ptr(result->cpus, c);
+		memset(cpu, 0, sizeof(*cpu));
+		spin_lock_init(&cpu->lock);
+	}
+
+	kref_init(&result->refcount);
+	return result;
+}
+
+void rtcache_get(struct route_cache *cache)
+{
+	kref_get(&cache->refcount);
+}
+
+static void release_cache(struct kref *refcount)
+{
+	struct route_cache *cache;
+	cache = container_of(refcount, struct route_cache, refcount);
+
+	rtcache_flush(cache);
+	free_percpu(cache->cpus);
+	wkfree(struct route_cache, cache);
+}
+
+void rtcache_put(struct route_cache *cache)
+{
+	kref_put(&cache->refcount, release_cache);
+}
+
+/**
+ * rtcache_route - Same as route(), except it remembers the result and reuses
+ * it for later packets that would be routed the same way.
+ *
+ * Has to be called with bottom halves disabled (which the packet path already
+ * is).
+ */
+RCUTAG_PKT
+struct dst_entry *rtcache_route(struct route_cache *cache, struct net *ns,
+		struct packet *pkt)
+{
+	struct rtcache_key key;
+	struct rtcache_cpu *cpu;
+	struct rtcache_slot *slot;
+	struct dst_entry *dst;
+	struct dst_entry *old;
+
+	/* Sometimes the packet was already routed. */
+	dst = skb_dst(pkt->skb);
+	if (dst)
+		return dst;
+
+	if (init_key(&key, pkt))
+		return route(ns, pkt);
+
+	cpu = this_cpu_ptr(cache->cpus);
+	slot = &cpu->slots[hash_key(&key)];
+
+	spin_lock(&cpu->lock);
+
+	dst = slot->dst;
+	if (dst && memcmp(&slot->key, &key, sizeof(key)) == 0) {
+		if (dst_check(dst, slot->cookie) == dst) {
+			dst_hold(dst);
+			cpu->hits++;
+			spin_unlock(&cpu->lock);
+
+			skb_dst_set(pkt->skb, dst);
+			return dst;
+		}
+
+		/* The FIB changed since we cached it. */
+		clear_slot(slot);
+		cpu->stale++;
+	}
+	cpu->misses++;
+
+	spin_unlock(&cpu->lock);
+
+	dst = route(ns, pkt);
+	if (!dst)
+		return NULL;
+
+	spin_lock(&cpu->lock);
+	old = slot->dst;
+	slot->key = key;
+	slot->dst = dst;
+	slot->cookie = get_cookie(dst, key.l3_proto);
+	dst_hold(dst);
+	spin_unlock(&cpu->lock);
+
+	if (old)
+		dst_release(old);
+	return dst;
+}
+
+/**
+ * rtcache_flush - Forgets every route @cache knows, and releases them.
+ */
+void rtcache_flush(struct route_cache *cache)
+{
+	struct rtcache_cpu *cpu;
+	unsigned int i;
+	int c;
+
+	for_each_possible_cpu(c) {
+		cpu = per_cpu_ptr(cache->cpus, c);
+		spin_lock_bh(&cpu->lock);
+		for (i = 0; i < RTCACHE_SLOTS; i++)
+			clear_slot(&cpu->slots[i]);
+		spin_unlock_bh(&cpu->lock);
+	}
+}
+
+/**
+ * rtcache_stats - Adds up the counters of every CPU.
+ *
+ * The result is not atomic; other CPUs are not stopped while we read.
+ */
+void rtcache_stats(struct route_cache *cache, struct rtcache_stats_usr *result)
+{
+	struct rtcache_cpu *cpu;
+	int c;
+
+	memset(result, 0, sizeof(*result));
+	for_each_possible_cpu(c) {
+		cpu = per_cpu_ptr(cache->cpus, c);
+		result->hits += cpu->hits;
+		result->misses += cpu->misses;
+		result->stale += cpu->stale;
+	}
+}
+
+static int flush_ns(struct xlator *jool, void *ns)
+{
+	if (jool->ns == ns)
+		rtcache_flush(jool->rtcache);
+	return 0;
+}
+
+/**
+ * The cached dsts hold references to their devices (at least on older
+ * kernels), so let go of them before the device is expected to go away.
+ */
+static int rtcache_netdev_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+#if LINUX_VERSION_AT_LEAST(3, 11, 0, 7, 0)
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+#else
+	struct net_device *dev = ptr;
+#endif
+
+	switch (event) {
+	case NETDEV_DOWN:
+	case NETDEV_UNREGISTER:
+	case NETDEV_CHANGEADDR:
+		xlator_foreach(flush_ns, dev_net(dev));
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block rtcache_notifier = {
+	.notifier_call = rtcache_netdev_event,
+};
+
+int rtcache_init(void)
+{
+	return register_netdevice_notifier(&rtcache_notifier);
+}
+
+void rtcache_destroy(void)
+{
+	unregister_netdevice_notifier(&rtcache_notifier);
+}
@@ -1,5 +1,7 @@
 #include "nat64/mod/common/rtrie.h"
 
+#include <linux/bitops.h>
+#include <linux/rculist.h>
 #include <linux/rcupdate.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/wkmalloc.h"
@@ -16,438 +18,525 @@
 #define deref_both(trie, node) \
 	rcu_dereference_bh_check(node, lockdep_is_held(&trie->lock))
 
+#define CHUNK_MASK (RTRIE_FANOUT - 1)
+
 static __u8 bits_to_bytes(__u8 bits)
 {
 	return (bits != 0u) ? (((bits - 1u) >> 3) + 1u) : 0u;
 }
 
-static struct rtrie_node *create_inode(struct rtrie_key *key,
-		struct rtrie_node *left_child,
-		struct rtrie_node *right_child)
+/**
+ * Returns a mask whose first @bits bits are enabled. @bits has to be 1-64.
+ */
+static u64 high_mask(unsigned int bits)
 {
-	struct rtrie_node *inode;
-	__u8 key_len;
-
-	key_len = bits_to_bytes(key->len);
-	inode = __wkmalloc("Rtrie node", sizeof(*inode) + key_len, GFP_ATOMIC);
-	if (!inode)
-		return NULL;
-
-	RCU_INIT_POINTER(inode->left, left_child);
-	RCU_INIT_POINTER(inode->right, right_child);
-	inode->parent = NULL;
-	inode->color = COLOR_BLACK;
-	INIT_LIST_HEAD(&inode->list_hook);
-	inode->key.bytes = (__u8 *) (inode + 1);
-	inode->key.len = key->len;
-	memcpy(inode->key.bytes, key->bytes, key_len);
-
-	return inode;
+	return ~0ULL << (64u - bits);
 }
 
-static struct rtrie_node *create_leaf(void *content, size_t content_len,
-		size_t key_offset, __u8 key_len)
+/**
+ * Zeroes all the bits from @key that come after the first @len.
+ */
+static void key_trim(u64 *key, unsigned int len)
 {
-	struct rtrie_node *leaf;
-
-	leaf = __wkmalloc("Rtrie node", sizeof(*leaf) + content_len, GFP_ATOMIC);
-	if (!leaf)
-		return NULL;
+	if (len == 0) {
+		key[0] = 0;
+		key[1] = 0;
+	} else if (len <= 64) {
+		key[0] &= high_mask(len);
+		key[1] = 0;
+	} else {
+		key[1] &= high_mask(len - 64);
+	}
+}
 
-	RCU_INIT_POINTER(leaf->left, NULL);
-	RCU_INIT_POINTER(leaf->right, NULL);
-	leaf->parent = NULL;
-	leaf->color = COLOR_WHITE;
-	INIT_LIST_HEAD(&leaf->list_hook);
-	leaf->key.bytes = ((__u8 *) (leaf + 1)) + key_offset;
-	leaf->key.len = key_len;
-	memcpy(leaf + 1, content, content_len);
+/**
+ * Converts @key into the representation the trie works with: two host-order
+ * words, so comparisons don't have to crawl through the key bit by bit.
+ */
+static void key_load(struct rtrie_key *key, u64 *result)
+{
+	__be64 words[2] = { 0, 0 };
 
-	return leaf;
+	memcpy(words, key->bytes, bits_to_bytes(key->len));
+	result[0] = be64_to_cpu(words[0]);
+	result[1] = be64_to_cpu(words[1]);
+	key_trim(result, key->len);
 }
 
-static unsigned int get_bit(__u8 byte, unsigned int pos)
+/**
+ * Returns the RTRIE_STRIDE bits of @key that start at bit @pos.
+ */
+static unsigned int chunk(const u64 *key, unsigned int pos)
 {
-	return (byte >> (7u - pos)) & 1u;
+	return (key[pos >> 6] >> (64u - RTRIE_STRIDE - (pos & 63u)))
+			& CHUNK_MASK;
 }
 
-static unsigned int __key_match(struct rtrie_key *key1, struct rtrie_key *key2,
-		unsigned int bits)
+/**
+ * Returns true if the first @len bits of @key1 and @key2 are the same.
+ */
+static bool prefix_match(const u64 *key1, const u64 *key2, unsigned int len)
 {
-	unsigned int result = 0;
-	unsigned int y, i; /* b[y]te counter, b[i]t counter. */
-	unsigned int bytes;
-	unsigned int bit1, bit2;
-
-	bytes = bits >> 3; /* >> 3 = / 8*/
-	bits &= 7; /* & 7 = % 8 */
-
-	for (y = 0; y < bytes; y++) {
-		if (key1->bytes[y] != key2->bytes[y]) {
-			bits = 8;
-			break;
-		}
-		result += 8;
-	}
-
-	for (i = 0; i < bits; i++) {
-		bit1 = get_bit(key1->bytes[y], i);
-		bit2 = get_bit(key2->bytes[y], i);
+	if (len == 0)
+		return true;
+	if (len <= 64)
+		return !((key1[0] ^ key2[0]) & high_mask(len));
+	return (key1[0] == key2[0])
+			&& !((key1[1] ^ key2[1]) & high_mask(len - 64));
+}
 
-		if (bit1 != bit2)
-			break;
+/**
+ * Returns the number of leading bits @key1 and @key2 have in common, but no
+ * more than @limit.
+ */
+static unsigned int match_len(const u64 *key1, const u64 *key2,
+		unsigned int limit)
+{
+	unsigned int result;
+	u64 diff;
 
-		result++;
+	diff = key1[0] ^ key2[0];
+	if (diff) {
+		result = 64 - fls64(diff);
+	} else {
+		diff = key1[1] ^ key2[1];
+		result = diff ? (128 - fls64(diff)) : 128;
 	}
 
-	return result;
+	return min(result, limit);
 }
 
 /**
- * match - Returns the number of prefix bits @key1 and @key2 have in common.
+ * Returns the position of the node that should host prefixes of length @len.
+ * (@len has to be nonzero.)
  */
-static unsigned int key_match(struct rtrie_key *key1, struct rtrie_key *key2)
+static unsigned int host_pos(unsigned int len)
 {
-	return __key_match(key1, key2, min(key1->len, key2->len));
+	return (len - 1) & ~(RTRIE_STRIDE - 1);
 }
 
 /**
- * Returns true if @key1 is a prefix of @key2, false otherwise.
- *
- * The name can go both ways so it might be confusing. Think of it like this:
- * If @key1 is 2001:db8::/32 and @key2 is 2001:db8:1::/64, then @key1 contains
- * @key2.
+ * Returns true if @leaf (which is hosted by @node) covers @node's slot @slot.
  */
-static bool key_contains(struct rtrie_key *key1, struct rtrie_key *key2)
+static bool leaf_covers(struct rtrie_node *node, struct rtrie_leaf *leaf,
+		unsigned int slot)
 {
-	return (key2->len >= key1->len)
-			? (__key_match(key1, key2, key1->len) == key1->len)
-			: false;
+	unsigned int shift = node->pos + RTRIE_STRIDE - leaf->len;
+	return (slot >> shift) == (chunk(leaf->key, node->pos) >> shift);
 }
 
-static bool key_equals(struct rtrie_key *key1, struct rtrie_key *key2)
+static struct rtrie_leaf *create_leaf(struct rtrie *trie, void *value,
+		size_t key_offset, __u8 key_len)
 {
-	return (key1->len == key2->len)
-			? (__key_match(key1, key2, key1->len) == key1->len)
-			: false;
+	struct rtrie_leaf *leaf;
+	struct rtrie_key key;
+
+	leaf = __wkmalloc("Rtrie leaf", sizeof(*leaf) + trie->value_size,
+			GFP_ATOMIC);
+	if (!leaf)
+		return NULL;
+
+	key.bytes = ((__u8 *) value) + key_offset;
+	key.len = key_len;
+	key_load(&key, leaf->key);
+	leaf->len = key_len;
+	INIT_LIST_HEAD(&leaf->host_hook);
+	INIT_LIST_HEAD(&leaf->list_hook);
+	memcpy(leaf + 1, value, trie->value_size);
+
+	return leaf;
 }
 
-void rtrie_init(struct rtrie *trie, size_t size)
+static struct rtrie_node *create_node(const u64 *key, unsigned int pos)
 {
-	trie->root = NULL;
-	INIT_LIST_HEAD(&trie->list);
-	trie->value_size = size;
+	struct rtrie_node *node;
+
+	node = __wkmalloc("Rtrie node", sizeof(*node), GFP_ATOMIC);
+	if (!node)
+		return NULL;
+
+	memset(node, 0, sizeof(*node));
+	node->key[0] = key[0];
+	node->key[1] = key[1];
+	key_trim(node->key, pos);
+	node->pos = pos;
+	INIT_LIST_HEAD(&node->hosted);
+	INIT_LIST_HEAD(&node->list_hook);
+
+	return node;
 }
 
-void rtrie_destroy(struct rtrie *trie)
+static unsigned int free_all(struct list_head *leaves, struct list_head *nodes)
 {
+	struct rtrie_leaf *leaf;
+	struct rtrie_leaf *tmp_leaf;
 	struct rtrie_node *node;
 	struct rtrie_node *tmp_node;
 	unsigned int i = 0;
 
-	/* rtrie_print("Destroying trie", trie); */
-	list_for_each_entry_safe(node, tmp_node, &trie->list, list_hook) {
+	list_for_each_entry_safe(leaf, tmp_leaf, leaves, list_hook) {
+		list_del(&leaf->list_hook);
+		__wkfree("Rtrie leaf", leaf);
+		i++;
+	}
+
+	list_for_each_entry_safe(node, tmp_node, nodes, list_hook) {
 		list_del(&node->list_hook);
 		__wkfree("Rtrie node", node);
 		i++;
 	}
 
+	return i;
+}
+
+void rtrie_init(struct rtrie *trie, size_t size)
+{
+	RCU_INIT_POINTER(trie->root, NULL);
+	RCU_INIT_POINTER(trie->dflt, NULL);
+	INIT_LIST_HEAD(&trie->list);
+	INIT_LIST_HEAD(&trie->nodes);
+	trie->value_size = size;
+}
+
+void rtrie_destroy(struct rtrie *trie)
+{
+	unsigned int i;
+
+	/* rtrie_print("Destroying trie", trie); */
+	i = free_all(&trie->list, &trie->nodes);
 	log_debug("Deleted %u nodes.", i);
-	/* rtrie_print("Trie after", trie); */
 }
 
 /**
- * find_longest_common_prefix - Returns the node from @trie which best matches
- * @key.
+ * Returns the longest prefix hosted by @node that contains the first @len bits
+ * of @key, or @best if there is none.
  *
- * If you're a reader, you need to "lock" RCU reads before calling.
+ * This is the slow path, which only happens when the key ends in the middle
+ * of @node's chunk. (Full addresses always take the slot path.)
+ */
+static struct rtrie_leaf *find_hosted_lcp(struct rtrie_node *node,
+		const u64 *key, unsigned int len, struct rtrie_leaf *best)
+{
+	struct rtrie_leaf *leaf;
+	struct rtrie_leaf *result = best;
+
+	list_for_each_entry_rcu(leaf, &node->hosted, host_hook) {
+		if (leaf->len > len)
+			continue;
+		if (result != best && leaf->len <= result->len)
+			continue;
+		if (prefix_match(leaf->key, key, leaf->len))
+			result = leaf;
+	}
+
+	return result;
+}
+
+/**
+ * find_longest_common_prefix - Returns the leaf from @trie which best matches
+ * the first @len bits of @key.
  *
- * @force_white: if true, the resulting node will be the best white match.
- *	If false, the result will be the best match, regardless of color.
+ * If you're a reader, you need to "lock" RCU reads before calling.
  */
-static struct rtrie_node *find_longest_common_prefix(struct rtrie *trie,
-		struct rtrie_key *key, bool force_white)
+static struct rtrie_leaf *find_longest_common_prefix(struct rtrie *trie,
+		const u64 *key, unsigned int len)
 {
+	struct rtrie_leaf *best;
+	struct rtrie_leaf *leaf;
 	struct rtrie_node *node;
-	struct rtrie_node *child;
-	struct rtrie_node *last_white;
+	unsigned int slot;
 
+	best = deref_both(trie, trie->dflt);
 	node = deref_both(trie, trie->root);
-	if (!node || !key_contains(&node->key, key))
-		return NULL;
 
-	last_white = NULL;
-	do {
-		if (node->color == COLOR_WHITE)
-			last_white = node;
+	while (node && node->pos < len) {
+		/* The path compression might have skipped some bits. */
+		if (!prefix_match(node->key, key, node->pos))
+			break;
 
-		child = deref_both(trie, node->left);
-		if (child && key_contains(&child->key, key)) {
-			node = child;
-			continue;
-		}
+		if (len < node->pos + RTRIE_STRIDE)
+			return find_hosted_lcp(node, key, len, best);
 
-		child = deref_both(trie, node->right);
-		if (child && key_contains(&child->key, key)) {
-			node = child;
-			continue;
-		}
+		slot = chunk(key, node->pos);
+		leaf = deref_both(trie, node->slots[slot]);
+		if (leaf)
+			best = leaf;
 
-		return force_white ? last_white : node;
-	} while (true);
+		node = deref_both(trie, node->children[slot]);
+	}
 
-	return NULL; /* <-- Shuts up Eclipse. */
+	return best;
 }
 
 /**
- * This must only be called by updater code.
+ * Returns the leaf hosted by @node whose key is exactly @key/@len.
+ * Updater only.
  */
-static struct rtrie_node __rcu **get_parent_ptr(struct rtrie *trie,
-		struct rtrie_node *node)
+static struct rtrie_leaf *find_hosted_exact(struct rtrie_node *node,
+		const u64 *key, unsigned int len)
 {
-	struct rtrie_node *parent = node->parent;
+	struct rtrie_leaf *leaf;
 
-	if (!parent)
-		return &trie->root;
+	list_for_each_entry(leaf, &node->hosted, host_hook) {
+		if (leaf->len == len && prefix_match(leaf->key, key, len))
+			return leaf;
+	}
 
-	return (deref_updater(trie, parent->left) == node)
-			? &parent->left
-			: &parent->right;
+	return NULL;
 }
 
-static void swap_nodes(struct rtrie *trie, struct rtrie_node *old,
-		struct rtrie_node *new)
+/**
+ * Returns the longest prefix hosted by @node which covers slot @slot.
+ * Updater only.
+ */
+static struct rtrie_leaf *find_slot_owner(struct rtrie_node *node,
+		unsigned int slot)
 {
-	struct rtrie_node __rcu **parent_ptr;
+	struct rtrie_leaf *leaf;
+	struct rtrie_leaf *result = NULL;
 
-	new->left = old->left;
-	new->right = old->right;
-	new->parent = old->parent;
+	list_for_each_entry(leaf, &node->hosted, host_hook) {
+		if (!leaf_covers(node, leaf, slot))
+			continue;
+		if (!result || leaf->len > result->len)
+			result = leaf;
+	}
 
-	parent_ptr = get_parent_ptr(trie, old);
-	rcu_assign_pointer(*parent_ptr, new);
+	return result;
+}
 
-	list_add(&new->list_hook, &trie->list);
-	list_del(&old->list_hook);
+/**
+ * Adds @leaf to @node's prefixes. The slots @leaf covers start pointing to it,
+ * unless they're already taken by longer prefixes.
+ */
+static void host_leaf(struct rtrie *trie, struct rtrie_node *node,
+		struct rtrie_leaf *leaf)
+{
+	struct rtrie_leaf *old;
+	unsigned int first;
+	unsigned int last;
+	unsigned int slot;
+
+	first = chunk(leaf->key, node->pos);
+	last = first + (1u << (node->pos + RTRIE_STRIDE - leaf->len));
+
+	for (slot = first; slot < last; slot++) {
+		old = deref_updater(trie, node->slots[slot]);
+		if (!old || old->len < leaf->len)
+			rcu_assign_pointer(node->slots[slot], leaf);
+	}
 
-	__wkfree("Rtrie node", old);
+	list_add_rcu(&leaf->host_hook, &node->hosted);
 }
 
-static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
+/**
+ * Reverts host_leaf(). @leaf must survive until the next grace period.
+ */
+static void unhost_leaf(struct rtrie *trie, struct rtrie_node *node,
+		struct rtrie_leaf *leaf)
 {
-	struct rtrie_node *root = deref_updater(trie, trie->root);
-	struct rtrie_node *inode;
-	struct rtrie_key key;
+	unsigned int first;
+	unsigned int last;
+	unsigned int slot;
 
-	if (!root) {
-		rcu_assign_pointer(trie->root, new);
-		list_add(&new->list_hook, &trie->list);
-		return 0;
-	}
+	list_del_rcu(&leaf->host_hook);
 
-	if (key_contains(&new->key, &root->key)) {
-		RCU_INIT_POINTER(new->left, root);
-		root->parent = new;
-		list_add(&new->list_hook, &trie->list);
-		rcu_assign_pointer(trie->root, new);
-		return 0;
+	first = chunk(leaf->key, node->pos);
+	last = first + (1u << (node->pos + RTRIE_STRIDE - leaf->len));
+
+	for (slot = first; slot < last; slot++) {
+		if (deref_updater(trie, node->slots[slot]) == leaf) {
+			rcu_assign_pointer(node->slots[slot],
+					find_slot_owner(node, slot));
+		}
 	}
+}
+
+/**
+ * This must only be called by updater code.
+ */
+static struct rtrie_node __rcu **get_parent_ptr(struct rtrie *trie,
+		struct rtrie_node *node)
+{
+	struct rtrie_node *parent = node->parent;
 
-	key.bytes = new->key.bytes;
-	key.len = key_match(&root->key, &new->key);
+	if (!parent)
+		return &trie->root;
 
-	inode = create_inode(&key, root, new);
-	if (!inode)
+	return &parent->children[chunk(node->key, parent->pos)];
+}
+
+/**
+ * Creates a node for @leaf and hangs it from @node_ptr.
+ */
+static int add_to_null(struct rtrie *trie, struct rtrie_node *parent,
+		struct rtrie_node __rcu **node_ptr, struct rtrie_leaf *leaf)
+{
+	struct rtrie_node *new;
+
+	new = create_node(leaf->key, host_pos(leaf->len));
+	if (!new)
 		return -ENOMEM;
 
-	root->parent = inode;
-	new->parent = inode;
-	list_add(&inode->list_hook, &trie->list);
-	list_add(&new->list_hook, &trie->list);
+	host_leaf(trie, new, leaf);
+	new->parent = parent;
+	list_add(&new->list_hook, &trie->nodes);
 
-	rcu_assign_pointer(trie->root, inode);
+	rcu_assign_pointer(*node_ptr, new);
 	return 0;
 }
 
-static int add_full_collision(struct rtrie *trie, struct rtrie_node *parent,
-		struct rtrie_node *new)
-{
-	/*
-	 * We're adding new to
-	 *
-	 * parent
-	 *    |
-	 *    +---- child1
-	 *    |
-	 *    +---- child2
-	 *
-	 * We need to turn it into this:
-	 *
-	 * parent
-	 *    |
-	 *    +---- smallest_prefix_node
-	 *    |
-	 *    +---- inode
-	 *             |
-	 *             +---- higher_prefix1
-	 *             |
-	 *             +---- higher_prefix2
-	 *
-	 * { smallest_prefix_node, higher_prefix1, higher_prefix2 } is some
-	 * combination from { child1, child2, new }.
-	 */
-	struct rtrie_node *left = deref_updater(trie, parent->left);
-	struct rtrie_node *right = deref_updater(trie, parent->right);
-
-	struct rtrie_node *smallest_prefix;
-	struct rtrie_node *higher_prefix1;
-	struct rtrie_node *higher_prefix2;
-	struct rtrie_node *inode;
-	struct rtrie_key inode_prefix;
-
-	unsigned int match_lr = key_match(&left->key, &right->key);
-	unsigned int match_ln = key_match(&left->key, &new->key);
-	unsigned int match_rn = key_match(&right->key, &new->key);
-
-	if (match_lr > match_ln && match_lr > match_rn) {
-		smallest_prefix = new;
-		higher_prefix1 = left;
-		higher_prefix2 = right;
-		inode_prefix.len = match_lr;
-	} else if (match_ln > match_lr && match_ln > match_rn) {
-		smallest_prefix = right;
-		higher_prefix1 = new;
-		higher_prefix2 = left;
-		inode_prefix.len = match_ln;
-	} else if (match_rn > match_lr && match_rn > match_ln) {
-		smallest_prefix = left;
-		higher_prefix1 = new;
-		higher_prefix2 = right;
-		inode_prefix.len = match_rn;
-	} else {
-		WARN(true, "Inconsistent bwrtrie! (%u %u %u)",
-				match_lr, match_ln, match_rn);
-		return -EINVAL;
-	}
-	inode_prefix.bytes = higher_prefix1->key.bytes;
+/**
+ * @node is more specific than @leaf. Creates a node for @leaf, makes @node
+ * its child and hangs the result where @node used to be.
+ */
+static int add_above(struct rtrie *trie, struct rtrie_node *node,
+		struct rtrie_leaf *leaf)
+{
+	struct rtrie_node *new;
 
-	inode = create_inode(&inode_prefix, higher_prefix1, higher_prefix2);
-	if (!inode)
+	new = create_node(leaf->key, host_pos(leaf->len));
+	if (!new)
 		return -ENOMEM;
 
-	rcu_assign_pointer(parent->left, NULL);
-	rcu_assign_pointer(parent->right, NULL);
-	synchronize_rcu_bh();
-	rcu_assign_pointer(parent->left, smallest_prefix);
-	rcu_assign_pointer(parent->right, inode);
-
-	smallest_prefix->parent = parent;
-	inode->parent = parent;
-	higher_prefix1->parent = inode;
-	higher_prefix2->parent = inode;
-	list_add(&inode->list_hook, &trie->list);
-	list_add(&new->list_hook, &trie->list);
+	host_leaf(trie, new, leaf);
+	new->parent = node->parent;
+	RCU_INIT_POINTER(new->children[chunk(node->key, new->pos)], node);
+	list_add(&new->list_hook, &trie->nodes);
 
+	rcu_assign_pointer(*get_parent_ptr(trie, node), new);
+	node->parent = new;
 	return 0;
 }
 
-int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len)
+/**
+ * @node and @leaf diverge at bit @common, which comes before both of their
+ * positions. Creates a fork node where they diverge, and hangs both @node and
+ * a new node for @leaf from it.
+ */
+static int add_fork(struct rtrie *trie, struct rtrie_node *node,
+		struct rtrie_leaf *leaf, unsigned int common)
 {
+	struct rtrie_node *fork;
 	struct rtrie_node *new;
-	struct rtrie_node *parent;
-	struct rtrie_node *left, *right;
-	bool contains_left;
-	bool contains_right;
 
-	new = create_leaf(value, trie->value_size, key_offset, key_len);
-	if (!new)
+	fork = create_node(leaf->key, common & ~(RTRIE_STRIDE - 1));
+	if (!fork)
 		return -ENOMEM;
+	new = create_node(leaf->key, host_pos(leaf->len));
+	if (!new) {
+		__wkfree("Rtrie node", fork);
+		return -ENOMEM;
+	}
 
-	parent = find_longest_common_prefix(trie, &new->key, false);
-	if (!parent)
-		return add_to_root(trie, new);
+	host_leaf(trie, new, leaf);
+	new->parent = fork;
+	fork->parent = node->parent;
+	RCU_INIT_POINTER(fork->children[chunk(new->key, fork->pos)], new);
+	RCU_INIT_POINTER(fork->children[chunk(node->key, fork->pos)], node);
+	list_add(&new->list_hook, &trie->nodes);
+	list_add(&fork->list_hook, &trie->nodes);
 
-	if (key_equals(&parent->key, &new->key)) {
-		if (parent->color == COLOR_BLACK) {
-			swap_nodes(trie, parent, new);
-			return 0;
-		}
-		__wkfree("Rtrie node", new);
-		return -EEXIST;
-	}
+	rcu_assign_pointer(*get_parent_ptr(trie, node), fork);
+	node->parent = fork;
+	return 0;
+}
 
-	if (!parent->left) {
-		rcu_assign_pointer(parent->left, new);
-		goto simple_success;
-	}
-	if (!parent->right) {
-		rcu_assign_pointer(parent->right, new);
-		goto simple_success;
+static int add_leaf(struct rtrie *trie, struct rtrie_leaf *leaf)
+{
+	struct rtrie_node __rcu **node_ptr;
+	struct rtrie_node *parent;
+	struct rtrie_node *node;
+	unsigned int pos;
+	unsigned int common;
+
+	if (leaf->len == 0) {
+		if (deref_updater(trie, trie->dflt))
+			return -EEXIST;
+		rcu_assign_pointer(trie->dflt, leaf);
+		return 0;
 	}
 
-	left = deref_updater(trie, parent->left);
-	right = deref_updater(trie, parent->right);
-	contains_left = key_contains(&new->key, &left->key);
-	contains_right = key_contains(&new->key, &right->key);
+	pos = host_pos(leaf->len);
+	parent = NULL;
+	node_ptr = &trie->root;
 
-	if (contains_left && contains_right) {
-		if (parent->color == COLOR_BLACK) {
-			swap_nodes(trie, parent, new);
+	do {
+		node = deref_updater(trie, *node_ptr);
+		if (!node)
+			return add_to_null(trie, parent, node_ptr, leaf);
+
+		common = match_len(node->key, leaf->key, min(node->pos, pos));
+		if (common < node->pos && common < pos)
+			return add_fork(trie, node, leaf, common);
+		if (node->pos > pos)
+			return add_above(trie, node, leaf);
+		if (node->pos == pos) {
+			if (find_hosted_exact(node, leaf->key, leaf->len))
+				return -EEXIST;
+			host_leaf(trie, node, leaf);
 			return 0;
 		}
 
-		RCU_INIT_POINTER(new->left, left);
-		RCU_INIT_POINTER(new->right, right);
-		rcu_assign_pointer(parent->left, NULL);
-		rcu_assign_pointer(parent->right, NULL);
-		synchronize_rcu_bh();
-		rcu_assign_pointer(parent->right, new);
-
-		left->parent = new;
-		right->parent = new;
-		goto simple_success;
-	}
+		parent = node;
+		node_ptr = &node->children[chunk(leaf->key, node->pos)];
+	} while (true);
 
-	if (contains_left) {
-		RCU_INIT_POINTER(new->left, left);
-		rcu_assign_pointer(parent->left, new);
+	return 0; /* <-- Shuts up Eclipse. */
+}
 
-		left->parent = new;
-		goto simple_success;
-	}
+int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len)
+{
+	struct rtrie_leaf *leaf;
+	int error;
 
-	if (contains_right) {
-		RCU_INIT_POINTER(new->right, right);
-		rcu_assign_pointer(parent->right, new);
+	leaf = create_leaf(trie, value, key_offset, key_len);
+	if (!leaf)
+		return -ENOMEM;
 
-		right->parent = new;
-		goto simple_success;
+	error = add_leaf(trie, leaf);
+	if (error) {
+		__wkfree("Rtrie leaf", leaf);
+		return error;
 	}
 
-	return add_full_collision(trie, parent, new);
-
-simple_success:
-	new->parent = parent;
-	list_add(&new->list_hook, &trie->list);
+	list_add(&leaf->list_hook, &trie->list);
 	return 0;
 }
 
+/**
+ * rtrie_find - Returns the value whose key is the longest prefix of @key.
+ *
+ * The result is only valid until you unlock RCU reads, so you need to "lock"
+ * them before calling. This is faster than rtrie_get() because it doesn't
+ * copy the value.
+ */
+void *rtrie_find(struct rtrie *trie, struct rtrie_key *key)
+{
+	struct rtrie_leaf *leaf;
+	u64 words[2];
+
+	key_load(key, words);
+	leaf = find_longest_common_prefix(trie, words, key->len);
+	return leaf ? (leaf + 1) : NULL;
+}
+
 /**
  * rtrie_get - Finds the node keyed @key, and copies its value to @result.
  */
 int rtrie_get(struct rtrie *trie, struct rtrie_key *key, void *result)
 {
-	struct rtrie_node *node;
+	void *value;
 
 	rcu_read_lock_bh();
 
-	node = find_longest_common_prefix(trie, key, true);
-	if (!node) {
+	value = rtrie_find(trie, key);
+	if (!value) {
 		rcu_read_unlock_bh();
 		return -ESRCH;
 	}
 
-	memcpy(result, node + 1, trie->value_size);
+	memcpy(result, value, trie->value_size);
 	rcu_read_unlock_bh();
 	return 0;
 }
@@ -457,7 +546,7 @@ bool rtrie_contains(struct rtrie *trie, struct rtrie_key *key)
 	bool result;
 
 	rcu_read_lock_bh();
-	result = !!find_longest_common_prefix(trie, key, true);
+	result = !!rtrie_find(trie, key);
 	rcu_read_unlock_bh();
 
 	return result;
@@ -468,104 +557,146 @@ bool rtrie_is_empty(struct rtrie *trie)
 	bool result;
 
 	rcu_read_lock_bh();
-	result = !!deref_reader(trie->root);
+	result = !deref_reader(trie->root) && !deref_reader(trie->dflt);
 	rcu_read_unlock_bh();
 
 	return result;
 }
 
-int rtrie_rm(struct rtrie *trie, struct rtrie_key *key)
+/**
+ * Removes @node and its ancestors from the trie for as long as they are no
+ * longer needed. (A node is needed if it hosts prefixes or forks.)
+ *
+ * The removed nodes are moved to @garbage; they need to survive until the
+ * next grace period.
+ */
+static void prune(struct rtrie *trie, struct rtrie_node *node,
+		struct list_head *garbage)
 {
-	struct rtrie_node *node;
-	struct rtrie_node *new;
 	struct rtrie_node *parent;
-	struct rtrie_node __rcu **parent_ptr;
+	struct rtrie_node *child;
+	struct rtrie_node *only_child;
+	unsigned int children;
+	unsigned int i;
+
+	while (node && list_empty(&node->hosted)) {
+		only_child = NULL;
+		children = 0;
+		for (i = 0; i < RTRIE_FANOUT; i++) {
+			child = deref_updater(trie, node->children[i]);
+			if (child) {
+				only_child = child;
+				children++;
+			}
+		}
+		if (children > 1)
+			return;
 
-	node = find_longest_common_prefix(trie, key, true);
-	if (!node || !key_equals(&node->key, key))
-		return -ESRCH;
+		parent = node->parent;
+		rcu_assign_pointer(*get_parent_ptr(trie, node), only_child);
+		if (only_child)
+			only_child->parent = parent;
+		list_move(&node->list_hook, garbage);
 
-	if (node->left && node->right) {
-		new = create_inode(&node->key,
-				deref_updater(trie, node->left),
-				deref_updater(trie, node->right));
-		if (!new)
-			return -ENOMEM;
+		node = parent;
+	}
+}
 
-		parent = node->parent;
-		parent_ptr = get_parent_ptr(trie, node);
+void rtrie_garbage_init(struct rtrie_garbage *garbage)
+{
+	INIT_LIST_HEAD(&garbage->leaves);
+	INIT_LIST_HEAD(&garbage->nodes);
+}
 
-		rcu_assign_pointer(*parent_ptr, new);
-		synchronize_rcu_bh();
+/**
+ * rtrie_rm_deferred - Like rtrie_rm(), except it does not wait for the grace
+ * period. Instead, whatever the removal leaves behind is moved to @garbage,
+ * which the caller has to rtrie_garbage_free() after its own
+ * synchronize_rcu_bh().
+ *
+ * This is for callers that have more RCU-protected memory to release, so they
+ * can pay for a single grace period.
+ */
+int rtrie_rm_deferred(struct rtrie *trie, struct rtrie_key *key,
+		struct rtrie_garbage *garbage)
+{
+	struct rtrie_leaf *leaf;
+	struct rtrie_node *node;
+	unsigned int pos;
+	u64 words[2];
 
-		deref_updater(trie, new->left)->parent = new;
-		deref_updater(trie, new->right)->parent = new;
-		list_add(&new->list_hook, &trie->list);
-		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
-		return 0;
+	key_load(key, words);
+
+	if (key->len == 0) {
+		leaf = deref_updater(trie, trie->dflt);
+		if (!leaf)
+			return -ESRCH;
+		rcu_assign_pointer(trie->dflt, NULL);
+		goto end;
 	}
 
-	/* Keep pruning unnecessary nodes. */
-	do {
-		/*
-		 * At this point, node cannot have two children,
-		 * so it's going down.
-		 */
-		parent = node->parent;
-		parent_ptr = get_parent_ptr(trie, node);
-
-		if (node->left) {
-			rcu_assign_pointer(*parent_ptr, node->left);
-			synchronize_rcu_bh();
-			deref_updater(trie, node->left)->parent = parent;
-			list_del(&node->list_hook);
-			__wkfree("Rtrie node", node);
-			return 0;
-		}
+	pos = host_pos(key->len);
+	node = deref_updater(trie, trie->root);
+	while (node && node->pos < pos && prefix_match(node->key, words, node->pos))
+		node = deref_updater(trie, node->children[chunk(words, node->pos)]);
 
-		if (node->right) {
-			rcu_assign_pointer(*parent_ptr, node->right);
-			synchronize_rcu_bh();
-			deref_updater(trie, node->right)->parent = parent;
-			list_del(&node->list_hook);
-			__wkfree("Rtrie node", node);
-			return 0;
-		}
+	if (!node || node->pos != pos || !prefix_match(node->key, words, pos))
+		return -ESRCH;
+	leaf = find_hosted_exact(node, words, key->len);
+	if (!leaf)
+		return -ESRCH;
 
-		rcu_assign_pointer(*parent_ptr, NULL);
-		synchronize_rcu_bh();
-		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
+	unhost_leaf(trie, node, leaf);
+	prune(trie, node, &garbage->nodes);
 
-		node = parent;
-	} while (node && node->color == COLOR_BLACK);
+end:
+	list_move(&leaf->list_hook, &garbage->leaves);
+	return 0;
+}
+
+/**
+ * Releases the leaves and nodes rtrie_rm_deferred() moved to @garbage.
+ * Readers must not be able to see them anymore.
+ */
+void rtrie_garbage_free(struct rtrie_garbage *garbage)
+{
+	free_all(&garbage->leaves, &garbage->nodes);
+}
+
+int rtrie_rm(struct rtrie *trie, struct rtrie_key *key)
+{
+	struct rtrie_garbage garbage;
+	int error;
 
+	rtrie_garbage_init(&garbage);
+	error = rtrie_rm_deferred(trie, key, &garbage);
+	if (error)
+		return error;
+
+	synchronize_rcu_bh();
+	rtrie_garbage_free(&garbage);
 	return 0;
 }
 
 void rtrie_flush(struct rtrie *trie)
 {
-	struct rtrie_node *node;
-	struct rtrie_node *tmp_node;
-	struct list_head tmp_list;
+	struct list_head leaves;
+	struct list_head nodes;
 	unsigned int i = 0;
 
 	/* rtrie_print("Flushing trie", trie); */
 
-	if (!deref_updater(trie, trie->root))
+	if (list_empty(&trie->list))
 		goto end;
 
 	rcu_assign_pointer(trie->root, NULL);
-	list_replace_init(&trie->list, &tmp_list);
+	rcu_assign_pointer(trie->dflt, NULL);
+	list_replace_init(&trie->list, &leaves);
+	list_replace_init(&trie->nodes, &nodes);
 
 	synchronize_rcu_bh();
 
-	list_for_each_entry_safe(node, tmp_node, &tmp_list, list_hook) {
-		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
-		i++;
-	}
+	i = free_all(&leaves, &nodes);
 
 end:
 	log_debug("Deleted %u nodes.", i);
@@ -579,18 +710,24 @@ int rtrie_foreach(struct rtrie *trie,
 		int (*cb)(void *, void *), void *arg,
 		struct rtrie_key *offset)
 {
-	struct rtrie_node *node;
+	struct rtrie_leaf *leaf;
+	u64 offset_key[2];
 	int error;
 
 	if (list_empty(&trie->list))
 		return 0;
 
-	list_for_each_entry(node, &trie->list, list_hook) {
+	if (offset)
+		key_load(offset, offset_key);
+
+	list_for_each_entry(leaf, &trie->list, list_hook) {
 		if (offset) {
-			if (key_equals(offset, &node->key))
+			if (offset->len == leaf->len
+					&& prefix_match(offset_key, leaf->key,
+							leaf->len))
 				offset = NULL;
-		} else if (node->color == COLOR_WHITE) {
-			error = cb(node + 1, arg);
+		} else {
+			error = cb(leaf + 1, arg);
 			if (error)
 				return error;
 		}
@@ -599,46 +736,35 @@ int rtrie_foreach(struct rtrie *trie,
 	return offset ? -ESRCH : 0;
 }
 
-static char *color2str(enum rtrie_color color)
+static void print_key(const u64 *key, unsigned int len)
 {
-	switch (color) {
-	case COLOR_WHITE:
-		return "w";
-	case COLOR_BLACK:
-		return "b";
-	}
-	return "u";
+	printk("%016llx%016llx/%u", key[0], key[1], len);
 }
 
 static void print_node(struct rtrie_node *node, unsigned int level)
 {
-	unsigned int i, j;
-	unsigned int remainder;
+	struct rtrie_leaf *leaf;
+	unsigned int i;
 
 	if (!node)
 		return;
 
 	for (i = 0; i < level; i++)
 		printk("| ");
+	printk("(n) ");
+	print_key(node->key, node->pos);
+	printk("\n");
 
-	printk("(%s) ", color2str(node->color));
-
-	for (i = 0; i < (node->key.len >> 3); i++)
-		printk("%02x", node->key.bytes[i]);
-	remainder = node->key.len & 7u;
-	if (remainder) {
-		printk(" ");
-		for (j = 0; j < remainder; j++)
-			printk("%u", (node->key.bytes[i] >> (7u - j)) & 1u);
+	list_for_each_entry_rcu(leaf, &node->hosted, host_hook) {
+		for (i = 0; i < level; i++)
+			printk("| ");
+		printk("  (l) ");
+		print_key(leaf->key, leaf->len);
+		printk("\n");
 	}
 
-	printk(" (/%u)", node->key.len);
-	printk(" %p %p %p", &node->list_hook, node->list_hook.prev,
-			node->list_hook.next);
-	printk("\n");
-
-	print_node(deref_reader(node->left), level + 1);
-	print_node(deref_reader(node->right), level + 1);
+	for (i = 0; i < RTRIE_FANOUT; i++)
+		print_node(deref_reader(node->children[i]), level + 1);
 }
 
 /**
@@ -648,15 +774,18 @@ static void print_node(struct rtrie_node *node, unsigned int level)
  */
 void rtrie_print(char *prefix, struct rtrie *trie)
 {
+	struct rtrie_leaf *dflt;
 	struct rtrie_node *root;
 
 	printk(KERN_DEBUG "%s:\n", prefix);
 	printk("-----------------------\n");
 
-	printk("root: %p %p %p\n", &trie->list, trie->list.prev, trie->list.next);
-
 	rcu_read_lock_bh();
 
+	dflt = deref_reader(trie->dflt);
+	if (dflt)
+		printk("default: present\n");
+
 	root = deref_reader(trie->root);
 	if (root) {
 		print_node(root, 0);
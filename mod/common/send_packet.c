@@ -5,8 +5,9 @@
 #include "nat64/mod/common/linux_version.h"
 #include "nat64/mod/common/icmp_wrapper.h"
 #include "nat64/mod/common/packet.h"
-#include "nat64/mod/common/route.h"
-#include "nat64/mod/common/log_time.h"
+#include "nat64/mod/common/route_cache.h"
+#include "nat64/mod/common/rfc6145/common.h"
+#include "nat64/mod/common/stats.h"
 
 static unsigned int get_nexthop_mtu(struct packet *pkt)
 {
@@ -17,15 +18,44 @@ static unsigned int get_nexthop_mtu(struct packet *pkt)
 #endif
 }
 
-static int whine_if_too_big(struct packet *in, struct packet *out)
+/**
+ * Returns @state->in's IPv4 header, even if the packet was translated in place.
+ */
+static struct iphdr *in_hdr4(struct xlation *state)
 {
+	struct inplace_backup *backup = &state->backup;
+
+	if (backup->active)
+		return (struct iphdr *)(backup->hdrs + backup->l2_len);
+	return pkt_ip4_hdr(&state->in);
+}
+
+/**
+ * Gets rid of @state->out, which is not going to be sent, and returns @result.
+ *
+ * If @state->out was translated in place, it is also the incoming packet, so it
+ * is reverted instead of freed. (Because the kernel still owns it.)
+ */
+static verdict cancel_out(struct xlation *state, verdict result)
+{
+	if (state->out.skb == state->in.skb)
+		ttpcomm_inplace_undo(state);
+	else
+		kfree_skb(state->out.skb);
+	return result;
+}
+
+static int whine_if_too_big(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct packet *out = &state->out;
 	unsigned int len;
 	unsigned int mtu;
 
-	if (pkt_l3_proto(in) == L3PROTO_IPV4 && !is_df_set(pkt_ip4_hdr(in)))
+	if (pkt_l3_proto(in) == L3PROTO_IPV4 && !is_df_set(in_hdr4(state)))
 		return 0;
 
-	len = pkt_len(out);
+	len = pkt_seglen(out);
 	mtu = get_nexthop_mtu(out);
 	if (len > mtu) {
 		/*
@@ -42,6 +72,8 @@ static int whine_if_too_big(struct packet *in, struct packet *out)
 			mtu += 20;
 			break;
 		}
+		/* The error has to quote the original packet. */
+		ttpcomm_inplace_undo(state);
 		icmp64_send(out, ICMPERR_FRAG_NEEDED, mtu);
 
 		return -EINVAL;
@@ -55,20 +87,18 @@ verdict sendpkt_send(struct xlation *state)
 	struct packet *out = &state->out;
 	int error;
 
-	logtime(out);
-
-	if (!route(state->jool.ns, out)) {
-		kfree_skb(out->skb);
-		return VERDICT_ACCEPT;
+	if (!rtcache_route(state->jool.rtcache, state->jool.ns, out)) {
+		jstat_inc(state->jool.stats, JSTAT_ROUTE_FAILED);
+		return cancel_out(state, VERDICT_ACCEPT);
 	}
 
 	out->skb->dev = skb_dst(out->skb)->dev;
 	log_debug("Sending skb.");
 
-	error = whine_if_too_big(&state->in, out);
+	error = whine_if_too_big(state);
 	if (error) {
-		kfree_skb(out->skb);
-		return VERDICT_DROP;
+		jstat_inc(state->jool.stats, JSTAT_TOO_BIG);
+		return cancel_out(state, VERDICT_DROP);
 	}
 
 #if LINUX_VERSION_AT_LEAST(3, 16, 0, 7, 2)
@@ -77,6 +107,15 @@ verdict sendpkt_send(struct xlation *state)
 	out->skb->local_df = true; /* FFS, kernel. */
 #endif
 
+	if (state->backup.active) {
+		/* The original's conntrack entry would confuse the new hooks. */
+#if LINUX_VERSION_AT_LEAST(5, 4, 0, 9999, 0)
+		nf_reset_ct(out->skb);
+#else
+		nf_reset(out->skb);
+#endif
+	}
+
 	/*
 	 * Implicit kfree_skb(out->skb) here.
 	 *
@@ -90,7 +129,12 @@ verdict sendpkt_send(struct xlation *state)
 #endif
 	if (error) {
 		log_debug("dst_output() returned errcode %d.", error);
-		return VERDICT_DROP;
+		jstat_inc(state->jool.stats, JSTAT_XMIT_FAILED);
+		/*
+		 * If the packet was translated in place, the incoming packet is
+		 * already gone too.
+		 */
+		return state->backup.active ? VERDICT_STOLEN : VERDICT_DROP;
 	}
 
 	return VERDICT_CONTINUE;
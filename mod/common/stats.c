@@ -1,6 +1,7 @@
 #include "nat64/mod/common/stats.h"
 
 #include <linux/netdevice.h>
+#include <linux/percpu.h>
 #include <linux/skbuff.h>
 #include <linux/version.h>
 #include <net/addrconf.h>
@@ -8,7 +9,22 @@
 #include <net/ipv6.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/packet.h"
-
+#include "nat64/mod/common/wkmalloc.h"
+
+struct jstat_cpu {
+	u64 counters[JSTAT_COUNT];
+};
+
+/**
+ * An instance's counters.
+ *
+ * Each CPU only ever writes its own copy, so the packet path increments them
+ * without atomics or locks. Readers add up all the copies.
+ */
+struct jool_stats {
+	struct jstat_cpu __percpu *cpus;
+	struct kref refcount;
+};
 
 static int validate_skb(struct sk_buff *skb)
 {
@@ -27,9 +43,13 @@ static int validate_pkt(struct packet *pkt)
 	return likely(pkt) ? validate_skb(pkt->skb) : -EINVAL;
 }
 
+/*
+ * The packet path runs in an RCU read-side critical section, so the inet6_dev
+ * does not need to be kref_get()ted.
+ */
 static void inc_stats6(struct sk_buff *skb, int field)
 {
-	struct inet6_dev *idev = in6_dev_get(skb->dev);
+	struct inet6_dev *idev = __in6_dev_get(skb->dev);
 	if (!idev)
 		return;
 
@@ -38,8 +58,6 @@ static void inc_stats6(struct sk_buff *skb, int field)
 #else
 	__IP6_INC_STATS(dev_net(skb->dev), idev, field);
 #endif
-
-	in6_dev_put(idev);
 }
 
 static void inc_stats4(struct sk_buff *skb, int field)
@@ -100,3 +118,101 @@ void inc_stats(struct packet *pkt, int field)
 		break;
 	}
 }
+
+struct jool_stats *jstat_create(void)
+{
+	struct jool_stats *result;
+	int c;
+
+	result = wkmalloc(struct jool_stats, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	result->cpus = alloc_percpu(struct jstat_cpu);
+	if (!result->cpus) {
+		wkfree(struct jool_stats, result);
+		return NULL;
+	}
+
+	for_each_possible_cpu(c)
+		memset(per_cpu_ptr(result->cpus, c), 0, sizeof(struct jstat_cpu));
+
+	kref_init(&result->refcount);
+	return result;
+}
+
+void jstat_get(struct jool_stats *stats)
+{
+	kref_get(&stats->refcount);
+}
+
+static void release_stats(struct kref *refcount)
+{
+	struct jool_stats *stats;
+	stats = container_of(refcount, struct jool_stats, refcount);
+
+	free_percpu(stats->cpus);
+	wkfree(struct jool_stats, stats);
+}
+
+void jstat_put(struct jool_stats *stats)
+{
+	kref_put(&stats->refcount, release_stats);
+}
+
+/**
+ * jstat_inc - Bumps @stats's @id counter.
+ *
+ * Has to be called with bottom halves disabled (which the packet path already
+ * is), or the CPU might change halfway through.
+ */
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id id)
+{
+	this_cpu_inc(stats->cpus->counters[id]);
+}
+
+/**
+ * jstat_inc_verdict - Bumps the counter of @result, the verdict a packet's
+ * translation ended with. (VERDICT_CONTINUE is not an ending, so it is not
+ * counted.)
+ *
+ * @inplace: the packet was translated in place. Stolen packets are normally
+ * held for later (fragments, TCP Simultaneous Open), but the ones translated
+ * in place are stolen because they died in dst_output().
+ */
+void jstat_inc_verdict(struct jool_stats *stats, verdict result, bool inplace)
+{
+	switch (result) {
+	case VERDICT_STOLEN:
+		jstat_inc(stats, inplace ? JSTAT_DROP : JSTAT_HELD);
+		break;
+	case VERDICT_ACCEPT:
+		jstat_inc(stats, JSTAT_ACCEPT);
+		break;
+	case VERDICT_DROP:
+		jstat_inc(stats, JSTAT_DROP);
+		break;
+	case VERDICT_CONTINUE:
+		break;
+	}
+}
+
+/**
+ * jstat_query - Adds up the counters of every CPU. @result has to have room for
+ * JSTAT_COUNT counters.
+ *
+ * The result is not atomic; other CPUs are not stopped while we read.
+ */
+void jstat_query(struct jool_stats *stats, __u64 *result)
+{
+	struct jstat_cpu *cpu;
+	unsigned int i;
+	int c;
+
+	memset(result, 0, JSTAT_COUNT * sizeof(*result));
+	for_each_possible_cpu(c) {
+		cpu = per_cpu_ptr(stats->cpus, c);
+		for (i = 0; i < JSTAT_COUNT; i++)
+			result[i] += cpu->counters[i];
+	}
+}
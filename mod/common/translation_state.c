@@ -4,9 +4,5 @@
 void xlation_init(struct xlation *state)
 {
 	bib_session_init(&state->entries);
-}
-
-void xlation_put(struct xlation *state)
-{
-	xlator_put(&state->jool);
+	state->backup.active = false;
 }
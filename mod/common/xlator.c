@@ -1,10 +1,13 @@
 #include "nat64/mod/common/xlator.h"
 
 #include <linux/sched.h>
+#include <net/netns/generic.h>
 #include "nat64/common/types.h"
 #include "nat64/common/xlat.h"
 #include "nat64/mod/common/atomic_config.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/route_cache.h"
+#include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/wkmalloc.h"
 #include "nat64/mod/stateless/blacklist4.h"
 #include "nat64/mod/stateless/eam.h"
@@ -22,21 +25,40 @@ struct jool_instance {
 	struct xlator jool;
 
 	/*
-	 * I want to turn this into a hash table, but it doesn't seem like
-	 * @ns holds anything reminiscent of an identifier...
+	 * The packet path finds instances through jool_pernet, not through
+	 * this list. The list is only here so xlator_foreach() and
+	 * xlator_destroy() can reach every instance.
 	 */
 	struct list_head list_hook;
 };
 
+/**
+ * Jool's slice of each namespace's net_generic() storage.
+ */
+struct jool_pernet {
+	/** The instance translating @ns's packets. NULL if there's none. */
+	struct jool_instance __rcu *instance;
+};
+
+static unsigned int jool_net_id __read_mostly;
+
 static struct list_head __rcu *pool;
+/** Protects @pool and the jool_pernet.instance writers. */
 static DEFINE_MUTEX(lock);
 
+static struct jool_pernet *get_pernet(struct net *ns)
+{
+	return net_generic(ns, jool_net_id);
+}
+
 static void xlator_get(struct xlator *jool)
 {
 	get_net(jool->ns);
 
 	config_get(jool->global);
 	pool6_get(jool->pool6);
+	rtcache_get(jool->rtcache);
+	jstat_get(jool->stats);
 
 	if (xlat_is_siit()) {
 		eamt_get(jool->siit.eamt);
@@ -57,38 +79,38 @@ static void xlator_get(struct xlator *jool)
  */
 static int exit_net(struct net *ns)
 {
-	struct list_head *list;
+	struct jool_pernet *pernet;
 	struct jool_instance *instance;
 
 	mutex_lock(&lock);
 
-	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
-	list_for_each_entry(instance, list, list_hook) {
-		if (instance->jool.ns == ns) {
-			/* Remove the instance from the list FIRST. */
-			list_del_rcu(&instance->list_hook);
-			mutex_unlock(&lock);
-
-			/* Then wait for the grace period. */
-			synchronize_rcu_bh();
-
-			/*
-			 * Nobody can kref_get the databases now:
-			 * Other code should not do it because of the
-			 * xlator_find() contract, and xlator_find()'s
-			 * xlator_get() already happened. Other xlator_find()'s
-			 * xlator_get()s are not going to get in the way either
-			 * because the instance is no longer listed.
-			 * So finally return everything.
-			 */
-			xlator_put(&instance->jool);
-			wkfree(struct jool_instance, instance);
-			return 0;
-		}
+	pernet = get_pernet(ns);
+	instance = rcu_dereference_protected(pernet->instance,
+			lockdep_is_held(&lock));
+	if (!instance) {
+		mutex_unlock(&lock);
+		return -ESRCH;
 	}
 
+	/* Unpublish the instance FIRST. */
+	RCU_INIT_POINTER(pernet->instance, NULL);
+	list_del_rcu(&instance->list_hook);
 	mutex_unlock(&lock);
-	return -ESRCH;
+
+	/* Then wait for the grace period. */
+	synchronize_rcu_bh();
+
+	/*
+	 * Nobody can see the instance now:
+	 * The packet path only uses it within an RCU-bh read-side critical
+	 * section, and those have all finished. xlator_find()'s xlator_get()s
+	 * already happened, and other code should not kref_get because of the
+	 * xlator_find() contract.
+	 * So finally return everything.
+	 */
+	xlator_put(&instance->jool);
+	wkfree(struct jool_instance, instance);
+	return 0;
 }
 
 static void __net_exit joolns_exit_net(struct net *ns)
@@ -98,6 +120,8 @@ static void __net_exit joolns_exit_net(struct net *ns)
 
 static struct pernet_operations joolns_ops = {
 	.exit = joolns_exit_net,
+	.id = &jool_net_id,
+	.size = sizeof(struct jool_pernet),
 };
 
 /**
@@ -154,6 +178,16 @@ static int init_siit(struct xlator *jool)
 	error = pool6_init(&jool->pool6);
 	if (error)
 		goto pool6_fail;
+	jool->rtcache = rtcache_create();
+	if (!jool->rtcache) {
+		error = -ENOMEM;
+		goto rtcache_fail;
+	}
+	jool->stats = jstat_create();
+	if (!jool->stats) {
+		error = -ENOMEM;
+		goto stats_fail;
+	}
 	error = eamt_init(&jool->siit.eamt);
 	if (error)
 		goto eamt_fail;
@@ -176,6 +210,10 @@ rfc6791_fail:
 blacklist_fail:
 	eamt_put(jool->siit.eamt);
 eamt_fail:
+	jstat_put(jool->stats);
+stats_fail:
+	rtcache_put(jool->rtcache);
+rtcache_fail:
 	pool6_put(jool->pool6);
 pool6_fail:
 	config_put(jool->global);
@@ -193,6 +231,16 @@ static int init_nat64(struct xlator *jool)
 	error = pool6_init(&jool->pool6);
 	if (error)
 		goto pool6_fail;
+	jool->rtcache = rtcache_create();
+	if (!jool->rtcache) {
+		error = -ENOMEM;
+		goto rtcache_fail;
+	}
+	jool->stats = jstat_create();
+	if (!jool->stats) {
+		error = -ENOMEM;
+		goto stats_fail;
+	}
 	jool->nat64.frag = fragdb_create();
 	if (!jool->nat64.frag) {
 		error = -ENOMEM;
@@ -229,6 +277,10 @@ bib_fail:
 pool4_fail:
 	fragdb_put(jool->nat64.frag);
 fragdb_fail:
+	jstat_put(jool->stats);
+stats_fail:
+	rtcache_put(jool->rtcache);
+rtcache_fail:
 	pool6_put(jool->pool6);
 pool6_fail:
 	config_put(jool->global);
@@ -245,6 +297,7 @@ config_fail:
 int xlator_add(struct xlator *result)
 {
 	struct list_head *list;
+	struct jool_pernet *pernet;
 	struct jool_instance *instance;
 	struct net *ns;
 	int error;
@@ -272,21 +325,18 @@ int xlator_add(struct xlator *result)
 	}
 
 	mutex_lock(&lock);
-	error = xlator_find(ns, NULL);
-	switch (error) {
-	case 0:
+
+	pernet = get_pernet(ns);
+	if (rcu_dereference_protected(pernet->instance,
+			lockdep_is_held(&lock))) {
 		log_err("This namespace already has a Jool instance.");
 		error = -EEXIST;
 		goto mutex_fail;
-	case -ESRCH: /* Happy path. */
-		break;
-	default:
-		log_err("Unknown error code: %d.", error);
-		goto mutex_fail;
 	}
 
 	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
 	list_add_tail_rcu(&instance->list_hook, list);
+	rcu_assign_pointer(pernet->instance, instance);
 
 	if (result) {
 		xlator_get(&instance->jool);
@@ -336,7 +386,7 @@ int xlator_rm(void)
 
 int xlator_replace(struct xlator *jool)
 {
-	struct list_head *list;
+	struct jool_pernet *pernet;
 	struct jool_instance *old;
 	struct jool_instance *new;
 
@@ -348,23 +398,26 @@ int xlator_replace(struct xlator *jool)
 
 	mutex_lock(&lock);
 
-	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
-	list_for_each_entry_rcu(old, list, list_hook) {
-		if (old->jool.ns == new->jool.ns) {
-			/* The comments at exit_net() also apply here. */
-			list_replace_rcu(&old->list_hook, &new->list_hook);
-			mutex_unlock(&lock);
-
-			synchronize_rcu_bh();
-
-			xlator_put(&old->jool);
-			wkfree(struct jool_instance, old);
-			return 0;
-		}
+	pernet = get_pernet(new->jool.ns);
+	old = rcu_dereference_protected(pernet->instance,
+			lockdep_is_held(&lock));
+	if (!old) {
+		mutex_unlock(&lock);
+		xlator_put(&new->jool);
+		wkfree(struct jool_instance, new);
+		return -ESRCH;
 	}
 
+	/* The comments at exit_net() also apply here. */
+	list_replace_rcu(&old->list_hook, &new->list_hook);
+	rcu_assign_pointer(pernet->instance, new);
 	mutex_unlock(&lock);
-	return -ESRCH;
+
+	synchronize_rcu_bh();
+
+	xlator_put(&old->jool);
+	wkfree(struct jool_instance, old);
+	return 0;
 }
 
 /**
@@ -378,26 +431,44 @@ int xlator_replace(struct xlator *jool)
  */
 int xlator_find(struct net *ns, struct xlator *result)
 {
-	struct list_head *list;
 	struct jool_instance *instance;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool);
-	list_for_each_entry_rcu(instance, list, list_hook) {
-		if (instance->jool.ns == ns) {
-			if (result) {
-				xlator_get(&instance->jool);
-				memcpy(result, &instance->jool,
-						sizeof(instance->jool));
-			}
-			rcu_read_unlock_bh();
-			return 0;
-		}
+	instance = rcu_dereference_bh(get_pernet(ns)->instance);
+	if (!instance) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
+	}
+
+	if (result) {
+		xlator_get(&instance->jool);
+		memcpy(result, &instance->jool, sizeof(instance->jool));
 	}
 
 	rcu_read_unlock_bh();
-	return -ESRCH;
+	return 0;
+}
+
+/**
+ * xlator_find_rcu - Packet path version of xlator_find(). Does not take any
+ * references, so it's cheap.
+ *
+ * The caller must hold rcu_read_lock_bh() for as long as it uses @result, and
+ * must not xlator_put() it.
+ * (xlator_replace() and xlator_rm() wait for the grace period before releasing
+ * the old instance's databases.)
+ */
+int xlator_find_rcu(struct net *ns, struct xlator *result)
+{
+	struct jool_instance *instance;
+
+	instance = rcu_dereference_bh(get_pernet(ns)->instance);
+	if (!instance)
+		return -ESRCH;
+
+	memcpy(result, &instance->jool, sizeof(instance->jool));
+	return 0;
 }
 
 /**
@@ -437,6 +508,8 @@ void xlator_put(struct xlator *jool)
 
 	config_put(jool->global);
 	pool6_put(jool->pool6);
+	rtcache_put(jool->rtcache);
+	jstat_put(jool->stats);
 
 	if (xlat_is_siit()) {
 		eamt_put(jool->siit.eamt);
@@ -1,5 +1,11 @@
 #include "nat64/mod/stateful/bib/db.h"
 
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 #include <net/ip6_checksum.h>
 
 #include "nat64/common/constants.h"
@@ -7,37 +13,42 @@
 #include "nat64/mod/common/icmp_wrapper.h"
 #include "nat64/mod/common/linux_version.h"
 #include "nat64/mod/common/rbtree.h"
+#include "nat64/mod/common/rcu.h"
 #include "nat64/mod/common/route.h"
 #include "nat64/mod/common/wkmalloc.h"
 #include "nat64/mod/stateful/bib/pkt_queue.h"
 
 /*
- * TODO (performance) Maybe pack this?
+ * The layouts of this and tabled_session are meant to minimize padding, since
+ * there can be millions of them. Please keep that in mind when adding fields.
+ * (See bib_session_bytes().)
  */
 struct tabled_bib {
 	struct ipv6_transport_addr src6;
 	struct ipv4_transport_addr src4;
-	l4_protocol proto;
+	/* l4_protocol, squeezed. */
+	__u8 proto;
 	bool is_static;
+	/**
+	 * Index (in the prefix cache) of the prefix the session that created
+	 * this entry was using. IPv4-initiated sessions inherit it, so the
+	 * IPv6 node sees them coming from the same prefix it has been talking
+	 * to. PREFIX_NONE if unknown (static entries, wide creators); those
+	 * sessions fall back to pool6's first prefix.
+	 */
+	__u8 prefix;
 
-	struct rb_node hook6;
+	struct hlist_node hash6_hook;
+	struct hlist_node hash4_hook;
 	struct rb_node hook4;
 
 	struct rb_root sessions;
+
+	/** See refresh_rcu(). */
+	struct rcu_head rcu;
 };
 
-/*
- * TODO (performance) Maybe pack this?
- */
 struct tabled_session {
-	/**
-	 * We don't strictly need to store @dst6; @dst6 is always @dst4 plus the
-	 * pool6 prefix. But we store it anyway so I don't have to make more
-	 * mess constatly in this module.
-	 */
-	struct ipv6_transport_addr dst6;
-	struct ipv4_transport_addr dst4;
-	tcp_state state;
 	/** MUST NOT be NULL. */
 	struct tabled_bib *bib;
 
@@ -49,6 +60,10 @@ struct tabled_session {
 	 * pool6 prefix. Therefore, and assuming the pool6 prefix stays still
 	 * (something I'm well willing to enforce), sessions indexed by dst4
 	 * yield exactly the same tree as sessions indexed by dst6.
+	 * pool6 can have several prefixes, so this only holds as long as a BIB
+	 * entry does not reach the same dst4 through two of them. The IPv4
+	 * side could not tell those sessions apart anyway, so the second one
+	 * is refused. (See dst6_matches().)
 	 *
 	 * In ICMP, dst4.l4 is the same as src4.l4 instead of dst6.l4. This
 	 * would normally mean that dst6 sessions would yield a different tree
@@ -68,13 +83,92 @@ struct tabled_session {
 	 */
 	struct rb_node tree_hook;
 
-	unsigned long update_time;
-	/** MUST NOT be NULL. */
-	struct expire_timer *expirer;
-	struct list_head list_hook;
+	union {
+		/** Hangs from one of @timer's wheel slots. */
+		struct list_head list_hook;
+		/**
+		 * See refresh_rcu(). Sessions are always out of the wheel (or
+		 * the wheel is being destroyed) by the time they are freed, so
+		 * the two can share the space.
+		 */
+		struct rcu_head rcu;
+	};
 
 	/** See pke_queue.h for some thoughts on stored packets. */
 	struct sk_buff *stored;
+
+	struct ipv4_transport_addr dst4;
+	/**
+	 * Jiffy this session was last updated, truncated to 32 bits.
+	 * Please use get_update_time() and set_update_time().
+	 *
+	 * Might be bumped without moving the session to the wheel slot it now
+	 * belongs to. (See refresh_rcu().) The wheel sorts that out when the
+	 * old slot comes up.
+	 */
+	__u32 update_time;
+	/*
+	 * dst6's port. It cannot be derived from anything else because ICMP
+	 * sessions have been inconsistent about it.
+	 */
+	__u16 dst6_l4;
+	/**
+	 * dst6's address is not stored; it is always dst4's address embedded in
+	 * one of the prefixes from the prefix cache. (See get_dst6().) This is
+	 * the index of that prefix. If it's PREFIX_NONE, the session is really
+	 * a struct wide_session instead.
+	 */
+	__u8 prefix;
+	/* tcp_state. */
+	__u8 state:4;
+	/* session_timer_type. Tells which of the shard's expirers owns this. */
+	__u8 timer:4;
+};
+
+/**
+ * A session whose dst6 is not RFC 6052-compatible with its dst4 (or one
+ * created while the prefix cache was full) needs to store its full dst6.
+ * These are rare, so they are given their own (bigger) cache.
+ */
+struct wide_session {
+	struct tabled_session session;
+	struct in6_addr dst6;
+};
+
+/**
+ * A prefix some sessions use to derive their dst6 address from their dst4
+ * address.
+ *
+ * There is normally only one (pool6's), so the cache is small and searched
+ * linearly.
+ */
+struct session_prefix {
+	/** The prefix, with the bytes where dst4 goes (@layout) zeroized. */
+	struct in6_addr addr;
+	/** Index of the relevant entry from the v4_offsets array. */
+	unsigned int layout;
+	/**
+	 * Number of sessions that are using this prefix. Zero means the slot
+	 * is free.
+	 */
+	atomic_t refs;
+};
+
+/** Size of the prefix cache. */
+#define PREFIX_SLOTS 16
+/** tabled_session.prefix value of sessions that store their own dst6. */
+#define PREFIX_NONE 0xFF
+
+/**
+ * The prefix cache. Each BIB has its own, so namespaces do not compete for
+ * slots, nor see each other's prefixes.
+ */
+struct session_prefixes {
+	struct session_prefix slots[PREFIX_SLOTS];
+	/** Number of slots that have ever been used. */
+	unsigned int count;
+	/* Only needed to claim free slots. Lookups are lockless. */
+	spinlock_t lock;
 };
 
 struct bib_session_tuple {
@@ -98,18 +192,95 @@ struct probing_session {
 	struct list_head list_hook;
 };
 
+/*
+ * Sessions are expired by hierarchical timing wheels.
+ *
+ * Time is divided in ticks of WHEEL_TICK jiffies. Each level of the wheel has
+ * WHEEL_SIZE slots; a level 0 slot spans one tick, and every slot of the next
+ * level spans a full revolution of the previous one. Sessions hang from the
+ * slot that corresponds to their update tick, on the lowest level whose range
+ * covers it. (See wheel_add().) Whenever a level completes a revolution, the next slot of
+ * the upper level is "cascaded" (redistributed) into the lower levels.
+ *
+ * This makes adding, refreshing and moving a session O(1) regardless of its
+ * timeout, and lets the cleaner stop (and resume) at any point.
+ */
+#define WHEEL_BITS 5
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+/* Between an eighth and a quarter of a second. Needs to be a power of two. */
+#define WHEEL_TICK_SHIFT ilog2(HZ / 4)
+#define WHEEL_TICK (1UL << WHEEL_TICK_SHIFT)
+/** Distance (in ticks) beyond which every session is the same. */
+#define WHEEL_HORIZON ((1UL << (WHEEL_LEVELS * WHEEL_BITS)) - 1)
+
+struct timer_wheel {
+	/**
+	 * The tick (in jiffies, always a multiple of WHEEL_TICK) the cleaner
+	 * has to process next.
+	 */
+	unsigned long clk;
+	struct list_head slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
 struct expire_timer {
-	struct list_head sessions;
+	struct timer_wheel wheel;
 	unsigned long timeout;
 	session_timer_type type;
 	fate_cb decide_fate_cb;
 };
 
-struct bib_table {
+/**
+ * Bucket array of one of a shard's hash indexes.
+ *
+ * It is never resized in place; growing an index means hanging its entries from
+ * a larger array, and then freeing the old one once the lockless readers are
+ * done with it. (See grow_hashes_work().)
+ *
+ * Big arrays are vmalloc'd, so the bucket count can keep up with the number of
+ * entries no matter how large the table gets.
+ */
+struct bib_buckets {
+	/** Number of elements in @heads. Always a power of two. */
+	unsigned int size;
+	struct hlist_head heads[];
+};
+
+struct bib_table;
+
+/**
+ * A fraction of a BIB table.
+ *
+ * The BIB entries (along with their sessions) are spread across the shards by
+ * hashing their IPv6 transport address. Each shard has its own lock, so
+ * translations of unrelated connections rarely step on each other's toes.
+ *
+ * Dynamic BIB entries always receive IPv4 masks whose port (or ICMP identifier)
+ * yields the shard's index (see shard4_index()), which is how the 4-to-6 path
+ * finds the owning shard without knowing the IPv6 side. Entries that cannot
+ * honor this (static entries, joold-synchronized entries, simultaneous opens)
+ * are "strays"; they are additionally indexed by @table's stray tree.
+ */
+struct bib_shard {
 	/** Indexes the entries using their IPv6 identifiers. */
-	struct rb_root tree6;
+	struct bib_buckets *hash6;
 	/** Indexes the entries using their IPv4 identifiers. */
+	struct bib_buckets *hash4;
+	/**
+	 * Also indexes the entries using their IPv4 identifiers, but sorted.
+	 * The packet path only uses this to allocate masks
+	 * (find_available_mask()); exact lookups go through the hash indexes.
+	 * It's otherwise only needed by the operations that care about order
+	 * (the foreaches and bib_rm_range()).
+	 */
 	struct rb_root tree4;
+	/**
+	 * Which of this shard's IPv4 masks are taken (struct port_map, indexed
+	 * by address). Lets find_available_mask() skip the occupied ones
+	 * without walking @tree4.
+	 */
+	struct rb_root port_maps;
 
 	/* Write BIB entries on the log as they are created and destroyed? */
 	bool log_bibs;
@@ -122,13 +293,30 @@ struct bib_table {
 	 */
 	bool drop_by_addr;
 
-	/* Number of entries in this table. */
+	/* Number of entries in this shard. */
 	u64 bib_count;
 	u64 session_count;
+	/** How many of the @session_count sessions are wide_sessions. */
+	u64 wide_count;
 
+	/**
+	 * Protects everything in this structure.
+	 * If you need to hold several shard locks at the same time, acquire
+	 * them in ascending index order. (See lock_shards().)
+	 */
 	spinlock_t lock;
+	/**
+	 * Bumped (while holding @lock) whenever the trees or a session's state
+	 * change, so the lockless lookups can tell if they raced with a writer.
+	 */
+	seqcount_t seq;
+	/**
+	 * Grows @hash6 and @hash4. The packet path can't do it itself because
+	 * the bucket arrays are allocated in process context.
+	 */
+	struct work_struct grow_work;
 
-	/** Expires this table's established sessions. */
+	/** Expires this shard's established sessions. */
 	struct expire_timer est_timer;
 
 	/*
@@ -140,30 +328,95 @@ struct bib_table {
 	 */
 
 	/**
-	 * Expires this table's transitory sessions.
+	 * Expires this shard's transitory sessions.
 	 * This is initialized in the UDP/ICMP tables, but all their operations
 	 * become no-ops.
 	 */
 	struct expire_timer trans_timer;
 	/**
-	 * Expires this table's type-2 packets and their sessions.
+	 * Expires this shard's type-2 packets and their sessions.
 	 * This is initialized in the UDP/ICMP tables, but all their operations
 	 * become no-ops.
 	 */
 	struct expire_timer syn4_timer;
 
-	/** Current number of packets (of both types) in the table. */
-	int pkt_count;
 	/** Maximum storable packets (of both types) in the table. */
 	unsigned int pkt_limit;
 	/** Drop externally initiated TCP connections? */
 	bool drop_v4_syn;
 
+	/** The table this shard belongs to. */
+	struct bib_table *table;
+	/** Position of this shard in @table's shard array. */
+	unsigned int index;
+};
+
+/**
+ * Index entry of a BIB entry whose IPv4 transport address does not point to
+ * the shard that holds it. See struct bib_shard.
+ */
+struct bib_stray {
+	struct ipv4_transport_addr src4;
+	/** The stray entry. Its shard can be inferred from its src6. */
+	struct tabled_bib *bib;
+	struct rb_node hook;
+};
+
+/** Number of ports (or ICMP identifiers) each IPv4 address has. */
+#define PORTS_PER_ADDR 65536
+#define PORT_WORDS (PORTS_PER_ADDR / BITS_PER_LONG)
+
+/**
+ * Free port bitmap of one of a shard's IPv4 addresses.
+ *
+ * Only the ports that belong to the shard (see shard4_index()) are tracked, so
+ * bit n stands for port (n * shard_count + shard index). Strays are not
+ * recorded.
+ *
+ * The map is only a hint; the tree is still the authority. If a map could not
+ * be allocated or lost track of an entry, find_available_mask() will stumble
+ * upon the collision and fix the map.
+ */
+struct port_map {
+	struct in_addr addr;
+	/** Number of set bits in @used. The map dies when this reaches zero. */
+	unsigned int count;
+	/** Bit n is set if word n of @used has no free ports. */
+	unsigned long full[BITS_TO_LONGS(PORT_WORDS)];
+	unsigned long *used;
+	struct rb_node hook;
+};
+
+struct bib_table {
+	/** Array of @shard_count shards. */
+	struct bib_shard *shards;
+	/** Always a power of two. */
+	unsigned int shard_count;
+
+	/**
+	 * Stray BIB entries (struct bib_stray), indexed by src4.
+	 * Protected by @strays_lock, which is acquired after shard locks.
+	 */
+	struct rb_root strays;
+	/**
+	 * Number of nodes in @strays. Allows the packet path to skip the
+	 * index (and its lock) altogether in the typical case.
+	 */
+	atomic_t stray_count;
+	spinlock_t strays_lock;
+
+	/** Current number of packets (of both types) in the table. */
+	atomic_t pkt_count;
 	/**
 	 * Packet storage for type 1 packets.
 	 * This is NULL in UDP/ICMP.
+	 * Protected by @pktqueue_lock, which is acquired after shard locks.
 	 */
 	struct pktqueue *pkt_queue;
+	spinlock_t pktqueue_lock;
+
+	/** The BIB's prefix cache. (Shared by its three tables.) */
+	struct session_prefixes *prefixes;
 };
 
 struct bib {
@@ -174,22 +427,380 @@ struct bib {
 	/** The session table for ICMP conversations. */
 	struct bib_table icmp;
 
+	/**
+	 * Maximum number of sessions bib_clean() is allowed to look at while
+	 * holding a shard's lock. Each shard gets its own budget per call.
+	 */
+	unsigned int clean_budget;
+
+	struct session_prefixes prefixes;
+
 	struct kref refs;
 };
 
+/** Number of shards each table of new BIBs will be split into. */
+static unsigned int shard_count;
+/** Seed of the hash indexes. */
+static u32 hash_rnd;
+
+/** Initial number of buckets of every hash index. */
+#define BIB_HASH_MIN_SIZE 64
+/**
+ * Hash indexes stop growing once they reach this number of buckets.
+ * This is only a sanity limit; a shard cannot hold this many entries in
+ * practice.
+ */
+#define BIB_HASH_MAX_SIZE (1 << 28)
+
 static struct kmem_cache *bib_cache;
 static struct kmem_cache *session_cache;
+static struct kmem_cache *wide_session_cache;
 
 #define alloc_bib(flags) wkmem_cache_alloc("bib entry", bib_cache, flags)
-#define alloc_session(flags) wkmem_cache_alloc("session", session_cache, flags)
 #define free_bib(bib) wkmem_cache_free("bib entry", bib_cache, bib)
-#define free_session(session) wkmem_cache_free("session", session_cache, session)
 
-static struct tabled_bib *bib6_entry(const struct rb_node *node)
+/**
+ * Positions of the IPv4 address within the IPv6 address, for each RFC 6052
+ * prefix length.
+ */
+static const unsigned char v4_offsets[][4] = {
+	{ 12, 13, 14, 15 }, /* /96 */
+	{ 9, 10, 11, 12 }, /* /64 */
+	{ 7, 9, 10, 11 }, /* /56 */
+	{ 6, 7, 9, 10 }, /* /48 */
+	{ 5, 6, 7, 9 }, /* /40 */
+	{ 4, 5, 6, 7 }, /* /32 */
+};
+
+static void embed_addr4(const struct in6_addr *prefix, unsigned int layout,
+		const struct in_addr *addr4, struct in6_addr *result)
+{
+	const __u8 *bytes4 = (const __u8 *)&addr4->s_addr;
+	unsigned int i;
+
+	*result = *prefix;
+	for (i = 0; i < 4; i++)
+		result->s6_addr[v4_offsets[layout][i]] = bytes4[i];
+}
+
+static bool prefix_matches(struct session_prefix *prefix,
+		const struct in6_addr *dst6, const struct in_addr *dst4)
 {
-	return node ? rb_entry(node, struct tabled_bib, hook6) : NULL;
+	struct in6_addr tmp;
+
+	embed_addr4(&prefix->addr, prefix->layout, dst4, &tmp);
+	return addr6_equals(&tmp, dst6);
 }
 
+/**
+ * Returns the index of a prefix that can rebuild @dst6 out of @dst4, and takes
+ * a reference to it. Lockless.
+ */
+static int find_prefix(struct session_prefixes *prefixes,
+		const struct in6_addr *dst6, const struct in_addr *dst4)
+{
+	struct session_prefix *prefix;
+	unsigned int count;
+	unsigned int i;
+
+	count = READ_ONCE(prefixes->count);
+	smp_rmb(); /* Pairs with get_prefix()'s smp_wmb(). */
+	for (i = 0; i < count; i++) {
+		prefix = &prefixes->slots[i];
+		if (!prefix_matches(prefix, dst6, dst4))
+			continue;
+		if (!atomic_inc_not_zero(&prefix->refs))
+			continue;
+		/* The slot might have been recycled before we got the ref. */
+		if (prefix_matches(prefix, dst6, dst4))
+			return i;
+		atomic_dec(&prefix->refs);
+	}
+
+	return -ESRCH;
+}
+
+/**
+ * Returns the index of a prefix that can rebuild @dst6 out of @dst4, taking
+ * a reference to it. Returns PREFIX_NONE if there's no such prefix and no room
+ * to create it.
+ */
+static unsigned int get_prefix(struct session_prefixes *prefixes,
+		const struct in6_addr *dst6, const struct in_addr *dst4)
+{
+	const __u8 *bytes4 = (const __u8 *)&dst4->s_addr;
+	struct session_prefix *prefix;
+	unsigned int layout;
+	unsigned int i;
+	unsigned int j;
+	int result;
+
+	result = find_prefix(prefixes, dst6, dst4);
+	if (result >= 0)
+		return result;
+
+	/* Which of the RFC 6052 prefix lengths does @dst6 follow? */
+	for (layout = 0; layout < ARRAY_SIZE(v4_offsets); layout++) {
+		for (i = 0; i < 4; i++)
+			if (dst6->s6_addr[v4_offsets[layout][i]] != bytes4[i])
+				break;
+		if (i == 4)
+			goto found;
+	}
+	return PREFIX_NONE;
+
+found:
+	spin_lock_bh(&prefixes->lock);
+
+	/* Somebody might have added it while we weren't looking. */
+	result = find_prefix(prefixes, dst6, dst4);
+	if (result >= 0)
+		goto end;
+
+	for (i = 0; i < PREFIX_SLOTS; i++) {
+		prefix = &prefixes->slots[i];
+		/* Only the lock holder can revive a dead slot. */
+		if (atomic_read(&prefix->refs))
+			continue;
+
+		prefix->addr = *dst6;
+		for (j = 0; j < 4; j++)
+			prefix->addr.s6_addr[v4_offsets[layout][j]] = 0;
+		prefix->layout = layout;
+		/* Publish the prefix before the refcount and the count. */
+		smp_wmb();
+		atomic_set(&prefix->refs, 1);
+		if (i >= prefixes->count)
+			WRITE_ONCE(prefixes->count, i + 1);
+		result = i;
+		goto end;
+	}
+
+	result = PREFIX_NONE;
+	/* Fall through. */
+
+end:
+	spin_unlock_bh(&prefixes->lock);
+	return result;
+}
+
+static void put_prefix(struct session_prefixes *prefixes, unsigned int index)
+{
+	atomic_dec(&prefixes->slots[index].refs);
+}
+
+/**
+ * Allocates a session, and initializes its address fields. Everything else is
+ * left for the caller.
+ */
+static struct tabled_session *alloc_session(struct bib_table *table,
+		const struct ipv6_transport_addr *dst6,
+		const struct ipv4_transport_addr *dst4)
+{
+	struct tabled_session *session;
+	struct wide_session *wide;
+	unsigned int prefix;
+
+	prefix = get_prefix(table->prefixes, &dst6->l3, &dst4->l3);
+	if (prefix != PREFIX_NONE) {
+		session = wkmem_cache_alloc("session", session_cache,
+				GFP_ATOMIC);
+		if (!session) {
+			put_prefix(table->prefixes, prefix);
+			return NULL;
+		}
+	} else {
+		wide = wkmem_cache_alloc("session", wide_session_cache,
+				GFP_ATOMIC);
+		if (!wide)
+			return NULL;
+		wide->dst6 = dst6->l3;
+		session = &wide->session;
+	}
+
+	session->dst4 = *dst4;
+	session->prefix = prefix;
+	session->dst6_l4 = dst6->l4;
+	return session;
+}
+
+/**
+ * Releases @session's prefix. Sessions that were ever hanging from the trees
+ * need to do this while their shard is locked, since free_session_rcu() cannot
+ * know the table.
+ *
+ * The slot might be recycled while lockless lookups are still reading
+ * @session, but they will notice the removal through the shard's seqcount and
+ * discard whatever get_dst6() gave them.
+ */
+static void unlink_prefix(struct bib_table *table,
+		struct tabled_session *session)
+{
+	if (session->prefix != PREFIX_NONE)
+		put_prefix(table->prefixes, session->prefix);
+}
+
+/** Assumes @session's prefix has already been unlinked. */
+static void __free_session(struct tabled_session *session)
+{
+	if (session->prefix != PREFIX_NONE) {
+		wkmem_cache_free("session", session_cache, session);
+	} else {
+		wkmem_cache_free("session", wide_session_cache,
+				container_of(session, struct wide_session,
+						session));
+	}
+}
+
+/** For sessions that never made it to the trees. */
+static void free_session(struct bib_table *table,
+		struct tabled_session *session)
+{
+	unlink_prefix(table, session);
+	__free_session(session);
+}
+
+static void get_dst6(struct bib_table *table,
+		const struct tabled_session *session,
+		struct ipv6_transport_addr *result)
+{
+	struct session_prefix *prefix;
+
+	if (session->prefix != PREFIX_NONE) {
+		prefix = &table->prefixes->slots[session->prefix];
+		embed_addr4(&prefix->addr, prefix->layout, &session->dst4.l3,
+				&result->l3);
+	} else {
+		result->l3 = container_of(session, struct wide_session,
+				session)->dst6;
+	}
+	result->l4 = session->dst6_l4;
+}
+
+/**
+ * Returns whether @session's dst6 address is @addr.
+ */
+static bool dst6_matches(struct bib_table *table,
+		const struct tabled_session *session,
+		const struct in6_addr *addr)
+{
+	struct ipv6_transport_addr dst6;
+
+	get_dst6(table, session, &dst6);
+	return addr6_equals(&dst6.l3, addr);
+}
+
+/**
+ * Makes @session's prefix @bib's. @session is supposed to be the session that
+ * caused @bib to be created.
+ */
+static void link_bib_prefix(struct bib_table *table, struct tabled_bib *bib,
+		struct tabled_session *session)
+{
+	bib->prefix = session->prefix;
+	if (bib->prefix != PREFIX_NONE)
+		atomic_inc(&table->prefixes->slots[bib->prefix].refs);
+}
+
+static void unlink_bib_prefix(struct bib_table *table, struct tabled_bib *bib)
+{
+	if (bib->prefix != PREFIX_NONE)
+		put_prefix(table->prefixes, bib->prefix);
+	bib->prefix = PREFIX_NONE;
+}
+
+/**
+ * Rebuilds @session's dst6 (which was computed out of pool6's first prefix)
+ * using @bib's prefix instead.
+ * Assumes @bib's shard is locked, so @bib's reference keeps the slot alive.
+ */
+static void inherit_prefix(struct bib_table *table, struct tabled_bib *bib,
+		struct tabled_session *session)
+{
+	struct session_prefix *prefix;
+
+	if (bib->prefix == PREFIX_NONE || bib->prefix == session->prefix)
+		return;
+
+	prefix = &table->prefixes->slots[bib->prefix];
+	if (session->prefix == PREFIX_NONE) {
+		/* Wide sessions keep their own copy of the address. */
+		embed_addr4(&prefix->addr, prefix->layout, &session->dst4.l3,
+				&container_of(session, struct wide_session,
+						session)->dst6);
+		return;
+	}
+
+	atomic_inc(&prefix->refs);
+	put_prefix(table->prefixes, session->prefix);
+	session->prefix = bib->prefix;
+}
+
+static void count_session(struct bib_shard *shard,
+		struct tabled_session *session)
+{
+	shard->session_count++;
+	if (session->prefix == PREFIX_NONE)
+		shard->wide_count++;
+}
+
+static void uncount_session(struct bib_shard *shard,
+		struct tabled_session *session)
+{
+	shard->session_count--;
+	if (session->prefix == PREFIX_NONE)
+		shard->wide_count--;
+}
+
+/**
+ * Update times are stored as 32-bit jiffies, which means they can only
+ * represent the last 2^31 jiffies. (Older times are not needed since that
+ * exceeds the maximum session timeout; see clamp_timeout().)
+ */
+static unsigned long get_update_time(const struct tabled_session *session)
+{
+	unsigned long now = jiffies;
+	s32 age;
+
+	age = (u32)now - READ_ONCE(session->update_time);
+	/* Refreshed by somebody whose clock is ahead of ours. */
+	if (age < 0)
+		age = 0;
+
+	return now - age;
+}
+
+static void set_update_time(struct tabled_session *session,
+		unsigned long update_time)
+{
+	unsigned long now = jiffies;
+
+	if (time_after(update_time, now))
+		update_time = now;
+	else if (now - update_time > S32_MAX)
+		update_time = now - S32_MAX;
+
+	WRITE_ONCE(session->update_time, update_time);
+}
+
+static void __free_bib_rcu(struct rcu_head *rcu)
+{
+	free_bib(container_of(rcu, struct tabled_bib, rcu));
+}
+
+static void __free_session_rcu(struct rcu_head *rcu)
+{
+	__free_session(container_of(rcu, struct tabled_session, rcu));
+}
+
+/*
+ * Entries that were ever hanging from the trees might still be being read by
+ * the lockless lookups, so they need to be freed through these instead.
+ */
+#define free_bib_rcu(bib) call_rcu_bh(&(bib)->rcu, __free_bib_rcu)
+#define free_session_rcu(session) \
+	call_rcu_bh(&(session)->rcu, __free_session_rcu)
+
 static struct tabled_bib *bib4_entry(const struct rb_node *node)
 {
 	return node ? rb_entry(node, struct tabled_bib, hook4) : NULL;
@@ -216,18 +827,34 @@ static void tbtobe(struct tabled_bib *tabled, struct bib_entry *bib)
 /**
  * "[Convert] tabled session to session entry"
  */
-static void tstose(struct tabled_session *tsession,
+static struct expire_timer *get_expirer(struct bib_shard *shard,
+		session_timer_type type)
+{
+	switch (type) {
+	case SESSION_TIMER_EST:
+		return &shard->est_timer;
+	case SESSION_TIMER_TRANS:
+		return &shard->trans_timer;
+	case SESSION_TIMER_SYN4:
+		return &shard->syn4_timer;
+	}
+
+	return NULL;
+}
+
+static void tstose(struct bib_shard *shard,
+		struct tabled_session *tsession,
 		struct session_entry *session)
 {
 	session->src6 = tsession->bib->src6;
-	session->dst6 = tsession->dst6;
+	get_dst6(shard->table, tsession, &session->dst6);
 	session->src4 = tsession->bib->src4;
 	session->dst4 = tsession->dst4;
 	session->proto = tsession->bib->proto;
 	session->state = tsession->state;
-	session->timer_type = tsession->expirer->type;
-	session->update_time = tsession->update_time;
-	session->timeout = tsession->expirer->timeout;
+	session->timer_type = tsession->timer;
+	session->update_time = get_update_time(tsession);
+	session->timeout = get_expirer(shard, tsession->timer)->timeout;
 	session->has_stored = !!tsession->stored;
 }
 
@@ -248,37 +875,586 @@ static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
 /**
  * [Convert] tabled session to bib_session"
  */
-static void tstobs(struct tabled_session *session, struct bib_session *bs)
+static void tstobs(struct bib_shard *shard,
+		struct tabled_session *session,
+		struct bib_session *bs)
 {
 	if (!bs)
 		return;
 
 	bs->bib_set = true;
 	bs->session_set = true;
-	tstose(session, &bs->session);
+	tstose(shard, session, &bs->session);
+}
+
+/**
+ * One-liner to get the session table corresponding to the @proto protocol.
+ */
+static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		return &db->tcp;
+	case L4PROTO_UDP:
+		return &db->udp;
+	case L4PROTO_ICMP:
+		return &db->icmp;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	WARN(true, "Unsupported transport protocol: %u.", proto);
+	return NULL;
+}
+
+/**
+ * Returns the index of the shard that owns (or would own) the BIB entry whose
+ * IPv6 transport address is @addr.
+ *
+ * The hash is unseeded on purpose; joold peers need to agree on it.
+ */
+static unsigned int shard6_index(struct bib_table *table,
+		const struct ipv6_transport_addr *addr)
+{
+	return jhash2(addr->l3.s6_addr32, 4, addr->l4)
+			& (table->shard_count - 1);
+}
+
+/**
+ * Returns the index of the shard that owns the BIB entry whose IPv4 transport
+ * address is @addr, assuming the entry is not a stray.
+ */
+static unsigned int shard4_index(struct bib_table *table,
+		const struct ipv4_transport_addr *addr)
+{
+	return addr->l4 & (table->shard_count - 1);
+}
+
+static struct bib_shard *get_shard6(struct bib_table *table,
+		const struct ipv6_transport_addr *addr)
+{
+	return &table->shards[shard6_index(table, addr)];
+}
+
+static bool is_stray(struct bib_table *table, struct tabled_bib *bib)
+{
+	return shard4_index(table, &bib->src4) != shard6_index(table, &bib->src6);
+}
+
+static int compare_stray(struct bib_stray *a, struct ipv4_transport_addr *b)
+{
+	return taddr4_compare(&a->src4, b);
+}
+
+/**
+ * Assumes @table->strays_lock is held.
+ */
+static struct bib_stray *find_stray(struct bib_table *table,
+		struct ipv4_transport_addr *addr)
+{
+	return rbtree_find(addr, &table->strays, compare_stray,
+			struct bib_stray, hook);
+}
+
+/**
+ * Same as find_stray(), except it handles @table->strays_lock on its own.
+ * Assumes bottom halves are already disabled.
+ */
+static bool stray_exists(struct bib_table *table,
+		struct ipv4_transport_addr *addr)
+{
+	bool result;
+
+	if (!atomic_read(&table->stray_count))
+		return false;
+
+	spin_lock(&table->strays_lock);
+	result = !!find_stray(table, addr);
+	spin_unlock(&table->strays_lock);
+
+	return result;
+}
+
+/**
+ * Indexes @bib in the stray tree, using the preallocated @stray node.
+ * Assumes @bib's shard is locked and @bib does not collide with anything.
+ */
+static void add_stray(struct bib_table *table, struct bib_stray *stray,
+		struct tabled_bib *bib)
+{
+	stray->src4 = bib->src4;
+	stray->bib = bib;
+
+	spin_lock(&table->strays_lock);
+	if (WARN(rbtree_add(stray, &stray->src4, &table->strays, compare_stray,
+			struct bib_stray, hook), "Stray BIB entry collides.")) {
+		spin_unlock(&table->strays_lock);
+		wkfree(struct bib_stray, stray);
+		return;
+	}
+	atomic_inc(&table->stray_count);
+	spin_unlock(&table->strays_lock);
+}
+
+/**
+ * Removes @bib from the stray tree, if it was there.
+ * Assumes @bib's shard is locked.
+ */
+static void rm_stray(struct bib_table *table, struct tabled_bib *bib)
+{
+	struct bib_stray *stray;
+
+	if (!is_stray(table, bib))
+		return;
+
+	spin_lock(&table->strays_lock);
+	stray = find_stray(table, &bib->src4);
+	if (!WARN(!stray, "Stray BIB entry was not indexed.")) {
+		rb_erase(&stray->hook, &table->strays);
+		atomic_dec(&table->stray_count);
+	}
+	spin_unlock(&table->strays_lock);
+
+	if (stray)
+		wkfree(struct bib_stray, stray);
+}
+
+/**
+ * Returns the shard that owns (or would own) the BIB entry whose IPv4
+ * transport address is @addr. (ie. the shard the 4-to-6 direction needs to
+ * lock.)
+ *
+ * There is a race condition: by the time the caller locks the shard, the entry
+ * might have died or a stray might have been created. It doesn't matter; it's
+ * the same as the packet having arrived a little earlier or later.
+ */
+static struct bib_shard *get_shard4(struct bib_table *table,
+		struct ipv4_transport_addr *addr)
+{
+	struct bib_stray *stray;
+	unsigned int index;
+
+	index = shard4_index(table, addr);
+
+	if (atomic_read(&table->stray_count)) {
+		spin_lock_bh(&table->strays_lock);
+		stray = find_stray(table, addr);
+		if (stray)
+			index = shard6_index(table, &stray->bib->src6);
+		spin_unlock_bh(&table->strays_lock);
+	}
+
+	return &table->shards[index];
+}
+
+/**
+ * Locks the shards @a and @b (which can be the same), honoring the lock
+ * ordering rule.
+ */
+static void lock_shards(struct bib_shard *a, struct bib_shard *b)
+{
+	if (a == b) {
+		spin_lock_bh(&a->lock);
+		return;
+	}
+
+	if (a->index > b->index)
+		swap(a, b);
+	spin_lock_bh(&a->lock);
+	spin_lock_nested(&b->lock, SINGLE_DEPTH_NESTING);
+}
+
+static void unlock_shards(struct bib_shard *a, struct bib_shard *b)
+{
+	if (a != b)
+		spin_unlock(&b->lock);
+	spin_unlock_bh(&a->lock);
+}
+
+/**
+ * Allocates a bucket array of @size heads. Can sleep.
+ */
+static struct bib_buckets *alloc_buckets(unsigned int size)
+{
+	struct bib_buckets *buckets;
+	unsigned int i;
+
+	buckets = __wkvmalloc("BIB buckets", sizeof(*buckets)
+			+ (size_t)size * sizeof(struct hlist_head));
+	if (!buckets)
+		return NULL;
+
+	buckets->size = size;
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(&buckets->heads[i]);
+	return buckets;
+}
+
+static void free_buckets(struct bib_buckets *buckets)
+{
+	__wkvfree("BIB buckets", buckets);
+}
+
+static unsigned int hash6(struct bib_buckets *buckets,
+		const struct ipv6_transport_addr *addr)
+{
+	return jhash2(addr->l3.s6_addr32, 4, hash_rnd ^ addr->l4)
+			& (buckets->size - 1);
+}
+
+static unsigned int hash4(struct bib_buckets *buckets,
+		const struct ipv4_transport_addr *addr)
+{
+	return jhash_2words((__force u32)addr->l3.s_addr, addr->l4, hash_rnd)
+			& (buckets->size - 1);
+}
+
+/**
+ * Returns the BIB entry from @shard whose src6 is @addr, or NULL.
+ *
+ * Works both while holding @shard's lock and (locklessly) inside a
+ * rcu_read_lock_bh() section. (In the latter case, false negatives are
+ * possible if a writer is touching the shard at the same time.)
+ */
+static struct tabled_bib *find_bib6(struct bib_shard *shard,
+		const struct ipv6_transport_addr *addr)
+{
+	struct bib_buckets *buckets;
+	struct hlist_node *node;
+	struct tabled_bib *bib;
+
+	buckets = rcu_dereference_bh(shard->hash6);
+	hlist_for_each_rcu_bh(node, &buckets->heads[hash6(buckets, addr)]) {
+		bib = hlist_entry(node, struct tabled_bib, hash6_hook);
+		if (taddr6_equals(&bib->src6, addr))
+			return bib;
+	}
+
+	return NULL;
+}
+
+/**
+ * IPv4 version of find_bib6().
+ */
+static struct tabled_bib *find_bib4(struct bib_shard *shard,
+		const struct ipv4_transport_addr *addr)
+{
+	struct bib_buckets *buckets;
+	struct hlist_node *node;
+	struct tabled_bib *bib;
+
+	buckets = rcu_dereference_bh(shard->hash4);
+	hlist_for_each_rcu_bh(node, &buckets->heads[hash4(buckets, addr)]) {
+		bib = hlist_entry(node, struct tabled_bib, hash4_hook);
+		if (taddr4_equals(&bib->src4, addr))
+			return bib;
+	}
+
+	return NULL;
+}
+
+/**
+ * Adds @bib to @shard's hash indexes. (But not to the tree.)
+ * Assumes @shard is locked and @bib does not collide with anything.
+ */
+static void hash_add(struct bib_shard *shard, struct tabled_bib *bib)
+{
+	struct bib_buckets *buckets;
+
+	buckets = shard->hash6;
+	hlist_add_head_rcu(&bib->hash6_hook,
+			&buckets->heads[hash6(buckets, &bib->src6)]);
+	buckets = shard->hash4;
+	hlist_add_head_rcu(&bib->hash4_hook,
+			&buckets->heads[hash4(buckets, &bib->src4)]);
+}
+
+/**
+ * Removes @bib from its shard's hash indexes. (But not from the tree.)
+ * Assumes the shard is locked.
+ */
+static void hash_rm(struct tabled_bib *bib)
+{
+	hlist_del_rcu(&bib->hash6_hook);
+	hlist_del_rcu(&bib->hash4_hook);
+}
+
+/**
+ * Returns the number of ports each of @table's port maps tracks.
+ */
+static unsigned int port_map_bits(struct bib_table *table)
+{
+	return max(PORTS_PER_ADDR / table->shard_count, 1U);
+}
+
+static int compare_port_map(struct port_map *map, struct in_addr *addr)
+{
+	return ipv4_addr_cmp(&map->addr, addr);
+}
+
+static struct port_map *find_port_map(struct bib_shard *shard,
+		struct in_addr *addr)
+{
+	return rbtree_find(addr, &shard->port_maps, compare_port_map,
+			struct port_map, hook);
+}
+
+static void free_port_map(struct port_map *map)
+{
+	__wkfree("port bitmap", map->used);
+	wkfree(struct port_map, map);
+}
+
+static struct port_map *create_port_map(struct bib_shard *shard,
+		struct in_addr *addr)
+{
+	struct port_map *map;
+	size_t size;
+
+	map = wkmalloc(struct port_map, GFP_ATOMIC);
+	if (!map)
+		return NULL;
+	size = BITS_TO_LONGS(port_map_bits(shard->table)) * sizeof(long);
+	map->used = __wkmalloc("port bitmap", size, GFP_ATOMIC);
+	if (!map->used) {
+		wkfree(struct port_map, map);
+		return NULL;
+	}
+
+	map->addr = *addr;
+	map->count = 0;
+	memset(map->full, 0, sizeof(map->full));
+	memset(map->used, 0, size);
+
+	if (WARN(rbtree_add(map, addr, &shard->port_maps, compare_port_map,
+			struct port_map, hook), "Port map collides.")) {
+		free_port_map(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+static void release_port_map(struct rb_node *node, void *arg)
+{
+	free_port_map(rb_entry(node, struct port_map, hook));
+}
+
+/**
+ * Marks @bib's mask as taken. Does nothing if @bib is a stray.
+ * Assumes @shard is locked.
+ *
+ * Failure is not a problem. (See struct port_map.)
+ */
+static void ports_add(struct bib_shard *shard, struct tabled_bib *bib)
+{
+	struct port_map *map;
+	unsigned int bit;
+
+	if (shard4_index(shard->table, &bib->src4) != shard->index)
+		return;
+
+	map = find_port_map(shard, &bib->src4.l3);
+	if (!map) {
+		map = create_port_map(shard, &bib->src4.l3);
+		if (!map)
+			return;
+	}
+
+	bit = bib->src4.l4 / shard->table->shard_count;
+	if (__test_and_set_bit(bit, map->used))
+		return;
+	map->count++;
+	if (map->used[BIT_WORD(bit)] == ~0UL)
+		__set_bit(BIT_WORD(bit), map->full);
+}
+
+/**
+ * Marks @bib's mask as available. Assumes @shard is locked.
+ */
+static void ports_rm(struct bib_shard *shard, struct tabled_bib *bib)
+{
+	struct port_map *map;
+	unsigned int bit;
+
+	if (shard4_index(shard->table, &bib->src4) != shard->index)
+		return;
+
+	map = find_port_map(shard, &bib->src4.l3);
+	if (!map)
+		return;
+
+	bit = bib->src4.l4 / shard->table->shard_count;
+	if (!__test_and_clear_bit(bit, map->used))
+		return;
+	__clear_bit(BIT_WORD(bit), map->full);
+	map->count--;
+	if (!map->count) {
+		rb_erase(&map->hook, &shard->port_maps);
+		free_port_map(map);
+	}
+}
+
+/**
+ * Returns the first bit from @map->used, starting from @bit, that is not set.
+ * Returns @bits if there is none.
+ *
+ * Full words are skipped through @map->full, so this performs a handful of word
+ * reads no matter how crowded the address is.
+ */
+static unsigned int port_map_next_free(struct port_map *map,
+		unsigned int bits, unsigned int bit)
+{
+	unsigned int words = BITS_TO_LONGS(bits);
+	unsigned int word;
+	unsigned long free;
+
+	while (bit < bits) {
+		word = BIT_WORD(bit);
+		if (!test_bit(word, map->full)) {
+			free = ~map->used[word] & (~0UL << (bit % BITS_PER_LONG));
+			if (free)
+				return min_t(unsigned int,
+						word * BITS_PER_LONG + __ffs(free),
+						bits);
+		}
+		bit = find_next_zero_bit(map->full, words, word + 1)
+				* BITS_PER_LONG;
+	}
+
+	return bits;
+}
+
+/**
+ * Returns the first port from the [@port, @last] range that belongs to @shard
+ * and is not taken according to @map (which can be NULL).
+ * Returns a value greater than @last if there is none.
+ */
+static unsigned int next_free_port(struct bib_shard *shard,
+		struct port_map *map,
+		unsigned int port,
+		unsigned int last)
+{
+	unsigned int count = shard->table->shard_count;
+	unsigned int index = shard->index;
+	unsigned int bit;
+	unsigned int last_bit;
+
+	if (last < index)
+		return last + 1;
+
+	/* First and last masks of the range that belong to the shard. */
+	bit = (port + count - 1 - index) / count;
+	last_bit = (last - index) / count;
+	if (map)
+		bit = port_map_next_free(map, last_bit + 1, bit);
+
+	return (bit > last_bit) ? (last + 1) : (bit * count + index);
+}
+
+/**
+ * Hangs all of @old's entries from @new.
+ *
+ * The entries are moved without unhooking them first, so a lockless reader
+ * walking @old might end up in one of @new's chains. That's fine; it will
+ * still reach the end of the chain (there are no loops), and its seqcount
+ * check will tell it the lookup is untrustworthy.
+ */
+static void rehash(struct bib_buckets *old, struct bib_buckets *new, bool is6)
+{
+	struct hlist_node *node;
+	struct hlist_node *tmp;
+	struct tabled_bib *bib;
+	unsigned int bucket;
+	unsigned int i;
+
+	for (i = 0; i < old->size; i++) {
+		hlist_for_each_safe(node, tmp, &old->heads[i]) {
+			if (is6) {
+				bib = hlist_entry(node, struct tabled_bib,
+						hash6_hook);
+				bucket = hash6(new, &bib->src6);
+			} else {
+				bib = hlist_entry(node, struct tabled_bib,
+						hash4_hook);
+				bucket = hash4(new, &bib->src4);
+			}
+			hlist_add_head_rcu(node, &new->heads[bucket]);
+		}
+	}
+}
+
+/**
+ * Grows @shard's hash indexes so they have at least as many buckets as
+ * entries.
+ *
+ * The arrays are allocated before the shard is locked, but the entries are
+ * moved while holding the lock. Because the indexes always grow to the next
+ * power of two, this happens O(log n) times during the life of the shard.
+ */
+static void grow_hashes_work(struct work_struct *work)
+{
+	struct bib_shard *shard;
+	struct bib_buckets *old6;
+	struct bib_buckets *old4;
+	struct bib_buckets *new6;
+	struct bib_buckets *new4;
+	unsigned int size;
+	u64 count;
+
+	shard = container_of(work, struct bib_shard, grow_work);
+
+	spin_lock_bh(&shard->lock);
+	size = shard->hash6->size;
+	count = shard->bib_count;
+	spin_unlock_bh(&shard->lock);
+
+	if (count <= size || size >= BIB_HASH_MAX_SIZE)
+		return;
+	while (size < count && size < BIB_HASH_MAX_SIZE)
+		size <<= 1;
+
+	new6 = alloc_buckets(size);
+	if (!new6)
+		return;
+	new4 = alloc_buckets(size);
+	if (!new4) {
+		free_buckets(new6);
+		return;
+	}
+
+	spin_lock_bh(&shard->lock);
+	old6 = shard->hash6;
+	old4 = shard->hash4;
+	write_seqcount_begin(&shard->seq);
+	rehash(old6, new6, true);
+	rehash(old4, new4, false);
+	rcu_assign_pointer(shard->hash6, new6);
+	rcu_assign_pointer(shard->hash4, new4);
+	write_seqcount_end(&shard->seq);
+	spin_unlock_bh(&shard->lock);
+
+	synchronize_rcu_bh();
+	free_buckets(old6);
+	free_buckets(old4);
 }
 
 /**
- * One-liner to get the session table corresponding to the @proto protocol.
+ * Asks for @shard's hash indexes to be grown if they are getting crowded.
+ * (ie. if there are more entries than buckets.)
+ *
+ * Assumes @shard is locked. Until the work runs (or if it fails), the chains
+ * just get longer.
  */
-static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+static void grow_hashes(struct bib_shard *shard)
 {
-	switch (proto) {
-	case L4PROTO_TCP:
-		return &db->tcp;
-	case L4PROTO_UDP:
-		return &db->udp;
-	case L4PROTO_ICMP:
-		return &db->icmp;
-	case L4PROTO_OTHER:
-		break;
-	}
+	unsigned int size = shard->hash6->size;
 
-	WARN(true, "Unsupported transport protocol: %u.", proto);
-	return NULL;
+	if (shard->bib_count > size && size < BIB_HASH_MAX_SIZE)
+		schedule_work(&shard->grow_work);
 }
 
-static void kill_stored_pkt(struct bib_table *table,
+static void kill_stored_pkt(struct bib_shard *shard,
 		struct tabled_session *session)
 {
 	if (!session->stored)
@@ -287,11 +1463,19 @@ static void kill_stored_pkt(struct bib_table *table,
 	log_debug("Deleting stored type 2 packet.");
 	kfree_skb(session->stored);
 	session->stored = NULL;
-	table->pkt_count--;
+	atomic_dec(&shard->table->pkt_count);
 }
 
-int bib_init(void)
+int bib_init(unsigned int shards)
 {
+	if (!is_power_of_2(shards)) {
+		log_err("The BIB shard count (%u) must be a power of two.",
+				shards);
+		return -EINVAL;
+	}
+	shard_count = shards;
+	get_random_bytes(&hash_rnd, sizeof(hash_rnd));
+
 	bib_cache = kmem_cache_create("bib_nodes",
 			sizeof(struct tabled_bib),
 			0, 0, NULL);
@@ -301,18 +1485,31 @@ int bib_init(void)
 	session_cache = kmem_cache_create("session_nodes",
 			sizeof(struct tabled_session),
 			0, 0, NULL);
-	if (!session_cache) {
-		kmem_cache_destroy(bib_cache);
-		return -ENOMEM;
-	}
+	if (!session_cache)
+		goto session_fail;
+
+	wide_session_cache = kmem_cache_create("wide_session_nodes",
+			sizeof(struct wide_session),
+			0, 0, NULL);
+	if (!wide_session_cache)
+		goto wide_session_fail;
 
 	return 0;
+
+wide_session_fail:
+	kmem_cache_destroy(session_cache);
+session_fail:
+	kmem_cache_destroy(bib_cache);
+	return -ENOMEM;
 }
 
 void bib_destroy(void)
 {
+	/* Wait for the pending free_*_rcu()s. */
+	rcu_barrier_bh();
 	kmem_cache_destroy(bib_cache);
 	kmem_cache_destroy(session_cache);
+	kmem_cache_destroy(wide_session_cache);
 }
 
 static enum session_fate just_die(struct session_entry *session, void *arg)
@@ -320,70 +1517,180 @@ static enum session_fate just_die(struct session_entry *session, void *arg)
 	return FATE_RM;
 }
 
+/*
+ * Sessions cannot be kept longer than their update times can represent. (See
+ * get_update_time().) The margin gives the cleaner some room to be late.
+ */
+#define MAX_TIMEOUT (S32_MAX - 3600 * HZ)
+
+static unsigned long clamp_timeout(unsigned long timeout)
+{
+	return min(timeout, (unsigned long)MAX_TIMEOUT);
+}
+
 static void init_expirer(struct expire_timer *expirer,
 		unsigned long timeout,
 		session_timer_type type,
 		fate_cb fate_cb)
 {
-	INIT_LIST_HEAD(&expirer->sessions);
-	expirer->timeout = msecs_to_jiffies(1000 * timeout);
+	unsigned int level;
+	unsigned int slot;
+
+	expirer->timeout = clamp_timeout(msecs_to_jiffies(1000 * timeout));
+	/* Sessions older than this would be expired already. */
+	expirer->wheel.clk = (jiffies - expirer->timeout) & ~(WHEEL_TICK - 1);
+	for (level = 0; level < WHEEL_LEVELS; level++)
+		for (slot = 0; slot < WHEEL_SIZE; slot++)
+			INIT_LIST_HEAD(&expirer->wheel.slots[level][slot]);
 	expirer->type = type;
 	expirer->decide_fate_cb = fate_cb;
 }
 
-static void init_table(struct bib_table *table,
+static int init_shard(struct bib_table *table,
+		unsigned int index,
 		unsigned long est_timeout,
 		unsigned long trans_timeout,
 		fate_cb est_cb)
 {
-	table->tree6 = RB_ROOT;
-	table->tree4 = RB_ROOT;
-	table->log_bibs = DEFAULT_BIB_LOGGING;
-	table->log_sessions = DEFAULT_SESSION_LOGGING;
-	table->drop_by_addr = DEFAULT_ADDR_DEPENDENT_FILTERING;
-	table->bib_count = 0;
-	table->session_count = 0;
-	spin_lock_init(&table->lock);
-	init_expirer(&table->est_timer, est_timeout, SESSION_TIMER_EST, est_cb);
-
-	init_expirer(&table->trans_timer, trans_timeout, SESSION_TIMER_TRANS,
+	struct bib_shard *shard = &table->shards[index];
+
+	shard->hash6 = alloc_buckets(BIB_HASH_MIN_SIZE);
+	if (!shard->hash6)
+		return -ENOMEM;
+	shard->hash4 = alloc_buckets(BIB_HASH_MIN_SIZE);
+	if (!shard->hash4) {
+		free_buckets(shard->hash6);
+		return -ENOMEM;
+	}
+	shard->tree4 = RB_ROOT;
+	shard->port_maps = RB_ROOT;
+	shard->log_bibs = DEFAULT_BIB_LOGGING;
+	shard->log_sessions = DEFAULT_SESSION_LOGGING;
+	shard->drop_by_addr = DEFAULT_ADDR_DEPENDENT_FILTERING;
+	shard->bib_count = 0;
+	shard->session_count = 0;
+	shard->wide_count = 0;
+	spin_lock_init(&shard->lock);
+	seqcount_init(&shard->seq);
+	INIT_WORK(&shard->grow_work, grow_hashes_work);
+	init_expirer(&shard->est_timer, est_timeout, SESSION_TIMER_EST, est_cb);
+
+	init_expirer(&shard->trans_timer, trans_timeout, SESSION_TIMER_TRANS,
 			just_die);
 	/* TODO "just_die"? what about the stored packet? */
-	init_expirer(&table->syn4_timer, TCP_INCOMING_SYN, SESSION_TIMER_SYN4,
+	init_expirer(&shard->syn4_timer, TCP_INCOMING_SYN, SESSION_TIMER_SYN4,
 			just_die);
-	table->pkt_count = 0;
-	table->pkt_limit = 0;
-	table->drop_v4_syn = DEFAULT_DROP_EXTERNAL_CONNECTIONS;
+	shard->pkt_limit = 0;
+	shard->drop_v4_syn = DEFAULT_DROP_EXTERNAL_CONNECTIONS;
+	shard->table = table;
+	shard->index = index;
+	return 0;
+}
+
+static void destroy_shard(struct bib_shard *shard)
+{
+	free_buckets(shard->hash6);
+	free_buckets(shard->hash4);
+	rbtree_clear(&shard->port_maps, release_port_map, NULL);
+}
+
+static int init_table(struct bib_table *table,
+		struct session_prefixes *prefixes,
+		unsigned long est_timeout,
+		unsigned long trans_timeout,
+		fate_cb est_cb)
+{
+	unsigned int i;
+	int error;
+
+	table->shards = __wkmalloc("BIB shards",
+			shard_count * sizeof(*table->shards), GFP_KERNEL);
+	if (!table->shards)
+		return -ENOMEM;
+	table->shard_count = shard_count;
+	for (i = 0; i < shard_count; i++) {
+		error = init_shard(table, i, est_timeout, trans_timeout, est_cb);
+		if (error)
+			goto fail;
+	}
+
+	table->strays = RB_ROOT;
+	atomic_set(&table->stray_count, 0);
+	spin_lock_init(&table->strays_lock);
+	atomic_set(&table->pkt_count, 0);
 	table->pkt_queue = NULL;
+	spin_lock_init(&table->pktqueue_lock);
+	table->prefixes = prefixes;
+	return 0;
+
+fail:
+	while (i-- > 0)
+		destroy_shard(&table->shards[i]);
+	__wkfree("BIB shards", table->shards);
+	return error;
+}
+
+static void destroy_table(struct bib_table *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < table->shard_count; i++)
+		destroy_shard(&table->shards[i]);
+	__wkfree("BIB shards", table->shards);
 }
 
+#define foreach_shard(table, shard) \
+	for (shard = (table)->shards; \
+			shard < (table)->shards + (table)->shard_count; \
+			shard++)
+
 struct bib *bib_create(void)
 {
 	struct bib *db;
+	struct bib_shard *shard;
 
 	db = wkmalloc(struct bib, GFP_KERNEL);
 	if (!db)
 		return NULL;
 
-	init_table(&db->udp, UDP_DEFAULT, 0, just_die);
-	init_table(&db->tcp, TCP_EST, TCP_TRANS, tcp_est_expire_cb);
-	init_table(&db->icmp, ICMP_DEFAULT, 0, just_die);
+	memset(db->prefixes.slots, 0, sizeof(db->prefixes.slots));
+	db->prefixes.count = 0;
+	spin_lock_init(&db->prefixes.lock);
 
-	db->tcp.pkt_limit = DEFAULT_MAX_STORED_PKTS;
+	if (init_table(&db->udp, &db->prefixes, UDP_DEFAULT, 0, just_die))
+		goto udp_fail;
+	if (init_table(&db->tcp, &db->prefixes, TCP_EST, TCP_TRANS,
+			tcp_est_expire_cb))
+		goto tcp_fail;
+	if (init_table(&db->icmp, &db->prefixes, ICMP_DEFAULT, 0, just_die))
+		goto icmp_fail;
+
+	foreach_shard(&db->tcp, shard)
+		shard->pkt_limit = DEFAULT_MAX_STORED_PKTS;
 	db->tcp.pkt_queue = pktqueue_create();
-	if (!db->tcp.pkt_queue) {
-		wkfree(struct bib, db);
-		return NULL;
-	}
+	if (!db->tcp.pkt_queue)
+		goto pktqueue_fail;
 	/*
 	 * Just in case some crazy psycho decides to change the default.
 	 * THERE IS NO ADRESS-DEPENDENT FILTERING ON ICMP; the RFC is wrong.
 	 */
-	db->icmp.drop_by_addr = false;
+	foreach_shard(&db->icmp, shard)
+		shard->drop_by_addr = false;
 
+	db->clean_budget = DEFAULT_CLEAN_BUDGET;
 	kref_init(&db->refs);
 
 	return db;
+
+pktqueue_fail:
+	destroy_table(&db->icmp);
+icmp_fail:
+	destroy_table(&db->tcp);
+tcp_fail:
+	destroy_table(&db->udp);
+udp_fail:
+	wkfree(struct bib, db);
+	return NULL;
 }
 
 void bib_get(struct bib *db)
@@ -404,7 +1711,11 @@ static void release_session(struct rb_node *node, void *arg)
 		kfree_skb(session->stored);
 	}
 
-	free_session(session);
+	/*
+	 * The prefix was either unlinked by detach_session() or is dying along
+	 * with the whole BIB.
+	 */
+	free_session_rcu(session);
 }
 
 /**
@@ -415,23 +1726,44 @@ static void release_bib_entry(struct rb_node *node, void *arg)
 {
 	struct tabled_bib *bib = bib4_entry(node);
 	rbtree_clear(&bib->sessions, release_session, NULL);
-	free_bib(bib);
+	free_bib_rcu(bib);
 }
 
-static void release_bib(struct kref *refs)
+static void release_stray(struct rb_node *node, void *arg)
 {
-	struct bib *db;
-	db = container_of(refs, struct bib, refs);
+	wkfree(struct bib_stray, rb_entry(node, struct bib_stray, hook));
+}
+
+static void release_table(struct bib_table *table)
+{
+	struct bib_shard *shard;
 
 	/*
-	 * The trees share the entries, so only one tree of each protocol
-	 * needs to be emptied.
+	 * The trees share the entries, so only one tree of each shard needs to
+	 * be emptied.
+	 * Pending growths have to be stopped first; they would touch the
+	 * entries.
 	 */
-	rbtree_clear(&db->udp.tree4, release_bib_entry, NULL);
-	rbtree_clear(&db->tcp.tree4, release_bib_entry, NULL);
-	rbtree_clear(&db->icmp.tree4, release_bib_entry, NULL);
+	foreach_shard(table, shard) {
+		cancel_work_sync(&shard->grow_work);
+		rbtree_clear(&shard->tree4, release_bib_entry, NULL);
+	}
+	rbtree_clear(&table->strays, release_stray, NULL);
+
+	if (table->pkt_queue)
+		pktqueue_destroy(table->pkt_queue);
+
+	destroy_table(table);
+}
+
+static void release_bib(struct kref *refs)
+{
+	struct bib *db;
+	db = container_of(refs, struct bib, refs);
 
-	pktqueue_destroy(db->tcp.pkt_queue);
+	release_table(&db->udp);
+	release_table(&db->tcp);
+	release_table(&db->icmp);
 
 	wkfree(struct bib, db);
 }
@@ -443,55 +1775,74 @@ void bib_put(struct bib *db)
 
 void bib_config_copy(struct bib *db, struct bib_config *config)
 {
-	spin_lock_bh(&db->tcp.lock);
-	config->bib_logging = db->tcp.log_bibs;
-	config->session_logging = db->tcp.log_sessions;
-	config->drop_by_addr = db->tcp.drop_by_addr;
-	config->ttl.tcp_est = db->tcp.est_timer.timeout;
-	config->ttl.tcp_trans = db->tcp.trans_timer.timeout;
-	config->max_stored_pkts = db->tcp.pkt_limit;
-	config->drop_external_tcp = db->tcp.drop_v4_syn;
-	spin_unlock_bh(&db->tcp.lock);
-
-	spin_lock_bh(&db->udp.lock);
-	config->ttl.udp = db->udp.est_timer.timeout;
-	spin_unlock_bh(&db->udp.lock);
-
-	spin_lock_bh(&db->icmp.lock);
-	config->ttl.icmp = db->icmp.est_timer.timeout;
-	spin_unlock_bh(&db->icmp.lock);
+	struct bib_shard *shard;
+
+	/* All the shards share the same configuration. */
+
+	shard = &db->tcp.shards[0];
+	spin_lock_bh(&shard->lock);
+	config->bib_logging = shard->log_bibs;
+	config->session_logging = shard->log_sessions;
+	config->drop_by_addr = shard->drop_by_addr;
+	config->ttl.tcp_est = shard->est_timer.timeout;
+	config->ttl.tcp_trans = shard->trans_timer.timeout;
+	config->max_stored_pkts = shard->pkt_limit;
+	config->drop_external_tcp = shard->drop_v4_syn;
+	spin_unlock_bh(&shard->lock);
+
+	config->clean_budget = READ_ONCE(db->clean_budget);
+
+	shard = &db->udp.shards[0];
+	spin_lock_bh(&shard->lock);
+	config->ttl.udp = shard->est_timer.timeout;
+	spin_unlock_bh(&shard->lock);
+
+	shard = &db->icmp.shards[0];
+	spin_lock_bh(&shard->lock);
+	config->ttl.icmp = shard->est_timer.timeout;
+	spin_unlock_bh(&shard->lock);
 }
 
 void bib_config_set(struct bib *db, struct bib_config *config)
 {
-	spin_lock_bh(&db->tcp.lock);
-	db->tcp.log_bibs = config->bib_logging;
-	db->tcp.log_sessions = config->session_logging;
-	db->tcp.drop_by_addr = config->drop_by_addr;
-	db->tcp.est_timer.timeout = config->ttl.tcp_est;
-	db->tcp.trans_timer.timeout = config->ttl.tcp_trans;
-	db->tcp.pkt_limit = config->max_stored_pkts;
-	db->tcp.drop_v4_syn = config->drop_external_tcp;
-	spin_unlock_bh(&db->tcp.lock);
+	struct bib_shard *shard;
+
+	WRITE_ONCE(db->clean_budget, config->clean_budget);
+
+	foreach_shard(&db->tcp, shard) {
+		spin_lock_bh(&shard->lock);
+		shard->log_bibs = config->bib_logging;
+		shard->log_sessions = config->session_logging;
+		shard->drop_by_addr = config->drop_by_addr;
+		shard->est_timer.timeout = clamp_timeout(config->ttl.tcp_est);
+		shard->trans_timer.timeout = clamp_timeout(config->ttl.tcp_trans);
+		shard->pkt_limit = config->max_stored_pkts;
+		shard->drop_v4_syn = config->drop_external_tcp;
+		spin_unlock_bh(&shard->lock);
+	}
 
-	spin_lock_bh(&db->udp.lock);
-	db->udp.drop_by_addr = config->drop_by_addr;
-	db->udp.est_timer.timeout = config->ttl.udp;
-	spin_unlock_bh(&db->udp.lock);
+	foreach_shard(&db->udp, shard) {
+		spin_lock_bh(&shard->lock);
+		shard->drop_by_addr = config->drop_by_addr;
+		shard->est_timer.timeout = clamp_timeout(config->ttl.udp);
+		spin_unlock_bh(&shard->lock);
+	}
 
-	spin_lock_bh(&db->icmp.lock);
-	db->icmp.est_timer.timeout = config->ttl.icmp;
-	spin_unlock_bh(&db->icmp.lock);
+	foreach_shard(&db->icmp, shard) {
+		spin_lock_bh(&shard->lock);
+		shard->est_timer.timeout = clamp_timeout(config->ttl.icmp);
+		spin_unlock_bh(&shard->lock);
+	}
 }
 
-static void log_bib(struct bib_table *table,
+static void log_bib(struct bib_shard *shard,
 		struct tabled_bib *bib,
 		char *action)
 {
 	struct timeval tval;
 	struct tm t;
 
-	if (!table->log_bibs)
+	if (!shard->log_bibs)
 		return;
 
 	do_gettimeofday(&tval);
@@ -504,21 +1855,23 @@ static void log_bib(struct bib_table *table,
 			l4proto_to_string(bib->proto));
 }
 
-static void log_new_bib(struct bib_table *table, struct tabled_bib *bib)
+static void log_new_bib(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	return log_bib(table, bib, "Mapped");
+	return log_bib(shard, bib, "Mapped");
 }
 
-static void log_session(struct bib_table *table,
+static void log_session(struct bib_shard *shard,
 		struct tabled_session *session,
 		char *action)
 {
+	struct ipv6_transport_addr dst6;
 	struct timeval tval;
 	struct tm t;
 
-	if (!table->log_sessions)
+	if (!shard->log_sessions)
 		return;
 
+	get_dst6(shard->table, session, &dst6);
 	do_gettimeofday(&tval);
 	time_to_tm(tval.tv_sec, 0, &t);
 	log_info("%ld/%d/%d %d:%d:%d (GMT) - %s %pI6c#%u|%pI6c#%u|"
@@ -526,16 +1879,16 @@ static void log_session(struct bib_table *table,
 			1900 + t.tm_year, t.tm_mon + 1, t.tm_mday,
 			t.tm_hour, t.tm_min, t.tm_sec, action,
 			&session->bib->src6.l3, session->bib->src6.l4,
-			&session->dst6.l3, session->dst6.l4,
+			&dst6.l3, dst6.l4,
 			&session->bib->src4.l3, session->bib->src4.l4,
 			&session->dst4.l3, session->dst4.l4,
 			l4proto_to_string(session->bib->proto));
 }
 
-static void log_new_session(struct bib_table *table,
+static void log_new_session(struct bib_shard *shard,
 		struct tabled_session *session)
 {
-	return log_session(table, session, "Added session");
+	return log_session(shard, session, "Added session");
 }
 
 /**
@@ -545,7 +1898,7 @@ static void log_new_session(struct bib_table *table,
  * This function does not actually send the probe; it merely prepares it so the
  * caller can commit to sending it after releasing the spinlock.
  */
-static void handle_probe(struct bib_table *table,
+static void handle_probe(struct bib_shard *shard,
 		struct list_head *probes,
 		struct tabled_session *session,
 		struct session_entry *tmp)
@@ -572,7 +1925,7 @@ static void handle_probe(struct bib_table *table,
 	if (session->stored) {
 		probe->skb = session->stored;
 		session->stored = NULL;
-		table->pkt_count--;
+		atomic_dec(&shard->table->pkt_count);
 	} else {
 		probe->skb = NULL;
 	}
@@ -586,10 +1939,10 @@ discard_probe:
 	 * we do not want that massive thing to linger in the database anymore,
 	 * especially if we failed due to a memory allocation.
 	 */
-	kill_stored_pkt(table, session);
+	kill_stored_pkt(shard, session);
 }
 
-static void rm(struct bib_table *table,
+static void rm(struct bib_shard *shard,
 		struct list_head *probes,
 		struct tabled_session *session,
 		struct session_entry *tmp)
@@ -597,69 +1950,96 @@ static void rm(struct bib_table *table,
 	struct tabled_bib *bib = session->bib;
 
 	if (session->stored)
-		handle_probe(table, probes, session, tmp);
+		handle_probe(shard, probes, session, tmp);
 
+	write_seqcount_begin(&shard->seq);
 	rb_erase(&session->tree_hook, &bib->sessions);
+	write_seqcount_end(&shard->seq);
 	list_del(&session->list_hook);
-	log_session(table, session, "Forgot session");
-	free_session(session);
-	table->session_count--;
+	log_session(shard, session, "Forgot session");
+	uncount_session(shard, session);
+	unlink_prefix(shard->table, session);
+	free_session_rcu(session);
 
 	if (!bib->is_static && RB_EMPTY_ROOT(&bib->sessions)) {
-		rb_erase(&bib->hook6, &table->tree6);
-		rb_erase(&bib->hook4, &table->tree4);
-		log_bib(table, bib, "Forgot");
-		free_bib(bib);
-		table->bib_count--;
+		rm_stray(shard->table, bib);
+		write_seqcount_begin(&shard->seq);
+		hash_rm(bib);
+		rb_erase(&bib->hook4, &shard->tree4);
+		write_seqcount_end(&shard->seq);
+		ports_rm(shard, bib);
+		log_bib(shard, bib, "Forgot");
+		unlink_bib_prefix(shard->table, bib);
+		free_bib_rcu(bib);
+		shard->bib_count--;
+	}
+}
+
+static unsigned int slot_index(unsigned long key, unsigned int level)
+{
+	return (key >> (WHEEL_TICK_SHIFT + level * WHEEL_BITS)) & WHEEL_MASK;
+}
+
+/**
+ * Hangs @session from the @wheel slot that corresponds to its update_time.
+ *
+ * Notice that the wheel is keyed by update time, not expiration time. The
+ * cleaner processes the slots @timeout jiffies late instead. This way, a
+ * timeout change applies to all of the expirer's sessions right away, just
+ * like it did when they were sorted in a list.
+ */
+static void wheel_add(struct timer_wheel *wheel, struct tabled_session *session)
+{
+	unsigned long key;
+	unsigned long delta;
+	unsigned int level;
+
+	key = ALIGN(get_update_time(session), WHEEL_TICK);
+	if (time_before(key, wheel->clk))
+		key = wheel->clk; /* Overdue; process it as soon as possible. */
+
+	delta = (key - wheel->clk) >> WHEEL_TICK_SHIFT;
+	if (delta > WHEEL_HORIZON) {
+		/* We'll take another look at it when the slot comes up. */
+		delta = WHEEL_HORIZON;
+		key = wheel->clk + (delta << WHEEL_TICK_SHIFT);
 	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < (1UL << ((level + 1) * WHEEL_BITS)))
+			break;
+
+	list_add_tail(&session->list_hook,
+			&wheel->slots[level][slot_index(key, level)]);
 }
 
 static void handle_fate_timer(struct tabled_session *session,
 		struct expire_timer *timer)
 {
-	session->update_time = jiffies;
-	session->expirer = timer;
+	set_update_time(session, jiffies);
+	session->timer = timer->type;
 	list_del(&session->list_hook);
-	list_add_tail(&session->list_hook, &timer->sessions);
+	wheel_add(&timer->wheel, session);
 }
 
-static int queue_unsorted_session(struct bib_table *table,
+static int queue_unsorted_session(struct bib_shard *shard,
 		struct tabled_session *session,
 		session_timer_type timer_type,
 		bool remove_first)
 {
 	struct expire_timer *expirer;
-	struct list_head *list;
-	struct list_head *cursor;
-	struct tabled_session *old;
 
-	switch (timer_type) {
-	case SESSION_TIMER_EST:
-		expirer = &table->est_timer;
-		break;
-	case SESSION_TIMER_TRANS:
-		expirer = &table->trans_timer;
-		break;
-	case SESSION_TIMER_SYN4:
-		expirer = &table->syn4_timer;
-		break;
-	default:
+	expirer = get_expirer(shard, timer_type);
+	if (!expirer) {
 		log_warn_once("incoming joold session's timer (%d) is unknown.",
 				timer_type);
 		return -EINVAL;
 	}
 
-	list = &expirer->sessions;
-	for (cursor = list->prev; cursor != list; cursor = cursor->prev) {
-		old = list_entry(cursor, struct tabled_session, list_hook);
-		if (old->update_time < session->update_time)
-			break;
-	}
-
 	if (remove_first)
 		list_del(&session->list_hook);
-	list_add(&session->list_hook, cursor);
-	session->expirer = expirer;
+	wheel_add(&expirer->wheel, session);
+	session->timer = timer_type;
 	return 0;
 }
 
@@ -667,7 +2047,7 @@ static int queue_unsorted_session(struct bib_table *table,
  * Assumes result->session has been set (result->session_set is true).
  */
 static verdict decide_fate(struct collision_cb *cb,
-		struct bib_table *table,
+		struct bib_shard *shard,
 		struct tabled_session *session,
 		struct list_head *probes)
 {
@@ -677,31 +2057,35 @@ static verdict decide_fate(struct collision_cb *cb,
 	if (!cb)
 		return VERDICT_CONTINUE;
 
-	tstose(session, &tmp);
+	tstose(shard, session, &tmp);
 	fate = cb->cb(&tmp, cb->arg);
 
 	/* The callback above is entitled to tweak these fields. */
-	session->state = tmp.state;
-	session->update_time = tmp.update_time;
+	if (session->state != tmp.state) {
+		write_seqcount_begin(&shard->seq);
+		session->state = tmp.state;
+		write_seqcount_end(&shard->seq);
+	}
+	set_update_time(session, tmp.update_time);
 	if (!tmp.has_stored)
-		kill_stored_pkt(table, session);
-	/* Also the expirer, which is down below. */
+		kill_stored_pkt(shard, session);
+	/* Also the timer, which is down below. */
 
 	switch (fate) {
 	case FATE_TIMER_EST:
-		handle_fate_timer(session, &table->est_timer);
+		handle_fate_timer(session, &shard->est_timer);
 		break;
 
 	case FATE_PROBE:
 		/* TODO ICMP errors aren't supposed to drop down to TRANS. */
-		handle_probe(table, probes, session, &tmp);
+		handle_probe(shard, probes, session, &tmp);
 		/* Fall through. */
 	case FATE_TIMER_TRANS:
-		handle_fate_timer(session, &table->trans_timer);
+		handle_fate_timer(session, &shard->trans_timer);
 		break;
 
 	case FATE_RM:
-		rm(table, probes, session, &tmp);
+		rm(shard, probes, session, &tmp);
 		break;
 
 	case FATE_PRESERVE:
@@ -715,7 +2099,7 @@ static verdict decide_fate(struct collision_cb *cb,
 		 * If timer type was invalid, well don't change the expirer.
 		 * We left a warning in the log.
 		 */
-		queue_unsorted_session(table, session, tmp.timer_type, true);
+		queue_unsorted_session(shard, session, tmp.timer_type, true);
 		break;
 	}
 
@@ -837,40 +2221,55 @@ static void post_fate(struct net *ns, struct list_head *probes)
 }
 
 struct slot_group {
-	struct tree_slot bib6;
 	struct tree_slot bib4;
 	struct tree_slot session;
+	/**
+	 * Stray index node for the new BIB entry, if it needs one.
+	 * (Only joold-synchronized entries might.)
+	 */
+	struct bib_stray *stray;
 };
 
-static void commit_bib_add(struct bib_table *table, struct slot_group *slots)
+static void commit_bib_add(struct bib_shard *shard, struct slot_group *slots)
 {
-	treeslot_commit(&slots->bib6);
+	struct tabled_bib *bib = bib4_entry(slots->bib4.entry);
+
+	write_seqcount_begin(&shard->seq);
+	hash_add(shard, bib);
 	treeslot_commit(&slots->bib4);
-	table->bib_count++;
+	write_seqcount_end(&shard->seq);
+	ports_add(shard, bib);
+	shard->bib_count++;
+	grow_hashes(shard);
+	/* Its only session is the one that created it. */
+	link_bib_prefix(shard->table, bib, node2session(bib->sessions.rb_node));
+
+	if (slots->stray) {
+		add_stray(shard->table, slots->stray, bib);
+		slots->stray = NULL;
+	}
 }
 
-static void commit_session_add(struct bib_table *table, struct tree_slot *slot)
+/*
+ * The lockless readers might run into the new node as soon as it's linked, so
+ * it goes in through rb_link_node_rcu().
+ */
+static void commit_session_add(struct bib_shard *shard,
+		struct tabled_session *session,
+		struct tree_slot *slot)
 {
-	treeslot_commit(slot);
-	table->session_count++;
+	write_seqcount_begin(&shard->seq);
+	treeslot_commit_rcu(slot);
+	write_seqcount_end(&shard->seq);
+	count_session(shard, session);
 }
 
 static void attach_timer(struct tabled_session *session,
 		struct expire_timer *expirer)
 {
-	session->update_time = jiffies;
-	session->expirer = expirer;
-	list_add_tail(&session->list_hook, &expirer->sessions);
-}
-
-static int compare_src6(struct tabled_bib *a, struct ipv6_transport_addr *b)
-{
-	return taddr6_compare(&a->src6, b);
-}
-
-static int compare_src6_rbnode(struct rb_node *a, struct rb_node *b)
-{
-	return taddr6_compare(&bib6_entry(a)->src6, &bib6_entry(b)->src6);
+	set_update_time(session, jiffies);
+	session->timer = expirer->type;
+	wheel_add(&expirer->wheel, session);
 }
 
 static int compare_src4(struct tabled_bib const *a,
@@ -889,36 +2288,12 @@ static int compare_dst4(struct tabled_session *a, struct tabled_session *b)
 	return taddr4_compare(&a->dst4, &b->dst4);
 }
 
-static struct tabled_bib *find_bib6(struct bib_table *table,
-		struct ipv6_transport_addr *addr)
-{
-	return rbtree_find(addr, &table->tree6, compare_src6, struct tabled_bib,
-			hook6);
-}
-
-static struct tabled_bib *find_bib4(struct bib_table *table,
-		struct ipv4_transport_addr *addr)
-{
-	return rbtree_find(addr, &table->tree4, compare_src4, struct tabled_bib,
-			hook4);
-}
-
-static struct tabled_bib *find_bibtree6_slot(struct bib_table *table,
-		struct tabled_bib *new,
-		struct tree_slot *slot)
-{
-	struct rb_node *collision;
-	collision = rbtree_find_slot(&new->hook6, &table->tree6,
-			compare_src6_rbnode, slot);
-	return bib6_entry(collision);
-}
-
-static struct tabled_bib *find_bibtree4_slot(struct bib_table *table,
+static struct tabled_bib *find_bibtree4_slot(struct bib_shard *shard,
 		struct tabled_bib *new,
 		struct tree_slot *slot)
 {
 	struct rb_node *collision;
-	collision = rbtree_find_slot(&new->hook4, &table->tree4,
+	collision = rbtree_find_slot(&new->hook4, &shard->tree4,
 			compare_src4_rbnode, slot);
 	return bib4_entry(collision);
 }
@@ -953,7 +2328,8 @@ static struct tabled_session *find_session_slot(struct tabled_bib *bib,
 	int comparison;
 
 	treeslot_init(slot, &bib->sessions, &new->tree_hook);
-	node = bib->sessions.rb_node;
+	/* Might be lockless; see refresh_rcu(). */
+	node = rcu_dereference_raw(bib->sessions.rb_node);
 	if (allow)
 		*allow = false;
 
@@ -967,10 +2343,10 @@ static struct tabled_session *find_session_slot(struct tabled_bib *bib,
 		slot->parent = node;
 		if (comparison < 0) {
 			slot->rb_link = &node->rb_right;
-			node = node->rb_right;
+			node = rcu_dereference_raw(node->rb_right);
 		} else if (comparison > 0) {
 			slot->rb_link = &node->rb_left;
-			node = node->rb_left;
+			node = rcu_dereference_raw(node->rb_left);
 		} else {
 			return session;
 		}
@@ -979,13 +2355,17 @@ static struct tabled_session *find_session_slot(struct tabled_bib *bib,
 	return NULL;
 }
 
-static int alloc_bib_session(struct bib_session_tuple *tuple)
+static int alloc_bib_session(struct bib_table *table,
+		struct bib_session_tuple *tuple,
+		const struct ipv6_transport_addr *dst6,
+		const struct ipv4_transport_addr *dst4)
 {
 	tuple->bib = alloc_bib(GFP_ATOMIC);
 	if (!tuple->bib)
 		return -ENOMEM;
+	tuple->bib->prefix = PREFIX_NONE;
 
-	tuple->session = alloc_session(GFP_ATOMIC);
+	tuple->session = alloc_session(table, dst6, dst4);
 	if (!tuple->session) {
 		free_bib(tuple->bib);
 		return -ENOMEM;
@@ -994,19 +2374,20 @@ static int alloc_bib_session(struct bib_session_tuple *tuple)
 	return 0;
 }
 
-static int create_bib_session6(struct bib_session_tuple *tuple,
+static int create_bib_session6(struct bib_table *table,
+		struct bib_session_tuple *tuple,
 		struct tuple *tuple6,
 		struct ipv4_transport_addr *dst4,
 		tcp_state state)
 {
 	int error;
 
-	error = alloc_bib_session(tuple);
+	error = alloc_bib_session(table, tuple, &tuple6->dst.addr6, dst4);
 	if (error)
 		return error;
 
 	/*
-	 * Hooks, expirer fields and session->bib are left uninitialized since
+	 * Hooks, timer fields and session->bib are left uninitialized since
 	 * they depend on database knowledge.
 	 */
 
@@ -1019,45 +2400,44 @@ static int create_bib_session6(struct bib_session_tuple *tuple,
 	tuple->bib->proto = tuple6->l4_proto;
 	tuple->bib->is_static = false;
 	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = tuple6->dst.addr6;
-	tuple->session->dst4 = *dst4;
 	tuple->session->state = state;
 	tuple->session->stored = NULL;
 	return 0;
 }
 
-static struct tabled_session *create_session4(struct tuple *tuple4,
+static struct tabled_session *create_session4(struct bib_table *table,
+		struct tuple *tuple4,
 		struct ipv6_transport_addr *dst6,
 		tcp_state state)
 {
 	struct tabled_session *session;
 
-	session = alloc_session(GFP_ATOMIC);
+	session = alloc_session(table, dst6, &tuple4->src.addr4);
 	if (!session)
 		return NULL;
 
 	/*
-	 * Hooks, expirer fields and session->bib are left uninitialized since
+	 * Hooks, timer fields and session->bib are left uninitialized since
 	 * they depend on database knowledge.
 	 */
-	session->dst6 = *dst6;
-	session->dst4 = tuple4->src.addr4;
 	session->state = state;
 	session->stored = NULL;
 	return session;
 }
 
-static int create_bib_session(struct session_entry *session,
+static int create_bib_session(struct bib_table *table,
+		struct session_entry *session,
 		struct bib_session_tuple *tuple)
 {
 	int error;
 
-	error = alloc_bib_session(tuple);
+	error = alloc_bib_session(table, tuple, &session->dst6,
+			&session->dst4);
 	if (error)
 		return error;
 
 	/*
-	 * Hooks, most expirer fields and session->bib are left uninitialized
+	 * Hooks, most timer fields and session->bib are left uninitialized
 	 * since they depend on database knowledge.
 	 */
 	tuple->bib->src6 = session->src6;
@@ -1065,22 +2445,20 @@ static int create_bib_session(struct session_entry *session,
 	tuple->bib->proto = session->proto;
 	tuple->bib->is_static = false;
 	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = session->dst6;
-	tuple->session->dst4 = session->dst4;
 	tuple->session->state = session->state;
-	tuple->session->update_time = session->update_time;
+	set_update_time(tuple->session, session->update_time);
 	tuple->session->stored = NULL;
 	return 0;
 }
 
 /**
  * Boilerplate code to finish hanging @new->session (and potentially @new->bib
- * as well) on one af @table's trees. 6-to-4 direction.
+ * as well) on one af @shard's trees. 6-to-4 direction.
  *
  * It assumes @slots already describes the tree containers where the entries are
  * supposed to be added.
  */
-static void commit_add6(struct bib_table *table,
+static void commit_add6(struct bib_shard *shard,
 		struct bib_session_tuple *old,
 		struct bib_session_tuple *new,
 		struct slot_group *slots,
@@ -1088,27 +2466,27 @@ static void commit_add6(struct bib_table *table,
 		struct bib_session *result)
 {
 	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(table, &slots->session);
+	commit_session_add(shard, new->session, &slots->session);
 	attach_timer(new->session, expirer);
-	log_new_session(table, new->session);
-	tstobs(new->session, result);
+	log_new_session(shard, new->session);
+	tstobs(shard, new->session, result);
 	new->session = NULL; /* Do not free! */
 
 	if (!old->bib) {
-		commit_bib_add(table, slots);
-		log_new_bib(table, new->bib);
+		commit_bib_add(shard, slots);
+		log_new_bib(shard, new->bib);
 		new->bib = NULL; /* Do not free! */
 	}
 }
 
 /**
- * Boilerplate code to finish hanging *@new on one af @table's trees.
+ * Boilerplate code to finish hanging *@new on one af @shard's trees.
  * 4-to-6 direction.
  *
  * It assumes @slot already describes the tree container where the session is
  * supposed to be added.
  */
-static void commit_add4(struct bib_table *table,
+static void commit_add4(struct bib_shard *shard,
 		struct bib_session_tuple *old,
 		struct tabled_session **new,
 		struct tree_slot *slot,
@@ -1118,21 +2496,21 @@ static void commit_add4(struct bib_table *table,
 	struct tabled_session *session = *new;
 
 	session->bib = old->bib;
-	commit_session_add(table, slot);
+	commit_session_add(shard, session, slot);
 	attach_timer(session, expirer);
-	log_new_session(table, session);
-	tstobs(session, result);
+	log_new_session(shard, session);
+	tstobs(shard, session, result);
 	*new = NULL; /* Do not free! */
 }
 
 /**
- * Boilerplate code to finish hanging *@new on one af @table's trees.
+ * Boilerplate code to finish hanging *@new on one af @shard's trees.
  * joold version.
  *
  * It assumes @slots already describes the tree containers where the entries are
  * supposed to be added.
  */
-static int commit_add(struct bib_table *table,
+static int commit_add(struct bib_shard *shard,
 		struct bib_session_tuple *old,
 		struct bib_session_tuple *new,
 		struct slot_group *slots,
@@ -1140,55 +2518,52 @@ static int commit_add(struct bib_table *table,
 {
 	int error;
 
-	error = queue_unsorted_session(table, new->session, timer_type, false);
+	error = queue_unsorted_session(shard, new->session, timer_type, false);
 	if (error)
 		return error;
 
 	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(table, &slots->session);
-	log_new_session(table, new->session);
+	commit_session_add(shard, new->session, &slots->session);
+	log_new_session(shard, new->session);
 	new->session = NULL; /* Do not free! */
 
 	if (!old->bib) {
-		commit_bib_add(table, slots);
-		log_new_bib(table, new->bib);
+		commit_bib_add(shard, slots);
+		log_new_bib(shard, new->bib);
 		new->bib = NULL; /* Do not free! */
 	}
 
 	return 0;
 }
 
-struct detach_args {
-	struct bib_table *table;
-	struct sk_buff *probes;
-	unsigned int detached;
-};
-
 static void detach_session(struct rb_node *node, void *arg)
 {
 	struct tabled_session *session = node2session(node);
-	struct detach_args *args = arg;
+	struct bib_shard *shard = arg;
 
 	list_del(&session->list_hook);
 	if (session->stored)
-		args->table->pkt_count--;
-	args->detached++;
+		atomic_dec(&shard->table->pkt_count);
+	uncount_session(shard, session);
+	unlink_prefix(shard->table, session);
 }
 
-static unsigned int detach_sessions(struct bib_table *table,
-		struct tabled_bib *bib)
+static void detach_sessions(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	struct detach_args arg = { .table = table, .detached = 0, };
-	rbtree_foreach(&bib->sessions, detach_session, &arg);
-	return arg.detached;
+	rbtree_foreach(&bib->sessions, detach_session, shard);
 }
 
-static void detach_bib(struct bib_table *table, struct tabled_bib *bib)
+static void detach_bib(struct bib_shard *shard, struct tabled_bib *bib)
 {
-	rb_erase(&bib->hook6, &table->tree6);
-	rb_erase(&bib->hook4, &table->tree4);
-	table->bib_count--;
-	table->session_count -= detach_sessions(table, bib);
+	rm_stray(shard->table, bib);
+	write_seqcount_begin(&shard->seq);
+	hash_rm(bib);
+	rb_erase(&bib->hook4, &shard->tree4);
+	write_seqcount_end(&shard->seq);
+	ports_rm(shard, bib);
+	shard->bib_count--;
+	unlink_bib_prefix(shard->table, bib);
+	detach_sessions(shard, bib);
 }
 
 struct bib_delete_list {
@@ -1212,118 +2587,89 @@ static void commit_delete_list(struct bib_delete_list *list)
 	}
 }
 
-/**
- * Tests whether @predecessor's immediate succesor tree slot is a suitable
- * placeholder for @bib. Returns the colliding node.
- *
- * (That is, returns NULL on success, a collision on failure.)
- *
- * In other words:
- * Assumes that @predecessor belongs to @table's v4 tree and that it is @bib's
- * predecessor. (ie. @predecessor's transport address is @bib's transport
- * address - 1.) You want to test whether @bib can be inserted to the tree.
- * If @predecessor's succesor collides with @bib (ie. it has @bib's v4 address),
- * it returns the colliding succesor.
- * If @predecessor's succesor does not collide with @bib, it returns NULL and
- * initializes @slot so you can actually add @bib to the tree.
- */
-static struct tabled_bib *try_next(struct bib_table *table,
-		struct tabled_bib *predecessor,
-		struct tabled_bib *bib,
-		struct tree_slot *slot)
-{
-	struct tabled_bib *next;
-
-	next = bib4_entry(rb_next(&predecessor->hook4));
-	if (!next) {
-		/* There is no succesor and therefore no collision. */
-		slot->tree = &table->tree4;
-		slot->entry = &bib->hook4;
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-		return NULL;
-	}
-
-	if (taddr4_equals(&next->src4, &bib->src4))
-		return next; /* Next is yet another collision. */
-
-	slot->tree = &table->tree4;
-	slot->entry = &bib->hook4;
-	if (predecessor->hook4.rb_right) {
-		slot->parent = &next->hook4;
-		slot->rb_link = &slot->parent->rb_left;
-	} else {
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-	}
-	return NULL;
-}
-
 /**
  * This is this function in pseudocode form:
  *
  * 	// wraps around until offset - 1
  * 	foreach (mask in @masks starting from some offset)
- * 		if (mask is not taken by an existing BIB entry from @table)
+ * 		if (mask does not belong to @shard)
+ * 			continue
+ * 		if (mask is not taken by an existing BIB entry)
  * 			init the new BIB entry, @bib, using mask
  * 			init @slot as the tree slot where @bib should be added
  * 			return success (0)
  * 	return failure (-ENOENT)
  *
+ * (A mask "belongs" to @shard if its port yields @shard's index. This is what
+ * prevents the new entry from becoming a stray.)
+ *
+ * The masks are requested in runs of consecutive ports, and the taken ones are
+ * skipped in bulk by way of the port maps, so the cost does not depend on how
+ * crowded pool4 is.
  */
-static int find_available_mask(struct bib_table *table,
+static int find_available_mask(struct bib_shard *shard,
 		struct mask_domain *masks,
 		struct tabled_bib *bib,
 		struct tree_slot *slot)
 {
-	struct tabled_bib *collision = NULL;
+	struct bib_table *table = shard->table;
+	struct port_map *map;
+	struct tabled_bib *collision;
+	unsigned int port;
+	__u16 last;
 	int error;
-	bool consecutive;
 
-	/*
-	 * We're going to assume the masks are generally consecutive.
-	 * I think it's a fair assumption until someone requests otherwise as a
-	 * new feature.
-	 * This allows us to find an unoccupied mask with minimal further tree
-	 * traversal.
-	 */
-	do {
-		error = mask_domain_next(masks, &bib->src4, &consecutive);
+	while (true) {
+		error = mask_domain_next(masks, &bib->src4, &last);
 		if (error)
 			return error;
 
-		/*
-		 * Just for the sake of clarity:
-		 * @consecutive is never true on the first iteration.
-		 */
-		collision = consecutive
-				? try_next(table, collision, bib, slot)
-				: find_bibtree4_slot(table, bib, slot);
-	} while (collision);
+		map = find_port_map(shard, &bib->src4.l3);
+		port = next_free_port(shard, map, bib->src4.l4, last);
 
-	return 0;
+		while (port <= last) {
+			bib->src4.l4 = port;
+
+			collision = find_bibtree4_slot(shard, bib, slot);
+			if (collision) {
+				/* The map was out of date. */
+				ports_add(shard, collision);
+				map = find_port_map(shard, &bib->src4.l3);
+			} else if (!stray_exists(table, &bib->src4)) {
+				return 0;
+			}
+
+			port = next_free_port(shard, map, port + 1, last);
+		}
+	}
 }
 
-static int upgrade_pktqueue_session(struct bib_table *table,
+static int upgrade_pktqueue_session(struct bib_shard *shard,
 		struct mask_domain *masks,
 		struct bib_session_tuple *new,
 		struct bib_session_tuple *old)
 {
+	struct bib_table *table = shard->table;
 	struct pktqueue_session *sos; /* "simultaneous open" session */
+	struct bib_shard *port_shard;
+	struct bib_stray *stray = NULL;
 	struct tabled_bib *bib;
 	struct tabled_bib *collision;
 	struct tabled_session *session;
-	struct tree_slot bib_slot6;
+	struct ipv6_transport_addr dst6;
 	struct tree_slot bib_slot4;
 	int error;
 
 	if (new->bib->proto != L4PROTO_TCP)
 		return -ESRCH;
 
-	sos = pktqueue_find(table->pkt_queue, &new->session->dst6, masks);
+	get_dst6(table, new->session, &dst6);
+	spin_lock(&table->pktqueue_lock);
+	sos = pktqueue_find(table->pkt_queue, &dst6, masks);
+	spin_unlock(&table->pktqueue_lock);
 	if (!sos)
 		return -ESRCH;
-	table->pkt_count--;
+	atomic_dec(&table->pkt_count);
 
 	if (!masks) {
 		/*
@@ -1366,7 +2712,7 @@ static int upgrade_pktqueue_session(struct bib_table *table,
 	 * We're going to pretend that @sos has been a valid V4 INIT session all
 	 * along.
 	 */
-	error = alloc_bib_session(old);
+	error = alloc_bib_session(table, old, &sos->dst6, &sos->dst4);
 	if (error) {
 		pktqueue_put_node(sos);
 		return error;
@@ -1381,43 +2727,107 @@ static int upgrade_pktqueue_session(struct bib_table *table,
 	bib->is_static = false;
 	bib->sessions = RB_ROOT;
 
-	session->dst6 = sos->dst6;
-	session->dst4 = sos->dst4;
 	session->state = V4_INIT;
 	session->bib = bib;
-	session->update_time = jiffies;
+	set_update_time(session, jiffies);
 	session->stored = NULL;
 
+	/*
+	 * The v4 node chose src4, so there is no guarantee that it belongs to
+	 * this shard. If it doesn't, the entry has to become a stray, and for
+	 * that we need the port shard's lock. We're already holding a shard
+	 * lock, so we cannot wait for it without breaking the lock ordering;
+	 * if it's busy, drop the SO. (Same reaction as the joold case above.)
+	 */
+	port_shard = &table->shards[shard4_index(table, &bib->src4)];
+	if (port_shard != shard) {
+		stray = wkmalloc(struct bib_stray, GFP_ATOMIC);
+		if (!stray)
+			goto trainwreck;
+		if (!spin_trylock(&port_shard->lock)) {
+			log_debug("Port shard is busy; dropping the SO.");
+			goto trainwreck;
+		}
+	}
+
 	/*
 	 * This *has* to work. src6 wasn't in the database because we just
 	 * looked it up and src4 wasn't either because pktqueue had it.
+	 * (Unless the entry was added statically after the SO packet was
+	 * stored, in which case @port_shard or the stray index has it.)
 	 */
-	collision = find_bibtree6_slot(table, bib, &bib_slot6);
-	if (WARN(collision, "BIB entry was and then wasn't in the v6 tree."))
-		goto trainwreck;
-	collision = find_bibtree4_slot(table, bib, &bib_slot4);
+	collision = find_bib6(shard, &bib->src6);
+	if (WARN(collision, "BIB entry was and then wasn't in the v6 index."))
+		goto unlock_port;
+	collision = find_bibtree4_slot(shard, bib, &bib_slot4);
 	if (WARN(collision, "BIB entry was and then wasn't in the v4 tree."))
-		goto trainwreck;
-	treeslot_commit(&bib_slot6);
-	treeslot_commit(&bib_slot4);
-
+		goto unlock_port;
+	if (port_shard != shard) {
+		if (find_bib4(port_shard, &bib->src4)
+				|| stray_exists(table, &bib->src4))
+			goto unlock_port;
+	}
+	/* (Nobody can see @bib's tree until hash_add() publishes @bib.) */
 	rb_link_node(&session->tree_hook, NULL, &bib->sessions.rb_node);
 	rb_insert_color(&session->tree_hook, &bib->sessions);
-	attach_timer(session, &table->syn4_timer);
+	write_seqcount_begin(&shard->seq);
+	hash_add(shard, bib);
+	treeslot_commit(&bib_slot4);
+	write_seqcount_end(&shard->seq);
+	ports_add(shard, bib);
+	shard->bib_count++;
+	count_session(shard, session);
+	link_bib_prefix(table, bib, session);
+	if (stray) {
+		add_stray(table, stray, bib);
+		spin_unlock(&port_shard->lock);
+	}
+
+	attach_timer(session, &shard->syn4_timer);
 
 	pktqueue_put_node(sos);
 
-	log_new_bib(table, bib);
-	log_new_session(table, session);
+	log_new_bib(shard, bib);
+	log_new_session(shard, session);
 	return 0;
 
+unlock_port:
+	if (port_shard != shard)
+		spin_unlock(&port_shard->lock);
+	/* Fall through. */
 trainwreck:
 	pktqueue_put_node(sos);
+	if (stray)
+		wkfree(struct bib_stray, stray);
 	free_bib(bib);
-	free_session(session);
+	free_session(table, session);
 	return -EINVAL;
 }
 
+/**
+ * Makes sure that no other shard owns @bib's (predefined) src4. If @bib needs
+ * to become a stray, also allocates its index node.
+ * Assumes @bib's port shard is locked.
+ */
+static int prepare_stray(struct bib_shard *shard, struct tabled_bib *bib,
+		struct bib_stray **stray)
+{
+	struct bib_table *table = shard->table;
+	unsigned int port_index;
+
+	if (stray_exists(table, &bib->src4))
+		return -EEXIST;
+
+	port_index = shard4_index(table, &bib->src4);
+	if (port_index == shard->index)
+		return 0;
+	if (find_bib4(&table->shards[port_index], &bib->src4))
+		return -EEXIST;
+
+	*stray = wkmalloc(struct bib_stray, GFP_ATOMIC);
+	return *stray ? 0 : -ENOMEM;
+}
+
 static bool issue216_needed(struct mask_domain *masks,
 		struct bib_session_tuple *old)
 {
@@ -1427,6 +2837,142 @@ static bool issue216_needed(struct mask_domain *masks,
 			&& !mask_domain_matches(masks, &old->bib->src4);
 }
 
+/**
+ * Lockless version of the "session already exists" paths of the packet
+ * functions below.
+ *
+ * Almost every translated packet belongs to an established session, and all
+ * those need is a bump of the session's update_time. So instead of fighting
+ * over the shard lock, the session is looked up under RCU and refreshed lazily:
+ * it stays in its old wheel slot, and the cleaner moves it forward once it
+ * notices it's not expired after all.
+ *
+ * Anything more involved than that (creating the session, changing its state,
+ * moving it to another list) still needs the lock, so in that case this
+ * function gives up and returns false, and the caller has to do it the slow
+ * way. It also gives up if a writer was fiddling with the shard in the
+ * meantime (which is what @seq is for). Nothing is modified on failure.
+ *
+ * @session has to have been found while in the same RCU read-side critical
+ * section, after @seq was read from @shard->seq.
+ *
+ * On kernels whose session trees can't be searched locklessly (see
+ * RBTREE_LOCKLESS_READS), the callers give up right away.
+ */
+static bool refresh_rcu(struct bib_shard *shard,
+		struct tabled_session *session,
+		unsigned int seq,
+		struct collision_cb *cb,
+		struct bib_session *result)
+{
+	struct session_entry tmp;
+	tcp_state state;
+
+	if (session->timer != SESSION_TIMER_EST)
+		return false;
+	tstose(shard, session, &tmp);
+	if (tmp.has_stored)
+		return false;
+
+	if (cb) {
+		state = tmp.state;
+		if (cb->cb(&tmp, cb->arg) != FATE_TIMER_EST)
+			return false;
+		if (tmp.state != state || tmp.has_stored)
+			return false;
+	}
+
+	if (read_seqcount_retry(&shard->seq, seq))
+		return false;
+
+	tmp.update_time = jiffies;
+	set_update_time(session, tmp.update_time);
+
+	if (result) {
+		result->bib_set = true;
+		result->session_set = true;
+		result->session = tmp;
+	}
+	return true;
+}
+
+/**
+ * Attempts to handle a 6-to-4 packet that belongs to an existing session
+ * without locking @shard. See refresh_rcu().
+ */
+static bool refresh6_rcu(struct bib_shard *shard,
+		struct mask_domain *masks,
+		struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4,
+		struct collision_cb *cb,
+		struct bib_session *result)
+{
+	struct bib_session_tuple old;
+	struct tabled_session key;
+	struct tree_slot slot;
+	unsigned int seq;
+	bool success = false;
+
+	if (!RBTREE_LOCKLESS_READS)
+		return false;
+
+	rcu_read_lock_bh();
+	seq = read_seqcount_begin(&shard->seq);
+
+	old.bib = find_bib6(shard, &tuple6->src.addr6);
+	if (!old.bib || issue216_needed(masks, &old))
+		goto end;
+
+	key.dst4 = *dst4;
+	if (tuple6->l4_proto == L4PROTO_ICMP)
+		key.dst4.l4 = old.bib->src4.l4;
+	old.session = find_session_slot(old.bib, &key, NULL, &slot);
+	if (old.session && dst6_matches(shard->table, old.session,
+			&tuple6->dst.addr6.l3))
+		success = refresh_rcu(shard, old.session, seq, cb, result);
+	/* Fall through. */
+
+end:
+	rcu_read_unlock_bh();
+	return success;
+}
+
+/**
+ * 4-to-6 version of refresh6_rcu().
+ */
+static bool refresh4_rcu(struct bib_shard *shard,
+		struct tuple *tuple4,
+		struct collision_cb *cb,
+		struct bib_session *result)
+{
+	struct tabled_bib *bib;
+	struct tabled_session key;
+	struct tabled_session *session;
+	struct tree_slot slot;
+	unsigned int seq;
+	bool success = false;
+
+	if (!RBTREE_LOCKLESS_READS)
+		return false;
+
+	rcu_read_lock_bh();
+	seq = read_seqcount_begin(&shard->seq);
+
+	bib = find_bib4(shard, &tuple4->dst.addr4);
+	if (!bib)
+		goto end;
+
+	key.dst4 = tuple4->src.addr4;
+	session = find_session_slot(bib, &key, NULL, &slot);
+	if (session)
+		success = refresh_rcu(shard, session, seq, cb, result);
+	/* Fall through. */
+
+end:
+	rcu_read_unlock_bh();
+	return success;
+}
+
 /**
  * This is a find and an add at the same time, for both @new->bib and
  * @new->session.
@@ -1436,9 +2982,11 @@ static bool issue216_needed(struct mask_domain *masks,
  * If @new->bib collides, you will find the collision in @old->bib.
  * If @new->session collides, you will find the collision in @old->session.
  *
- * @masks will be used to init @new->bib.src4 if applies.
+ * @masks will be used to init @new->bib.src4 if applies. If @masks is NULL,
+ * the shard that corresponds to @new->bib.src4 (see shard4_index()) has to be
+ * locked as well.
  */
-static int find_bib_session6(struct bib_table *table,
+static int find_bib_session6(struct bib_shard *shard,
 		struct mask_domain *masks,
 		struct bib_session_tuple *new,
 		struct bib_session_tuple *old,
@@ -1466,7 +3014,8 @@ static int find_bib_session6(struct bib_table *table,
 	 * See below for more stuff.
 	 */
 
-	old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
+	slots->stray = NULL;
+	old->bib = find_bib6(shard, &new->bib->src6);
 	if (old->bib) {
 		if (!issue216_needed(masks, old)) {
 			if (new->bib->proto == L4PROTO_ICMP)
@@ -1485,32 +3034,23 @@ static int find_bib_session6(struct bib_table *table,
 		 * https://github.com/NICMx/Jool/issues/216
 		 */
 		log_debug("Issue #216.");
-		detach_bib(table, old->bib);
+		detach_bib(shard, old->bib);
 		add_to_delete_list(rm_list, &old->bib->hook4);
-
-		/*
-		 * The detaching above might have involved a rebalance.
-		 * I believe that completely invalidates the bib6 slot.
-		 * Tough luck; we'll need another lookup.
-		 * At least this only happens on empty pool4s. (Low traffic.)
-		 */
-		old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
-		if (WARN(old->bib, "Found a BIB entry I just removed!"))
-			return -EINVAL;
+		old->bib = NULL;
 
 	} else {
 		/*
 		 * No BIB nor session in the main database? Try the SO
 		 * sub-database.
 		 */
-		error = upgrade_pktqueue_session(table, masks, new, old);
+		error = upgrade_pktqueue_session(shard, masks, new, old);
 		if (!error)
 			return 0; /* Unusual happy path for existing sessions */
 	}
 
 	/*
 	 * In case you're tweaking this function: By this point, old->bib has to
-	 * be NULL and slots->bib6 has to be a valid potential tree slot. We're
+	 * be NULL, which means @new->bib's src6 is not in the v6 index. We're
 	 * now in create-new-BIB-and-session mode.
 	 * Time to worry about slots->bib4.
 	 *
@@ -1518,7 +3058,7 @@ static int find_bib_session6(struct bib_table *table,
 	 * NULL.)
 	 */
 	if (masks) {
-		error = find_available_mask(table, masks, new->bib, &slots->bib4);
+		error = find_available_mask(shard, masks, new->bib, &slots->bib4);
 		if (error) {
 			if (WARN(error != -ENOENT, "Unknown error: %d", error))
 				return error;
@@ -1534,8 +3074,11 @@ static int find_bib_session6(struct bib_table *table,
 		 * TODO (issue113) perhaps the sender's session shold be trusted
 		 * more.
 		 */
-		if (find_bibtree4_slot(table, new->bib, &slots->bib4))
+		if (find_bibtree4_slot(shard, new->bib, &slots->bib4))
 			return -EEXIST;
+		error = prepare_stray(shard, new->bib, &slots->stray);
+		if (error)
+			return error;
 	}
 
 	/* Ok, time to worry about slots->session now. */
@@ -1563,6 +3106,7 @@ int bib_add6(struct bib *db,
 		struct bib_session *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct bib_session_tuple new;
 	struct bib_session_tuple old;
 	struct slot_group slots;
@@ -1572,6 +3116,10 @@ int bib_add6(struct bib *db,
 	table = get_table(db, tuple6->l4_proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard6(table, &tuple6->src.addr6);
+
+	if (refresh6_rcu(shard, masks, tuple6, dst4, NULL, result))
+		return 0;
 
 	/*
 	 * We might have a lot to do. This function may index three RB-trees
@@ -1586,46 +3134,52 @@ int bib_add6(struct bib *db,
 	 * Let's start by allocating and initializing the objects as much as we
 	 * can, even if we end up not needing them.
 	 */
-	error = create_bib_session6(&new, tuple6, dst4, ESTABLISHED);
+	error = create_bib_session6(table, &new, tuple6, dst4, ESTABLISHED);
 	if (error)
 		return error;
 
-	spin_lock_bh(&table->lock); /* Here goes... */
+	spin_lock_bh(&shard->lock); /* Here goes... */
 
-	error = find_bib_session6(table, masks, &new, &old, &slots, &rm_list);
+	error = find_bib_session6(shard, masks, &new, &old, &slots, &rm_list);
 	if (error)
 		goto end;
 
 	if (old.session) { /* Session already exists. */
-		handle_fate_timer(old.session, &table->est_timer);
-		tstobs(old.session, result);
+		if (!dst6_matches(table, old.session, &tuple6->dst.addr6.l3)) {
+			log_debug("The BIB entry already reaches %pI4 through another pool6 prefix.",
+					&dst4->l3);
+			error = -EEXIST;
+			goto end;
+		}
+		handle_fate_timer(old.session, &shard->est_timer);
+		tstobs(shard, old.session, result);
 		goto end;
 	}
 
 	/* New connection; add the session. (And maybe the BIB entry as well) */
-	commit_add6(table, &old, &new, &slots, &table->est_timer, result);
+	commit_add6(shard, &old, &new, &slots, &shard->est_timer, result);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	if (new.bib)
 		free_bib(new.bib);
 	if (new.session)
-		free_session(new.session);
+		free_session(table, new.session);
 	commit_delete_list(&rm_list);
 
 	return error;
 }
 
-static void find_bib_session4(struct bib_table *table,
+static void find_bib_session4(struct bib_shard *shard,
 		struct tuple *tuple4,
 		struct tabled_session *new,
 		struct bib_session_tuple *old,
 		bool *allow,
 		struct tree_slot *slot)
 {
-	old->bib = find_bib4(table, &tuple4->dst.addr4);
+	old->bib = find_bib4(shard, &tuple4->dst.addr4);
 	old->session = old->bib
 			? find_session_slot(old->bib, new, allow, slot)
 			: NULL;
@@ -1640,6 +3194,7 @@ int bib_add4(struct bib *db,
 		struct bib_session *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct bib_session_tuple old;
 	struct tabled_session *new;
 	struct tree_slot session_slot;
@@ -1649,18 +3204,22 @@ int bib_add4(struct bib *db,
 	table = get_table(db, tuple4->l4_proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard4(table, &tuple4->dst.addr4);
 
-	new = create_session4(tuple4, dst6, ESTABLISHED);
+	if (refresh4_rcu(shard, tuple4, NULL, result))
+		return 0;
+
+	new = create_session4(table, tuple4, dst6, ESTABLISHED);
 	if (!new)
 		return -ENOMEM;
 
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	find_bib_session4(table, tuple4, new, &old, &allow, &session_slot);
+	find_bib_session4(shard, tuple4, new, &old, &allow, &session_slot);
 
 	if (old.session) {
-		handle_fate_timer(old.session, &table->est_timer);
-		tstobs(old.session, result);
+		handle_fate_timer(old.session, &shard->est_timer);
+		tstobs(shard, old.session, result);
 		goto end;
 	}
 
@@ -1670,19 +3229,20 @@ int bib_add4(struct bib *db,
 	}
 
 	/* Address-Dependent Filtering. */
-	if (table->drop_by_addr && !allow) {
+	if (shard->drop_by_addr && !allow) {
 		error = -EPERM;
 		goto end;
 	}
 
 	/* Ok, no issues; add the session. */
-	commit_add4(table, &old, &new, &session_slot, &table->est_timer, result);
+	inherit_prefix(table, old.bib, new);
+	commit_add4(shard, &old, &new, &session_slot, &shard->est_timer, result);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 	if (new)
-		free_session(new);
+		free_session(table, new);
 	return error;
 }
 
@@ -1697,7 +3257,7 @@ verdict bib_add_tcp6(struct bib *db,
 		struct collision_cb *cb,
 		struct bib_session *result)
 {
-	struct bib_table *table;
+	struct bib_shard *shard;
 	struct bib_session_tuple new;
 	struct bib_session_tuple old;
 	struct slot_group slots;
@@ -1707,22 +3267,32 @@ verdict bib_add_tcp6(struct bib *db,
 	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
 		return VERDICT_DROP;
 
-	if (create_bib_session6(&new, &pkt->tuple, dst4, V6_INIT))
+	shard = get_shard6(&db->tcp, &pkt->tuple.src.addr6);
+	if (refresh6_rcu(shard, masks, &pkt->tuple, dst4, cb, result))
+		return VERDICT_CONTINUE;
+
+	if (create_bib_session6(&db->tcp, &new, &pkt->tuple, dst4, V6_INIT))
 		return VERDICT_DROP;
 
-	table = &db->tcp;
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	if (find_bib_session6(table, masks, &new, &old, &slots, &rm_list)) {
+	if (find_bib_session6(shard, masks, &new, &old, &slots, &rm_list)) {
 		verdict = VERDICT_DROP;
 		goto end;
 	}
 
 	if (old.session) {
+		if (!dst6_matches(&db->tcp, old.session,
+				&pkt->tuple.dst.addr6.l3)) {
+			log_debug("The BIB entry already reaches %pI4 through another pool6 prefix.",
+					&dst4->l3);
+			verdict = VERDICT_DROP;
+			goto end;
+		}
 		/* All states except CLOSED. */
-		verdict = decide_fate(cb, table, old.session, NULL);
+		verdict = decide_fate(cb, shard, old.session, NULL);
 		if (verdict == VERDICT_CONTINUE)
-			tstobs(old.session, result);
+			tstobs(shard, old.session, result);
 		goto end;
 	}
 
@@ -1741,17 +3311,17 @@ verdict bib_add_tcp6(struct bib *db,
 
 	/* All exits up till now require @new.* to be deleted. */
 
-	commit_add6(table, &old, &new, &slots, &table->trans_timer, result);
+	commit_add6(shard, &old, &new, &slots, &shard->trans_timer, result);
 	verdict = VERDICT_CONTINUE;
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	if (new.bib)
 		free_bib(new.bib);
 	if (new.session)
-		free_session(new.session);
+		free_session(&db->tcp, new.session);
 	commit_delete_list(&rm_list);
 
 	return verdict;
@@ -1768,6 +3338,7 @@ verdict bib_add_tcp4(struct bib *db,
 		struct bib_session *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_session *new;
 	struct bib_session_tuple old;
 	struct tree_slot session_slot;
@@ -1777,20 +3348,24 @@ verdict bib_add_tcp4(struct bib *db,
 	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
 		return VERDICT_DROP;
 
-	new = create_session4(&pkt->tuple, dst6, V4_INIT);
+	table = &db->tcp;
+	shard = get_shard4(table, &pkt->tuple.dst.addr4);
+	if (refresh4_rcu(shard, &pkt->tuple, cb, result))
+		return VERDICT_CONTINUE;
+
+	new = create_session4(table, &pkt->tuple, dst6, V4_INIT);
 	if (!new)
 		return VERDICT_DROP;
 
-	table = &db->tcp;
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	find_bib_session4(table, &pkt->tuple, new, &old, NULL, &session_slot);
+	find_bib_session4(shard, &pkt->tuple, new, &old, NULL, &session_slot);
 
 	if (old.session) {
 		/* All states except CLOSED. */
-		verdict = decide_fate(cb, table, old.session, NULL);
+		verdict = decide_fate(cb, shard, old.session, NULL);
 		if (verdict == VERDICT_CONTINUE)
-			tstobs(old.session, result);
+			tstobs(shard, old.session, result);
 		goto end;
 	}
 
@@ -1807,7 +3382,7 @@ verdict bib_add_tcp4(struct bib *db,
 		goto end;
 	}
 
-	if (table->drop_v4_syn) {
+	if (shard->drop_v4_syn) {
 		log_debug("Externally initiated TCP connections are prohibited.");
 		verdict = VERDICT_DROP;
 		goto end;
@@ -1817,12 +3392,14 @@ verdict bib_add_tcp4(struct bib *db,
 		bool too_many;
 
 		log_debug("Potential Simultaneous Open; storing type 1 packet.");
-		too_many = table->pkt_count >= table->pkt_limit;
+		too_many = atomic_read(&table->pkt_count) >= shard->pkt_limit;
+		spin_lock(&table->pktqueue_lock);
 		error = pktqueue_add(table->pkt_queue, pkt, dst6, too_many);
+		spin_unlock(&table->pktqueue_lock);
 		switch (error) {
 		case 0:
 			verdict = VERDICT_STOLEN;
-			table->pkt_count++;
+			atomic_inc(&table->pkt_count);
 			goto end;
 		case -EEXIST:
 			log_debug("Simultaneous Open already exists.");
@@ -1842,14 +3419,14 @@ verdict bib_add_tcp4(struct bib *db,
 
 	verdict = VERDICT_CONTINUE;
 
-	if (table->drop_by_addr) {
-		if (table->pkt_count >= table->pkt_limit)
+	if (shard->drop_by_addr) {
+		if (atomic_read(&table->pkt_count) >= shard->pkt_limit)
 			goto too_many_pkts;
 
 		log_debug("Potential Simultaneous Open; storing type 2 packet.");
 		new->stored = pkt_original_pkt(pkt)->skb;
 		verdict = VERDICT_STOLEN;
-		table->pkt_count++;
+		atomic_inc(&table->pkt_count);
 		/*
 		 * Yes, fall through. No goto; we need to add this session.
 		 * Notice that if you need to cancel before the spin unlock then
@@ -1857,28 +3434,59 @@ verdict bib_add_tcp4(struct bib *db,
 		 */
 	}
 
-	commit_add4(table, &old, &new, &session_slot,
-			new->stored ? &table->syn4_timer : &table->trans_timer,
+	inherit_prefix(table, old.bib, new);
+	commit_add4(shard, &old, &new, &session_slot,
+			new->stored ? &shard->syn4_timer : &shard->trans_timer,
 			result);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	if (new)
-		free_session(new);
+		free_session(table, new);
 
 	return verdict;
 
 too_many_pkts:
-	spin_unlock_bh(&table->lock);
-	free_session(new);
+	spin_unlock_bh(&shard->lock);
+	free_session(table, new);
 	log_debug("Too many Simultaneous Opens.");
 	/* Fall back to assume there's no SO. */
 	icmp64_send(pkt, ICMPERR_PORT_UNREACHABLE, 0);
 	return VERDICT_DROP;
 }
 
+/**
+ * bib_find()'s IPv4 version. Also retrieves the session, if there is one,
+ * because the 4-to-6 direction needs to know which prefix it is using.
+ */
+static int bib_find_session4(struct bib *db, struct tuple *tuple4,
+		struct bib_session *result)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_session_tuple old;
+	struct tabled_session key;
+	struct tree_slot slot;
+
+	table = get_table(db, tuple4->l4_proto);
+	if (!table)
+		return -EINVAL;
+	shard = get_shard4(table, &tuple4->dst.addr4);
+	key.dst4 = tuple4->src.addr4;
+
+	spin_lock_bh(&shard->lock);
+	find_bib_session4(shard, tuple4, &key, &old, NULL, &slot);
+	if (old.session)
+		tstobs(shard, old.session, result);
+	else if (old.bib)
+		tbtobs(old.bib, result);
+	spin_unlock_bh(&shard->lock);
+
+	return old.bib ? 0 : -ESRCH;
+}
+
 int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
 {
 	struct bib_entry tmp;
@@ -1889,8 +3497,7 @@ int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
 		error = bib_find6(db, tuple->l4_proto, &tuple->src.addr6, &tmp);
 		break;
 	case L3PROTO_IPV4:
-		error = bib_find4(db, tuple->l4_proto, &tuple->dst.addr4, &tmp);
-		break;
+		return bib_find_session4(db, tuple, result);
 	default:
 		WARN(true, "Unknown layer 3 protocol: %u", tuple->l3_proto);
 		return -EINVAL;
@@ -1906,11 +3513,67 @@ int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
 	return 0;
 }
 
+/**
+ * Moves the update time of the session [@src6, @dst4] up to @update_time, on
+ * behalf of packets that were translated somewhere else. (See
+ * usr/fastpath.)
+ *
+ * Only sessions ruled by the established timer are affected. The others are
+ * waiting for something only Jool can see (such as a TCP handshake), so they
+ * are left alone.
+ *
+ * Returns -ESRCH if the session does not exist (anymore).
+ */
+int bib_refresh(struct bib *db, l4_protocol proto,
+		struct ipv6_transport_addr *src6,
+		struct ipv4_transport_addr *dst4,
+		unsigned long update_time)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	struct tabled_bib *bib;
+	struct tabled_session key;
+	struct tabled_session *session;
+	struct tree_slot slot;
+	int error = -ESRCH;
+
+	table = get_table(db, proto);
+	if (!table)
+		return -EINVAL;
+	shard = get_shard6(table, src6);
+
+	spin_lock_bh(&shard->lock);
+
+	bib = find_bib6(shard, src6);
+	if (!bib)
+		goto end;
+
+	key.dst4 = *dst4;
+	if (proto == L4PROTO_ICMP)
+		key.dst4.l4 = bib->src4.l4;
+	session = find_session_slot(bib, &key, NULL, &slot);
+	if (!session)
+		goto end;
+
+	/* The wheel sorts the slot out later; see refresh_rcu(). */
+	if (session->timer == SESSION_TIMER_EST
+			&& time_after(update_time, get_update_time(session)))
+		set_update_time(session, update_time);
+	error = 0;
+	/* Fall through. */
+
+end:
+	spin_unlock_bh(&shard->lock);
+	return error;
+}
+
 int bib_add_session(struct bib *db,
 		struct session_entry *session,
 		struct collision_cb *cb)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_shard *port_shard;
 	struct bib_session_tuple new;
 	struct bib_session_tuple old;
 	struct slot_group slots;
@@ -1920,90 +3583,191 @@ int bib_add_session(struct bib *db,
 	table = get_table(db, session->proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard6(table, &session->src6);
+	port_shard = &table->shards[shard4_index(table, &session->src4)];
 
-	error = create_bib_session(session, &new);
+	error = create_bib_session(table, session, &new);
 	if (error)
 		return error;
 
-	spin_lock_bh(&table->lock);
+	lock_shards(shard, port_shard);
 
-	error = find_bib_session6(table, NULL, &new, &old, &slots, &rm_list);
+	error = find_bib_session6(shard, NULL, &new, &old, &slots, &rm_list);
 	if (error)
 		goto end;
 
 	if (old.session) {
 		/* There's no packet; ignore the verdict. */
-		decide_fate(cb, table, old.session, NULL);
+		decide_fate(cb, shard, old.session, NULL);
 		goto end;
 	}
 
-	error = commit_add(table, &old, &new, &slots, session->timer_type);
+	error = commit_add(shard, &old, &new, &slots, session->timer_type);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	unlock_shards(shard, port_shard);
 
+	if (slots.stray)
+		wkfree(struct bib_stray, slots.stray);
 	if (new.bib)
 		free_bib(new.bib);
 	if (new.session)
-		free_session(new.session);
+		free_session(table, new.session);
 	commit_delete_list(&rm_list);
 
 	return error;
 }
 
-static void __clean(struct expire_timer *expirer,
-		struct bib_table *table,
-		struct list_head *probes)
+/**
+ * Redistributes the current slot of @level among the lower levels.
+ * Returns the remaining budget; if it ran out, the slot is not finished.
+ */
+static unsigned int cascade(struct timer_wheel *wheel, unsigned int level,
+		unsigned int budget)
+{
+	struct list_head *slot;
+	struct tabled_session *session;
+
+	slot = &wheel->slots[level][slot_index(wheel->clk, level)];
+	while (!list_empty(slot)) {
+		if (!budget)
+			return 0;
+		session = list_first_entry(slot, struct tabled_session,
+				list_hook);
+		list_del(&session->list_hook);
+		wheel_add(wheel, session);
+		budget--;
+	}
+
+	return budget;
+}
+
+/**
+ * Handles @expirer's expired sessions. Stops after @budget sessions, and
+ * returns what's left of the budget.
+ */
+static unsigned int __clean(struct expire_timer *expirer,
+		struct bib_shard *shard,
+		struct list_head *probes,
+		unsigned int budget)
 {
+	struct timer_wheel *wheel = &expirer->wheel;
 	struct tabled_session *session;
-	struct tabled_session *tmp;
 	struct collision_cb cb;
+	unsigned long now;
+	unsigned int level;
+	LIST_HEAD(batch);
 
 	cb.cb = expirer->decide_fate_cb;
 	cb.arg = NULL;
+	now = jiffies - expirer->timeout;
+
+	while (time_after_eq(now, wheel->clk)) {
+		/* A lower level completed a revolution? */
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (slot_index(wheel->clk, level - 1))
+				break;
+			budget = cascade(wheel, level, budget);
+			if (!budget)
+				return 0;
+		}
 
-	list_for_each_entry_safe(session, tmp, &expirer->sessions, list_hook) {
-		/*
-		 * "list" is sorted by expiration date,
-		 * so stop on the first unexpired session.
-		 */
-		if (time_before(jiffies, session->update_time + expirer->timeout))
-			break;
-		decide_fate(&cb, table, session, probes);
+		list_splice_init(&wheel->slots[0][slot_index(wheel->clk, 0)],
+				&batch);
+		wheel->clk += WHEEL_TICK;
+
+		while (!list_empty(&batch)) {
+			if (!budget) {
+				/* They're due; put them first in line. */
+				list_splice(&batch, &wheel->slots[0]
+						[slot_index(wheel->clk, 0)]);
+				return 0;
+			}
+
+			session = list_first_entry(&batch, struct tabled_session,
+					list_hook);
+			list_del(&session->list_hook);
+			/*
+			 * If it was refreshed (see refresh_rcu()), this moves
+			 * it where it belongs now. Otherwise it lands on the
+			 * next tick, in case decide_fate() wants to keep it
+			 * around.
+			 */
+			wheel_add(wheel, session);
+			budget--;
+
+			if (time_before(jiffies, get_update_time(session)
+					+ expirer->timeout))
+				continue;
+			decide_fate(&cb, shard, session, probes);
+		}
 	}
+
+	return budget;
 }
 
-static void clean_table(struct bib_table *table, struct net *ns)
+/**
+ * Returns true if the shard still has expired sessions that didn't fit in
+ * @budget.
+ */
+static bool clean_shard(struct bib_shard *shard, struct net *ns,
+		unsigned int budget)
 {
 	LIST_HEAD(probes);
+
+	spin_lock_bh(&shard->lock);
+	budget = __clean(&shard->est_timer, shard, &probes, budget);
+	budget = __clean(&shard->trans_timer, shard, &probes, budget);
+	budget = __clean(&shard->syn4_timer, shard, &probes, budget);
+	spin_unlock_bh(&shard->lock);
+
+	post_fate(ns, &probes);
+	return !budget;
+}
+
+static bool clean_table(struct bib_table *table, struct net *ns,
+		unsigned int budget)
+{
+	struct bib_shard *shard;
+	bool pending = false;
 	LIST_HEAD(icmps);
 
-	spin_lock_bh(&table->lock);
-	__clean(&table->est_timer, table, &probes);
-	__clean(&table->trans_timer, table, &probes);
-	__clean(&table->syn4_timer, table, &probes);
+	foreach_shard(table, shard)
+		pending |= clean_shard(shard, ns, budget);
+
 	if (table->pkt_queue) {
-		table->pkt_count -= pktqueue_prepare_clean(table->pkt_queue,
-				&icmps);
+		spin_lock_bh(&table->pktqueue_lock);
+		atomic_sub(pktqueue_prepare_clean(table->pkt_queue, &icmps),
+				&table->pkt_count);
+		spin_unlock_bh(&table->pktqueue_lock);
+		pktqueue_clean(&icmps);
 	}
-	spin_unlock_bh(&table->lock);
 
-	post_fate(ns, &probes);
-	pktqueue_clean(&icmps);
+	return pending;
 }
 
 /**
  * Forgets or downgrades (from EST to TRANS) old sessions.
+ *
+ * Each shard lock is never held for more than the configured budget of
+ * sessions. (The budget is per shard, not per call.) Returns true if that was
+ * not enough to handle all the expired sessions of some shard, in which case
+ * the caller should call again soon.
  */
-void bib_clean(struct bib *db, struct net *ns)
+bool bib_clean(struct bib *db, struct net *ns)
 {
-	clean_table(&db->udp, ns);
-	clean_table(&db->tcp, ns);
-	clean_table(&db->icmp, ns);
+	unsigned int budget = READ_ONCE(db->clean_budget);
+	bool pending = false;
+
+	pending |= clean_table(&db->udp, ns, budget);
+	pending |= clean_table(&db->tcp, ns, budget);
+	pending |= clean_table(&db->icmp, ns, budget);
+
+	return pending;
 }
 
-static struct rb_node *find_starting_point(struct bib_table *table,
+static struct rb_node *find_starting_point(struct bib_shard *shard,
 		const struct ipv4_transport_addr *offset,
 		bool include_offset)
 {
@@ -2013,10 +3777,10 @@ static struct rb_node *find_starting_point(struct bib_table *table,
 
 	/* If there's no offset, start from the beginning. */
 	if (!offset)
-		return rb_first(&table->tree4);
+		return rb_first(&shard->tree4);
 
 	/* If offset is found, start from offset or offset's next. */
-	rbtree_find_node(offset, &table->tree4, compare_src4, struct tabled_bib,
+	rbtree_find_node(offset, &shard->tree4, compare_src4, struct tabled_bib,
 			hook4, parent, node);
 	if (*node)
 		return include_offset ? (*node) : rb_next(*node);
@@ -2033,30 +3797,164 @@ static struct rb_node *find_starting_point(struct bib_table *table,
 	return (compare_src4(bib, offset) < 0) ? rb_next(parent) : parent;
 }
 
+/*
+ * Foreaches have to yield the entries sorted by src4 (because that's what the
+ * offsets are based on), but every shard sorts its own entries independently.
+ * So the shards are merged: each shard is assigned a cursor which remembers the
+ * next entry it wants to yield, and the smallest cursor wins every iteration.
+ *
+ * Only one shard is locked at a time, and it stays locked for as long as its
+ * cursor keeps winning. (So a single-shard table is walked in one go.)
+ *
+ * A cursor remembers both the entry and a copy of its key. The entry is only
+ * trusted if the shard's tree didn't change while it was unlocked (which is
+ * what @seq is for); otherwise the entry might have died, and the position is
+ * looked up again by key.
+ */
+struct bib_cursor {
+	/**
+	 * @src is the BIB entry's src4.
+	 * @dst is the session's dst4. (Only in session foreaches.)
+	 */
+	struct taddr4_tuple key;
+	/** The BIB entry @key.src was copied from. */
+	struct tabled_bib *bib;
+	/** The session @key.dst was copied from. (Only in session foreaches.) */
+	struct tabled_session *session;
+	/** The shard's seqcount at the time @bib and @session were recorded. */
+	unsigned int seq;
+	/** false if the shard has nothing else to yield. */
+	bool valid;
+};
+
+static struct bib_cursor *alloc_cursors(struct bib_table *table, gfp_t flags)
+{
+	/* Zeroed because bib_foreach() does not use @key.dst. */
+	return __wkmalloc("BIB cursors",
+			table->shard_count * sizeof(struct bib_cursor),
+			flags | __GFP_ZERO);
+}
+
+static void free_cursors(struct bib_cursor *cursors)
+{
+	__wkfree("BIB cursors", cursors);
+}
+
+static int compare_cursors(struct bib_cursor *a, struct bib_cursor *b)
+{
+	int gap;
+
+	gap = taddr4_compare(&a->key.src, &b->key.src);
+	if (gap)
+		return gap;
+
+	return taddr4_compare(&a->key.dst, &b->key.dst);
+}
+
+/**
+ * Returns the index of the shard that holds the smallest pending entry, or -1
+ * if all the shards are exhausted.
+ */
+static int next_cursor(struct bib_table *table, struct bib_cursor *cursors)
+{
+	unsigned int i;
+	int result = -1;
+
+	for (i = 0; i < table->shard_count; i++) {
+		if (!cursors[i].valid)
+			continue;
+		if (result == -1 || compare_cursors(&cursors[i], &cursors[result]) < 0)
+			result = i;
+	}
+
+	return result;
+}
+
+/**
+ * Points @cursor to @node, which belongs to @shard. Assumes @shard is locked.
+ */
+static void bib_cursor_set(struct bib_shard *shard, struct bib_cursor *cursor,
+		struct rb_node *node)
+{
+	cursor->bib = bib4_entry(node);
+	cursor->valid = !!cursor->bib;
+	if (cursor->bib)
+		cursor->key.src = cursor->bib->src4;
+	cursor->seq = read_seqcount_begin(&shard->seq);
+}
+
+/**
+ * Returns the node @cursor points to. Assumes @shard is locked.
+ *
+ * If the entry died while @shard was unlocked, returns its successor instead.
+ */
+static struct rb_node *bib_cursor_get(struct bib_shard *shard,
+		struct bib_cursor *cursor)
+{
+	if (!read_seqcount_retry(&shard->seq, cursor->seq))
+		return &cursor->bib->hook4;
+	return find_starting_point(shard, &cursor->key.src, true);
+}
+
 int bib_foreach(struct bib *db, l4_protocol proto,
 		struct bib_foreach_func *func,
 		const struct ipv4_transport_addr *offset)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_cursor *cursors;
 	struct rb_node *node;
 	struct tabled_bib *tabled;
 	struct bib_entry bib;
+	int i;
+	int next;
 	int error = 0;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	cursors = alloc_cursors(table, GFP_KERNEL);
+	if (!cursors)
+		return -ENOMEM;
+
+	for (i = 0; i < table->shard_count; i++) {
+		shard = &table->shards[i];
+		spin_lock_bh(&shard->lock);
+		node = find_starting_point(shard, offset, false);
+		bib_cursor_set(shard, &cursors[i], node);
+		spin_unlock_bh(&shard->lock);
+	}
 
-	node = find_starting_point(table, offset, false);
-	for (; node && !error; node = rb_next(node)) {
-		tabled = bib4_entry(node);
-		tbtobe(tabled, &bib);
-		error = func->cb(&bib, tabled->is_static, func->arg);
+	i = next_cursor(table, cursors);
+	while (!error && i != -1) {
+		shard = &table->shards[i];
+		spin_lock_bh(&shard->lock);
+
+		node = bib_cursor_get(shard, &cursors[i]);
+		do {
+			tabled = bib4_entry(node);
+			/*
+			 * If the entry died, @node is its successor, which
+			 * might no longer be the smallest one. In that case
+			 * just refresh the cursor and compare again.
+			 */
+			if (tabled && taddr4_equals(&tabled->src4,
+					&cursors[i].key.src)) {
+				tbtobe(tabled, &bib);
+				error = func->cb(&bib, tabled->is_static,
+						func->arg);
+				node = rb_next(node);
+			}
+			bib_cursor_set(shard, &cursors[i], node);
+			next = next_cursor(table, cursors);
+		} while (!error && next == i);
+
+		spin_unlock_bh(&shard->lock);
+		i = next;
 	}
 
-	spin_unlock_bh(&table->lock);
+	free_cursors(cursors);
 	return error;
 }
 
@@ -2100,7 +3998,7 @@ static void next_session(struct rb_node *next, struct bib_session_tuple *pos)
  * follow one that would match perfectly. This is because sessions expiring
  * during ongoing fragmented foreaches are not considered a problem.
  */
-static void find_session_offset(struct bib_table *table,
+static void find_session_offset(struct bib_shard *shard,
 		struct session_foreach_offset *offset,
 		struct bib_session_tuple *pos)
 {
@@ -2111,7 +4009,7 @@ static void find_session_offset(struct bib_table *table,
 	memset(pos, 0, sizeof(*pos));
 
 	tmp_bib.src4 = offset->offset.src;
-	pos->bib = find_bibtree4_slot(table, &tmp_bib, &slot);
+	pos->bib = find_bibtree4_slot(shard, &tmp_bib, &slot);
 	if (!pos->bib) {
 		next_bib(slot_next(&slot), pos);
 		return;
@@ -2128,73 +4026,164 @@ static void find_session_offset(struct bib_table *table,
 		next_session(rb_next(&pos->session->tree_hook), pos);
 }
 
-#define foreach_bib(table, node) \
-		for (node = bib4_entry(rb_first(&(table)->tree4)); \
-				node; \
-				node = bib4_entry(rb_next(&node->hook4)))
-#define foreach_session(tree, node) \
-		for (node = node2session(rb_first(tree)); \
-				node; \
-				node = node2session(rb_next(&node->tree_hook)))
+/**
+ * Fixes @pos so it points to an actual session.
+ * (It might be pointing to a BIB entry that has no sessions.)
+ */
+static void skip_empty_bibs(struct bib_session_tuple *pos)
+{
+	while (pos->bib && !pos->session) {
+		pos->session = node2session(rb_first(&pos->bib->sessions));
+		if (!pos->session)
+			next_bib(rb_next(&pos->bib->hook4), pos);
+	}
+}
+
+/**
+ * Points @cursor to @pos (or the first session that follows it), which belongs
+ * to @shard. Assumes @shard is locked.
+ */
+static void session_cursor_set(struct bib_shard *shard,
+		struct bib_cursor *cursor,
+		struct bib_session_tuple *pos)
+{
+	skip_empty_bibs(pos);
+	cursor->valid = !!pos->session;
+	if (pos->session) {
+		cursor->key.src = pos->bib->src4;
+		cursor->key.dst = pos->session->dst4;
+		cursor->bib = pos->bib;
+		cursor->session = pos->session;
+	}
+	cursor->seq = read_seqcount_begin(&shard->seq);
+}
+
+/**
+ * Session version of bib_cursor_get(). The result goes to @pos.
+ */
+static void session_cursor_get(struct bib_shard *shard,
+		struct bib_cursor *cursor,
+		struct bib_session_tuple *pos)
+{
+	struct session_foreach_offset offset;
 
-int bib_foreach_session(struct bib *db, l4_protocol proto,
+	if (!read_seqcount_retry(&shard->seq, cursor->seq)) {
+		pos->bib = cursor->bib;
+		pos->session = cursor->session;
+		return;
+	}
+
+	offset.offset = cursor->key;
+	offset.include_offset = true;
+	find_session_offset(shard, &offset, pos);
+	skip_empty_bibs(pos);
+}
+
+static bool session_matches_cursor(struct bib_session_tuple *pos,
+		struct bib_cursor *cursor)
+{
+	return pos->session
+			&& taddr4_equals(&pos->bib->src4, &cursor->key.src)
+			&& taddr4_equals(&pos->session->dst4, &cursor->key.dst);
+}
+
+static int __bib_foreach_session(struct bib *db, l4_protocol proto,
 		struct session_foreach_func *func,
-		struct session_foreach_offset *offset)
+		struct session_foreach_offset *offset,
+		gfp_t flags)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_cursor *cursors;
 	struct bib_session_tuple pos;
 	struct session_entry tmp;
+	int i;
+	int next;
 	int error = 0;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	cursors = alloc_cursors(table, flags);
+	if (!cursors)
+		return -ENOMEM;
 
-	if (offset) {
-		find_session_offset(table, offset, &pos);
-		/* if pos.session != NULL, then pos.bib != NULL. */
-		if (pos.session)
-			goto goto_session;
-		if (pos.bib)
-			goto goto_bib;
-		goto end;
+	for (i = 0; i < table->shard_count; i++) {
+		shard = &table->shards[i];
+		spin_lock_bh(&shard->lock);
+		if (offset) {
+			find_session_offset(shard, offset, &pos);
+		} else {
+			pos.bib = bib4_entry(rb_first(&shard->tree4));
+			pos.session = NULL;
+		}
+		session_cursor_set(shard, &cursors[i], &pos);
+		spin_unlock_bh(&shard->lock);
 	}
 
-	foreach_bib(table, pos.bib) {
-goto_bib:	foreach_session(&pos.bib->sessions, pos.session) {
-goto_session:		tstose(pos.session, &tmp);
-			error = func->cb(&tmp, func->arg);
-			if (error)
-				goto end;
-		}
+	i = next_cursor(table, cursors);
+	while (!error && i != -1) {
+		shard = &table->shards[i];
+		spin_lock_bh(&shard->lock);
+
+		session_cursor_get(shard, &cursors[i], &pos);
+		do {
+			/* See bib_foreach() for some thoughts on dead entries. */
+			if (session_matches_cursor(&pos, &cursors[i])) {
+				tstose(shard, pos.session, &tmp);
+				error = func->cb(&tmp, func->arg);
+				next_session(rb_next(&pos.session->tree_hook),
+						&pos);
+			}
+			session_cursor_set(shard, &cursors[i], &pos);
+			next = next_cursor(table, cursors);
+		} while (!error && next == i);
+
+		spin_unlock_bh(&shard->lock);
+		i = next;
 	}
 
-end:
-	spin_unlock_bh(&table->lock);
+	free_cursors(cursors);
 	return error;
 }
 
-#undef foreach_session
-#undef foreach_bib
+int bib_foreach_session(struct bib *db, l4_protocol proto,
+		struct session_foreach_func *func,
+		struct session_foreach_offset *offset)
+{
+	return __bib_foreach_session(db, proto, func, offset, GFP_KERNEL);
+}
+
+/**
+ * bib_foreach_session_atomic - Same as bib_foreach_session(), except it can be
+ * called from atomic context.
+ */
+int bib_foreach_session_atomic(struct bib *db, l4_protocol proto,
+		struct session_foreach_func *func,
+		struct session_foreach_offset *offset)
+{
+	return __bib_foreach_session(db, proto, func, offset, GFP_ATOMIC);
+}
 
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib *bib;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard6(table, addr);
 
-	spin_lock_bh(&table->lock);
-	bib = find_bib6(table, addr);
+	spin_lock_bh(&shard->lock);
+	bib = find_bib6(shard, addr);
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2204,17 +4193,19 @@ int bib_find4(struct bib *db, l4_protocol proto,
 		struct bib_entry *result)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib *bib;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard4(table, addr);
 
-	spin_lock_bh(&table->lock);
-	bib = find_bib4(table, addr);
+	spin_lock_bh(&shard->lock);
+	bib = find_bib4(shard, addr);
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2225,43 +4216,94 @@ static void bib2tabled(struct bib_entry *bib, struct tabled_bib *tabled)
 	tabled->src4 = bib->ipv4;
 	tabled->proto = bib->l4_proto;
 	tabled->is_static = true;
+	tabled->prefix = PREFIX_NONE;
 	tabled->sessions = RB_ROOT;
 }
 
+/**
+ * If @addr belongs to a stray, copies the stray to @result and returns true.
+ * Assumes bottom halves are already disabled.
+ */
+static bool find_stray_copy(struct bib_table *table,
+		struct ipv4_transport_addr *addr,
+		struct bib_entry *result)
+{
+	struct bib_stray *stray;
+
+	if (!atomic_read(&table->stray_count))
+		return false;
+
+	spin_lock(&table->strays_lock);
+	stray = find_stray(table, addr);
+	if (stray)
+		tbtobe(stray->bib, result);
+	spin_unlock(&table->strays_lock);
+
+	return !!stray;
+}
+
 int bib_add_static(struct bib *db, struct bib_entry *new,
 		struct bib_entry *old)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
+	struct bib_shard *port_shard;
+	struct bib_stray *stray = NULL;
 	struct tabled_bib *bib;
 	struct tabled_bib *collision;
-	struct tree_slot slot6;
 	struct tree_slot slot4;
+	int error;
 
 	table = get_table(db, new->l4_proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard6(table, &new->ipv6);
+	port_shard = &table->shards[shard4_index(table, &new->ipv4)];
 
 	bib = alloc_bib(GFP_ATOMIC);
 	if (!bib)
 		return -ENOMEM;
 	bib2tabled(new, bib);
 
-	spin_lock_bh(&table->lock);
+	if (shard != port_shard) {
+		stray = wkmalloc(struct bib_stray, GFP_ATOMIC);
+		if (!stray) {
+			free_bib(bib);
+			return -ENOMEM;
+		}
+	}
+
+	lock_shards(shard, port_shard);
 
-	collision = find_bibtree6_slot(table, bib, &slot6);
+	collision = find_bib6(shard, &bib->src6);
 	if (collision) {
 		if (taddr4_equals(&bib->src4, &collision->src4))
 			goto upgrade;
 		goto eexist;
 	}
 
-	collision = find_bibtree4_slot(table, bib, &slot4);
+	collision = find_bibtree4_slot(shard, bib, &slot4);
 	if (collision)
 		goto eexist;
+	if (shard != port_shard) {
+		collision = find_bib4(port_shard, &bib->src4);
+		if (collision)
+			goto eexist;
+	}
+	if (find_stray_copy(table, &bib->src4, old)) {
+		error = -EEXIST;
+		goto end;
+	}
 
-	treeslot_commit(&slot6);
+	write_seqcount_begin(&shard->seq);
+	hash_add(shard, bib);
 	treeslot_commit(&slot4);
-	table->bib_count++;
+	write_seqcount_end(&shard->seq);
+	ports_add(shard, bib);
+	shard->bib_count++;
+	grow_hashes(shard);
+	if (stray)
+		add_stray(table, stray, bib);
 
 	/*
 	 * Since the BIB entry is now available, and assuming ADF is disabled,
@@ -2269,28 +4311,37 @@ int bib_add_static(struct bib *db, struct bib_entry *new,
 	 * That's bound to be a lot of messy code though, and the v4 client is
 	 * going to retry anyway, so let's just forget the packets instead.
 	 */
-	if (new->l4_proto == L4PROTO_TCP)
-		pktqueue_rm(db->tcp.pkt_queue, &new->ipv4);
+	if (table->pkt_queue) {
+		spin_lock(&table->pktqueue_lock);
+		pktqueue_rm(table->pkt_queue, &new->ipv4);
+		spin_unlock(&table->pktqueue_lock);
+	}
 
-	spin_unlock_bh(&table->lock);
+	unlock_shards(shard, port_shard);
 	return 0;
 
 upgrade:
 	collision->is_static = true;
-	spin_unlock_bh(&table->lock);
-	free_bib(bib);
-	return 0;
+	error = 0;
+	goto end;
 
 eexist:
 	tbtobe(collision, old);
-	spin_unlock_bh(&table->lock);
+	error = -EEXIST;
+	/* Fall through. */
+
+end:
+	unlock_shards(shard, port_shard);
 	free_bib(bib);
-	return -EEXIST;
+	if (stray)
+		wkfree(struct bib_stray, stray);
+	return error;
 }
 
 int bib_rm(struct bib *db, struct bib_entry *entry)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 	struct tabled_bib key;
 	struct tabled_bib *bib;
 	int error = -ESRCH;
@@ -2298,18 +4349,19 @@ int bib_rm(struct bib *db, struct bib_entry *entry)
 	table = get_table(db, entry->l4_proto);
 	if (!table)
 		return -EINVAL;
+	shard = get_shard6(table, &entry->ipv6);
 
 	bib2tabled(entry, &key);
 
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	bib = find_bib6(table, &key.src6);
+	bib = find_bib6(shard, &key.src6);
 	if (bib && taddr4_equals(&key.src4, &bib->src4)) {
-		detach_bib(table, bib);
+		detach_bib(shard, bib);
 		error = 0;
 	}
 
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	if (!error)
 		release_bib_entry(&bib->hook4, NULL);
@@ -2317,25 +4369,20 @@ int bib_rm(struct bib *db, struct bib_entry *entry)
 	return error;
 }
 
-void bib_rm_range(struct bib *db, l4_protocol proto, struct ipv4_range *range)
+static void rm_range_shard(struct bib_shard *shard, struct ipv4_range *range)
 {
-	struct bib_table *table;
 	struct ipv4_transport_addr offset;
 	struct rb_node *node;
 	struct rb_node *next;
 	struct tabled_bib *bib;
 	struct bib_delete_list delete_list = { NULL };
 
-	table = get_table(db, proto);
-	if (!table)
-		return;
-
 	offset.l3 = range->prefix.address;
 	offset.l4 = range->ports.min;
 
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	node = find_starting_point(table, &offset, true);
+	node = find_starting_point(shard, &offset, true);
 	for (; node; node = next) {
 		next = rb_next(node);
 		bib = bib4_entry(node);
@@ -2343,35 +4390,56 @@ void bib_rm_range(struct bib *db, l4_protocol proto, struct ipv4_range *range)
 		if (!prefix4_contains(&range->prefix, &bib->src4.l3))
 			break;
 		if (port_range_contains(&range->ports, bib->src4.l4)) {
-			detach_bib(table, bib);
+			detach_bib(shard, bib);
 			add_to_delete_list(&delete_list, node);
 		}
 	}
 
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	commit_delete_list(&delete_list);
 }
 
-static void flush_table(struct bib_table *table)
+void bib_rm_range(struct bib *db, l4_protocol proto, struct ipv4_range *range)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+
+	table = get_table(db, proto);
+	if (!table)
+		return;
+
+	foreach_shard(table, shard)
+		rm_range_shard(shard, range);
+}
+
+static void flush_shard(struct bib_shard *shard)
 {
 	struct rb_node *node;
 	struct rb_node *next;
 	struct bib_delete_list delete_list = { NULL };
 
-	spin_lock_bh(&table->lock);
+	spin_lock_bh(&shard->lock);
 
-	for (node = rb_first(&table->tree4); node; node = next) {
+	for (node = rb_first(&shard->tree4); node; node = next) {
 		next = rb_next(node);
-		detach_bib(table, bib4_entry(node));
+		detach_bib(shard, bib4_entry(node));
 		add_to_delete_list(&delete_list, node);
 	}
 
-	spin_unlock_bh(&table->lock);
+	spin_unlock_bh(&shard->lock);
 
 	commit_delete_list(&delete_list);
 }
 
+static void flush_table(struct bib_table *table)
+{
+	struct bib_shard *shard;
+
+	foreach_shard(table, shard)
+		flush_shard(shard);
+}
+
 void bib_flush(struct bib *db)
 {
 	flush_table(&db->tcp);
@@ -2382,28 +4450,65 @@ void bib_flush(struct bib *db)
 int bib_count(struct bib *db, l4_protocol proto, __u64 *count)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
-	*count = table->bib_count;
-	spin_unlock_bh(&table->lock);
+	*count = 0;
+	foreach_shard(table, shard) {
+		spin_lock_bh(&shard->lock);
+		*count += shard->bib_count;
+		spin_unlock_bh(&shard->lock);
+	}
 	return 0;
 }
 
 int bib_count_sessions(struct bib *db, l4_protocol proto, __u64 *count)
 {
 	struct bib_table *table;
+	struct bib_shard *shard;
+
+	table = get_table(db, proto);
+	if (!table)
+		return -EINVAL;
+
+	*count = 0;
+	foreach_shard(table, shard) {
+		spin_lock_bh(&shard->lock);
+		*count += shard->session_count;
+		spin_unlock_bh(&shard->lock);
+	}
+	return 0;
+}
+
+/**
+ * Returns in @bytes the memory @proto's sessions are taking. This is the size
+ * of the slab objects (ie. including alignment padding), not counting the
+ * slabs' own bookkeeping, nor the BIB entries (which might be shared by several
+ * sessions).
+ */
+int bib_session_bytes(struct bib *db, l4_protocol proto, __u64 *bytes)
+{
+	struct bib_table *table;
+	struct bib_shard *shard;
+	u64 narrow = 0;
+	u64 wide = 0;
 
 	table = get_table(db, proto);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
-	*count = table->session_count;
-	spin_unlock_bh(&table->lock);
+	foreach_shard(table, shard) {
+		spin_lock_bh(&shard->lock);
+		narrow += shard->session_count - shard->wide_count;
+		wide += shard->wide_count;
+		spin_unlock_bh(&shard->lock);
+	}
+
+	*bytes = narrow * kmem_cache_size(session_cache)
+			+ wide * kmem_cache_size(wide_session_cache);
 	return 0;
 }
 
@@ -2414,25 +4519,28 @@ static void print_tabs(int tabs)
 		pr_cont("  ");
 }
 
-static void print_session(struct rb_node *node, int tabs, char *prefix)
+static void print_session(struct bib_table *table, struct rb_node *node,
+		int tabs, char *prefix)
 {
 	struct tabled_session *session;
+	struct ipv6_transport_addr dst6;
 
 	if (!node)
 		return;
 	pr_info("[Ssn]");
 
 	session = node2session(node);
+	get_dst6(table, session, &dst6);
 	print_tabs(tabs);
 	pr_cont("[%s] %pI4#%u %pI6c#%u\n", prefix,
 			&session->dst4.l3, session->dst4.l4,
-			&session->dst6.l3, session->dst6.l4);
+			&dst6.l3, dst6.l4);
 
-	print_session(node->rb_left, tabs + 1, "L"); /* "Left" */
-	print_session(node->rb_right, tabs + 1, "R"); /* "Right" */
+	print_session(table, node->rb_left, tabs + 1, "L"); /* "Left" */
+	print_session(table, node->rb_right, tabs + 1, "R"); /* "Right" */
 }
 
-static void print_bib(struct rb_node *node, int tabs)
+static void print_bib(struct bib_table *table, struct rb_node *node, int tabs)
 {
 	struct tabled_bib *bib;
 
@@ -2445,17 +4553,28 @@ static void print_bib(struct rb_node *node, int tabs)
 	pr_cont("%pI4#%u %pI6c#%u\n", &bib->src4.l3, bib->src4.l4,
 			&bib->src6.l3, bib->src6.l4);
 
-	print_session(bib->sessions.rb_node, tabs + 1, "T"); /* "Tree" */
-	print_bib(node->rb_left, tabs + 1);
-	print_bib(node->rb_right, tabs + 1);
+	/* "Tree" */
+	print_session(table, bib->sessions.rb_node, tabs + 1, "T");
+	print_bib(table, node->rb_left, tabs + 1);
+	print_bib(table, node->rb_right, tabs + 1);
+}
+
+static void print_table(struct bib_table *table)
+{
+	struct bib_shard *shard;
+
+	foreach_shard(table, shard) {
+		log_debug("  Shard %u:", shard->index);
+		print_bib(table, shard->tree4.rb_node, 1);
+	}
 }
 
 void bib_print(struct bib *db)
 {
 	log_debug("TCP:");
-	print_bib(db->tcp.tree4.rb_node, 1);
+	print_table(&db->tcp);
 	log_debug("UDP:");
-	print_bib(db->udp.tree4.rb_node, 1);
+	print_table(&db->udp);
 	log_debug("ICMP:");
-	print_bib(db->icmp.tree4.rb_node, 1);
+	print_table(&db->icmp);
 }
@@ -42,6 +42,14 @@ static int xlat_addr46(struct xlation *state, struct ipv6_transport_addr *addr6)
 	struct ipv4_transport_addr *s = &state->in.tuple.src.addr4;
 
 	addr6->l4 = s->l4;
+	/*
+	 * pool6 might have several prefixes, and the session knows which one
+	 * the IPv6 node is using.
+	 */
+	if (state->entries.session_set) {
+		addr6->l3 = state->entries.session.dst6.l3;
+		return 0;
+	}
 	return rfc6052_4to6(state->jool.pool6, &s->l3, &addr6->l3);
 }
 
@@ -273,6 +273,15 @@ verdict determine_in_tuple(struct xlation *state)
 
 	log_debug("Step 1: Determining the Incoming Tuple");
 
+	/*
+	 * Subsequent fragments lack layer 4 headers; fragdb_handle() already
+	 * built their tuples out of their first fragments'.
+	 */
+	if (!pkt_is_first_frag(pkt) && pkt_l4_proto(pkt) != L4PROTO_OTHER) {
+		log_debug("Subsequent fragment; tuple already known.");
+		goto end;
+	}
+
 	switch (pkt_l3_proto(pkt)) {
 	case L3PROTO_IPV4:
 		switch (pkt_l4_proto(pkt)) {
@@ -307,6 +316,7 @@ verdict determine_in_tuple(struct xlation *state)
 		break;
 	}
 
+end:
 	if (result == VERDICT_CONTINUE)
 		log_tuple(&pkt->tuple);
 	log_debug("Done step 1.");
@@ -342,5 +352,6 @@ unknown_proto_ipv6:
 	/* RFC6146 logic. */
 	icmp64_send(pkt, ICMPERR_PROTO_UNREACHABLE, 0);
 	inc_stats(pkt, IPSTATS_MIB_INUNKNOWNPROTOS);
+	jstat_inc(state->jool.stats, JSTAT_UNKNOWN_L4);
 	return VERDICT_DROP;
 }
@@ -102,9 +102,10 @@ static verdict succeed(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-static verdict breakdown(struct xlation *state)
+static verdict breakdown(struct xlation *state, enum jool_stat_id reason)
 {
 	inc_stats(&state->in, IPSTATS_MIB_INDISCARDS);
+	jstat_inc(state->jool.stats, reason);
 	return VERDICT_DROP;
 }
 
@@ -125,7 +126,7 @@ static int xlat_dst_6to4(struct xlation *state,
  */
 static int find_mask_domain(struct xlation *state,
 		struct ipv4_transport_addr *dst,
-		struct mask_domain **masks)
+		struct mask_domain *masks)
 {
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(&state->in);
 	struct route4_args args = {
@@ -136,9 +137,8 @@ static int find_mask_domain(struct xlation *state,
 		.mark = state->in.skb->mark,
 	};
 
-	*masks = mask_domain_find(state->jool.nat64.pool4, &state->in.tuple,
-			state->jool.global->cfg.nat64.f_args, &args);
-	if (*masks)
+	if (!mask_domain_find(state->jool.nat64.pool4, &state->in.tuple,
+			state->jool.global->cfg.nat64.f_args, &args, masks))
 		return 0;
 
 	log_debug("There is no mask domain mapped to mark %u.",
@@ -158,17 +158,17 @@ static int find_mask_domain(struct xlation *state,
 static verdict ipv6_simple(struct xlation *state)
 {
 	struct ipv4_transport_addr dst4;
-	struct mask_domain *masks;
+	struct mask_domain masks;
 	int error;
 
 	if (xlat_dst_6to4(state, &dst4))
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	if (find_mask_domain(state, &dst4, &masks))
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 
-	error = bib_add6(state->jool.nat64.bib, masks, &state->in.tuple, &dst4,
+	error = bib_add6(state->jool.nat64.bib, &masks, &state->in.tuple, &dst4,
 			&state->entries);
-	mask_domain_put(masks);
+	mask_domain_put(&masks);
 
 	switch (error) {
 	case 0:
@@ -179,7 +179,9 @@ static verdict ipv6_simple(struct xlation *state)
 		 * messily, let's leave this here just in case.
 		 */
 		log_debug("bib_add6() threw error code %d.", error);
-		return breakdown(state);
+		return breakdown(state, (error == -ENOENT)
+				? JSTAT_POOL4_EXHAUSTED
+				: JSTAT_SESSION_REJECTED);
 	}
 }
 
@@ -200,8 +202,8 @@ static verdict ipv4_simple(struct xlation *state)
 	int error;
 
 	error = rfc6052_4to6(state->jool.pool6, &src4->l3, &dst6.l3);
-	if (error)
-		return breakdown(state); /* Error msg already printed. */
+	if (error) /* Error msg already printed. */
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	dst6.l4 = src4->l4;
 
 	error = bib_add4(state->jool.nat64.bib, &dst6, &state->in.tuple,
@@ -213,15 +215,16 @@ static verdict ipv4_simple(struct xlation *state)
 	case -ESRCH:
 		log_debug("There is no BIB entry for the IPv4 packet.");
 		inc_stats(&state->in, IPSTATS_MIB_INNOROUTES);
+		jstat_inc(state->jool.stats, JSTAT_BIB4_NOT_FOUND);
 		return VERDICT_ACCEPT;
 	case -EPERM:
 		log_debug("Packet was blocked by Address-Dependent Filtering.");
 		icmp64_send(&state->in, ICMPERR_FILTER, 0);
-		return breakdown(state);
+		return breakdown(state, JSTAT_ADF);
 	default:
 		log_debug("Errcode %d while finding a BIB entry.", error);
 		icmp64_send(&state->in, ICMPERR_ADDR_UNREACHABLE, 0);
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	}
 }
 
@@ -473,27 +476,27 @@ static verdict ipv6_tcp(struct xlation *state)
 {
 	struct ipv4_transport_addr dst4;
 	struct collision_cb cb;
-	struct mask_domain *masks;
+	struct mask_domain masks;
 	verdict verdict;
 
 	if (xlat_dst_6to4(state, &dst4))
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	if (find_mask_domain(state, &dst4, &masks))
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 
 	cb.cb = tcp_state_machine;
 	cb.arg = state;
-	verdict = bib_add_tcp6(state->jool.nat64.bib, masks, &dst4, &state->in,
+	verdict = bib_add_tcp6(state->jool.nat64.bib, &masks, &dst4, &state->in,
 			&cb, &state->entries);
 
-	mask_domain_put(masks);
+	mask_domain_put(&masks);
 
 	/* Error msg already printed. We don't have an error code anyway. */
 	switch (verdict) {
 	case VERDICT_CONTINUE:
 		return succeed(state);
 	case VERDICT_DROP:
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	case VERDICT_STOLEN:
 	case VERDICT_ACCEPT:
 		break;
@@ -514,8 +517,8 @@ static verdict ipv4_tcp(struct xlation *state)
 	int error;
 
 	error = rfc6052_4to6(state->jool.pool6, &src4->l3, &dst6.l3);
-	if (error)
-		return breakdown(state); /* Error msg already printed. */
+	if (error) /* Error msg already printed. */
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	dst6.l4 = src4->l4;
 
 	cb.cb = tcp_state_machine;
@@ -528,7 +531,7 @@ static verdict ipv4_tcp(struct xlation *state)
 	case VERDICT_CONTINUE:
 		return succeed(state);
 	case VERDICT_DROP:
-		return breakdown(state);
+		return breakdown(state, JSTAT_SESSION_REJECTED);
 	case VERDICT_STOLEN:
 	case VERDICT_ACCEPT:
 		break;
@@ -556,10 +559,12 @@ verdict filtering_and_updating(struct xlation *state)
 		if (pool6_contains(state->jool.pool6, &hdr_ip6->saddr)) {
 			log_debug("Hairpinning loop. Dropping...");
 			inc_stats(in, IPSTATS_MIB_INADDRERRORS);
+			jstat_inc(state->jool.stats, JSTAT_HAIRPIN_LOOP);
 			return VERDICT_DROP;
 		}
 		if (!pool6_contains(state->jool.pool6, &hdr_ip6->daddr)) {
 			log_debug("Packet does not belong to pool6.");
+			jstat_inc(state->jool.stats, JSTAT_POOL6_MISMATCH);
 			return VERDICT_ACCEPT;
 		}
 
@@ -574,6 +579,7 @@ verdict filtering_and_updating(struct xlation *state)
 		if (!pool4db_contains(state->jool.nat64.pool4, state->jool.ns,
 				in->tuple.l4_proto, &in->tuple.dst.addr4)) {
 			log_debug("Packet does not belong to pool4.");
+			jstat_inc(state->jool.stats, JSTAT_POOL4_MISMATCH);
 			return VERDICT_ACCEPT;
 		}
 
@@ -585,6 +591,16 @@ verdict filtering_and_updating(struct xlation *state)
 		break;
 	}
 
+	/*
+	 * Subsequent fragments (which only exist in virtual reassembly mode)
+	 * lack the headers the state machines want. Step 3 will find the
+	 * session their first fragment left behind.
+	 */
+	if (!pkt_is_first_frag(in)) {
+		log_debug("Packet is a subsequent fragment; skipping step...");
+		return VERDICT_CONTINUE;
+	}
+
 	switch (pkt_l4_proto(in)) {
 	case L4PROTO_UDP:
 		switch (pkt_l3_proto(in)) {
@@ -614,6 +630,8 @@ verdict filtering_and_updating(struct xlation *state)
 			if (state->jool.global->cfg.nat64.drop_icmp6_info) {
 				log_debug("Packet is ICMPv6 info (ping); dropping due to policy.");
 				inc_stats(in, IPSTATS_MIB_INDISCARDS);
+				jstat_inc(state->jool.stats,
+						JSTAT_PING_PROHIBITED);
 				return VERDICT_DROP;
 			}
 
@@ -634,3 +652,37 @@ verdict filtering_and_updating(struct xlation *state)
 	log_debug("Done: Step 2.");
 	return result;
 }
+
+/**
+ * filtering_and_updating_hairpin - filtering_and_updating()'s IPv4 half, for
+ * the hairpins whose IPv4 version is never built. (See hairpin_shortcut().)
+ *
+ * @state->in.tuple and layer 3 protocol are the IPv4 packet's, but everything
+ * else is still the original IPv6 packet's. Only the layer 4 header (whose
+ * flags do not depend on the layer 3 protocol) is looked at, so this is only
+ * meant for unfragmented TCP and UDP.
+ */
+verdict filtering_and_updating_hairpin(struct xlation *state)
+{
+	verdict result = VERDICT_CONTINUE;
+
+	log_debug("Step 2: Filtering and Updating (hairpin)");
+
+	switch (pkt_l4_proto(&state->in)) {
+	case L4PROTO_UDP:
+		result = ipv4_simple(state);
+		break;
+	case L4PROTO_TCP:
+		result = ipv4_tcp(state);
+		break;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		WARN(true, "Unexpected layer 4 protocol: %d",
+				pkt_l4_proto(&state->in));
+		result = VERDICT_DROP;
+		break;
+	}
+
+	log_debug("Done: Step 2.");
+	return result;
+}
@@ -1,124 +1,178 @@
 #include "nat64/mod/stateful/fragment_db.h"
 #include "nat64/common/constants.h"
 #include "nat64/mod/common/config.h"
+#include "nat64/mod/common/ipv6_hdr_iterator.h"
 #include "nat64/mod/common/linux_version.h"
+#include "nat64/mod/common/rcu.h"
 #include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/packet.h"
+#include "nat64/mod/common/wkmalloc.h"
 
 #include <linux/version.h>
 #include <linux/ip.h>
+#include <linux/jhash.h>
 #include <linux/ipv6.h>
 #include <net/ipv6.h>
 #include <net/netfilter/ipv4/nf_defrag_ipv4.h>
 #include <net/netfilter/ipv6/nf_defrag_ipv6.h>
 
-struct reassembly_buffer {
-	/** first fragment (fragment offset zero) of the packet. */
+/*
+ * The database is split into FRAGDB_STRIPES independent hash tables (stripes),
+ * each with its own lock, buckets and expiration list. The low bits of an
+ * entry's hash pick its stripe, and the rest pick its bucket within it.
+ *
+ * Each stripe doubles its own bucket array (from the timer, so the packet path
+ * never has to) whenever its chains grow longer than FRAGDB_MAX_CHAIN entries
+ * on average.
+ *
+ * The memory limit is also accounted per stripe; see charge().
+ */
+
+/** Number of stripes per database. Must be a power of two. */
+#define FRAGDB_STRIPE_BITS 4
+#define FRAGDB_STRIPES (1U << FRAGDB_STRIPE_BITS)
+/** Initial number of buckets per stripe. Must be a power of two. */
+#define FRAGDB_MIN_BUCKETS 16
+/** Maximum number of buckets per stripe. Must be a power of two. */
+#define FRAGDB_MAX_BUCKETS 4096
+/** Average chain length past which a stripe's bucket array is doubled. */
+#define FRAGDB_MAX_CHAIN 2
+
+/** Maximum number of fragments a flow can hold while waiting for the first. */
+#define VR_MAX_HELD 64
+
+/**
+ * The fields that identify a fragmented datagram. IPv4 only uses the first
+ * word of the addresses.
+ */
+struct frag_key {
+	struct in6_addr src;
+	struct in6_addr dst;
+	__u32 id;
+	__u8 l3_proto;
+	__u8 l4_proto;
+	__u16 slop;
+};
+
+/**
+ * A datagram whose fragments are still going through.
+ *
+ * In reassembly mode, @pkt is the first fragment and the rest are queued in its
+ * frag_list.
+ * In virtual reassembly mode, @pkt is unused and @held queues the fragments
+ * that arrived before the first one.
+ */
+struct fragdb_entry {
+	struct frag_key key;
+	/** jhash of @key. Picks the stripe and the bucket. */
+	u32 hash;
+
+	/** Reassembly mode: first fragment (offset zero) of the packet. */
 	struct packet pkt;
-	/** This points to the place the next frament should be queued. */
+	/** Virtual mode: fragments that arrived before the first one. */
+	struct sk_buff *held;
+	/** This points to the place the next fragment should be queued. */
 	struct sk_buff **next_slot;
-	/* Jiffy at which the fragment timer will delete this buffer. */
+	/** Virtual mode: length of @held. */
+	unsigned int held_count;
+
+	/** Virtual mode: the first fragment's layer 4 ports. */
+	__u16 src_l4;
+	__u16 dst_l4;
+	/**
+	 * Virtual mode: did the first fragment make it past Filtering and
+	 * Updating? (Also means @src_l4 and @dst_l4 are valid.)
+	 */
+	bool first_seen;
+	/** Virtual mode: did Filtering and Updating turn the first one down? */
+	bool rejected;
+	/** Virtual mode: if @rejected, the verdict the rest should get. */
+	verdict rejected_verdict;
+	/** Virtual mode: fragment payload bytes let through so far. */
+	unsigned int bytes_seen;
+	/** Virtual mode: datagram's payload length. Zero until the last one. */
+	unsigned int total_len;
+
+	/** Bytes this entry is charged against its database's memory limit. */
+	unsigned int mem;
+	/* Jiffy at which the fragment timer will delete this entry. */
 	unsigned long dying_time;
 
+	struct hlist_node hlist_hook;
 	struct list_head list_hook;
 };
 
-/** Cache for struct reassembly_buffers, for efficient allocation. */
-static struct kmem_cache *buffer_cache;
+struct fragdb_stripe {
+	spinlock_t lock;
 
-#define HTABLE_NAME fragdb_table
-#define KEY_TYPE struct packet
-#define VALUE_TYPE struct reassembly_buffer
-#define HASH_TABLE_SIZE 256
-#include "../common/hash_table.c"
+	/** The buckets. There are @size of them; always a power of two. */
+	struct hlist_head *table;
+	unsigned int size;
+	/** Number of entries in @table. */
+	unsigned int count;
+	/** The same entries, oldest first. (For both expiration and eviction.) */
+	struct list_head expire_list;
+	/**
+	 * Bytes charged by this stripe's entries. Only written while @lock is
+	 * held, but read locklessly by other stripes' fragdb_mem().
+	 */
+	unsigned int mem;
 
-/**
- * Just a random number, initialized at startup.
- * Used to prevent attackers from crafting special packets that will have the
- * same hash code but different hash slots. See
- * http://stackoverflow.com/questions/12175109
- */
-static u32 rnd;
+	u64 evictions;
+	u64 timeouts;
+} ____cacheline_aligned_in_smp;
 
 struct fragdb {
-	struct fragdb_table table;
+	struct fragdb_stripe stripes[FRAGDB_STRIPES];
 
-	struct list_head expire_list;
 	/**
 	 * Maximum number of jiffies any entry in this database should survive
 	 * idle.
 	 */
 	unsigned long timeout;
+	/** Old entries are evicted to keep the stripes' @mem below this. */
+	unsigned int max_bytes;
 
-	spinlock_t lock;
 	struct kref ref;
 };
 
+/** Cache for struct fragdb_entrys, for efficient allocation. */
+static struct kmem_cache *entry_cache;
+
 /**
- * As specified above, the database is (mostly) a hash table. This is one of two
- * functions used internally by the table to search for values.
+ * Just a random number, initialized at startup.
+ * Used to prevent attackers from crafting special packets that will have the
+ * same hash code but different hash slots. See
+ * http://stackoverflow.com/questions/12175109
  */
-static bool equals_function(const struct packet *k1, const struct packet *k2)
-{
-	struct ipv6hdr *hdr1;
-	struct ipv6hdr *hdr2;
-
-	if (k1 == k2)
-		return true;
-	if (k1 == NULL || k2 == NULL)
-		return false;
-
-	hdr1 = pkt_ip6_hdr(k1);
-	hdr2 = pkt_ip6_hdr(k2);
-
-	if (!addr6_equals(&hdr1->saddr, &hdr2->saddr))
-		return false;
-	if (!addr6_equals(&hdr1->daddr, &hdr2->daddr))
-		return false;
-	if (pkt_frag_hdr(k1)->identification != pkt_frag_hdr(k2)->identification)
-		return false;
-	if (pkt_l4_proto(k1) != pkt_l4_proto(k2))
-		return false;
-
-	return true;
-}
+static u32 rnd;
 
-#if LINUX_VERSION_AT_LEAST(3, 13, 0, 7, 2)
 /**
- * Hash function for IPv6 keys from reassembly.c
+ * Are we translating fragments as they arrive (instead of having the kernel
+ * reassemble them first)? Module-wide, because the kernel's defragmenters are
+ * too.
  */
-static unsigned int inet6_hash_frag(__be32 id, const struct in6_addr *saddr,
-		const struct in6_addr *daddr, u32 rnd)
-{
-	u32 c;
-	c = jhash_3words(ipv6_addr_hash(saddr), ipv6_addr_hash(daddr),
-			(__force u32)id, rnd);
-	return c & (INETFRAGS_HASHSZ - 1);
-}
-#endif
+static bool virtual_mode;
 
 /**
- * As specified above, the database is a hash table. This is one of two
- * functions used internally by the table to search for values.
+ * @virtual_reassembly: Translate fragments one by one instead of reassembling
+ *	them? (See fragdb_handle().)
  */
-static unsigned int hash_function(const struct packet *key)
+int fragdb_init(bool virtual_reassembly)
 {
-	struct ipv6hdr *hdr = pkt_ip6_hdr(key);
-	return inet6_hash_frag(pkt_frag_hdr(key)->identification,
-			&hdr->saddr, &hdr->daddr, rnd);
-}
+	virtual_mode = virtual_reassembly;
 
-int fragdb_init(void)
-{
 #ifndef UNIT_TESTING
-	nf_defrag_ipv6_enable();
-	nf_defrag_ipv4_enable();
+	if (!virtual_mode) {
+		nf_defrag_ipv6_enable();
+		nf_defrag_ipv4_enable();
+	}
 #endif
 
-	buffer_cache = kmem_cache_create("jool_reassembly_buffers",
-			sizeof(struct reassembly_buffer), 0, 0, NULL);
-	if (!buffer_cache) {
-		log_err("Could not allocate the reassembly buffer cache.");
+	entry_cache = kmem_cache_create("jool_fragdb_entries",
+			sizeof(struct fragdb_entry), 0, 0, NULL);
+	if (!entry_cache) {
+		log_err("Could not allocate the fragment database entry cache.");
 		return -ENOMEM;
 	}
 
@@ -129,30 +183,58 @@ int fragdb_init(void)
 
 void fragdb_destroy(void)
 {
-	kmem_cache_destroy(buffer_cache);
+	kmem_cache_destroy(entry_cache);
+}
+
+static struct hlist_head *alloc_buckets(unsigned int size, gfp_t flags)
+{
+	struct hlist_head *table;
+	unsigned int i;
+
+	table = __wkmalloc("fragdb buckets", size * sizeof(*table), flags);
+	if (!table)
+		return NULL;
+
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(&table[i]);
+	return table;
 }
 
 struct fragdb *fragdb_create(void)
 {
 	struct fragdb *db;
-	int error;
+	struct fragdb_stripe *stripe;
+	unsigned int s;
 
 	db = wkmalloc(struct fragdb, GFP_KERNEL);
 	if (!db)
 		return NULL;
 
-	error = fragdb_table_init(&db->table, equals_function, hash_function);
-	if (error) {
-		wkfree(struct fragdb, db);
-		return NULL;
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		stripe = &db->stripes[s];
+		stripe->table = alloc_buckets(FRAGDB_MIN_BUCKETS, GFP_KERNEL);
+		if (!stripe->table)
+			goto fail;
+		spin_lock_init(&stripe->lock);
+		stripe->size = FRAGDB_MIN_BUCKETS;
+		stripe->count = 0;
+		INIT_LIST_HEAD(&stripe->expire_list);
+		stripe->mem = 0;
+		stripe->evictions = 0;
+		stripe->timeouts = 0;
 	}
 
-	INIT_LIST_HEAD(&db->expire_list);
 	db->timeout = msecs_to_jiffies(1000 * FRAGMENT_MIN);
-	spin_lock_init(&db->lock);
+	db->max_bytes = DEFAULT_FRAG_MAX_BYTES;
 	kref_init(&db->ref);
 
 	return db;
+
+fail:
+	while (s-- > 0)
+		__wkfree("fragdb buckets", db->stripes[s].table);
+	wkfree(struct fragdb, db);
+	return NULL;
 }
 
 void fragdb_get(struct fragdb *db)
@@ -160,17 +242,54 @@ void fragdb_get(struct fragdb *db)
 	kref_get(&db->ref);
 }
 
-static void buffer_dealloc(struct reassembly_buffer *buffer)
+/** Releases a list of held fragments (linked by skb->next). */
+static void free_held(struct sk_buff *skb)
+{
+	struct sk_buff *next;
+
+	for (; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		kfree_skb(skb);
+	}
+}
+
+/**
+ * Removes @entry from @stripe and destroys it, along with any fragments it was
+ * still holding.
+ */
+static void entry_destroy(struct fragdb *db, struct fragdb_stripe *stripe,
+		struct fragdb_entry *entry)
 {
-	kfree_skb(buffer->pkt.skb);
-	wkmem_cache_free("reassembly buffer", buffer_cache, buffer);
+	hlist_del(&entry->hlist_hook);
+	list_del(&entry->list_hook);
+	stripe->count--;
+	WRITE_ONCE(stripe->mem, stripe->mem - entry->mem);
+
+	if (entry->pkt.skb)
+		kfree_skb(entry->pkt.skb);
+	free_held(entry->held);
+
+	wkmem_cache_free("fragdb entry", entry_cache, entry);
 }
 
 static void fragdb_release(struct kref *ref)
 {
 	struct fragdb *db;
+	struct fragdb_stripe *stripe;
+	unsigned int s;
+
 	db = container_of(ref, struct fragdb, ref);
-	fragdb_table_empty(&db->table, buffer_dealloc);
+
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		stripe = &db->stripes[s];
+		while (!list_empty(&stripe->expire_list))
+			entry_destroy(db, stripe, list_first_entry(
+					&stripe->expire_list,
+					struct fragdb_entry, list_hook));
+		__wkfree("fragdb buckets", stripe->table);
+	}
+
 	wkfree(struct fragdb, db);
 }
 
@@ -181,36 +300,335 @@ void fragdb_put(struct fragdb *db)
 
 void fragdb_config_copy(struct fragdb *db, struct fragdb_config *config)
 {
-	spin_lock_bh(&db->lock);
-	config->ttl = db->timeout;
-	spin_unlock_bh(&db->lock);
+	config->ttl = READ_ONCE(db->timeout);
+	config->max_bytes = READ_ONCE(db->max_bytes);
 }
 
 void fragdb_config_set(struct fragdb *db, struct fragdb_config *config)
 {
-	spin_lock_bh(&db->lock);
-	db->timeout = config->ttl;
-	spin_unlock_bh(&db->lock);
+	WRITE_ONCE(db->timeout, config->ttl);
+	WRITE_ONCE(db->max_bytes, config->max_bytes);
+}
+
+/**
+ * Adds up the counters of every stripe. The stripes are locked one at a time,
+ * so the result is not an atomic snapshot.
+ */
+void fragdb_stats(struct fragdb *db, struct fragdb_stats_usr *result)
+{
+	struct fragdb_stripe *stripe;
+	unsigned int s;
+
+	memset(result, 0, sizeof(*result));
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		stripe = &db->stripes[s];
+		spin_lock_bh(&stripe->lock);
+		result->entries += stripe->count;
+		result->bytes += stripe->mem;
+		result->evictions += stripe->evictions;
+		result->timeouts += stripe->timeouts;
+		spin_unlock_bh(&stripe->lock);
+	}
+}
+
+static void init_key(struct frag_key *key, struct packet *pkt)
+{
+	struct ipv6hdr *hdr6;
+	struct iphdr *hdr4;
+
+	memset(key, 0, sizeof(*key));
+	key->l3_proto = pkt_l3_proto(pkt);
+	key->l4_proto = pkt_l4_proto(pkt);
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		hdr6 = pkt_ip6_hdr(pkt);
+		key->src = hdr6->saddr;
+		key->dst = hdr6->daddr;
+		key->id = be32_to_cpu(pkt_frag_hdr(pkt)->identification);
+		break;
+	case L3PROTO_IPV4:
+		hdr4 = pkt_ip4_hdr(pkt);
+		key->src.s6_addr32[0] = hdr4->saddr;
+		key->dst.s6_addr32[0] = hdr4->daddr;
+		key->id = be16_to_cpu(hdr4->id);
+		break;
+	}
+}
+
+static u32 hash_key(struct frag_key *key)
+{
+	return jhash2((u32 *)key, sizeof(*key) / sizeof(u32), rnd);
+}
+
+static struct fragdb_stripe *get_stripe(struct fragdb *db, u32 hash)
+{
+	return &db->stripes[hash & (FRAGDB_STRIPES - 1)];
+}
+
+static struct hlist_head *get_bucket(struct fragdb_stripe *stripe, u32 hash)
+{
+	return &stripe->table[(hash >> FRAGDB_STRIPE_BITS) & (stripe->size - 1)];
+}
+
+static struct fragdb_entry *entry_find(struct fragdb_stripe *stripe,
+		struct frag_key *key, u32 hash)
+{
+	struct hlist_node *node;
+	struct fragdb_entry *entry;
+
+	/* (Not hlist_for_each_entry(); its signature changed in 3.9.) */
+	hlist_for_each(node, get_bucket(stripe, hash)) {
+		entry = hlist_entry(node, struct fragdb_entry, hlist_hook);
+		if (entry->hash == hash
+				&& memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns the bytes charged by all of @db's stripes. The stripes are not
+ * locked, so this is only an approximation; the limit can be overshot by
+ * whatever the other CPUs charge while we're looking.
+ */
+static unsigned int fragdb_mem(struct fragdb *db)
+{
+	unsigned int result = 0;
+	unsigned int s;
+
+	for (s = 0; s < FRAGDB_STRIPES; s++)
+		result += READ_ONCE(db->stripes[s].mem);
+
+	return result;
+}
+
+/**
+ * Destroys @stripe's oldest entries (other than @keep) until @len more bytes
+ * fit in @db. Assumes @stripe is locked.
+ */
+static void evict(struct fragdb *db, struct fragdb_stripe *stripe,
+		struct fragdb_entry *keep, unsigned int len, unsigned int max)
+{
+	struct fragdb_entry *victim;
+	struct fragdb_entry *tmp;
+
+	list_for_each_entry_safe(victim, tmp, &stripe->expire_list, list_hook) {
+		if (fragdb_mem(db) + len <= max)
+			return;
+		if (victim == keep)
+			continue;
+		entry_destroy(db, stripe, victim);
+		stripe->evictions++;
+	}
 }
 
+/**
+ * Charges @len more bytes to @entry. If that would exceed the database's
+ * limit, evicts the oldest entries (other than @entry) first. Returns false
+ * (and charges nothing) if that still isn't enough.
+ *
+ * Each stripe keeps its own byte count, so charging never writes to a
+ * cacheline shared by all the CPUs. While @stripe stays below its fair share
+ * of the limit, the others are not even looked at; past that, the limit is
+ * enforced on their (approximate) sum. This means the total can briefly
+ * overshoot the limit, until the next charge past a share evicts it back.
+ *
+ * @stripe (@entry's stripe, which is locked) is emptied first. The other
+ * stripes are only trylocked; if we waited on them while holding @stripe, two
+ * CPUs evicting towards each other would deadlock.
+ */
+static bool charge(struct fragdb *db, struct fragdb_stripe *stripe,
+		struct fragdb_entry *entry, unsigned int len)
+{
+	unsigned int max = READ_ONCE(db->max_bytes);
+	struct fragdb_stripe *other;
+	unsigned int s;
+
+	if (stripe->mem + len <= max / FRAGDB_STRIPES)
+		goto success;
+
+	evict(db, stripe, entry, len, max);
+
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		if (fragdb_mem(db) + len <= max)
+			break;
+		other = &db->stripes[s];
+		if (other == stripe || !spin_trylock(&other->lock))
+			continue;
+		evict(db, other, NULL, len, max);
+		spin_unlock(&other->lock);
+	}
+
+	if (fragdb_mem(db) + len > max) {
+		log_debug("The fragment database is full.");
+		return false;
+	}
+
+success:
+	WRITE_ONCE(stripe->mem, stripe->mem + len);
+	entry->mem += len;
+	return true;
+}
+
+static struct fragdb_entry *entry_create(struct fragdb *db,
+		struct fragdb_stripe *stripe, struct frag_key *key, u32 hash)
+{
+	struct fragdb_entry *entry;
+
+	entry = wkmem_cache_alloc("fragdb entry", entry_cache, GFP_ATOMIC);
+	if (!entry)
+		return NULL;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->key = *key;
+	entry->hash = hash;
+	entry->next_slot = &entry->held;
+	entry->dying_time = jiffies + READ_ONCE(db->timeout);
+
+	if (!charge(db, stripe, entry, sizeof(*entry))) {
+		wkmem_cache_free("fragdb entry", entry_cache, entry);
+		return NULL;
+	}
+
+	hlist_add_head(&entry->hlist_hook, get_bucket(stripe, hash));
+	list_add_tail(&entry->list_hook, &stripe->expire_list);
+	stripe->count++;
+	return entry;
+}
+
+/**
+ * Grows @stripe's bucket array if its chains have gotten too long.
+ *
+ * Only the timer calls this, so @stripe->size cannot change between the two
+ * critical sections.
+ */
+static void stripe_grow(struct fragdb_stripe *stripe)
+{
+	struct hlist_head *old_table;
+	struct hlist_head *new_table;
+	unsigned int old_size;
+	unsigned int new_size;
+	struct fragdb_entry *entry;
+	struct hlist_node *node;
+	struct hlist_node *tmp;
+	unsigned int i;
+
+	spin_lock_bh(&stripe->lock);
+	old_size = stripe->size;
+	new_size = old_size;
+	while (stripe->count > FRAGDB_MAX_CHAIN * new_size
+			&& new_size < FRAGDB_MAX_BUCKETS)
+		new_size <<= 1;
+	spin_unlock_bh(&stripe->lock);
+
+	if (new_size == old_size)
+		return;
+
+	/* The timer is a softirq, hence the atomic allocation. */
+	new_table = alloc_buckets(new_size, GFP_ATOMIC);
+	if (!new_table)
+		return; /* Whatever; next time. */
+
+	spin_lock_bh(&stripe->lock);
+
+	old_table = stripe->table;
+	stripe->table = new_table;
+	stripe->size = new_size;
+
+	for (i = 0; i < old_size; i++) {
+		hlist_for_each_safe(node, tmp, &old_table[i]) {
+			entry = hlist_entry(node, struct fragdb_entry,
+					hlist_hook);
+			hlist_del(&entry->hlist_hook);
+			hlist_add_head(&entry->hlist_hook,
+					get_bucket(stripe, entry->hash));
+		}
+	}
+
+	spin_unlock_bh(&stripe->lock);
+
+	__wkfree("fragdb buckets", old_table);
+	log_debug("Fragment database stripe grew to %u buckets.", new_size);
+}
+
+/**
+ * Executed every once in a while to exterminate expired fragments.
+ */
+void fragdb_clean(struct fragdb *db)
+{
+	struct fragdb_stripe *stripe;
+	struct fragdb_entry *entry;
+	unsigned int s;
+	unsigned int e = 0;
+
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		stripe = &db->stripes[s];
+
+		spin_lock_bh(&stripe->lock);
+		while (!list_empty(&stripe->expire_list)) {
+			entry = list_first_entry(&stripe->expire_list,
+					struct fragdb_entry, list_hook);
+			if (time_after(entry->dying_time, jiffies))
+				break;
+
+			entry_destroy(db, stripe, entry);
+			stripe->timeouts++;
+			e++;
+		}
+		spin_unlock_bh(&stripe->lock);
+
+		stripe_grow(stripe);
+	}
+
+	log_debug("Deleted %u fragment database entries.", e);
+}
+
+#define COMMON_MSG " I will not be able to translate; aborting.\n" \
+		"(I don't think this error is going to happen... but if it does, either some future kernel " \
+		"version broke our assumptions or there is a kernel module in prerouting (pre-Jool), " \
+		"which is doing some questionable edits on the packet.)"
+/**
+ * This whole module is a hack that tries to leverage nf_defrag_ipv6's hack,
+ * but we can't do it if there are more hacks on top of it.
+ * Therefore additional validations.
+ */
+static int validate_skb(struct sk_buff *skb)
+{
+	if (WARN(skb->prev || skb->next, "Packet is listed." COMMON_MSG))
+		return -EINVAL;
+
+	if (WARN(skb_shinfo(skb)->frag_list, "Packet has a fragment list."
+			COMMON_MSG))
+		return -EINVAL;
+
+	return 0;
+}
+#undef COMMON_MSG
+
 #define COMMON_MSG " Looks like nf_defrag_ipv6 is not sorting the fragments, " \
 		"or something's shuffling them later. Please report."
-static struct reassembly_buffer *add_pkt(struct fragdb *db, struct packet *pkt)
+static struct fragdb_entry *add_pkt(struct fragdb *db,
+		struct fragdb_stripe *stripe, struct packet *pkt,
+		struct frag_key *key, u32 hash)
 {
-	struct reassembly_buffer *buffer;
+	struct fragdb_entry *entry;
 	struct frag_hdr *hdr_frag = pkt_frag_hdr(pkt);
 	unsigned int payload_len;
 
-	/* Does it already exist? If so, add to and return existing buffer */
-	buffer = fragdb_table_get(&db->table, pkt);
-	if (buffer) {
+	/* Does it already exist? If so, add to and return existing entry */
+	entry = entry_find(stripe, key, hash);
+	if (entry) {
 		if (WARN(is_first_frag6(hdr_frag),
 				"Non-first fragment's offset is zero."
 				COMMON_MSG))
 			return NULL;
+		if (!charge(db, stripe, entry, pkt->skb->truesize))
+			return NULL;
 
-		*buffer->next_slot = pkt->skb;
-		buffer->next_slot = &pkt->skb->next;
+		*entry->next_slot = pkt->skb;
+		entry->next_slot = &pkt->skb->next;
 
 		/*
 		 * Why this? Dunno, both defrags do it when they support
@@ -224,12 +642,12 @@ static struct reassembly_buffer *add_pkt(struct fragdb *db, struct packet *pkt)
 		 * calculation of this length.
 		 */
 		payload_len = pkt_payload_len_pkt(pkt);
-		buffer->pkt.skb->len += payload_len;
-		buffer->pkt.skb->data_len += payload_len;
-		buffer->pkt.skb->truesize += pkt->skb->truesize;
+		entry->pkt.skb->len += payload_len;
+		entry->pkt.skb->data_len += payload_len;
+		entry->pkt.skb->truesize += pkt->skb->truesize;
 		skb_pull(pkt->skb, pkt_hdrs_len(pkt));
 
-		return buffer;
+		return entry;
 	}
 
 	if (WARN(!is_first_frag6(hdr_frag),
@@ -251,91 +669,466 @@ static struct reassembly_buffer *add_pkt(struct fragdb *db, struct packet *pkt)
 		return NULL;
 	}
 
-	/* Create buffer, add the packet to it, index */
-	buffer = wkmem_cache_alloc("reassembly buffer", buffer_cache, GFP_ATOMIC);
-	if (!buffer)
+	/* Create entry, add the packet to it, index */
+	entry = entry_create(db, stripe, key, hash);
+	if (!entry)
 		return NULL;
-
-	buffer->pkt = *pkt;
-	buffer->pkt.original_pkt = &buffer->pkt;
-	buffer->next_slot = &skb_shinfo(pkt->skb)->frag_list;
-	buffer->dying_time = jiffies + db->timeout;
-
-	if (fragdb_table_put(&db->table, pkt, buffer)) {
-		wkmem_cache_free("reassembly buffer", buffer_cache, buffer);
+	if (!charge(db, stripe, entry, pkt->skb->truesize)) {
+		entry_destroy(db, stripe, entry);
 		return NULL;
 	}
 
-	/* Schedule for automatic deletion */
-	list_add_tail(&buffer->list_hook, &db->expire_list);
+	entry->pkt = *pkt;
+	entry->pkt.original_pkt = &entry->pkt;
+	entry->next_slot = &skb_shinfo(pkt->skb)->frag_list;
 
-	return buffer;
+	return entry;
 }
 #undef COMMON_MSG
 
 /**
- * Removes "buffer" from the database and destroys it.
+ * Assumes @pkt is the first fragment of @entry's datagram.
  */
-static void buffer_destroy(struct fragdb *db, struct reassembly_buffer *buffer,
-		struct packet *pkt)
+static void vr_learn_ports(struct fragdb_entry *entry, struct packet *pkt)
 {
-	if (WARN(!fragdb_table_remove(&db->table, pkt, NULL),
-			"Something is attempting to delete a buffer that wasn't stored in the database."))
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+		entry->src_l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->source);
+		entry->dst_l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->dest);
+		break;
+	case L4PROTO_UDP:
+		entry->src_l4 = be16_to_cpu(pkt_udp_hdr(pkt)->source);
+		entry->dst_l4 = be16_to_cpu(pkt_udp_hdr(pkt)->dest);
+		break;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		WARN(true, "Unexpected layer 4 protocol: %d", pkt_l4_proto(pkt));
 		return;
+	}
 
-	list_del(&buffer->list_hook);
-	buffer_dealloc(buffer);
+	entry->first_seen = true;
 }
 
 /**
- * Executed every once in a while to exterminate expired fragments.
+ * Builds @pkt's tuple out of its addresses and its first fragment's ports,
+ * since @pkt (a subsequent fragment) does not have any of the latter.
  */
-void fragdb_clean(struct fragdb *db)
+static void vr_fill_tuple(struct fragdb_entry *entry, struct packet *pkt)
 {
-	unsigned int b = 0;
-	struct reassembly_buffer *buffer;
+	struct tuple *tuple = &pkt->tuple;
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		tuple->src.addr6.l3 = pkt_ip6_hdr(pkt)->saddr;
+		tuple->src.addr6.l4 = entry->src_l4;
+		tuple->dst.addr6.l3 = pkt_ip6_hdr(pkt)->daddr;
+		tuple->dst.addr6.l4 = entry->dst_l4;
+		break;
+	case L3PROTO_IPV4:
+		tuple->src.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->saddr;
+		tuple->src.addr4.l4 = entry->src_l4;
+		tuple->dst.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->daddr;
+		tuple->dst.addr4.l4 = entry->dst_l4;
+		break;
+	}
 
-	spin_lock_bh(&db->lock);
+	tuple->l3_proto = pkt_l3_proto(pkt);
+	tuple->l4_proto = pkt_l4_proto(pkt);
+}
+
+/**
+ * Computes the position of @skb's payload within @entry's datagram. Returns
+ * @skb's More Fragments flag.
+ *
+ * Only looks at the layer 3 headers, so it works on held fragments, whose
+ * struct packets are long gone.
+ */
+static bool vr_bounds(struct fragdb_entry *entry, struct sk_buff *skb,
+		unsigned int *offset, unsigned int *len)
+{
+	struct ipv6hdr *hdr6;
+	struct frag_hdr *hdr_frag;
+	struct iphdr *hdr4;
+
+	switch (entry->key.l3_proto) {
+	case L3PROTO_IPV6:
+		hdr6 = ipv6_hdr(skb);
+		hdr_frag = hdr_iterator_find(hdr6, NEXTHDR_FRAGMENT);
+		if (WARN(!hdr_frag, "Fragment lost its fragment header."))
+			break;
+		*offset = get_fragment_offset_ipv6(hdr_frag);
+		/* Extension headers after the fragment header are payload. */
+		*len = sizeof(*hdr6) + be16_to_cpu(hdr6->payload_len)
+				- ((void *)(hdr_frag + 1) - (void *)hdr6);
+		return is_mf_set_ipv6(hdr_frag);
+	case L3PROTO_IPV4:
+		hdr4 = ip_hdr(skb);
+		*offset = get_fragment_offset_ipv4(hdr4);
+		*len = be16_to_cpu(hdr4->tot_len) - (hdr4->ihl << 2);
+		return is_mf_set_ipv4(hdr4);
+	}
 
-	while (!list_empty(&db->expire_list)) {
-		buffer = list_entry(db->expire_list.next,
-				struct reassembly_buffer,
-				list_hook);
+	*offset = 0;
+	*len = 0;
+	return true;
+}
 
-		if (time_after(buffer->dying_time, jiffies)) {
-			spin_unlock_bh(&db->lock);
-			log_debug("Deleted %u reassembly buffers.", b);
-			return;
+/** Counts @skb's payload as gone. */
+static void vr_count(struct fragdb_entry *entry, struct sk_buff *skb)
+{
+	unsigned int offset;
+	unsigned int len;
+
+	if (!vr_bounds(entry, skb, &offset, &len))
+		entry->total_len = offset + len;
+	entry->bytes_seen += len;
+}
+
+/**
+ * Counts @pkt's payload as gone, and forgets @entry if that was the last of
+ * it.
+ *
+ * Duplicate fragments might make us forget the entry early, in which case the
+ * stragglers (if any) will be held until the timer kills them. Same as if the
+ * datagram had lost a fragment, really.
+ */
+static void vr_account(struct fragdb *db, struct fragdb_stripe *stripe,
+		struct fragdb_entry *entry, struct packet *pkt)
+{
+	vr_count(entry, pkt->skb);
+	if (entry->total_len && entry->bytes_seen >= entry->total_len)
+		entry_destroy(db, stripe, entry);
+}
+
+/**
+ * Returns the place in @entry's held list (which is sorted by offset) where a
+ * fragment spanning @len bytes from @offset belongs. Returns NULL if it
+ * overlaps with the fragments that are already there, or contradicts the
+ * datagram's length.
+ */
+static struct sk_buff **vr_icmp_slot(struct fragdb_entry *entry,
+		unsigned int offset, unsigned int len, bool mf)
+{
+	struct sk_buff **slot;
+	unsigned int end = offset + len;
+	unsigned int slot_offset;
+	unsigned int slot_len;
+
+	/* Nothing can go past the last fragment, nor can there be two. */
+	if (entry->total_len && (end > entry->total_len || !mf))
+		return NULL;
+
+	for (slot = &entry->held; *slot; slot = &(*slot)->next) {
+		vr_bounds(entry, *slot, &slot_offset, &slot_len);
+		if (end <= slot_offset)
+			break;
+		if (offset < slot_offset + slot_len)
+			return NULL;
+	}
+
+	return (!mf && *slot) ? NULL : slot;
+}
+
+/**
+ * Chains @entry's held fragments (which are all of them, sorted) into a single
+ * packet, the way the kernel's defragmenters do it: the first fragment is the
+ * head, and the rest (minus their headers) hang from its frag_list.
+ */
+static struct sk_buff *vr_icmp_assemble(struct fragdb_entry *entry)
+{
+	struct sk_buff *head = entry->held;
+	struct sk_buff *skb;
+	struct frag_hdr *hdr_frag;
+	struct iphdr *hdr4;
+
+	entry->held = NULL;
+	entry->held_count = 0;
+
+	skb_shinfo(head)->frag_list = head->next;
+	head->next = NULL;
+	for (skb = skb_shinfo(head)->frag_list; skb; skb = skb->next) {
+		head->len += skb->len;
+		head->data_len += skb->len;
+		head->truesize += skb->truesize;
+	}
+	/* The fragments' checksums were not combined. */
+	head->ip_summed = CHECKSUM_NONE;
+
+	switch (entry->key.l3_proto) {
+	case L3PROTO_IPV6:
+		ipv6_hdr(head)->payload_len = cpu_to_be16(head->len
+				- sizeof(struct ipv6hdr));
+		/* Same as in reassembly mode; see fragdb_handle(). */
+		hdr_frag = hdr_iterator_find(ipv6_hdr(head), NEXTHDR_FRAGMENT);
+		hdr_frag->frag_off &= cpu_to_be16(~IP6_MF);
+		break;
+	case L3PROTO_IPV4:
+		hdr4 = ip_hdr(head);
+		hdr4->tot_len = cpu_to_be16(head->len);
+		hdr4->frag_off &= cpu_to_be16(~IP_MF);
+		hdr4->check = 0;
+		hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+		break;
+	}
+
+	return head;
+}
+
+/**
+ * vr_handle()'s ICMP version.
+ *
+ * ICMP checksums cover the entire message (and ICMPv6's also covers its
+ * length), so ICMP cannot be translated fragment by fragment. Instead, the
+ * fragments are held until the whole datagram has arrived, and then handed
+ * back through @held as a single (frag_list) packet, which the caller is
+ * expected to translate as if the kernel had reassembled it.
+ */
+static verdict vr_handle_icmp(struct fragdb *db, struct packet *pkt,
+		struct sk_buff **held)
+{
+	struct sk_buff *skb = pkt->skb;
+	struct frag_key key;
+	u32 hash;
+	struct fragdb_stripe *stripe;
+	struct fragdb_entry *entry;
+	struct sk_buff **slot;
+	unsigned int offset;
+	unsigned int len;
+	bool mf;
+
+	if (validate_skb(skb))
+		return VERDICT_DROP;
+	/* The head's header will be edited, and the rest's will be pulled. */
+	if (skb_cloned(skb)) {
+		log_debug("Packet is cloned, so I can't edit its shared area. Canceling translation.");
+		inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
+		return VERDICT_DROP;
+	}
+
+	init_key(&key, pkt);
+	hash = hash_key(&key);
+	stripe = get_stripe(db, hash);
+
+	spin_lock_bh(&stripe->lock);
+
+	entry = entry_find(stripe, &key, hash);
+	if (!entry) {
+		entry = entry_create(db, stripe, &key, hash);
+		if (!entry)
+			goto drop;
+	}
+
+	mf = vr_bounds(entry, skb, &offset, &len);
+	slot = vr_icmp_slot(entry, offset, len, mf);
+	if (!slot) {
+		log_debug("Fragment overlaps with its siblings.");
+		goto drop;
+	}
+	if (entry->held_count >= VR_MAX_HELD) {
+		log_debug("Too many fragments are waiting for the rest of their datagram.");
+		goto drop;
+	}
+	if (!charge(db, stripe, entry, skb->truesize))
+		goto drop;
+
+	/* Only the head keeps its headers. */
+	if (offset)
+		skb_pull(skb, skb->len - len);
+	/* The device might be gone by the time the datagram is complete. */
+	skb->dev = NULL;
+	skb->next = *slot;
+	*slot = skb;
+	entry->held_count++;
+
+	entry->bytes_seen += len;
+	if (!mf)
+		entry->total_len = offset + len;
+
+	if (!entry->total_len || entry->bytes_seen < entry->total_len) {
+		spin_unlock_bh(&stripe->lock);
+		log_debug("Holding the fragment until the rest of the datagram arrives.");
+		return VERDICT_STOLEN;
+	}
+
+	*held = vr_icmp_assemble(entry);
+	entry_destroy(db, stripe, entry);
+	spin_unlock_bh(&stripe->lock);
+	log_debug("All the fragments are now available. Resuming translation...");
+	return VERDICT_STOLEN;
+
+drop:
+	spin_unlock_bh(&stripe->lock);
+	inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
+	return VERDICT_DROP;
+}
+
+/**
+ * fragdb_handle()'s virtual reassembly version. See fragdb_handle().
+ */
+static verdict vr_handle(struct fragdb *db, struct packet *pkt,
+		struct sk_buff **held)
+{
+	struct frag_key key;
+	u32 hash;
+	struct fragdb_stripe *stripe;
+	struct fragdb_entry *entry;
+	verdict result;
+
+	if (!pkt_is_fragment(pkt))
+		return VERDICT_CONTINUE;
+
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+		break;
+	case L4PROTO_ICMP:
+		return vr_handle_icmp(db, pkt, held);
+	case L4PROTO_OTHER:
+		/* Not ours; step 1 will decide what to do with it. */
+		return VERDICT_CONTINUE;
+	}
+
+	if (validate_skb(pkt->skb))
+		return VERDICT_DROP;
+
+	init_key(&key, pkt);
+	hash = hash_key(&key);
+	stripe = get_stripe(db, hash);
+
+	spin_lock_bh(&stripe->lock);
+
+	entry = entry_find(stripe, &key, hash);
+	if (!entry) {
+		entry = entry_create(db, stripe, &key, hash);
+		if (!entry)
+			goto drop;
+	}
+
+	if (pkt_is_first_frag(pkt)) {
+		/*
+		 * The rest of the datagram is not let through until this one
+		 * survives Filtering and Updating. See fragdb_filtered().
+		 */
+		spin_unlock_bh(&stripe->lock);
+		return VERDICT_CONTINUE;
+
+	} else if (entry->first_seen) {
+		vr_fill_tuple(entry, pkt);
+
+	} else if (entry->rejected) {
+		log_debug("The first fragment was rejected; so is this one.");
+		result = entry->rejected_verdict;
+		vr_account(db, stripe, entry, pkt);
+		spin_unlock_bh(&stripe->lock);
+		if (result == VERDICT_DROP)
+			inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
+		return result;
+
+	} else {
+		if (entry->held_count >= VR_MAX_HELD) {
+			log_debug("Too many fragments are waiting for their first one.");
+			goto drop;
 		}
+		if (!charge(db, stripe, entry, pkt->skb->truesize))
+			goto drop;
+
+		/* The device might be gone by the time the first one arrives. */
+		pkt->skb->dev = NULL;
+		*entry->next_slot = pkt->skb;
+		entry->next_slot = &pkt->skb->next;
+		entry->held_count++;
 
-		buffer_destroy(db, buffer, &buffer->pkt);
-		b++;
+		spin_unlock_bh(&stripe->lock);
+		log_debug("Holding the fragment until the first one arrives.");
+		return VERDICT_STOLEN;
 	}
 
-	spin_unlock_bh(&db->lock);
+	vr_account(db, stripe, entry, pkt);
+	spin_unlock_bh(&stripe->lock);
+	return VERDICT_CONTINUE;
+
+drop:
+	spin_unlock_bh(&stripe->lock);
+	inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
+	return VERDICT_DROP;
 }
 
-#define COMMON_MSG " I will not be able to translate; aborting.\n" \
-		"(I don't think this error is going to happen... but if it does, either some future kernel " \
-		"version broke our assumptions or there is a kernel module in prerouting (pre-Jool), " \
-		"which is doing some questionable edits on the packet.)"
 /**
- * This whole module is a hack that tries to leverage nf_defrag_ipv6's hack,
- * but we can't do it if there are more hacks on top of it.
- * Therefore additional validations.
+ * fragdb_filtered - Tells @db what Filtering and Updating (or whatever step
+ * ended the translation before it) decided about @pkt.
+ *
+ * Only relevant to first fragments in virtual reassembly mode. If @result is
+ * VERDICT_CONTINUE, the first fragment's ports are learned, and the fragments
+ * that were waiting for them are handed back through @held (same as
+ * fragdb_handle()). Otherwise the held fragments are dropped, and the ones that
+ * arrive later will get @result as well, so they cannot sneak past the
+ * filtering their first fragment failed.
  */
-static int validate_skb(struct sk_buff *skb)
+void fragdb_filtered(struct fragdb *db, struct packet *pkt, verdict result,
+		struct sk_buff **held)
 {
-	if (WARN(skb->prev || skb->next, "Packet is listed." COMMON_MSG))
-		return -EINVAL;
+	struct frag_key key;
+	u32 hash;
+	struct fragdb_stripe *stripe;
+	struct fragdb_entry *entry;
+	struct sk_buff *skb;
+
+	*held = NULL;
+	if (!virtual_mode || !pkt_is_fragment(pkt) || !pkt_is_first_frag(pkt))
+		return;
 
-	if (WARN(skb_shinfo(skb)->frag_list, "Packet has a fragment list."
-			COMMON_MSG))
-		return -EINVAL;
+	switch (pkt_l4_proto(pkt)) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+		break;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		return;
+	}
 
-	return 0;
+	init_key(&key, pkt);
+	hash = hash_key(&key);
+	stripe = get_stripe(db, hash);
+
+	spin_lock_bh(&stripe->lock);
+
+	/* It might have been evicted or expired in the meantime. */
+	entry = entry_find(stripe, &key, hash);
+	if (!entry) {
+		entry = entry_create(db, stripe, &key, hash);
+		if (!entry)
+			goto end;
+	}
+
+	if (result == VERDICT_CONTINUE) {
+		vr_learn_ports(entry, pkt);
+		entry->rejected = false;
+		/* The held fragments are the caller's problem now. */
+		*held = entry->held;
+	} else {
+		entry->first_seen = false;
+		entry->rejected = true;
+		/* Stolen packets cannot be handed back to the kernel. */
+		entry->rejected_verdict = (result == VERDICT_ACCEPT)
+				? VERDICT_ACCEPT
+				: VERDICT_DROP;
+		for (skb = entry->held; skb; skb = skb->next)
+			vr_count(entry, skb);
+		free_held(entry->held);
+	}
+
+	entry->held = NULL;
+	entry->next_slot = &entry->held;
+	entry->held_count = 0;
+	WRITE_ONCE(stripe->mem, stripe->mem - (entry->mem - sizeof(*entry)));
+	entry->mem = sizeof(*entry);
+
+	vr_account(db, stripe, entry, pkt);
+	/* Fall through. */
+
+end:
+	spin_unlock_bh(&stripe->lock);
 }
-#undef COMMON_MSG
 
 /**
  * Groups "skb_in" with the rest of its fragments.
@@ -344,14 +1137,37 @@ static int validate_skb(struct sk_buff *skb)
  * If all of the fragments have arrived, this will return VER_CONTINUE and the
  * zero-offset fragment will be returned in "skb_out". The rest of the fragments
  * can be accesed via skb_out's list (skb_shinfo(skb_out)->frag_list).
+ *
+ * In virtual reassembly mode, on the other hand, fragments (IPv4 and IPv6)
+ * are never grouped. Once the first fragment survives Filtering and Updating
+ * (see fragdb_filtered()), its ports are remembered and used to fill in the
+ * tuples of the fragments that follow it, which return VERDICT_CONTINUE right
+ * away. Fragments that arrive before that are held (VERDICT_STOLEN), and handed
+ * back through fragdb_filtered()'s @held (linked by skb->next). The caller is
+ * expected to translate them after the first one.
+ * ICMP is the exception: its fragments are all held until the datagram is
+ * complete, and then handed back (through @held) as a single packet. See
+ * vr_handle_icmp().
+ *
+ * Either way, if storing the fragment would push the database past its memory
+ * limit, the oldest entries are evicted to make room. If that is not enough,
+ * the fragment is dropped.
  */
-verdict fragdb_handle(struct fragdb *db, struct packet *pkt)
+verdict fragdb_handle(struct fragdb *db, struct packet *pkt,
+		struct sk_buff **held)
 {
 	/* The fragment collector skb belongs to. */
-	struct reassembly_buffer *buffer;
+	struct fragdb_entry *entry;
 	struct frag_hdr *hdr_frag = pkt_frag_hdr(pkt);
+	struct frag_key key;
+	u32 hash;
+	struct fragdb_stripe *stripe;
 	int error;
 
+	*held = NULL;
+	if (virtual_mode)
+		return vr_handle(db, pkt, held);
+
 	if (!is_fragmented_ipv6(hdr_frag))
 		return VERDICT_CONTINUE;
 
@@ -372,11 +1188,15 @@ verdict fragdb_handle(struct fragdb *db, struct packet *pkt)
 	if (error)
 		return VERDICT_DROP;
 
-	spin_lock_bh(&db->lock);
+	init_key(&key, pkt);
+	hash = hash_key(&key);
+	stripe = get_stripe(db, hash);
+
+	spin_lock_bh(&stripe->lock);
 
-	buffer = add_pkt(db, pkt);
-	if (!buffer) {
-		spin_unlock_bh(&db->lock);
+	entry = add_pkt(db, stripe, pkt, &key, hash);
+	if (!entry) {
+		spin_unlock_bh(&stripe->lock);
 		return VERDICT_DROP;
 	}
 
@@ -389,16 +1209,16 @@ verdict fragdb_handle(struct fragdb *db, struct packet *pkt)
 	 * that in Jool 3.2, so you might be able to reuse it.
 	 */
 	if (is_mf_set_ipv6(hdr_frag)) {
-		spin_unlock_bh(&db->lock);
+		spin_unlock_bh(&stripe->lock);
 		return VERDICT_STOLEN;
 	}
 
-	*pkt = buffer->pkt;
+	*pkt = entry->pkt;
 	pkt->original_pkt = pkt;
-	buffer->pkt.skb = NULL;
-	/* Note, at this point, buffer->pkt is invalid. Do not use. */
-	buffer_destroy(db, buffer, pkt);
-	spin_unlock_bh(&db->lock);
+	entry->pkt.skb = NULL;
+	/* Note, at this point, entry->pkt is invalid. Do not use. */
+	entry_destroy(db, stripe, entry);
+	spin_unlock_bh(&stripe->lock);
 
 	if (!skb_make_writable(pkt->skb, pkt_l3hdr_len(pkt)))
 		return VERDICT_DROP;
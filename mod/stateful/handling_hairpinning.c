@@ -1,5 +1,11 @@
 #include "nat64/mod/common/handling_hairpinning.h"
 
+#include <net/ip6_checksum.h>
+
+#include "nat64/mod/common/icmp_wrapper.h"
+#include "nat64/mod/common/stats.h"
+#include "nat64/mod/common/rfc6145/6to4.h"
+#include "nat64/mod/common/rfc6145/common.h"
 #include "nat64/mod/common/rfc6145/core.h"
 #include "nat64/mod/common/send_packet.h"
 #include "nat64/mod/stateful/compute_outgoing_tuple.h"
@@ -66,3 +72,277 @@ verdict handling_hairpinning(struct xlation *old)
 	log_debug("Done step 5.");
 	return VERDICT_CONTINUE;
 }
+
+/**
+ * Can @state->in (which is known to hairpin) be translated straight into its
+ * final IPv6 form by hairpin_shortcut()?
+ *
+ * Only the boring packets can: unfragmented TCP and UDP without extension
+ * headers. ICMP and the rest still go through handling_hairpinning(), where the
+ * special cases live.
+ */
+bool hairpin_shortcut_possible(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct sk_buff *skb = in->skb;
+
+	if (pkt_l3_proto(in) != L3PROTO_IPV6)
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		break;
+	case L4PROTO_UDP:
+		if (pkt_udp_hdr(in)->check == 0)
+			return false;
+		break;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		return false;
+	}
+
+	/* This also rules out fragment headers. */
+	if (pkt_l3hdr_len(in) != sizeof(struct ipv6hdr))
+		return false;
+	/* The IPv4 version would not have fit in an IPv4 packet. */
+	if (sizeof(struct iphdr) + pkt_l3payload_len(in) > 0xFFFFu)
+		return false;
+	if (skb_shinfo(skb)->frag_list)
+		return false;
+	/* The IPv4 version would have lost its GSO-ness. */
+	if (skb_is_gso(skb) && !ttpcomm_xlat_gso_type(in, L3PROTO_IPV4))
+		return false;
+
+	return true;
+}
+
+static __wsum pseudohdr6_csum(struct ipv6hdr *hdr)
+{
+	return ~csum_unfold(csum_ipv6_magic(&hdr->saddr, &hdr->daddr, 0, 0, 0));
+}
+
+/**
+ * Moves @l4_out's checksum from @hdr_in's pseudoheader and @l4_in's ports to
+ * @hdr_out's pseudoheader and @l4_out's ports.
+ * (The 6-to-4 and 4-to-6 updates, minus the IPv4 pseudoheader that cancels
+ * out.)
+ */
+static __sum16 update_csum_6to6(struct packet *in, struct ipv6hdr *hdr_out,
+		void *l4_in, void *l4_out, size_t l4_len, __sum16 csum16)
+{
+	__wsum csum;
+
+	if (in->skb->ip_summed == CHECKSUM_PARTIAL) {
+		csum = csum_unfold(csum16);
+		csum = csum_sub(csum, pseudohdr6_csum(pkt_ip6_hdr(in)));
+		csum = csum_add(csum, pseudohdr6_csum(hdr_out));
+		return ~csum_fold(csum);
+	}
+
+	csum = ~csum_unfold(csum16);
+	csum = csum_sub(csum, pseudohdr6_csum(pkt_ip6_hdr(in)));
+	csum = csum_sub(csum, csum_partial(l4_in, l4_len, 0));
+	csum = csum_add(csum, pseudohdr6_csum(hdr_out));
+	csum = csum_add(csum, csum_partial(l4_out, l4_len, 0));
+	return csum_fold(csum);
+}
+
+/**
+ * Builds the headers hairpin_shortcut() will send @state->in with.
+ * They are what ttp64_ipv4() and then ttp46_ipv6() (plus their layer 4
+ * counterparts) would have produced.
+ */
+static void build_hdrs66(struct xlation *state, struct ipv6hdr *hdr6,
+		union inplace_l4hdr *l4)
+{
+	struct packet *in = &state->in;
+	struct tuple *tuple = &state->out.tuple;
+	struct global_config_usr *cfg = &state->jool.global->cfg;
+	struct ipv6hdr *hdr_in = pkt_ip6_hdr(in);
+	union inplace_l4hdr l4_in;
+	__u8 tos;
+
+	hdr6->version = 6;
+	if (cfg->reset_traffic_class) {
+		hdr6->priority = 0;
+		hdr6->flow_lbl[0] = 0;
+	} else {
+		tos = ttp64_xlat_tos(cfg, hdr_in);
+		hdr6->priority = tos >> 4;
+		hdr6->flow_lbl[0] = tos << 4;
+	}
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->payload_len = hdr_in->payload_len;
+	hdr6->nexthdr = hdr_in->nexthdr;
+	/* One per translation. */
+	hdr6->hop_limit = hdr_in->hop_limit - 2;
+	hdr6->saddr = tuple->src.addr6.l3;
+	hdr6->daddr = tuple->dst.addr6.l3;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		memcpy(&l4_in.tcp, pkt_tcp_hdr(in), sizeof(l4_in.tcp));
+		l4->tcp = l4_in.tcp;
+		l4->tcp.source = cpu_to_be16(tuple->src.addr6.l4);
+		l4->tcp.dest = cpu_to_be16(tuple->dst.addr6.l4);
+		l4_in.tcp.check = 0;
+		l4->tcp.check = 0;
+		l4->tcp.check = update_csum_6to6(in, hdr6, &l4_in.tcp,
+				&l4->tcp, sizeof(l4->tcp),
+				pkt_tcp_hdr(in)->check);
+		break;
+
+	case L4PROTO_UDP:
+		memcpy(&l4_in.udp, pkt_udp_hdr(in), sizeof(l4_in.udp));
+		l4->udp = l4_in.udp;
+		l4->udp.source = cpu_to_be16(tuple->src.addr6.l4);
+		l4->udp.dest = cpu_to_be16(tuple->dst.addr6.l4);
+		l4_in.udp.check = 0;
+		l4->udp.check = 0;
+		l4->udp.check = update_csum_6to6(in, hdr6, &l4_in.udp,
+				&l4->udp, sizeof(l4->udp),
+				pkt_udp_hdr(in)->check);
+		if (l4->udp.check == 0 && in->skb->ip_summed != CHECKSUM_PARTIAL)
+			l4->udp.check = CSUM_MANGLED_0;
+		break;
+
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		/* hairpin_shortcut_possible() prevents this. */
+		break;
+	}
+}
+
+/**
+ * Places the headers in a new skb, along with @state->in's payload.
+ * This is the only allocation a shortcut hairpin needs.
+ */
+static verdict copy66(struct xlation *state, struct ipv6hdr *hdr6,
+		union inplace_l4hdr *l4)
+{
+	struct packet *in = &state->in;
+	struct sk_buff *skb;
+	/* The kernel might want to fragment this so leave room. */
+	unsigned int reserve = LL_MAX_HEADER + sizeof(struct frag_hdr);
+	unsigned int l4_len = (pkt_l4_proto(in) == L4PROTO_TCP)
+			? sizeof(struct tcphdr)
+			: sizeof(struct udphdr);
+	unsigned int csum_offset = (pkt_l4_proto(in) == L4PROTO_TCP)
+			? offsetof(struct tcphdr, check)
+			: offsetof(struct udphdr, check);
+
+	skb = alloc_skb(reserve + sizeof(*hdr6) + pkt_l3payload_len(in),
+			GFP_ATOMIC);
+	if (!skb) {
+		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		jstat_inc(state->jool.stats, JSTAT_ENOMEM);
+		return VERDICT_DROP;
+	}
+
+	skb_reserve(skb, reserve);
+	skb_put(skb, sizeof(*hdr6) + pkt_l3payload_len(in));
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(*hdr6));
+
+	pkt_fill(&state->out, skb, L3PROTO_IPV6, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + pkt_l4hdr_len(in),
+			pkt_original_pkt(in));
+
+	skb->mark = in->skb->mark;
+	skb->protocol = htons(ETH_P_IPV6);
+	ttpcomm_copy_gso(in, skb, L3PROTO_IPV6);
+
+	memcpy(ipv6_hdr(skb), hdr6, sizeof(*hdr6));
+	/* TCP options, if any, come along untouched. */
+	memcpy(skb_transport_header(skb), pkt_tcp_hdr(in), pkt_l4hdr_len(in));
+	memcpy(skb_transport_header(skb), l4, l4_len);
+
+	if (in->skb->ip_summed == CHECKSUM_PARTIAL)
+		partialize_skb(skb, csum_offset);
+	else
+		ttpcomm_keep_complete(in, &state->out);
+
+	if (copy_payload(state)) {
+		kfree_skb(skb);
+		return VERDICT_DROP;
+	}
+
+	return VERDICT_CONTINUE;
+}
+
+/**
+ * hairpin_shortcut - Handles a hairpin without ever building its IPv4 version.
+ *
+ * handling_hairpinning() translates @state->in into IPv4 first, and then
+ * translates the result back into IPv6. Instead, this runs the IPv4 half of
+ * filtering and step 3 on the tuple alone, and then builds the final IPv6
+ * packet directly from the original one (in place, if allowed). The sessions
+ * and the resulting packet are the same.
+ *
+ * Only meant for the packets hairpin_shortcut_possible() approves. The result
+ * is @state->out, ready to be sent.
+ */
+verdict hairpin_shortcut(struct xlation *state)
+{
+	struct packet *in = &state->in;
+	struct xlation new;
+	struct ipv6hdr hdr6;
+	union inplace_l4hdr l4;
+	verdict result;
+
+	log_debug("Step 5: Handling Hairpinning (shortcut)...");
+
+	/* The IPv4 version's TTL would have expired. */
+	if (pkt_ip6_hdr(in)->hop_limit <= 1) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
+		return VERDICT_DROP;
+	}
+
+	xlation_init(&new);
+	new.jool = state->jool;
+	/* Pretend to be the IPv4 version. (See filtering_and_updating_hairpin().) */
+	new.in = *in;
+	new.in.tuple = state->out.tuple;
+	new.in.l3_proto = L3PROTO_IPV4;
+	new.in.hdr_frag = NULL;
+	new.in.original_pkt = pkt_original_pkt(in);
+
+	result = filtering_and_updating_hairpin(&new);
+	if (result != VERDICT_CONTINUE)
+		return result;
+	result = compute_out_tuple(&new);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	/*
+	 * The final IPv6 version's hop limit would have expired.
+	 * handling_hairpinning() would have noticed this while translating the
+	 * IPv4 version, but icmp64_send() always answers the original packet,
+	 * so the error was an ICMPv6 one towards the IPv6 source there too.
+	 */
+	if (pkt_ip6_hdr(in)->hop_limit <= 2) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		jstat_inc(state->jool.stats, JSTAT_HOP_LIMIT);
+		return VERDICT_DROP;
+	}
+
+	state->out.tuple = new.out.tuple;
+	build_hdrs66(state, &hdr6, &l4);
+
+	if (ttpcomm_inplace_possible(state)) {
+		if (ttpcomm_inplace_commit(state, L3PROTO_IPV6, &hdr6,
+				sizeof(hdr6), &l4))
+			return VERDICT_DROP;
+		result = VERDICT_CONTINUE;
+	} else {
+		result = copy66(state, &hdr6, &l4);
+	}
+
+	log_debug("Done step 5.");
+	return result;
+}
@@ -288,7 +288,9 @@ static int write_group_node(struct joold_node *node,
 		offset = &offset_struct;
 	}
 
-	error = bib_foreach_session(bib, node->group.proto, &func, offset);
+	/* The queue is locked. */
+	error = bib_foreach_session_atomic(bib, node->group.proto, &func,
+			offset);
 	if (error > 0) {
 		node->group.offset = arg.offset;
 		node->group.offset_set = true;
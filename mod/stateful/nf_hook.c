@@ -5,9 +5,9 @@
 #include "nat64/common/constants.h"
 #include "nat64/common/xlat.h"
 #include "nat64/mod/common/core.h"
-#include "nat64/mod/common/log_time.h"
 #include "nat64/mod/common/nf_wrapper.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/route_cache.h"
 #include "nat64/mod/common/wkmalloc.h"
 #include "nat64/mod/common/xlator.h"
 #include "nat64/mod/common/nl/nl_handler.h"
@@ -45,6 +45,20 @@ static bool no_instance;
 module_param(no_instance, bool, 0);
 MODULE_PARM_DESC(no_instance, "Prevent an instance from being added to the current namespace during the modprobe.");
 
+/*
+ * joold peers should be modprobed with the same bib_shards; nothing checks it.
+ * A mismatch does not break anything, but most synchronized BIB entries will
+ * end up in a shard that does not own their port, which turns them into strays
+ * (see struct bib_shard), and those are slower to look up.
+ */
+static unsigned int bib_shards = DEFAULT_BIB_SHARDS;
+module_param(bib_shards, uint, 0);
+MODULE_PARM_DESC(bib_shards, "Number of independently locked pieces each BIB table is split into. Must be a power of two. Each piece allocates its masks from its own share of pool4's ports. joold peers should use the same value.");
+
+static bool virtual_reassembly;
+module_param(virtual_reassembly, bool, 0);
+MODULE_PARM_DESC(virtual_reassembly, "Translate fragments as they arrive (remembering only the first fragment's ports) instead of having the kernel reassemble them first.");
+
 
 static char *banner = "\n"
 	"                                   ,----,                       \n"
@@ -121,10 +135,10 @@ static int __init jool_init(void)
 	log_debug("Inserting %s...", xlat_get_name());
 
 	/* Init Jool's submodules. */
-	error = bib_init();
+	error = bib_init(bib_shards);
 	if (error)
 		goto bib_fail;
-	error = fragdb_init();
+	error = fragdb_init(virtual_reassembly);
 	if (error)
 		goto fragdb_fail;
 	error = joold_init();
@@ -136,15 +150,15 @@ static int __init jool_init(void)
 	error = xlator_init();
 	if (error)
 		goto xlator_fail;
+	error = rtcache_init();
+	if (error)
+		goto rtcache_fail;
 	error = nlhandler_init();
 	if (error)
 		goto nlhandler_fail;
 	error = timer_init();
 	if (error)
 		goto timer_fail;
-	error = logtime_init();
-	if (error)
-		goto logtime_fail;
 
 	/* This needs to be last! (except for the hook registering.) */
 	error = add_instance();
@@ -163,12 +177,12 @@ static int __init jool_init(void)
 nf_register_hooks_fail:
 	xlator_rm();
 instance_fail:
-	logtime_destroy();
-logtime_fail:
 	timer_destroy();
 timer_fail:
 	nlhandler_destroy();
 nlhandler_fail:
+	rtcache_destroy();
+rtcache_fail:
 	xlator_destroy();
 xlator_fail:
 	rfc6056_destroy();
@@ -186,9 +200,9 @@ static void __exit jool_exit(void)
 {
 	nf_unregister_hooks(nfho, ARRAY_SIZE(nfho));
 
-	logtime_destroy();
 	timer_destroy();
 	nlhandler_destroy();
+	rtcache_destroy();
 	xlator_destroy();
 	rfc6056_destroy();
 	joold_terminate();
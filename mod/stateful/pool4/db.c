@@ -2,6 +2,8 @@
 
 #include <linux/hash.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/rbtree.h"
@@ -38,50 +40,77 @@ struct pool4_trees {
 	struct rb_root icmp;
 };
 
-struct pool4 {
-	/** Entries indexed via mark. (Normally used in 6->4) */
-	struct pool4_trees tree_mark;
-	/** Entries indexed via address. (Normally used in 4->6) */
-	struct pool4_trees tree_addr;
+/**
+ * Immutable and flattened version of a pool4_table.
+ */
+struct snapshot_table {
+	union {
+		__u32 mark;
+		struct in_addr addr;
+	};
+	unsigned int taddr_count;
+	unsigned int range_count;
+	struct pool4_range *ranges;
+	/**
+	 * offsets[i] is the number of transport addresses that precede
+	 * ranges[i] in the table. (So offsets[0] is always zero.)
+	 */
+	unsigned int *offsets;
+};
 
-	spinlock_t lock;
-	struct kref refcounter;
+/**
+ * Immutable and flattened version of one of the pool4 trees.
+ */
+struct snapshot_tree {
+	/** Sorted the same way as the tree. */
+	struct snapshot_table *tables;
+	unsigned int table_count;
 };
 
-struct mask_domain {
-	unsigned int taddr_count;
-	unsigned int taddr_counter;
+struct snapshot_trees {
+	struct snapshot_tree tcp;
+	struct snapshot_tree udp;
+	struct snapshot_tree icmp;
+};
 
-	unsigned int range_count;
-	struct pool4_range *current_range;
-	int current_port;
+/**
+ * Read-only copy of the entire pool4, for the packet path.
+ *
+ * The packet path needs no locks and no copies this way; it just has to stay
+ * inside an RCU-bh read-side critical section while it uses the snapshot.
+ * Writers rebuild the snapshot from scratch (from the trees) after every
+ * change, and then swap it. (See publish_snapshot().)
+ */
+struct pool4_snapshot {
+	struct snapshot_trees mark;
+	struct snapshot_trees addr;
+
+	/*
+	 * The arrays of struct snapshot_table, struct pool4_range and offsets
+	 * hang off here.
+	 */
+};
 
+struct pool4 {
+	/** Entries indexed via mark. (Normally used in 6->4) */
+	struct pool4_trees tree_mark;
+	/** Entries indexed via address. (Normally used in 4->6) */
+	struct pool4_trees tree_addr;
 	/**
-	 * A "dynamic" domain is one that was generated on the fly - that is,
-	 * Jool queried the interface addresses, picked one and used it to
-	 * improvise a domain.
-	 *
-	 * A "static" domain is one the user predefined.
-	 *
-	 * Empty pool4 generates dynamic domains and populated ones generate
-	 * static domains.
+	 * Copy of the trees the packet path reads.
+	 * NULL means pool4 is empty.
 	 */
-	bool dynamic;
+	struct pool4_snapshot __rcu *snapshot;
 
-	/*
-	 * An array of struct pool4_range hangs off here.
-	 * (The array length is @sample_count.)
+	/**
+	 * Protects the trees, and writers of @snapshot.
+	 * The packet path never takes it (it reads @snapshot instead), so it's
+	 * a mutex; writers can sleep while they build big snapshots.
 	 */
+	struct mutex lock;
+	struct kref refcounter;
 };
 
-/**
- * Assumes @domain has at least one entry.
- */
-#define foreach_domain_range(entry, domain) \
-	for (entry = first_domain_entry(domain); \
-			entry < first_domain_entry(domain) + domain->range_count; \
-			entry++)
-
 static struct rb_root *get_tree(struct pool4_trees *trees, l4_protocol proto)
 {
 	switch (proto) {
@@ -99,6 +128,24 @@ static struct rb_root *get_tree(struct pool4_trees *trees, l4_protocol proto)
 	return NULL;
 }
 
+static struct snapshot_tree *get_snapshot_tree(struct snapshot_trees *trees,
+		l4_protocol proto)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		return &trees->tcp;
+	case L4PROTO_UDP:
+		return &trees->udp;
+	case L4PROTO_ICMP:
+		return &trees->icmp;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	WARN(true, "Unsupported transport protocol: %u.", proto);
+	return NULL;
+}
+
 static int cmp_mark(struct pool4_table *table, __u32 mark)
 {
 	return ((int)mark) - (int)table->mark;
@@ -155,11 +202,6 @@ static struct pool4_range *last_table_entry(struct pool4_table *table)
 	return first_table_entry(table) + table->sample_count - 1;
 }
 
-static struct pool4_range *first_domain_entry(struct mask_domain *domain)
-{
-	return (struct pool4_range *)(domain + 1);
-}
-
 /* Leaves table->addr and table->mark undefined! */
 static struct pool4_table *create_table(struct pool4_range *range)
 {
@@ -168,7 +210,7 @@ static struct pool4_table *create_table(struct pool4_range *range)
 
 	table = __wkmalloc("pool4table",
 			sizeof(struct pool4_table) + sizeof(struct pool4_range),
-			GFP_ATOMIC);
+			GFP_KERNEL);
 	if (!table)
 		return NULL;
 
@@ -195,7 +237,8 @@ int pool4db_init(struct pool4 **pool)
 	result->tree_addr.tcp = RB_ROOT;
 	result->tree_addr.udp = RB_ROOT;
 	result->tree_addr.icmp = RB_ROOT;
-	spin_lock_init(&result->lock);
+	RCU_INIT_POINTER(result->snapshot, NULL);
+	mutex_init(&result->lock);
 	kref_init(&result->refcounter);
 
 	*pool = result;
@@ -229,11 +272,139 @@ static void clear_trees(struct pool4 *pool)
 	rbtree_clear(&pool->tree_addr.icmp, destroy_table_by_node, NULL);
 }
 
+static void count_tree(struct rb_root *tree, unsigned int *tables,
+		unsigned int *ranges)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		(*tables)++;
+		*ranges += rb_entry(node, struct pool4_table, tree_hook)
+				->sample_count;
+	}
+}
+
+static void count_trees(struct pool4_trees *trees, unsigned int *tables,
+		unsigned int *ranges)
+{
+	count_tree(&trees->tcp, tables, ranges);
+	count_tree(&trees->udp, tables, ranges);
+	count_tree(&trees->icmp, tables, ranges);
+}
+
+/** Write position in the arrays of a snapshot that's being built. */
+struct snapshot_cursor {
+	struct snapshot_table *table;
+	struct pool4_range *range;
+	unsigned int *offset;
+};
+
+static void flatten_tree(struct rb_root *tree, struct snapshot_tree *result,
+		struct snapshot_cursor *cursor)
+{
+	struct rb_node *node;
+	struct pool4_table *table;
+	struct snapshot_table *flat;
+	unsigned int offset;
+	unsigned int i;
+
+	result->tables = cursor->table;
+	result->table_count = 0;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		table = rb_entry(node, struct pool4_table, tree_hook);
+		flat = cursor->table;
+
+		flat->mark = table->mark; /* (Also copies addr.) */
+		flat->taddr_count = table->taddr_count;
+		flat->range_count = table->sample_count;
+		flat->ranges = cursor->range;
+		flat->offsets = cursor->offset;
+
+		memcpy(flat->ranges, first_table_entry(table),
+				table->sample_count * sizeof(struct pool4_range));
+		offset = 0;
+		for (i = 0; i < table->sample_count; i++) {
+			flat->offsets[i] = offset;
+			offset += port_range_count(&flat->ranges[i].ports);
+		}
+
+		cursor->table++;
+		cursor->range += table->sample_count;
+		cursor->offset += table->sample_count;
+		result->table_count++;
+	}
+}
+
+static void flatten_trees(struct pool4_trees *trees,
+		struct snapshot_trees *result,
+		struct snapshot_cursor *cursor)
+{
+	flatten_tree(&trees->tcp, &result->tcp, cursor);
+	flatten_tree(&trees->udp, &result->udp, cursor);
+	flatten_tree(&trees->icmp, &result->icmp, cursor);
+}
+
+/**
+ * Replaces @pool's snapshot with a fresh copy of the trees.
+ * Assumes @pool->lock is held. Can sleep.
+ *
+ * The snapshot is a single array, but it's vmalloc'd if it's too big for
+ * kmalloc(), so this should only fail if the system is truly out of memory.
+ * If it does, the packet path keeps seeing the previous version of pool4 until
+ * a later write succeeds.
+ */
+static int publish_snapshot(struct pool4 *pool)
+{
+	struct pool4_snapshot *old;
+	struct pool4_snapshot *new = NULL;
+	struct snapshot_cursor cursor;
+	unsigned int tables = 0;
+	unsigned int ranges = 0;
+
+	if (!is_empty(pool)) {
+		count_trees(&pool->tree_mark, &tables, &ranges);
+		count_trees(&pool->tree_addr, &tables, &ranges);
+
+		new = __wkvmalloc("pool4 snapshot",
+				sizeof(struct pool4_snapshot)
+				+ (size_t)tables * sizeof(struct snapshot_table)
+				+ (size_t)ranges * sizeof(struct pool4_range)
+				+ (size_t)ranges * sizeof(unsigned int));
+		if (!new) {
+			log_err("Could not allocate the new pool4; the translator will keep using the old one.");
+			return -ENOMEM;
+		}
+
+		cursor.table = (struct snapshot_table *)(new + 1);
+		cursor.range = (struct pool4_range *)(cursor.table + tables);
+		cursor.offset = (unsigned int *)(cursor.range + ranges);
+		flatten_trees(&pool->tree_mark, &new->mark, &cursor);
+		flatten_trees(&pool->tree_addr, &new->addr, &cursor);
+	}
+
+	old = rcu_dereference_protected(pool->snapshot,
+			lockdep_is_held(&pool->lock));
+	rcu_assign_pointer(pool->snapshot, new);
+	if (old) {
+		/* vfree() can't be called from RCU callbacks; wait here. */
+		synchronize_rcu_bh();
+		__wkvfree("pool4 snapshot", old);
+	}
+
+	return 0;
+}
+
 static void release(struct kref *refcounter)
 {
 	struct pool4 *pool;
+	struct pool4_snapshot *snapshot;
+
 	pool = container_of(refcounter, struct pool4, refcounter);
 	clear_trees(pool);
+	snapshot = rcu_dereference_protected(pool->snapshot, true);
+	if (snapshot)
+		__wkvfree("pool4 snapshot", snapshot);
 	wkfree(struct pool4, pool);
 }
 
@@ -305,7 +476,7 @@ static int slip_in(struct rb_root *tree, struct pool4_table *table,
 			* sizeof(struct pool4_range);
 
 	rb_replace_node(&table->tree_hook, &tmp, tree);
-	new_table = krealloc(table, new_size, GFP_ATOMIC);
+	new_table = krealloc(table, new_size, GFP_KERNEL);
 	if (!new_table) {
 		rb_replace_node(&tmp, &table->tree_hook, tree);
 		return -ENOMEM;
@@ -416,7 +587,8 @@ int pool4db_add(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 {
 	struct pool4_range addend = { .ports = range->ports };
 	u64 tmp;
-	int error;
+	int error = 0;
+	int publish_error;
 
 	if (addend.ports.min > addend.ports.max)
 		swap(addend.ports.min, addend.ports.max);
@@ -429,16 +601,21 @@ int pool4db_add(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 			range->ports.min, range->ports.max); */
 
 	foreach_addr4(addend.addr, tmp, &range->prefix) {
-		spin_lock_bh(&pool->lock);
+		mutex_lock(&pool->lock);
 		error = add_to_mark_tree(pool, mark, proto, &addend);
 		if (!error)
 			error = add_to_addr_tree(pool, proto, &addend);
-		spin_unlock_bh(&pool->lock);
+		mutex_unlock(&pool->lock);
 		if (error)
-			return error;
+			break;
 	}
 
-	return 0;
+	/* Publish even on failure; whatever was added stays in the trees. */
+	mutex_lock(&pool->lock);
+	publish_error = publish_snapshot(pool);
+	mutex_unlock(&pool->lock);
+
+	return error ? error : publish_error;
 }
 
 int pool4db_add_usr(struct pool4 *pool, struct pool4_entry_usr *entry)
@@ -631,18 +808,20 @@ int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 		struct ipv4_range *range)
 {
 	int error;
+	int publish_error;
 
 	if (range->ports.min > range->ports.max)
 		swap(range->ports.min, range->ports.max);
 
-	spin_lock_bh(&pool->lock);
+	mutex_lock(&pool->lock);
 
 	error = rm_from_mark_tree(pool, mark, proto, range);
 	if (!error)
 		error = rm_from_addr_tree(pool, proto, range);
+	publish_error = publish_snapshot(pool);
 
-	spin_unlock_bh(&pool->lock);
-	return error;
+	mutex_unlock(&pool->lock);
+	return error ? error : publish_error;
 }
 
 int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry_usr *entry)
@@ -652,33 +831,112 @@ int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry_usr *entry)
 
 void pool4db_flush(struct pool4 *pool)
 {
-	spin_lock_bh(&pool->lock);
+	mutex_lock(&pool->lock);
 	clear_trees(pool);
-	spin_unlock_bh(&pool->lock);
+	publish_snapshot(pool); /* Empty pool4 does not allocate; can't fail. */
+	mutex_unlock(&pool->lock);
 }
 
-static struct pool4_range *find_port_range(struct pool4_table *entry, __u16 port)
+static int cmp_snapshot_mark(struct snapshot_table *table, __u32 mark)
 {
-	struct pool4_range *first = first_table_entry(entry);
-	struct pool4_range *middle;
-	struct pool4_range *last = first + entry->sample_count - 1;
+	return ((int)mark) - (int)table->mark;
+}
 
-	do {
-		middle = first + ((last - first) / 2);
-		if (port < middle->ports.min) {
-			last = middle - 1;
-			continue;
-		}
-		if (port > middle->ports.max) {
+static int cmp_snapshot_addr(struct snapshot_table *table,
+		struct in_addr *addr)
+{
+	return ipv4_addr_cmp(&table->addr, addr);
+}
+
+/**
+ * Binary search; same as rbtree_find(), except on a snapshot tree.
+ */
+#define snapshot_find(expected, tree, compare_fn) \
+	({ \
+		struct snapshot_table *result = NULL; \
+		unsigned int first = 0; \
+		unsigned int last = (tree)->table_count; \
+		unsigned int middle; \
+		int comparison; \
+		\
+		while (first < last) { \
+			middle = first + (last - first) / 2; \
+			comparison = compare_fn(&(tree)->tables[middle], \
+					expected); \
+			if (comparison < 0) { \
+				first = middle + 1; \
+			} else if (comparison > 0) { \
+				last = middle; \
+			} else { \
+				result = &(tree)->tables[middle]; \
+				break; \
+			} \
+		} \
+		\
+		result; \
+	})
+
+static struct snapshot_table *find_snapshot_mark(struct snapshot_tree *tree,
+		__u32 mark)
+{
+	if (unlikely(!tree))
+		return NULL;
+	return snapshot_find(mark, tree, cmp_snapshot_mark);
+}
+
+static struct snapshot_table *find_snapshot_addr(struct snapshot_tree *tree,
+		struct in_addr *addr)
+{
+	if (unlikely(!tree))
+		return NULL;
+	return snapshot_find(addr, tree, cmp_snapshot_addr);
+}
+
+static struct pool4_range *find_port_range(struct snapshot_table *table,
+		__u16 port)
+{
+	unsigned int first = 0;
+	unsigned int last = table->range_count;
+	unsigned int middle;
+	struct pool4_range *range;
+
+	while (first < last) {
+		middle = first + (last - first) / 2;
+		range = &table->ranges[middle];
+		if (port < range->ports.min)
+			last = middle;
+		else if (port > range->ports.max)
 			first = middle + 1;
-			continue;
-		}
-		return middle;
-	} while (first <= last);
+		else
+			return range;
+	}
 
 	return NULL;
 }
 
+/**
+ * Returns the index of the range that contains @table's @offset'th transport
+ * address.
+ */
+static unsigned int find_offset_range(struct snapshot_table *table,
+		unsigned int offset)
+{
+	unsigned int first = 0;
+	unsigned int last = table->range_count - 1;
+	unsigned int middle;
+
+	/* Looking for the last range whose offset is <= @offset. */
+	while (first < last) {
+		middle = first + (last - first + 1) / 2;
+		if (table->offsets[middle] <= offset)
+			first = middle;
+		else
+			last = middle - 1;
+	}
+
+	return first;
+}
+
 /**
  * BTW: The reason why this doesn't care about mark is because it's an
  * inherently 4-to-6 function (it doesn't make sense otherwise).
@@ -687,21 +945,24 @@ static struct pool4_range *find_port_range(struct pool4_table *entry, __u16 port
 bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
 		struct ipv4_transport_addr *addr)
 {
-	struct pool4_table *table;
+	struct pool4_snapshot *snapshot;
+	struct snapshot_table *table;
 	bool found = false;
 
-	spin_lock_bh(&pool->lock);
+	rcu_read_lock_bh();
 
-	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
+	snapshot = rcu_dereference_bh(pool->snapshot);
+	if (!snapshot) {
+		rcu_read_unlock_bh();
 		return pool4empty_contains(ns, addr);
 	}
 
-	table = find_by_addr(get_tree(&pool->tree_addr, proto), &addr->l3);
+	table = find_snapshot_addr(get_snapshot_tree(&snapshot->addr, proto),
+			&addr->l3);
 	if (table)
 		found = find_port_range(table, addr->l4) != NULL;
 
-	spin_unlock_bh(&pool->lock);
+	rcu_read_unlock_bh();
 	return found;
 }
 
@@ -740,7 +1001,7 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 	struct pool4_sample sample = { .proto = proto };
 	int error = 0;
 
-	spin_lock_bh(&pool->lock);
+	mutex_lock(&pool->lock);
 
 	tree = get_tree(&pool->tree_mark, proto);
 	if (!tree) {
@@ -776,11 +1037,11 @@ offset_start:; /* <- The semicolon prevents a compiler error. */
 	}
 
 end:
-	spin_unlock_bh(&pool->lock);
+	mutex_unlock(&pool->lock);
 	return error;
 
 eagain:
-	spin_unlock_bh(&pool->lock);
+	mutex_unlock(&pool->lock);
 	log_err("Oops. Pool4 changed while I was iterating so I lost track of where I was. Try again.");
 	return -EAGAIN;
 }
@@ -833,124 +1094,135 @@ void pool4db_print(struct pool4 *pool)
 	print_tree(&pool->tree_addr.icmp, false);
 }
 
-static struct mask_domain *find_empty(struct route4_args *args,
-		unsigned int offset)
+static int find_empty(struct route4_args *args, unsigned int offset,
+		struct mask_domain *masks)
 {
-	struct mask_domain *masks;
-	struct pool4_range *range;
-
-	masks = __wkmalloc("mask_domain",
-			sizeof(struct mask_domain) * sizeof(struct pool4_range),
-			GFP_ATOMIC);
-	if (!masks)
-		return NULL;
+	struct pool4_range *range = &masks->dynamic_range;
+	int error;
 
-	range = (struct pool4_range *)(masks + 1);
-	if (pool4empty_find(args, range))
-		return NULL;
+	error = pool4empty_find(args, range);
+	if (error)
+		return error;
 
 	masks->taddr_count = port_range_count(&range->ports);
 	masks->taddr_counter = 0;
+	masks->ranges = range;
 	masks->range_count = 1;
 	masks->current_range = range;
-	masks->current_port = range->ports.min + offset % masks->taddr_count;
+	masks->current_port = range->ports.min
+			+ offset % masks->taddr_count - 1;
 	masks->dynamic = true;
-	return masks;
+	return 0;
 }
 
-struct mask_domain *mask_domain_find(struct pool4 *pool, struct tuple *tuple6,
-		__u8 f_args, struct route4_args *route_args)
+/**
+ * Initializes @masks as the set of masks the connection described by @tuple6
+ * can use.
+ *
+ * On success, @masks points to the current pool4 snapshot, which means you are
+ * in a RCU-bh read-side critical section until you mask_domain_put() it.
+ * (So don't sleep.)
+ */
+int mask_domain_find(struct pool4 *pool, struct tuple *tuple6,
+		__u8 f_args, struct route4_args *route_args,
+		struct mask_domain *masks)
 {
-	struct pool4_table *table;
-	struct pool4_range *entry;
-	struct mask_domain *masks;
+	struct pool4_snapshot *snapshot;
+	struct snapshot_table *table;
 	unsigned int offset;
+	unsigned int i;
+	int error;
 
-	if (rfc6056_f(tuple6, f_args, &offset))
-		return NULL;
+	error = rfc6056_f(tuple6, f_args, &offset);
+	if (error)
+		return error;
 
-	spin_lock_bh(&pool->lock);
+	rcu_read_lock_bh();
 
-	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
-		return find_empty(route_args, offset);
+	snapshot = rcu_dereference_bh(pool->snapshot);
+	if (!snapshot) {
+		error = find_empty(route_args, offset, masks);
+		if (error)
+			goto fail;
+		return 0;
 	}
 
-	table = find_by_mark(get_tree(&pool->tree_mark, tuple6->l4_proto),
-			route_args->mark);
-	if (!table)
+	table = find_snapshot_mark(get_snapshot_tree(&snapshot->mark,
+			tuple6->l4_proto), route_args->mark);
+	if (!table) {
+		error = -ESRCH;
 		goto fail;
+	}
 
-	masks = __wkmalloc("mask_domain", sizeof(struct mask_domain)
-			+ table->sample_count * sizeof(struct pool4_range),
-			GFP_ATOMIC);
-	if (!masks)
-		goto fail;
+	offset %= table->taddr_count;
+	i = find_offset_range(table, offset);
 
-	memcpy(masks + 1, table + 1,
-			table->sample_count * sizeof(struct pool4_range));
 	masks->taddr_count = table->taddr_count;
-	masks->range_count = table->sample_count;
-
-	spin_unlock_bh(&pool->lock);
-
 	masks->taddr_counter = 0;
+	masks->ranges = table->ranges;
+	masks->range_count = table->range_count;
+	masks->current_range = &table->ranges[i];
+	masks->current_port = table->ranges[i].ports.min
+			+ (offset - table->offsets[i]) - 1;
 	masks->dynamic = false;
-	offset %= masks->taddr_count;
-
-	foreach_domain_range(entry, masks) {
-		if (offset <= port_range_count(&entry->ports)) {
-			masks->current_range = entry;
-			masks->current_port = entry->ports.min + offset - 1;
-			return masks; /* Happy path */
-		}
-		offset -= port_range_count(&entry->ports);
-	}
-
-	WARN(true, "Bug: pool4 entry counter does not match entry count.");
-	__wkfree("mask_domain", masks);
-	return NULL;
+	return 0;
 
 fail:
-	spin_unlock_bh(&pool->lock);
-	return NULL;
+	rcu_read_unlock_bh();
+	return error;
 }
 
 void mask_domain_put(struct mask_domain *masks)
 {
-	__wkfree("mask_domain", masks);
+	rcu_read_unlock_bh();
 }
 
+/**
+ * Returns the next run of consecutive masks from @masks. The run spans ports
+ * @first->l4 through @last of address @first->l3.
+ *
+ * The runs never overlap, and all of them combined cover the entire domain
+ * exactly once. Returns -ENOENT once there are no more runs.
+ */
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive)
+		struct ipv4_transport_addr *first,
+		__u16 *last)
 {
-	masks->taddr_counter++;
-	if (masks->taddr_counter > masks->taddr_count)
+	unsigned int run;
+	unsigned int remaining;
+
+	if (masks->taddr_counter >= masks->taddr_count)
 		return -ENOENT;
 
 	masks->current_port++;
 	if (masks->current_port > masks->current_range->ports.max) {
-		*consecutive = false;
 		masks->current_range++;
-		if (masks->current_range > first_domain_entry(masks) + masks->range_count)
-			masks->current_range = first_domain_entry(masks);
+		if (masks->current_range >= masks->ranges + masks->range_count)
+			masks->current_range = masks->ranges;
 		masks->current_port = masks->current_range->ports.min;
-	} else {
-		*consecutive = (masks->taddr_counter != 1);
 	}
 
-	addr->l3 = masks->current_range->addr;
-	addr->l4 = masks->current_port;
+	run = masks->current_range->ports.max - masks->current_port + 1;
+	remaining = masks->taddr_count - masks->taddr_counter;
+	if (run > remaining)
+		run = remaining;
+
+	first->l3 = masks->current_range->addr;
+	first->l4 = masks->current_port;
+	masks->current_port += run - 1;
+	masks->taddr_counter += run;
+	*last = masks->current_port;
 	return 0;
 }
 
 bool mask_domain_matches(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr)
 {
-	struct pool4_range *entry;
+	const struct pool4_range *entry;
 
-	foreach_domain_range(entry, masks) {
+	for (entry = masks->ranges;
+			entry < masks->ranges + masks->range_count;
+			entry++) {
 		if (entry->addr.s_addr != addr->l3.s_addr)
 			continue;
 		if (port_range_contains(&entry->ports, addr->l4))
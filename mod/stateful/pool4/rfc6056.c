@@ -1,133 +1,220 @@
 #include "nat64/mod/stateful/pool4/rfc6056.h"
 
-#include <crypto/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <asm/unaligned.h>
 #include "nat64/mod/common/wkmalloc.h"
 
-/* TODO (issue175) RFC 6056 wants us to change this from time to time. */
-static unsigned char *secret_key;
-static size_t secret_key_len;
-static atomic_t next_ephemeral;
+/**
+ * RFC 6056 wants us to change the secret key from time to time.
+ * (issue175)
+ */
+#define SECRET_LIFETIME (60 * 60 * HZ)
+
+struct rfc6056_secret {
+	u64 key[2];
+	/** jiffies at which the key was generated. */
+	unsigned long birth;
+	struct rcu_head rcu;
+};
+
+/*
+ * The packet path only reads this, so it does not need to lock anything.
+ * Replacements are protected by @secret_lock.
+ */
+static struct rfc6056_secret __rcu *secret;
+static DEFINE_SPINLOCK(secret_lock);
 
-static struct crypto_shash *shash;
-static DEFINE_SPINLOCK(tfm_lock);
+static struct rfc6056_secret *create_secret(gfp_t flags)
+{
+	struct rfc6056_secret *result;
+
+	result = wkmalloc(struct rfc6056_secret, flags);
+	if (!result)
+		return NULL;
+
+	get_random_bytes(result->key, sizeof(result->key));
+	result->birth = jiffies;
+	return result;
+}
+
+static void __free_secret(struct rcu_head *rcu)
+{
+	wkfree(struct rfc6056_secret,
+			container_of(rcu, struct rfc6056_secret, rcu));
+}
 
 int rfc6056_init(void)
 {
-	unsigned int tmp;
-	int error;
+	struct rfc6056_secret *new;
 
-	/* Secret key stuff */
-	secret_key_len = (PAGE_SIZE < 128) ? PAGE_SIZE : 128;
-	secret_key = __wkmalloc("Secret key", secret_key_len, GFP_KERNEL);
-	if (!secret_key)
+	new = create_secret(GFP_KERNEL);
+	if (!new)
 		return -ENOMEM;
-	get_random_bytes(secret_key, secret_key_len);
-
-	/* Next ephemeral stuff */
-	get_random_bytes(&tmp, sizeof(tmp));
-	atomic_set(&next_ephemeral, tmp);
-
-	/* TFC stuff */
-	shash = crypto_alloc_shash("md5", 0, CRYPTO_ALG_ASYNC);
-	if (IS_ERR(shash)) {
-		error = PTR_ERR(shash);
-		log_warn_once("Failed to load transform for MD5; errcode %d",
-				error);
-		__wkfree("Secret key", secret_key);
-		return error;
-	}
 
+	RCU_INIT_POINTER(secret, new);
 	return 0;
 }
 
 void rfc6056_destroy(void)
 {
-	crypto_free_shash(shash);
-	__wkfree("Secret key", secret_key);
+	struct rfc6056_secret *old;
+
+	old = rcu_dereference_protected(secret, true);
+	RCU_INIT_POINTER(secret, NULL);
+	synchronize_rcu_bh();
+	wkfree(struct rfc6056_secret, old);
+	/* Wait for the pending __free_secret()s. */
+	rcu_barrier_bh();
 }
 
-static int hash_tuple(struct shash_desc *desc, __u8 fields,
-		const struct tuple *tuple6)
+/**
+ * Replaces the secret key if it's too old. Meant to be called periodically.
+ *
+ * The packet path never waits for this; translations that are already using
+ * the old key finish with it, and it is freed after them.
+ */
+void rfc6056_clean(void)
 {
-	int error;
+	struct rfc6056_secret *old;
+	struct rfc6056_secret *new;
+
+	spin_lock_bh(&secret_lock);
+
+	old = rcu_dereference_protected(secret, lockdep_is_held(&secret_lock));
+	if (time_before(jiffies, old->birth + SECRET_LIFETIME))
+		goto end;
+
+	new = create_secret(GFP_ATOMIC);
+	if (!new)
+		goto end; /* Whatever; try again later. */
+
+	rcu_assign_pointer(secret, new);
+	call_rcu_bh(&old->rcu, __free_secret);
+	/* Fall through. */
+
+end:
+	spin_unlock_bh(&secret_lock);
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+	} while (0)
+
+/**
+ * SipHash-2-4.
+ *
+ * (The kernel only ships its own implementation since Linux 4.11.)
+ */
+static u64 siphash24(const u8 *data, size_t len, const u64 key[2])
+{
+	u64 v0 = 0x736f6d6570736575ULL ^ key[0];
+	u64 v1 = 0x646f72616e646f6dULL ^ key[1];
+	u64 v2 = 0x6c7967656e657261ULL ^ key[0];
+	u64 v3 = 0x7465646279746573ULL ^ key[1];
+	u64 b = ((u64)len) << 56;
+	const u8 *end = data + len - (len % 8);
+	u64 m;
+
+	for (; data != end; data += 8) {
+		m = get_unaligned_le64(data);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	switch (len & 7) {
+	case 7:
+		b |= ((u64)data[6]) << 48;
+		/* Fall through. */
+	case 6:
+		b |= ((u64)data[5]) << 40;
+		/* Fall through. */
+	case 5:
+		b |= ((u64)data[4]) << 32;
+		/* Fall through. */
+	case 4:
+		b |= ((u64)data[3]) << 24;
+		/* Fall through. */
+	case 3:
+		b |= ((u64)data[2]) << 16;
+		/* Fall through. */
+	case 2:
+		b |= ((u64)data[1]) << 8;
+		/* Fall through. */
+	case 1:
+		b |= ((u64)data[0]);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return (v0 ^ v1) ^ (v2 ^ v3);
+}
+
+/**
+ * Appends the @fields fields of @tuple6 to @buffer, and returns the number of
+ * bytes written.
+ */
+static size_t serialize_tuple(__u8 fields, const struct tuple *tuple6,
+		u8 *buffer)
+{
+	u8 *cursor = buffer;
 
 	if (fields & F_ARGS_SRC_ADDR) {
-		error = crypto_shash_update(desc, (u8 *)&tuple6->src.addr6.l3,
+		memcpy(cursor, &tuple6->src.addr6.l3,
 				sizeof(tuple6->src.addr6.l3));
-		if (error)
-			return error;
+		cursor += sizeof(tuple6->src.addr6.l3);
 	}
 	if (fields & F_ARGS_SRC_PORT) {
-		error = crypto_shash_update(desc, (u8 *)&tuple6->src.addr6.l4,
+		memcpy(cursor, &tuple6->src.addr6.l4,
 				sizeof(tuple6->src.addr6.l4));
-		if (error)
-			return error;
+		cursor += sizeof(tuple6->src.addr6.l4);
 	}
 	if (fields & F_ARGS_DST_ADDR) {
-		error = crypto_shash_update(desc, (u8 *)&tuple6->dst.addr6.l3,
+		memcpy(cursor, &tuple6->dst.addr6.l3,
 				sizeof(tuple6->dst.addr6.l3));
-		if (error)
-			return error;
+		cursor += sizeof(tuple6->dst.addr6.l3);
 	}
 	if (fields & F_ARGS_DST_PORT) {
-		error = crypto_shash_update(desc, (u8 *)&tuple6->dst.addr6.l4,
+		memcpy(cursor, &tuple6->dst.addr6.l4,
 				sizeof(tuple6->dst.addr6.l4));
-		if (error)
-			return error;
+		cursor += sizeof(tuple6->dst.addr6.l4);
 	}
 
-	return crypto_shash_update(desc, secret_key, secret_key_len);
+	return cursor - buffer;
 }
 
 /**
  * RFC 6056, Algorithm 3.
+ *
+ * Does not allocate nor lock anything, so it's safe (and cheap) to run it in
+ * parallel from any number of CPUs.
  */
 int rfc6056_f(const struct tuple *tuple6, __u8 fields, unsigned int *result)
 {
-	union {
-		__be32 as32[4];
-		__u8 as8[16];
-	} md5_result;
-	struct shash_desc *desc;
-	int error = 0;
-
-	desc = __wkmalloc("shash desc", sizeof(struct shash_desc)
-			+ crypto_shash_descsize(shash), GFP_ATOMIC);
-	if (!desc)
-		return -ENOMEM;
+	u8 buffer[2 * sizeof(struct ipv6_transport_addr)];
+	size_t len;
 
-	desc->tfm = shash;
-	desc->flags = 0;
+	len = serialize_tuple(fields, tuple6, buffer);
 
-	/*
-	 * TODO (performance) it would appear this is a good opportunity to use
-	 * per-cpu variables instead of a spinlock.
-	 */
-	spin_lock_bh(&tfm_lock);
+	rcu_read_lock_bh();
+	*result = siphash24(buffer, len, rcu_dereference_bh(secret)->key);
+	rcu_read_unlock_bh();
 
-	error = crypto_shash_init(desc);
-	if (error) {
-		log_debug("crypto_hash_init() failed. Errcode: %d", error);
-		goto end;
-	}
-
-	error = hash_tuple(desc, fields, tuple6);
-	if (error) {
-		log_debug("crypto_hash_update() failed. Errcode: %d", error);
-		goto end;
-	}
-
-	error = crypto_shash_final(desc, md5_result.as8);
-	if (error) {
-		log_debug("crypto_hash_digest() failed. Errcode: %d", error);
-		goto end;
-	}
-
-	*result = (__force __u32)md5_result.as32[3];
-	/* Fall through. */
-
-end:
-	spin_unlock_bh(&tfm_lock);
-	__wkfree("shash desc", desc);
-	return error;
+	return 0;
 }
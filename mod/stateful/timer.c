@@ -4,23 +4,60 @@
 #include "nat64/mod/stateful/fragment_db.h"
 #include "nat64/mod/stateful/joold.h"
 #include "nat64/mod/stateful/bib/db.h"
+#include "nat64/mod/stateful/pool4/rfc6056.h"
 
 #define TIMER_PERIOD msecs_to_jiffies(2000)
+/*
+ * How long to wait when the last run could not finish its work.
+ * It's short because there's clearly work to do, but not zero because the
+ * point of the interruption was to let the packets through.
+ */
+#define TIMER_BACKOFF 1
 
 static struct timer_list timer;
+/**
+ * When the cleaners other than bib_clean() are due next.
+ * Only the BIB can have a backlog, so the rest stick to TIMER_PERIOD even while
+ * the timer is backing off.
+ */
+static unsigned long next_full_clean;
+
+struct clean_args {
+	/** Clean everything, not just the BIB? */
+	bool full;
+	/** Did bib_clean() leave work behind? (Output.) */
+	bool pending;
+};
 
-static int clean_state(struct xlator *jool, void *args)
+static int clean_state(struct xlator *jool, void *void_args)
 {
-	fragdb_clean(jool->nat64.frag);
-	bib_clean(jool->nat64.bib, jool->ns);
-	joold_clean(jool->nat64.joold, jool->nat64.bib);
+	struct clean_args *args = void_args;
+
+	if (args->full)
+		fragdb_clean(jool->nat64.frag);
+	if (bib_clean(jool->nat64.bib, jool->ns))
+		args->pending = true;
+	if (args->full)
+		joold_clean(jool->nat64.joold, jool->nat64.bib);
 	return 0;
 }
 
 static void timer_function(unsigned long arg)
 {
-	xlator_foreach(clean_state, NULL);
-	mod_timer(&timer, jiffies + TIMER_PERIOD);
+	struct clean_args args;
+	unsigned long next;
+
+	args.full = time_after_eq(jiffies, next_full_clean);
+	args.pending = false;
+	if (args.full)
+		next_full_clean = jiffies + TIMER_PERIOD;
+
+	xlator_foreach(clean_state, &args);
+	if (args.full)
+		rfc6056_clean();
+
+	next = args.pending ? (jiffies + TIMER_BACKOFF) : next_full_clean;
+	mod_timer(&timer, next);
 }
 
 /**
@@ -32,7 +69,8 @@ int timer_init(void)
 	timer.function = timer_function;
 	timer.expires = 0;
 	timer.data = 0;
-	mod_timer(&timer, jiffies + TIMER_PERIOD);
+	next_full_clean = jiffies + TIMER_PERIOD;
+	mod_timer(&timer, next_full_clean);
 	return 0;
 }
 
@@ -1,12 +1,17 @@
 #include "nat64/mod/stateless/blacklist4.h"
 
+#include <linux/hash.h>
 #include <linux/rculist.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
 #include <linux/inetdevice.h>
+#include <linux/rtnetlink.h>
+#include <net/netns/generic.h>
 
 #include "nat64/common/str_utils.h"
 #include "nat64/mod/common/address.h"
+#include "nat64/mod/common/linux_version.h"
+#include "nat64/mod/common/wkmalloc.h"
 #include "nat64/mod/common/xlator.h"
 #include "nat64/mod/common/rcu.h"
 
@@ -41,53 +46,320 @@ int blacklist_flush(struct addr4_pool *pool)
 }
 
 /**
- * Is @addr *NOT* translatable, according to the interfaces?
- *
- * The name comes from the fact that interface addresses are usually
- * non-translatable (ie. the traffic is meant for the translator box).
+ * An address some interface of a namespace answers to, and what
+ * interface_contains() has to say about it.
+ */
+struct ifaddr_slot {
+	__be32 addr;
+	/* Is this slot taken? (0.0.0.0 is a valid key, so it can't tell.) */
+	bool used;
+	/* Is @addr *NOT* translatable? */
+	bool blocked;
+};
+
+/**
+ * Open-addressing hash set of every address the namespace's interfaces own
+ * (and of their directed broadcasts). Never modified once published; events
+ * replace it as a whole.
+ */
+struct ifaddr_set {
+	unsigned int bits;
+	struct rcu_head rcu;
+	struct ifaddr_slot slots[0];
+};
+
+/**
+ * The blacklist's slice of each namespace's net_generic() storage.
+ */
+struct ifaddr_pernet {
+	/*
+	 * NULL if the last rebuild failed (or there hasn't been one yet);
+	 * interface_contains() falls back to walking the interfaces then.
+	 */
+	struct ifaddr_set __rcu *set;
+	/* The namespace is being dismantled; stop rebuilding @set. */
+	bool dead;
+};
+
+static unsigned int ifaddr_net_id __read_mostly;
+
+static struct ifaddr_pernet *get_pernet(struct net *ns)
+{
+	return net_generic(ns, ifaddr_net_id);
+}
+
+static unsigned int ifaddr_hash(struct ifaddr_set *set, __be32 addr)
+{
+	return hash_32((__force u32)addr, set->bits);
+}
+
+/**
+ * Returns the slot where @addr is, or the empty slot where it should go.
+ */
+static struct ifaddr_slot *ifaddr_find(struct ifaddr_set *set, __be32 addr)
+{
+	unsigned int mask = (1U << set->bits) - 1;
+	unsigned int i;
+
+	/* The set is never more than half full, so this terminates. */
+	for (i = ifaddr_hash(set, addr); true; i = (i + 1) & mask) {
+		if (!set->slots[i].used || set->slots[i].addr == addr)
+			return &set->slots[i];
+	}
+}
+
+static void ifaddr_add(void *arg, __be32 addr, bool blocked)
+{
+	struct ifaddr_slot *slot = ifaddr_find(arg, addr);
+
+	/*
+	 * The interface walk used to stop at the first match, so the first
+	 * interface that claims the address wins.
+	 */
+	if (slot->used)
+		return;
+
+	slot->addr = addr;
+	slot->used = true;
+	slot->blocked = blocked;
+}
+
+/**
+ * Calls @cb once for each address interface_contains() cares about, in the
+ * order in which the interface walk would have found them.
+ */
+static void foreach_ifaddr(struct net *ns, void (*cb)(void *, __be32, bool),
+		void *arg)
+{
+	struct net_device *dev;
+	struct in_device *in_dev;
+	struct in_ifaddr *ifa;
+
+	for_each_netdev(ns, dev) {
+		in_dev = __in_dev_get_rtnl(dev);
+		if (!in_dev)
+			continue;
+
+		for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
+			/* https://github.com/NICMx/Jool/issues/223 */
+			cb(arg, ifa->ifa_local, ifa->ifa_prefixlen != 32);
+			/* RFC3021: /31 (and /32) networks lack broadcast. */
+			if (ifa->ifa_prefixlen < 31)
+				cb(arg, ifa->ifa_local | ~ifa->ifa_mask, true);
+		}
+	}
+}
+
+static void count_ifaddr(void *arg, __be32 addr, bool blocked)
+{
+	(*(unsigned int *)arg)++;
+}
+
+static void __free_ifaddr_set(struct rcu_head *rcu)
+{
+	__wkfree("ifaddr set", container_of(rcu, struct ifaddr_set, rcu));
+}
+
+/**
+ * Replaces @ns's address set with a fresh one. Needs the RTNL.
+ */
+static void ifaddr_rebuild(struct net *ns)
+{
+	struct ifaddr_pernet *pernet = get_pernet(ns);
+	struct ifaddr_set *new;
+	struct ifaddr_set *old;
+	unsigned int count = 0;
+	unsigned int bits;
+
+	if (pernet->dead)
+		return;
+
+	foreach_ifaddr(ns, count_ifaddr, &count);
+	/* More than twice as many slots as addresses. */
+	bits = fls(count) + 1;
+
+	new = __wkmalloc("ifaddr set", sizeof(*new)
+			+ (sizeof(struct ifaddr_slot) << bits), GFP_KERNEL);
+	if (new) {
+		memset(new->slots, 0, sizeof(struct ifaddr_slot) << bits);
+		new->bits = bits;
+		foreach_ifaddr(ns, ifaddr_add, new);
+	} else {
+		log_err("Could not allocate the interface address set; the translator will walk the interfaces instead.");
+	}
+
+	old = rtnl_dereference(pernet->set);
+	rcu_assign_pointer(pernet->set, new);
+	if (old)
+		call_rcu_bh(&old->rcu, __free_ifaddr_set);
+}
+
+static int ifaddr_netdev_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+#if LINUX_VERSION_AT_LEAST(3, 11, 0, 7, 0)
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+#else
+	struct net_device *dev = ptr;
+#endif
+
+	/*
+	 * Address changes have their own notifier; this one is only here for
+	 * devices that come and go (or change namespaces) with their addresses.
+	 */
+	switch (event) {
+	case NETDEV_REGISTER:
+	case NETDEV_UNREGISTER:
+		ifaddr_rebuild(dev_net(dev));
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static int ifaddr_inetaddr_event(struct notifier_block *nb,
+		unsigned long event, void *ptr)
+{
+	struct in_ifaddr *ifa = ptr;
+
+	switch (event) {
+	case NETDEV_UP:
+	case NETDEV_DOWN:
+		ifaddr_rebuild(dev_net(ifa->ifa_dev->dev));
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ifaddr_netdev_notifier = {
+	.notifier_call = ifaddr_netdev_event,
+};
+
+static struct notifier_block ifaddr_inetaddr_notifier = {
+	.notifier_call = ifaddr_inetaddr_event,
+};
+
+static void __net_exit ifaddr_exit_net(struct net *ns)
+{
+	struct ifaddr_pernet *pernet = get_pernet(ns);
+	struct ifaddr_set *set;
+
+	rtnl_lock();
+	pernet->dead = true;
+	set = rtnl_dereference(pernet->set);
+	RCU_INIT_POINTER(pernet->set, NULL);
+	rtnl_unlock();
+
+	if (set)
+		call_rcu_bh(&set->rcu, __free_ifaddr_set);
+}
+
+static struct pernet_operations ifaddr_ops = {
+	.exit = ifaddr_exit_net,
+	.id = &ifaddr_net_id,
+	.size = sizeof(struct ifaddr_pernet),
+};
+
+/**
+ * ifaddrs_init - Starts tracking the namespaces' interface addresses.
  *
- * Recognizable directed broadcast is also not translatable.
+ * Registering the netdevice notifier replays NETDEV_REGISTER for the devices
+ * that already exist, so this also builds the sets of the existing namespaces.
  */
-bool interface_contains(struct net *ns, struct in_addr *addr)
+int ifaddrs_init(void)
+{
+	int error;
+
+	error = register_pernet_subsys(&ifaddr_ops);
+	if (error)
+		return error;
+	error = register_inetaddr_notifier(&ifaddr_inetaddr_notifier);
+	if (error)
+		goto inetaddr_fail;
+	error = register_netdevice_notifier(&ifaddr_netdev_notifier);
+	if (error)
+		goto netdev_fail;
+
+	return 0;
+
+netdev_fail:
+	unregister_inetaddr_notifier(&ifaddr_inetaddr_notifier);
+inetaddr_fail:
+	unregister_pernet_subsys(&ifaddr_ops);
+	return error;
+}
+
+void ifaddrs_destroy(void)
+{
+	unregister_netdevice_notifier(&ifaddr_netdev_notifier);
+	unregister_inetaddr_notifier(&ifaddr_inetaddr_notifier);
+	unregister_pernet_subsys(&ifaddr_ops);
+	/* Wait for the pending __free_ifaddr_set()s. */
+	rcu_barrier_bh();
+}
+
+/**
+ * The old way: Walk the interfaces. Only used when the set is unavailable.
+ */
+static bool interface_walk(struct net *ns, struct in_addr *addr)
 {
 	struct net_device *dev;
 	struct in_device *in_dev;
 	struct in_ifaddr *ifa;
 	struct in_addr ifaddr;
 
-	rcu_read_lock();
 	for_each_netdev_rcu(ns, dev) {
 		in_dev = rcu_dereference(dev->ip_ptr);
+		if (!in_dev)
+			continue;
 		ifa = in_dev->ifa_list;
 		while (ifa) {
 			ifaddr.s_addr = ifa->ifa_local;
-			if (ipv4_addr_cmp(&ifaddr, addr) == 0) {
-				/* https://github.com/NICMx/Jool/issues/223 */
-				if (ifa->ifa_prefixlen == 32)
-					goto do_translate;
-				else
-					goto dont_translate;
-			}
+			if (ipv4_addr_cmp(&ifaddr, addr) == 0)
+				return ifa->ifa_prefixlen != 32;
 
-			/* RFC3021: /31 (and /32) networks lack broadcast. */
 			if (ifa->ifa_prefixlen < 31) {
 				ifaddr.s_addr = ifa->ifa_local | ~ifa->ifa_mask;
 				if (ipv4_addr_cmp(&ifaddr, addr) == 0)
-					goto dont_translate;
+					return true;
 			}
 
 			ifa = ifa->ifa_next;
 		}
 	}
-	/* Fall through */
 
-do_translate:
-	rcu_read_unlock();
 	return false;
+}
+
+/**
+ * Is @addr *NOT* translatable, according to the interfaces?
+ *
+ * The name comes from the fact that interface addresses are usually
+ * non-translatable (ie. the traffic is meant for the translator box).
+ *
+ * Recognizable directed broadcast is also not translatable.
+ */
+bool interface_contains(struct net *ns, struct in_addr *addr)
+{
+	struct ifaddr_set *set;
+	struct ifaddr_slot *slot;
+	bool result;
+
+	rcu_read_lock_bh();
+
+	set = rcu_dereference_bh(get_pernet(ns)->set);
+	if (set) {
+		slot = ifaddr_find(set, addr->s_addr);
+		result = slot->used && slot->blocked;
+	} else {
+		rcu_read_lock();
+		result = interface_walk(ns, addr);
+		rcu_read_unlock();
+	}
 
-dont_translate:
-	rcu_read_unlock();
-	return true;
+	rcu_read_unlock_bh();
+	return result;
 }
 
 bool blacklist_contains(struct addr4_pool *pool, struct in_addr *addr)
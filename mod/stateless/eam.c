@@ -1,5 +1,6 @@
 #include "nat64/mod/stateless/eam.h"
 
+#include <linux/rcupdate.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/address.h"
 #include "nat64/mod/common/wkmalloc.h"
@@ -11,6 +12,50 @@
 #define ADDR_TO_KEY(addr)	INIT_KEY(addr, 8 * sizeof(*addr))
 #define PREFIX_TO_KEY(prefix)	INIT_KEY(&(prefix)->address, (prefix)->len)
 
+/**
+ * Where an EAM's suffix sits within the 128-bit IPv6 address, seen as two
+ * host-order 64-bit words.
+ */
+enum suffix6_type {
+	/* The IPv4 prefix is /32; there is no suffix to move. */
+	SUFFIX_NONE,
+	/* The suffix lies entirely within the high word. */
+	SUFFIX_HI,
+	/* The suffix lies entirely within the low word. (eg. /96 and /120.) */
+	SUFFIX_LO,
+	/* The suffix straddles both words. */
+	SUFFIX_SPLIT,
+};
+
+/**
+ * This is what the tries actually store: The entry, plus everything the packet
+ * path needs to move the suffix between the prefixes with a couple of word
+ * shifts instead of a bit-by-bit loop. It's all computed once, by eam_init().
+ */
+struct eam {
+	struct eamt_entry entry;
+
+	/* @entry.prefix6.address, in host byte order. */
+	u64 prefix6[2];
+	/* @entry.prefix4.address, in host byte order. */
+	__u32 prefix4;
+	/* Masks out the suffix, once it's aligned to the right. */
+	__u32 suffix_mask;
+
+	enum suffix6_type type;
+	/*
+	 * SUFFIX_HI and SUFFIX_SPLIT: The distance between the suffix and the
+	 * right end of the high word. (In the SPLIT case, it's the number of
+	 * suffix bits that overflow into the low word.)
+	 */
+	unsigned int hi_shift;
+	/*
+	 * SUFFIX_LO and SUFFIX_SPLIT: The distance between the suffix and the
+	 * right end of the low word.
+	 */
+	unsigned int lo_shift;
+};
+
 /**
  * Well, it really goes without saying, but I'll say it anyway:
  *
@@ -73,6 +118,97 @@ static int validate_prefixes(struct ipv6_prefix *prefix6,
 	return 0;
 }
 
+static void addr6_to_words(struct in6_addr *addr, u64 *words)
+{
+	words[0] = ((u64)be32_to_cpu(addr->s6_addr32[0]) << 32)
+			| be32_to_cpu(addr->s6_addr32[1]);
+	words[1] = ((u64)be32_to_cpu(addr->s6_addr32[2]) << 32)
+			| be32_to_cpu(addr->s6_addr32[3]);
+}
+
+static void words_to_addr6(u64 *words, struct in6_addr *addr)
+{
+	addr->s6_addr32[0] = cpu_to_be32(words[0] >> 32);
+	addr->s6_addr32[1] = cpu_to_be32(words[0]);
+	addr->s6_addr32[2] = cpu_to_be32(words[1] >> 32);
+	addr->s6_addr32[3] = cpu_to_be32(words[1]);
+}
+
+/**
+ * Builds the trie version of the (already validated) @prefix6 - @prefix4 EAM.
+ */
+static void eam_init(struct eam *eam, struct ipv6_prefix *prefix6,
+		struct ipv4_prefix *prefix4)
+{
+	unsigned int suffix_len = ADDR4_BITS - prefix4->len;
+	unsigned int start = prefix6->len;
+	unsigned int end = prefix6->len + suffix_len;
+
+	memset(eam, 0, sizeof(*eam));
+	eam->entry.prefix6 = *prefix6;
+	eam->entry.prefix4 = *prefix4;
+	addr6_to_words(&prefix6->address, eam->prefix6);
+	eam->prefix4 = be32_to_cpu(prefix4->address.s_addr);
+	eam->suffix_mask = suffix_len ? (0xFFFFFFFFu >> (32 - suffix_len)) : 0;
+
+	if (suffix_len == 0) {
+		eam->type = SUFFIX_NONE;
+	} else if (end <= 64) {
+		eam->type = SUFFIX_HI;
+		eam->hi_shift = 64 - end;
+	} else if (start >= 64) {
+		eam->type = SUFFIX_LO;
+		eam->lo_shift = 128 - end;
+	} else {
+		eam->type = SUFFIX_SPLIT;
+		eam->hi_shift = end - 64;
+		eam->lo_shift = 128 - end;
+	}
+}
+
+/**
+ * Returns the bits of @addr that follow @eam's IPv6 prefix, aligned to the
+ * right.
+ */
+static __u32 get_suffix6(struct eam *eam, u64 *addr)
+{
+	switch (eam->type) {
+	case SUFFIX_NONE:
+		return 0;
+	case SUFFIX_HI:
+		return (addr[0] >> eam->hi_shift) & eam->suffix_mask;
+	case SUFFIX_LO:
+		return (addr[1] >> eam->lo_shift) & eam->suffix_mask;
+	case SUFFIX_SPLIT:
+		return ((addr[0] << eam->hi_shift) | (addr[1] >> eam->lo_shift))
+				& eam->suffix_mask;
+	}
+
+	return 0;
+}
+
+/**
+ * Writes @suffix right after @eam's IPv6 prefix, in @addr. (The bits it lands
+ * on are assumed to be zero.)
+ */
+static void set_suffix6(struct eam *eam, u64 *addr, __u32 suffix)
+{
+	switch (eam->type) {
+	case SUFFIX_NONE:
+		return;
+	case SUFFIX_HI:
+		addr[0] |= (u64)suffix << eam->hi_shift;
+		return;
+	case SUFFIX_LO:
+		addr[1] |= (u64)suffix << eam->lo_shift;
+		return;
+	case SUFFIX_SPLIT:
+		addr[0] |= (u64)suffix >> eam->hi_shift;
+		addr[1] |= (u64)suffix << eam->lo_shift;
+		return;
+	}
+}
+
 static void msg_programming_error(void)
 {
 	log_err("(Note: This error should have been caught earlier.");
@@ -137,7 +273,7 @@ static int validate_overlapping(struct eam_table *eamt,
 		struct ipv4_prefix *prefix4,
 		bool force)
 {
-	struct eamt_entry old;
+	struct eam old;
 	struct rtrie_key key6 = PREFIX_TO_KEY(prefix6);
 	struct rtrie_key key4 = PREFIX_TO_KEY(prefix4);
 	int error;
@@ -149,14 +285,14 @@ static int validate_overlapping(struct eam_table *eamt,
 
 	error = rtrie_get(&eamt->trie6, &key6, &old);
 	if (!error) {
-		error = collision6(prefix6, prefix4, &old, force);
+		error = collision6(prefix6, prefix4, &old.entry, force);
 		if (error)
 			return error;
 	}
 
 	error = rtrie_get(&eamt->trie4, &key4, &old);
 	if (!error) {
-		error = collision4(prefix6, prefix4, &old, force);
+		error = collision4(prefix6, prefix4, &old.entry, force);
 		if (error)
 			return error;
 	}
@@ -174,16 +310,17 @@ static void __revert_add6(struct eam_table *eamt, struct ipv6_prefix *prefix6)
 			error);
 }
 
-static int eamt_add6(struct eam_table *eamt, struct eamt_entry *eam)
+static int eamt_add6(struct eam_table *eamt, struct eam *eam)
 {
+	struct ipv6_prefix *prefix = &eam->entry.prefix6;
 	size_t addr_offset;
 	int error;
 
-	addr_offset = offsetof(typeof(*eam), prefix6.address);
-	error = rtrie_add(&eamt->trie6, eam, addr_offset, eam->prefix6.len);
+	addr_offset = offsetof(typeof(*eam), entry.prefix6.address);
+	error = rtrie_add(&eamt->trie6, eam, addr_offset, prefix->len);
 	if (error == -EEXIST) {
 		log_err("Prefix %pI6c/%u already exists.",
-				&eam->prefix6.address, eam->prefix6.len);
+				&prefix->address, prefix->len);
 		msg_programming_error();
 	}
 	/* rtrie_print("IPv6 trie after add", &eamt->trie6); */
@@ -191,16 +328,17 @@ static int eamt_add6(struct eam_table *eamt, struct eamt_entry *eam)
 	return error;
 }
 
-static int eamt_add4(struct eam_table *eamt, struct eamt_entry *eam)
+static int eamt_add4(struct eam_table *eamt, struct eam *eam)
 {
+	struct ipv4_prefix *prefix = &eam->entry.prefix4;
 	size_t addr_offset;
 	int error;
 
-	addr_offset = offsetof(typeof(*eam), prefix4.address);
-	error = rtrie_add(&eamt->trie4, eam, addr_offset, eam->prefix4.len);
+	addr_offset = offsetof(typeof(*eam), entry.prefix4.address);
+	error = rtrie_add(&eamt->trie4, eam, addr_offset, prefix->len);
 	if (error == -EEXIST) {
 		log_err("Prefix %pI4/%u already exists.",
-				&eam->prefix4.address, eam->prefix4.len);
+				&prefix->address, prefix->len);
 		msg_programming_error();
 	}
 	/* rtrie_print("IPv4 trie after add", &eamt->trie4); */
@@ -213,7 +351,7 @@ int eamt_add(struct eam_table *eamt,
 		struct ipv4_prefix *prefix4,
 		bool force)
 {
-	struct eamt_entry new;
+	struct eam new;
 	int error;
 
 	error = validate_prefixes(prefix6, prefix4);
@@ -226,8 +364,7 @@ int eamt_add(struct eam_table *eamt,
 	if (error)
 		goto end;
 
-	new.prefix6 = *prefix6;
-	new.prefix4 = *prefix4;
+	eam_init(&new, prefix6, prefix4);
 
 	error = eamt_add6(eamt, &new);
 	if (error)
@@ -245,7 +382,7 @@ end:
 }
 
 static int get_exact6(struct eam_table *eamt, struct ipv6_prefix *prefix,
-		struct eamt_entry *eam)
+		struct eam *eam)
 {
 	struct rtrie_key key = PREFIX_TO_KEY(prefix);
 	int error;
@@ -254,11 +391,11 @@ static int get_exact6(struct eam_table *eamt, struct ipv6_prefix *prefix,
 	if (error)
 		return error;
 
-	return (eam->prefix6.len == prefix->len) ? 0 : -ESRCH;
+	return (eam->entry.prefix6.len == prefix->len) ? 0 : -ESRCH;
 }
 
 static int get_exact4(struct eam_table *eamt, struct ipv4_prefix *prefix,
-		struct eamt_entry *eam)
+		struct eam *eam)
 {
 	struct rtrie_key key = PREFIX_TO_KEY(prefix);
 	int error;
@@ -267,7 +404,7 @@ static int get_exact4(struct eam_table *eamt, struct ipv4_prefix *prefix,
 	if (error)
 		return error;
 
-	return (eam->prefix4.len == prefix->len) ? 0 : -ESRCH;
+	return (eam->entry.prefix4.len == prefix->len) ? 0 : -ESRCH;
 }
 
 static int __rm(struct eam_table *eamt,
@@ -300,18 +437,18 @@ static int eamt_rm_lockless(struct eam_table *eamt,
 		struct ipv6_prefix *prefix6,
 		struct ipv4_prefix *prefix4)
 {
-	struct eamt_entry eam6;
-	struct eamt_entry eam4;
+	struct eam eam6;
+	struct eam eam4;
 	int error;
 
 	if (!prefix4) {
 		error = get_exact6(eamt, prefix6, &eam6);
-		return error ? error : __rm(eamt, prefix6, &eam6.prefix4);
+		return error ? error : __rm(eamt, prefix6, &eam6.entry.prefix4);
 	}
 
 	if (!prefix6) {
 		error = get_exact4(eamt, prefix4, &eam4);
-		return error ? error : __rm(eamt, &eam4.prefix6, prefix4);
+		return error ? error : __rm(eamt, &eam4.entry.prefix6, prefix4);
 	}
 
 	error = get_exact6(eamt, prefix6, &eam6);
@@ -321,7 +458,7 @@ static int eamt_rm_lockless(struct eam_table *eamt,
 	if (error)
 		return error;
 
-	return eamt_entry_equals(&eam6, &eam4)
+	return eamt_entry_equals(&eam6.entry, &eam4.entry)
 			? __rm(eamt, prefix6, prefix4)
 			: -ESRCH;
 }
@@ -359,25 +496,26 @@ int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
 		struct in_addr *result)
 {
 	struct rtrie_key key = ADDR_TO_KEY(addr6);
-	struct eamt_entry eam;
-	unsigned int i;
-	int error;
+	struct eam *eam;
+	u64 words[2];
+	__u32 addr4;
+
+	rcu_read_lock_bh();
 
 	/* Find the entry. */
-	error = rtrie_get(&eamt->trie6, &key, &eam);
-	if (error)
-		return error;
+	eam = rtrie_find(&eamt->trie6, &key);
+	if (!eam) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
+	}
 
 	/* Translate the address. */
-	for (i = 0; i < ADDR4_BITS - eam.prefix4.len; i++) {
-		unsigned int offset4 = eam.prefix4.len + i;
-		unsigned int offset6 = eam.prefix6.len + i;
-		addr4_set_bit(&eam.prefix4.address, offset4,
-				addr6_get_bit(addr6, offset6));
-	}
+	addr6_to_words(addr6, words);
+	addr4 = eam->prefix4 | get_suffix6(eam, words);
 
-	/* I'm assuming the prefix address is already zero-trimmed. */
-	*result = eam.prefix4.address;
+	rcu_read_unlock_bh();
+
+	result->s_addr = cpu_to_be32(addr4);
 	return 0;
 }
 
@@ -385,25 +523,28 @@ int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
 		struct in6_addr *result)
 {
 	struct rtrie_key key = ADDR_TO_KEY(addr4);
-	struct eamt_entry eam;
-	unsigned int i;
-	int error;
+	struct eam *eam;
+	u64 words[2];
+
+	rcu_read_lock_bh();
 
 	/* Find the entry. */
-	error = rtrie_get(&eamt->trie4, &key, &eam);
-	if (error)
-		return error;
+	eam = rtrie_find(&eamt->trie4, &key);
+	if (!eam) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
+	}
 
 	/* Translate the address. */
-	for (i = 0; i < ADDR4_BITS - eam.prefix4.len; i++) {
-		unsigned int offset4 = eam.prefix4.len + i;
-		unsigned int offset6 = eam.prefix6.len + i;
-		addr6_set_bit(&eam.prefix6.address, offset6,
-				addr4_get_bit(addr4, offset4));
-	}
+	words[0] = eam->prefix6[0];
+	words[1] = eam->prefix6[1];
+	set_suffix6(eam, words,
+			be32_to_cpu(addr4->s_addr) & eam->suffix_mask);
+
+	rcu_read_unlock_bh();
 
 	/* I'm assuming the prefix address is already zero-trimmed. */
-	*result = eam.prefix6.address;
+	words_to_addr6(words, result);
 	return 0;
 }
 
@@ -428,7 +569,7 @@ struct foreach_args {
 static int foreach_cb(void *eam, void *arg)
 {
 	struct foreach_args *args = arg;
-	return args->cb(eam, args->arg);
+	return args->cb(&((struct eam *)eam)->entry, args->arg);
 }
 
 int eamt_foreach(struct eam_table *eamt,
@@ -472,8 +613,8 @@ int eamt_init(struct eam_table **eamt)
 	if (!result)
 		return -ENOMEM;
 
-	rtrie_init(&result->trie6, sizeof(struct eamt_entry));
-	rtrie_init(&result->trie4, sizeof(struct eamt_entry));
+	rtrie_init(&result->trie6, sizeof(struct eam));
+	rtrie_init(&result->trie4, sizeof(struct eam));
 	result->count = 0;
 	kref_init(&result->refcount);
 
@@ -15,6 +15,7 @@ verdict handling_hairpinning(struct xlation *old)
 
 	log_debug("Packet is a hairpin. U-turning...");
 
+	xlation_init(&new);
 	new.jool = old->jool;
 	new.in = old->out;
 
@@ -28,3 +29,15 @@ verdict handling_hairpinning(struct xlation *old)
 	log_debug("Done hairpinning.");
 	return VERDICT_CONTINUE;
 }
+
+bool hairpin_shortcut_possible(struct xlation *state)
+{
+	/* SIIT hairpins are only known after translation. */
+	return false;
+}
+
+verdict hairpin_shortcut(struct xlation *state)
+{
+	WARN(true, "The hairpin shortcut was called from SIIT code.");
+	return VERDICT_DROP;
+}
@@ -105,12 +105,24 @@ void fragdb_config_set(struct fragdb *db, struct fragdb_config *config)
 	/* No code. */
 }
 
-verdict fragdb_handle(struct fragdb *db, struct packet *pkt)
+void fragdb_stats(struct fragdb *db, struct fragdb_stats_usr *result)
+{
+	fail(__func__);
+}
+
+verdict fragdb_handle(struct fragdb *db, struct packet *pkt,
+		struct sk_buff **held)
 {
 	fail(__func__);
 	return VERDICT_DROP;
 }
 
+void fragdb_filtered(struct fragdb *db, struct packet *pkt, verdict result,
+		struct sk_buff **held)
+{
+	fail(__func__);
+}
+
 int pool4db_init(struct pool4 **pool)
 {
 	return fail(__func__);
@@ -239,6 +251,19 @@ int bib_count_sessions(struct bib *db, l4_protocol proto, __u64 *count)
 	return fail(__func__);
 }
 
+int bib_session_bytes(struct bib *db, l4_protocol proto, __u64 *bytes)
+{
+	return fail(__func__);
+}
+
+int bib_refresh(struct bib *db, l4_protocol proto,
+		struct ipv6_transport_addr *src6,
+		struct ipv4_transport_addr *dst4,
+		unsigned long update_time)
+{
+	return fail(__func__);
+}
+
 void bib_session_init(struct bib_session *bs)
 {
 	/* No code. */
@@ -5,12 +5,13 @@
 #include <linux/version.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/core.h"
-#include "nat64/mod/common/log_time.h"
 #include "nat64/mod/common/nf_wrapper.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/route_cache.h"
 #include "nat64/mod/common/wkmalloc.h"
 #include "nat64/mod/common/xlator.h"
 #include "nat64/mod/common/nl/nl_handler.h"
+#include "nat64/mod/stateless/blacklist4.h"
 #include "nat64/mod/stateless/pool.h"
 
 MODULE_LICENSE("GPL");
@@ -98,9 +99,12 @@ static int __init jool_init(void)
 	error = xlator_init();
 	if (error)
 		goto xlator_fail;
-	error = logtime_init();
+	error = rtcache_init();
 	if (error)
-		goto log_time_fail;
+		goto rtcache_fail;
+	error = ifaddrs_init();
+	if (error)
+		goto ifaddrs_fail;
 	error = nlhandler_init();
 	if (error)
 		goto nlhandler_fail;
@@ -124,8 +128,10 @@ nf_register_hooks_fail:
 instance_fail:
 	nlhandler_destroy();
 nlhandler_fail:
-	logtime_destroy();
-log_time_fail:
+	ifaddrs_destroy();
+ifaddrs_fail:
+	rtcache_destroy();
+rtcache_fail:
 	xlator_destroy();
 xlator_fail:
 	return error;
@@ -136,7 +142,8 @@ static void __exit jool_exit(void)
 	nf_unregister_hooks(nfho, ARRAY_SIZE(nfho));
 
 	nlhandler_destroy();
-	logtime_destroy();
+	ifaddrs_destroy();
+	rtcache_destroy();
 	xlator_destroy();
 
 #ifdef JKMEMLEAK
@@ -7,6 +7,7 @@
 #include "nat64/common/types.h"
 #include "nat64/mod/common/address.h"
 #include "nat64/mod/common/rcu.h"
+#include "nat64/mod/common/rtrie.h"
 #include "nat64/mod/common/tags.h"
 #include "nat64/mod/common/wkmalloc.h"
 
@@ -15,8 +16,28 @@ struct pool_entry {
 	struct list_head list_hook;
 };
 
+/**
+ * The pool's prefixes, indexed twice.
+ *
+ * @list keeps them in insertion order; foreach and count walk it. @trie
+ * answers pool_contains() in a longest-prefix-match lookup instead of a walk
+ * through the whole list, which matters because blacklists can be long.
+ *
+ * The pool tolerates duplicates, but the trie doesn't, so each distinct
+ * prefix has one trie leaf no matter how many times it appears in @list.
+ */
+struct pool_table {
+	struct list_head list;
+	struct rtrie trie;
+	/**
+	 * Number of addresses in @list, duplicates included.
+	 * Touch only while you're holding the mutex.
+	 */
+	__u64 addr_count;
+};
+
 struct addr4_pool {
-	struct list_head __rcu *list;
+	struct pool_table __rcu *table;
 	struct kref refcounter;
 };
 
@@ -51,53 +72,63 @@ static int parse_prefix4(const char *str, struct ipv4_prefix *prefix)
 	return error;
 }
 
+RCUTAG_FREE
+static void prefix_to_key(struct ipv4_prefix *prefix, struct rtrie_key *key)
+{
+	key->bytes = (__u8 *) &prefix->address;
+	key->len = prefix->len;
+}
+
 /**
- * Assumes it has exclusive access to @list.
+ * Assumes it has exclusive access to @table.
  */
 RCUTAG_FREE
-static void __destroy(struct list_head *list)
+static void __destroy(struct pool_table *table)
 {
 	struct list_head *node;
 	struct list_head *tmp;
 
-	list_for_each_safe(node, tmp, list) {
+	list_for_each_safe(node, tmp, &table->list) {
 		list_del(node);
 		wkfree(struct pool_entry, get_entry(node));
 	}
 
-	__wkfree("IPv4 address pool list", list);
+	rtrie_destroy(&table->trie);
+	wkfree(struct pool_table, table);
 }
 
 RCUTAG_USR /* Only because of GFP_KERNEL. Can be easily upgraded to FREE. */
-static struct list_head *alloc_list(void)
+static struct pool_table *alloc_table(void)
 {
-	struct list_head *list;
+	struct pool_table *table;
 
-	list = __wkmalloc("IPv4 address pool list", sizeof(*list), GFP_KERNEL);
-	if (!list)
+	table = wkmalloc(struct pool_table, GFP_KERNEL);
+	if (!table)
 		return NULL;
-	INIT_LIST_HEAD(list);
+	INIT_LIST_HEAD(&table->list);
+	rtrie_init(&table->trie, sizeof(struct ipv4_prefix));
+	table->addr_count = 0;
 
-	return list;
+	return table;
 }
 
 RCUTAG_USR
 int pool_init(struct addr4_pool **pool)
 {
 	struct addr4_pool *result;
-	struct list_head *list;
+	struct pool_table *table;
 
 	result = wkmalloc(struct addr4_pool, GFP_KERNEL);
 	if (!result)
 		return -ENOMEM;
 
-	list = alloc_list();
-	if (!list) {
+	table = alloc_table();
+	if (!table) {
 		wkfree(struct addr4_pool, result);
 		return -ENOMEM;
 	}
 
-	RCU_INIT_POINTER(result->list, list);
+	RCU_INIT_POINTER(result->table, table);
 	kref_init(&result->refcounter);
 
 	*pool = result;
@@ -114,7 +145,7 @@ static void destroy_pool(struct kref *refcounter)
 {
 	struct addr4_pool *pool;
 	pool = container_of(refcounter, struct addr4_pool, refcounter);
-	__destroy(rcu_dereference_raw(pool->list));
+	__destroy(rcu_dereference_raw(pool->table));
 	wkfree(struct addr4_pool, pool);
 }
 
@@ -141,9 +172,8 @@ static int validate_scope(struct ipv4_prefix *prefix, bool force)
 RCUTAG_USR
 int pool_add(struct addr4_pool *pool, struct ipv4_prefix *prefix, bool force)
 {
-	struct list_head *list;
+	struct pool_table *table;
 	struct pool_entry *entry;
-	__u64 count;
 	int error;
 
 	error = prefix4_validate(prefix);
@@ -155,14 +185,13 @@ int pool_add(struct addr4_pool *pool, struct ipv4_prefix *prefix, bool force)
 
 	mutex_lock(&lock);
 
-	error = pool_count(pool, &count);
-	if (error) {
-		log_err("Unknown error %d while trying to validate overflow.",
-				error);
-		goto end;
-	}
+	table = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
 
-	if (count + prefix4_get_addr_count(prefix) > UINT_MAX) {
+	/*
+	 * (Counting the list here would turn bulk additions, such as atomic
+	 * configuration, quadratic.)
+	 */
+	if (table->addr_count + prefix4_get_addr_count(prefix) > UINT_MAX) {
 		/* Otherwise get_rfc6791_address() overflows. */
 		log_err("The pool must not contain more than %u addresses.\n"
 				"(Duplicates do count towards the limit.)",
@@ -177,8 +206,18 @@ int pool_add(struct addr4_pool *pool, struct ipv4_prefix *prefix, bool force)
 	}
 	entry->prefix = *prefix;
 
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	list_add_tail_rcu(&entry->list_hook, list);
+	error = rtrie_add(&table->trie, prefix,
+			offsetof(struct ipv4_prefix, address), prefix->len);
+	if (error == -EEXIST) {
+		/* Duplicate; the trie already knows about the prefix. */
+		error = 0;
+	} else if (error) {
+		wkfree(struct pool_entry, entry);
+		goto end;
+	}
+
+	list_add_tail_rcu(&entry->list_hook, &table->list);
+	table->addr_count += prefix4_get_addr_count(prefix);
 
 end:
 	mutex_unlock(&lock);
@@ -205,45 +244,77 @@ int pool_add_str(struct addr4_pool *pool, char *pref_strs[], int pref_count)
 	return 0;
 }
 
+/**
+ * Removes one copy of @prefix from @pool.
+ *
+ * The list is only walked once: the first match is the victim, and the walk
+ * continues only to learn whether it has any duplicates (in which case the
+ * trie leaf has to stay). The list node and the trie's garbage are then
+ * released after a single grace period.
+ */
 RCUTAG_USR
 int pool_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix)
 {
-	struct list_head *list;
-	struct list_head *node;
+	struct pool_table *table;
 	struct pool_entry *entry;
+	struct pool_entry *victim = NULL;
+	bool duplicated = false;
+	struct rtrie_garbage garbage;
+	struct rtrie_key key;
+	int error;
 
+	rtrie_garbage_init(&garbage);
 	mutex_lock(&lock);
 
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	list_for_each(node, list) {
-		entry = get_entry(node);
-		if (prefix4_equals(prefix, &entry->prefix)) {
-			list_del_rcu(&entry->list_hook);
-			mutex_unlock(&lock);
-			synchronize_rcu_bh();
-			wkfree(struct pool_entry, entry);
-			return 0;
+	table = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
+	list_for_each_entry(entry, &table->list, list_hook) {
+		if (!prefix4_equals(prefix, &entry->prefix))
+			continue;
+		if (victim) {
+			duplicated = true;
+			break;
 		}
+		victim = entry;
+	}
+
+	if (!victim) {
+		mutex_unlock(&lock);
+		log_err("Could not find the requested entry in the IPv4 pool.");
+		return -ESRCH;
+	}
+
+	list_del_rcu(&victim->list_hook);
+	table->addr_count -= prefix4_get_addr_count(prefix);
+
+	/* Only drop the leaf if this was the last duplicate. */
+	if (!duplicated) {
+		prefix_to_key(prefix, &key);
+		error = rtrie_rm_deferred(&table->trie, &key, &garbage);
+		WARN(error, "Pool prefix %pI4/%u was not in the trie. (Errcode %d)",
+				&prefix->address, prefix->len, error);
 	}
 
 	mutex_unlock(&lock);
-	log_err("Could not find the requested entry in the IPv4 pool.");
-	return -ESRCH;
+
+	synchronize_rcu_bh();
+	wkfree(struct pool_entry, victim);
+	rtrie_garbage_free(&garbage);
+	return 0;
 }
 
 RCUTAG_USR
 int pool_flush(struct addr4_pool *pool)
 {
-	struct list_head *old;
-	struct list_head *new;
+	struct pool_table *old;
+	struct pool_table *new;
 
-	new = alloc_list();
+	new = alloc_table();
 	if (!new)
 		return -ENOMEM;
 
 	mutex_lock(&lock);
-	old = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	rcu_assign_pointer(pool->list, new);
+	old = rcu_dereference_protected(pool->table, lockdep_is_held(&lock));
+	rcu_assign_pointer(pool->table, new);
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
@@ -255,23 +326,19 @@ int pool_flush(struct addr4_pool *pool)
 RCUTAG_PKT
 bool pool_contains(struct addr4_pool *pool, struct in_addr *addr)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct pool_table *table;
+	struct rtrie_key key;
+	bool result;
 
-	rcu_read_lock_bh();
-
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
-		if (prefix4_contains(&entry->prefix, addr)) {
-			rcu_read_unlock_bh();
-			return true;
-		}
-	}
+	key.bytes = (__u8 *) addr;
+	key.len = 32;
 
+	rcu_read_lock_bh();
+	table = rcu_dereference_bh(pool->table);
+	result = rtrie_contains(&table->trie, &key);
 	rcu_read_unlock_bh();
-	return false;
+
+	return result;
 }
 
 RCUTAG_PKT
@@ -279,15 +346,15 @@ int pool_foreach(struct addr4_pool *pool,
 		int (*func)(struct ipv4_prefix *, void *), void *arg,
 		struct ipv4_prefix *offset)
 {
-	struct list_head *list;
+	struct pool_table *table;
 	struct list_head *node;
 	struct pool_entry *entry;
 	int error = 0;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
+	table = rcu_dereference_bh(pool->table);
+	list_for_each_rcu_bh(node, &table->list) {
 		entry = get_entry(node);
 		if (!offset) {
 			error = func(&entry->prefix, arg);
@@ -305,13 +372,13 @@ int pool_foreach(struct addr4_pool *pool,
 RCUTAG_PKT
 int pool_count(struct addr4_pool *pool, __u64 *result)
 {
-	struct list_head *list;
+	struct pool_table *table;
 	struct list_head *node;
 	__u64 count = 0;
 
 	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
+	table = rcu_dereference_bh(pool->table);
+	list_for_each_rcu_bh(node, &table->list) {
 		count += prefix4_get_addr_count(&get_entry(node)->prefix);
 	}
 	rcu_read_unlock_bh();
@@ -323,12 +390,12 @@ int pool_count(struct addr4_pool *pool, __u64 *result)
 RCUTAG_PKT
 bool pool_is_empty(struct addr4_pool *pool)
 {
-	struct list_head *list;
+	struct pool_table *table;
 	bool result;
 
 	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool->list);
-	result = list_empty(list);
+	table = rcu_dereference_bh(pool->table);
+	result = list_empty(&table->list);
 	rcu_read_unlock_bh();
 
 	return result;
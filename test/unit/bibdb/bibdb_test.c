@@ -1,5 +1,6 @@
 #include <linux/module.h>
 #include <linux/printk.h>
+#include <linux/ktime.h>
 #include "nat64/unit/unit_test.h"
 #include "nat64/unit/bib.h"
 
@@ -7,6 +8,11 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Alberto Leiva");
 MODULE_DESCRIPTION("BIB DB module test.");
 
+static bool benchmark;
+module_param(benchmark, bool, 0);
+MODULE_PARM_DESC(benchmark, "Also measure lookup latency on big tables. "
+		"(Slow, and needs a couple of gigabytes of memory.)");
+
 static struct bib *db;
 static const l4_protocol PROTO = L4PROTO_TCP;
 static struct bib_entry bibs[8];
@@ -201,14 +207,91 @@ static bool test_flow(void)
 	return success;
 }
 
+/** Number of lookups each benchmark measures. */
+#define BENCH_LOOKUPS 1000000
+
+static void init_bench_entry(unsigned int i, struct bib_entry *entry)
+{
+	entry->ipv6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	entry->ipv6.l3.s6_addr32[1] = 0;
+	entry->ipv6.l3.s6_addr32[2] = 0;
+	entry->ipv6.l3.s6_addr32[3] = cpu_to_be32(i);
+	entry->ipv6.l4 = i & 0xFFFF;
+	/* 198.18.0.0/15 has room for plenty of transport addresses. */
+	entry->ipv4.l3.s_addr = cpu_to_be32(0xc6120000 | (i >> 16));
+	entry->ipv4.l4 = i & 0xFFFF;
+	entry->l4_proto = PROTO;
+}
+
+/**
+ * Fills the database with @size entries, then prints the average time it took
+ * to find BENCH_LOOKUPS of them (in scattered order) by each index.
+ */
+static bool bench_lookups(unsigned int size)
+{
+	struct bib_entry entry;
+	ktime_t start;
+	s64 ns6;
+	s64 ns4;
+	unsigned int i;
+	bool success = true;
+
+	for (i = 0; i < size; i++) {
+		init_bench_entry(i, &entry);
+		if (bib_add_static(db, &entry, NULL)) {
+			log_err("Could not add benchmark entry #%u.", i);
+			success = false;
+			goto end;
+		}
+		if (!(i & 0xFFFF))
+			cond_resched();
+	}
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		init_bench_entry((i * 2654435761u) % size, &entry);
+		success &= !bib_find6(db, PROTO, &entry.ipv6, NULL);
+	}
+	ns6 = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		init_bench_entry((i * 2654435761u) % size, &entry);
+		success &= !bib_find4(db, PROTO, &entry.ipv4, NULL);
+	}
+	ns4 = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	log_info("%u entries: %lld ns per IPv6 lookup, %lld ns per IPv4 lookup.",
+			size, div_s64(ns6, BENCH_LOOKUPS),
+			div_s64(ns4, BENCH_LOOKUPS));
+	if (!success)
+		log_err("Some of the %u-entry lookups failed.", size);
+	/* Fall through. */
+
+end:
+	bib_flush(db);
+	return success;
+}
+
+static bool bench(void)
+{
+	bool success = true;
+
+	success &= bench_lookups(10000);
+	success &= bench_lookups(1000000);
+	success &= bench_lookups(10000000);
+
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
 }
 
-static bool init(void)
+static bool init_shards(unsigned int shards)
 {
-	if (bib_init())
+	if (bib_init(shards))
 		return false;
 	db = bib_create();
 	if (!db)
@@ -216,6 +299,17 @@ static bool init(void)
 	return db;
 }
 
+static bool init(void)
+{
+	return init_shards(1);
+}
+
+/* Most of the test entries end up being strays here. */
+static bool init_sharded(void)
+{
+	return init_shards(4);
+}
+
 static void end(void)
 {
 	bib_put(db);
@@ -227,6 +321,10 @@ int init_module(void)
 	START_TESTS("BIB");
 
 	INIT_CALL_END(init(), test_flow(), end(), "Flow");
+	INIT_CALL_END(init_sharded(), test_flow(), end(), "Sharded flow");
+	if (benchmark) {
+		INIT_CALL_END(init(), bench(), end(), "Lookup benchmark");
+	}
 
 	END_TESTS;
 }
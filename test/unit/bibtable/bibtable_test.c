@@ -157,9 +157,9 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 	return FATE_RM;
 }
 
-static bool init(void)
+static bool init(unsigned int shards)
 {
-	if (bib_init())
+	if (bib_init(shards))
 		return false;
 	db = bib_create();
 	if (!db)
@@ -177,7 +177,9 @@ int init_module(void)
 {
 	START_TESTS("BIB table");
 
-	INIT_CALL_END(init(), test_foreach(), end(), "Foreach");
+	INIT_CALL_END(init(1), test_foreach(), end(), "Foreach");
+	/* The shards have to be merged back into src4 order. */
+	INIT_CALL_END(init(4), test_foreach(), end(), "Foreach, 4 shards");
 
 	END_TESTS;
 }
@@ -1,12 +1,18 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("dhernandez");
 MODULE_AUTHOR("aleiva");
 MODULE_DESCRIPTION("Unit tests for the EAMT module");
 
+static bool benchmark;
+module_param(benchmark, bool, 0);
+MODULE_PARM_DESC(benchmark, "Also measure lookup throughput on big tables. "
+		"(Slow, and needs a few hundred megabytes of memory.)");
+
 #include "nat64/common/str_utils.h"
 #include "nat64/unit/types.h"
 #include "nat64/unit/unit_test.h"
@@ -224,6 +230,109 @@ static bool rfc7757_identical_test(void)
 	return success;
 }
 
+/**
+ * Adds the @addr4/@len4 - @addr6/@len6 EAM, after checking eam_init() files it
+ * under the @expected suffix layout.
+ */
+static bool add_layout(char *addr4, __u8 len4, char *addr6, __u8 len6,
+		enum suffix6_type expected)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	struct eam eam;
+
+	if (str_to_addr4(addr4, &prefix4.address))
+		return false;
+	prefix4.len = len4;
+	if (str_to_addr6(addr6, &prefix6.address))
+		return false;
+	prefix6.len = len6;
+
+	eam_init(&eam, &prefix6, &prefix4);
+	if (!ASSERT_INT(expected, eam.type, "layout of %s/%u - %s/%u",
+			addr4, len4, addr6, len6))
+		return false;
+
+	return add_entry(addr4, len4, addr6, len6);
+}
+
+/* The suffix ends before the 64th bit. */
+static bool layout_hi_test(void)
+{
+	bool success = true;
+
+	if (!add_layout("192.168.0.0", 16, "2001:db8:ff00::", 40, SUFFIX_HI))
+		return false;
+
+	success &= test("192.168.0.0", "2001:db8:ff00::");
+	success &= test("192.168.1.2", "2001:db8:ff01:200::");
+	success &= test("192.168.255.255", "2001:db8:ffff:ff00::");
+	/* Bits past the suffix are not part of the IPv4 address. */
+	success &= test_6to4("2001:db8:ff01:2ff:1::1", "192.168.1.2");
+	success &= test_6to4("2001:db9::", NULL);
+
+	return success;
+}
+
+/* The suffix starts at or after the 64th bit. */
+static bool layout_lo_test(void)
+{
+	bool success = true;
+
+	if (!add_layout("0.0.0.0", 0, "64:ff9b::", 96, SUFFIX_LO))
+		return false;
+	if (!add_layout("192.0.2.0", 24, "2001:db8::100", 120, SUFFIX_LO))
+		return false;
+
+	success &= test("0.0.0.0", "64:ff9b::");
+	success &= test("198.51.100.33", "64:ff9b::c633:6421");
+	success &= test("255.255.255.255", "64:ff9b::ffff:ffff");
+	success &= test("192.0.2.0", "2001:db8::100");
+	success &= test("192.0.2.77", "2001:db8::14d");
+	success &= test("192.0.2.255", "2001:db8::1ff");
+	success &= test_6to4("2001:db8::200", NULL);
+
+	return success;
+}
+
+/* The suffix straddles the 64th bit. */
+static bool layout_split_test(void)
+{
+	bool success = true;
+
+	if (!add_layout("10.1.0.0", 16, "2001:db8:0:ab00::", 56, SUFFIX_SPLIT))
+		return false;
+	if (!add_layout("11.0.0.0", 8, "2001:db8:0:10::", 60, SUFFIX_SPLIT))
+		return false;
+
+	success &= test("10.1.0.0", "2001:db8:0:ab00::");
+	success &= test("10.1.18.52", "2001:db8:0:ab12:3400::");
+	success &= test("10.1.255.255", "2001:db8:0:abff:ff00::");
+	success &= test_6to4("2001:db8:0:ab12:34ff:1::", "10.1.18.52");
+	success &= test("11.171.205.239", "2001:db8:0:1a:bcde:f000::");
+	success &= test("11.255.255.255", "2001:db8:0:1f:ffff:f000::");
+
+	return success;
+}
+
+/* /32 IPv4 prefixes leave no suffix to move. */
+static bool layout_none_test(void)
+{
+	bool success = true;
+
+	if (!add_layout("198.51.100.7", 32, "2001:db8::7", 128, SUFFIX_NONE))
+		return false;
+	if (!add_layout("198.51.100.8", 32, "2001:db8:1::", 64, SUFFIX_NONE))
+		return false;
+
+	success &= test("198.51.100.7", "2001:db8::7");
+	success &= test("198.51.100.8", "2001:db8:1::");
+	success &= test_6to4("2001:db8:1::abcd", "198.51.100.8");
+	success &= test_6to4("2001:db8::6", NULL);
+
+	return success;
+}
+
 static bool remove_entry(char *addr4, __u8 len4, char *addr6, __u8 len6,
 		int expected_error)
 {
@@ -452,6 +561,93 @@ static bool remove_test(void)
 	return success;
 }
 
+/** Number of lookups each benchmark measures. */
+#define BENCH_LOOKUPS 1000000
+
+static void init_bench_entry(unsigned int i, struct ipv6_prefix *prefix6,
+		struct ipv4_prefix *prefix4)
+{
+	/* Scatter the entries so the trie doesn't only grow sideways. */
+	__u32 scattered = i * 2654435761u;
+
+	prefix6->address.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	prefix6->address.s6_addr32[1] = 0;
+	prefix6->address.s6_addr32[2] = cpu_to_be32(i);
+	prefix6->address.s6_addr32[3] = cpu_to_be32(scattered);
+	prefix6->len = 128;
+	prefix4->address.s_addr = cpu_to_be32(scattered);
+	prefix4->len = 32;
+}
+
+static u64 lookups_per_sec(s64 ns)
+{
+	return div64_u64((u64)BENCH_LOOKUPS * NSEC_PER_SEC, max_t(s64, ns, 1));
+}
+
+/**
+ * Fills the EAMT with @size entries, then prints how many lookups per second
+ * it managed while translating BENCH_LOOKUPS addresses (in scattered order) in
+ * each direction.
+ */
+static bool bench_lookups(unsigned int size)
+{
+	struct ipv6_prefix prefix6;
+	struct ipv4_prefix prefix4;
+	struct in6_addr addr6;
+	struct in_addr addr4;
+	ktime_t start;
+	s64 ns6;
+	s64 ns4;
+	unsigned int i;
+	bool success = true;
+
+	for (i = 0; i < size; i++) {
+		init_bench_entry(i, &prefix6, &prefix4);
+		if (eamt_add(eamt, &prefix6, &prefix4, false)) {
+			log_err("Could not add benchmark entry #%u.", i);
+			success = false;
+			goto end;
+		}
+		if (!(i & 0xFFFF))
+			cond_resched();
+	}
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		init_bench_entry((i * 2654435761u) % size, &prefix6, &prefix4);
+		success &= !eamt_xlat_6to4(eamt, &prefix6.address, &addr4);
+	}
+	ns6 = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		init_bench_entry((i * 2654435761u) % size, &prefix6, &prefix4);
+		success &= !eamt_xlat_4to6(eamt, &prefix4.address, &addr6);
+	}
+	ns4 = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	log_info("%u entries: %llu 6-to-4 lookups/sec, %llu 4-to-6 lookups/sec.",
+			size, lookups_per_sec(ns6), lookups_per_sec(ns4));
+	if (!success)
+		log_err("Some of the %u-entry lookups failed.", size);
+	/* Fall through. */
+
+end:
+	eamt_flush(eamt);
+	return success;
+}
+
+static bool bench(void)
+{
+	bool success = true;
+
+	success &= bench_lookups(1000);
+	success &= bench_lookups(100000);
+	success &= bench_lookups(1000000);
+
+	return success;
+}
+
 static int address_mapping_test_init(void)
 {
 	START_TESTS("Address Mapping test");
@@ -461,7 +657,14 @@ static int address_mapping_test_init(void)
 	INIT_CALL_END(init(), rfc7757_examples_test(), end(), "RFC 7757 Appendix B");
 	INIT_CALL_END(init(), rfc7757_overlapping_test(), end(), "RFC 7757 Section 5, 1st half");
 	INIT_CALL_END(init(), rfc7757_identical_test(), end(), "RFC 7757 Section 5, 2nd half");
+	INIT_CALL_END(init(), layout_hi_test(), end(), "High word suffixes");
+	INIT_CALL_END(init(), layout_lo_test(), end(), "Low word suffixes");
+	INIT_CALL_END(init(), layout_split_test(), end(), "Split suffixes");
+	INIT_CALL_END(init(), layout_none_test(), end(), "No suffixes");
 	INIT_CALL_END(init(), remove_test(), end(), "remove function");
+	if (benchmark) {
+		INIT_CALL_END(init(), bench(), end(), "Lookup benchmark");
+	}
 
 	END_TESTS;
 }
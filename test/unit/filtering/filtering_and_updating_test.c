@@ -1,5 +1,6 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Roberto Aceves");
@@ -16,6 +17,11 @@ MODULE_DESCRIPTION("Unit tests for the Filtering module");
 
 static struct xlator jool;
 
+static bool benchmark;
+module_param(benchmark, bool, 0);
+MODULE_PARM_DESC(benchmark, "Also measure the BIB entry creation rate as "
+		"pool4 fills up. (Slow.)");
+
 static int bib_count_fn(struct bib_entry *bib, bool is_static, void *arg)
 {
 	int *count = arg;
@@ -522,7 +528,7 @@ static bool init(void)
 	struct ipv6_prefix prefix6;
 	struct ipv4_range range;
 
-	if (bib_init())
+	if (bib_init(1))
 		return false;
 	if (rfc6056_init())
 		goto fail2;
@@ -564,6 +570,89 @@ fail2:
 	return false;
 }
 
+/** Ports of the address the benchmark exhausts. */
+#define BENCH_PORT_MIN 1024
+#define BENCH_PORT_MAX 65535
+
+static int bench_add(unsigned int i)
+{
+	struct tuple tuple6;
+	struct ipv4_transport_addr dst4;
+	struct route4_args args = { .ns = jool.ns, .mark = 1, };
+	struct mask_domain masks;
+	struct bib_session result;
+	int error;
+
+	tuple6.src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	tuple6.src.addr6.l3.s6_addr32[1] = 0;
+	tuple6.src.addr6.l3.s6_addr32[2] = 0;
+	tuple6.src.addr6.l3.s6_addr32[3] = cpu_to_be32(i);
+	tuple6.src.addr6.l4 = 5000;
+	tuple6.dst.addr6.l3.s6_addr32[0] = cpu_to_be32(0x00030000);
+	tuple6.dst.addr6.l3.s6_addr32[1] = 0;
+	tuple6.dst.addr6.l3.s6_addr32[2] = 0;
+	tuple6.dst.addr6.l3.s6_addr32[3] = cpu_to_be32(0xcb007105);
+	tuple6.dst.addr6.l4 = 80;
+	tuple6.l3_proto = L3PROTO_IPV6;
+	tuple6.l4_proto = L4PROTO_UDP;
+
+	dst4.l3.s_addr = cpu_to_be32(0xcb007105);
+	dst4.l4 = 80;
+	args.daddr = dst4.l3;
+
+	error = mask_domain_find(jool.nat64.pool4, &tuple6,
+			jool.global->cfg.nat64.f_args, &args, &masks);
+	if (error)
+		return error;
+	error = bib_add6(jool.nat64.bib, &masks, &tuple6, &dst4, &result);
+	mask_domain_put(&masks);
+	return error;
+}
+
+/**
+ * Creates one BIB entry for every port of a pool4 address, and prints the
+ * average time each tenth of them took to create.
+ *
+ * The numbers should not grow much as the address fills up.
+ */
+static bool bench(void)
+{
+	struct ipv4_range range;
+	unsigned int total = BENCH_PORT_MAX - BENCH_PORT_MIN + 1;
+	unsigned int decile;
+	unsigned int i;
+	unsigned int end;
+	ktime_t start;
+	s64 ns;
+
+	if (str_to_addr4("192.0.2.1", &range.prefix.address))
+		return false;
+	range.prefix.len = 32;
+	range.ports.min = BENCH_PORT_MIN;
+	range.ports.max = BENCH_PORT_MAX;
+	if (pool4db_add(jool.nat64.pool4, 1, L4PROTO_UDP, &range))
+		return false;
+
+	for (decile = 0, i = 0; decile < 10; decile++) {
+		end = total * (decile + 1) / 10;
+		start = ktime_get();
+		for (; i < end; i++) {
+			if (bench_add(i)) {
+				log_err("Connection #%u could not be created.",
+						i);
+				return false;
+			}
+		}
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		log_info("%u%%-%u%% pool4 occupancy: %lld ns per connection.",
+				decile * 10, (decile + 1) * 10,
+				div_s64(ns, end - total * decile / 10));
+	}
+
+	return ASSERT_INT(-ENOENT, bench_add(total), "exhausted pool4");
+}
+
 static void end(void)
 {
 	icmp64_pop();
@@ -581,6 +670,9 @@ static int filtering_test_init(void)
 	INIT_CALL_END(init(), test_udp(), end(), "UDP");
 	INIT_CALL_END(init(), test_icmp(), end(), "ICMP");
 	INIT_CALL_END(init(), test_tcp(), end(), "test_tcp");
+	if (benchmark) {
+		INIT_CALL_END(init(), bench(), end(), "Allocation benchmark");
+	}
 
 	END_TESTS;
 }
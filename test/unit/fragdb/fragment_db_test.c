@@ -7,9 +7,6 @@
 #include "nat64/unit/skb_generator.h"
 #include "nat64/unit/types.h"
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
-#define GENERATE_FOR_EACH true
-#endif
 #include "stateful/fragment_db.c"
 
 
@@ -20,30 +17,61 @@ MODULE_DESCRIPTION("Fragment database test");
 
 static struct fragdb *db;
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
-
-static struct frag_hdr *get_frag_hdr(struct sk_buff *skb)
+/**
+ * Returns the number of entries in @db's expiration lists, and checks the
+ * stripes' counters agree.
+ */
+static int count_entries(void)
 {
-	return hdr_iterator_find(ipv6_hdr(skb), NEXTHDR_FRAGMENT);
+	struct fragdb_stripe *stripe;
+	struct list_head *node;
+	unsigned int s;
+	int listed = 0;
+	int counted = 0;
+
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		stripe = &db->stripes[s];
+		list_for_each(node, &stripe->expire_list)
+			listed++;
+		counted += stripe->count;
+	}
+
+	ASSERT_INT(listed, counted, "Stripe counters");
+	return listed;
 }
 
-static __u16 get_offset(struct sk_buff *skb)
+/**
+ * Returns the entry whose datagram comes from @src, or NULL.
+ */
+static struct fragdb_entry *find_entry(struct in6_addr *src)
 {
-	struct frag_hdr *hdr = get_frag_hdr(skb);
-	return hdr ? get_fragment_offset_ipv6(hdr) : 0;
+	struct fragdb_entry *entry;
+	unsigned int s;
+
+	for (s = 0; s < FRAGDB_STRIPES; s++) {
+		list_for_each_entry(entry, &db->stripes[s].expire_list,
+				list_hook) {
+			if (addr6_equals(&entry->key.src, src))
+				return entry;
+		}
+	}
+
+	return NULL;
 }
 
-static bool assert_fragdb_handle(struct sk_buff *skb, verdict expected)
+static bool __assert_fragdb_handle(struct sk_buff *skb, verdict expected,
+		struct packet *pkt, struct sk_buff **held)
 {
-	struct packet pkt;
 	int error = -EINVAL;
 
+	*held = NULL;
+
 	switch (ntohs(skb->protocol)) {
 	case ETH_P_IPV6:
-		error = pkt_init_ipv6(&pkt, skb);
+		error = pkt_init_ipv6(pkt, skb);
 		break;
 	case ETH_P_IP:
-		error = pkt_init_ipv4(&pkt, skb);
+		error = pkt_init_ipv4(pkt, skb);
 		break;
 	}
 
@@ -52,7 +80,32 @@ static bool assert_fragdb_handle(struct sk_buff *skb, verdict expected)
 		return false;
 	}
 
-	return ASSERT_INT(expected, fragdb_handle(db, &pkt), "verdict result");
+	return ASSERT_INT(expected, fragdb_handle(db, pkt, held),
+			"verdict result");
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
+
+static struct frag_hdr *get_frag_hdr(struct sk_buff *skb)
+{
+	return hdr_iterator_find(ipv6_hdr(skb), NEXTHDR_FRAGMENT);
+}
+
+static __u16 get_offset(struct sk_buff *skb)
+{
+	struct frag_hdr *hdr = get_frag_hdr(skb);
+	return hdr ? get_fragment_offset_ipv6(hdr) : 0;
+}
+
+static bool assert_fragdb_handle(struct sk_buff *skb, verdict expected)
+{
+	struct packet pkt;
+	struct sk_buff *held;
+	bool success;
+
+	success = __assert_fragdb_handle(skb, expected, &pkt, &held);
+	success &= ASSERT_PTR(NULL, held, "held fragments");
+	return success;
 }
 
 static bool validate_packet(struct sk_buff *skb, int expected_frags)
@@ -97,31 +150,9 @@ static bool validate_fragment(struct sk_buff *skb, bool has_frag_hdr,
 	return success;
 }
 
-static int fragdb_counter(struct reassembly_buffer *buffer, void *arg)
-{
-	unsigned int *int_arg = arg;
-	(*int_arg)++;
-	return 0;
-}
-
 static bool validate_database(int expected_count)
 {
-	struct list_head *node;
-	int p = 0;
-	bool success = true;
-
-	/* list */
-	list_for_each(node, &db->expire_list) {
-		p++;
-	}
-	success &= ASSERT_INT(expected_count, p, "Packets in the list");
-
-	/* table */
-	p = 0;
-	fragdb_table_for_each(&db->table, fragdb_counter, &p);
-	success &= ASSERT_INT(expected_count, p, "Packets in the hash table");
-
-	return success;
+	return ASSERT_INT(expected_count, count_entries(), "Packets in the db");
 }
 
 /**
@@ -213,20 +244,24 @@ struct frag_summary {
 	l4_protocol l4_proto;
 };
 
+/**
+ * The stripes don't keep any order between each other, so the entries are
+ * looked up by source address instead of walked.
+ */
 static bool validate_list(struct frag_summary *expected, int expected_count)
 {
-	struct reassembly_buffer *buffer;
+	struct fragdb_entry *entry;
 	struct packet *pkt;
 	struct ipv6hdr *hdr6;
 	bool success = true;
-	int c = 0;
+	int c;
 
-	list_for_each_entry(buffer, &db->expire_list, list_hook) {
-		if (!ASSERT_BOOL(true, c < expected_count, "List count (%u %u)",
-				c, expected_count))
+	for (c = 0; c < expected_count; c++) {
+		entry = find_entry(&expected[c].src_addr);
+		if (!ASSERT_BOOL(true, entry != NULL, "Entry %d exists", c))
 			return false;
 
-		pkt = &buffer->pkt;
+		pkt = &entry->pkt;
 
 		success &= ASSERT_UINT(L4PROTO_UDP, pkt_l4_proto(pkt), "proto");
 
@@ -238,8 +273,6 @@ static bool validate_list(struct frag_summary *expected, int expected_count)
 		success &= ASSERT_BE32(expected[c].identification,
 				get_frag_hdr(pkt->skb)->identification,
 				"frag id 6");
-
-		c++;
 	}
 
 	return success;
@@ -256,7 +289,8 @@ static bool test_timer(void)
 	struct sk_buff *skb;
 	struct tuple tuple1, tuple2;
 	struct frag_summary expected_keys[2];
-	struct reassembly_buffer *dummy_buffer;
+	struct fragdb_entry *entry1;
+	struct fragdb_entry *entry2;
 	bool success = true;
 	int error;
 
@@ -314,17 +348,19 @@ static bool test_timer(void)
 	success &= validate_list(&expected_keys[0], 2);
 
 	/* After 2 seconds, packet 1 should die. */
-	dummy_buffer = container_of(db->expire_list.next, struct reassembly_buffer, list_hook);
-	dummy_buffer->dying_time = jiffies - 1;
-	dummy_buffer = container_of(dummy_buffer->list_hook.next, struct reassembly_buffer, list_hook);
-	dummy_buffer->dying_time = jiffies + msecs_to_jiffies(4000);
+	entry1 = find_entry(&tuple1.src.addr6.l3);
+	entry2 = find_entry(&tuple2.src.addr6.l3);
+	if (!entry1 || !entry2)
+		return false;
+	entry1->dying_time = jiffies - 1;
+	entry2->dying_time = jiffies + msecs_to_jiffies(4000);
 
 	fragdb_clean(db);
 	success &= validate_database(1);
 	success &= validate_list(&expected_keys[1], 1);
 
 	/* After a while, packet 2 should die. */
-	dummy_buffer->dying_time = jiffies - 1;
+	entry2->dying_time = jiffies - 1;
 
 	fragdb_clean(db);
 	success &= validate_database(0);
@@ -334,11 +370,322 @@ static bool test_timer(void)
 
 #endif
 
+static bool validate_vr_database(int expected_count)
+{
+	return ASSERT_INT(expected_count, count_entries(), "Flows in the db");
+}
+
+static void kfree_skb_queue(struct sk_buff *skb)
+{
+	struct sk_buff *next;
+
+	for (; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		kfree_skb(skb);
+	}
+}
+
+/**
+ * Hands @skb to the database, and expects @expected back.
+ *
+ * On failure, releases @skb (unless the database kept it) and the held
+ * fragments, so the caller doesn't have to. On success, the caller is in
+ * charge of them.
+ */
+static bool handle_fragment(struct sk_buff *skb, verdict expected,
+		struct packet *pkt, struct sk_buff **held)
+{
+	verdict result;
+
+	*held = NULL;
+
+	if (pkt_init_ipv6(pkt, skb)) {
+		log_err("Could not init the packet.");
+		kfree_skb(skb);
+		return false;
+	}
+
+	result = fragdb_handle(db, pkt, held);
+	if (ASSERT_INT(expected, result, "verdict result"))
+		return true;
+
+	if (result != VERDICT_STOLEN)
+		kfree_skb(skb);
+	kfree_skb_queue(*held);
+	*held = NULL;
+	return false;
+}
+
+/**
+ * Virtual reassembly: fragments that arrive before the first one is filtered
+ * are held, and everyone gets the first fragment's ports.
+ *
+ * (The fragments the database still holds when this fails are released by
+ * fragdb_put().)
+ */
+static bool test_virtual(void)
+{
+	struct sk_buff *skb2, *skb3, *first;
+	struct sk_buff *held;
+	struct packet pkt;
+	struct tuple tuple6;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "1::2", 1212, "3::4", 3434, L4PROTO_UDP))
+		return false;
+
+	virtual_mode = true;
+
+	/* The second and third fragments arrive first. */
+	if (create_skb6_udp_frag(&tuple6, &skb2, 128, 384, true, true, 64, 32))
+		goto fail;
+	if (!handle_fragment(skb2, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+	success &= ASSERT_PTR(NULL, held, "held after the second fragment");
+	success &= validate_vr_database(1);
+
+	if (create_skb6_udp_frag(&tuple6, &skb3, 192, 384, true, false, 192,
+			32))
+		goto fail;
+	if (!handle_fragment(skb3, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+	success &= ASSERT_PTR(NULL, held, "held after the third fragment");
+	success &= validate_vr_database(1);
+
+	/* The first fragment releases them (in arrival order) once filtered. */
+	if (create_skb6_udp_frag(&tuple6, &first, 64 - sizeof(struct udphdr),
+			384, true, true, 0, 32))
+		goto fail;
+	if (!handle_fragment(first, VERDICT_CONTINUE, &pkt, &held))
+		goto fail;
+	success &= ASSERT_PTR(NULL, held, "held before filtering");
+	fragdb_filtered(db, &pkt, VERDICT_CONTINUE, &held);
+	kfree_skb(first);
+	success &= ASSERT_PTR(skb2, held, "first held fragment");
+	success &= ASSERT_PTR(skb3, skb2->next, "second held fragment");
+	success &= ASSERT_PTR(NULL, skb3->next, "held fragment count");
+	success &= validate_vr_database(1);
+	if (!success) {
+		kfree_skb_queue(held);
+		goto fail;
+	}
+
+	/* Once they come back, they get the ports and the flow dies. */
+	skb2->next = NULL;
+	if (!handle_fragment(skb2, VERDICT_CONTINUE, &pkt, &held)) {
+		kfree_skb(skb3);
+		goto fail;
+	}
+	kfree_skb_queue(held);
+	success &= ASSERT_UINT(1212, pkt.tuple.src.addr6.l4, "src port");
+	success &= ASSERT_UINT(3434, pkt.tuple.dst.addr6.l4, "dst port");
+	success &= validate_vr_database(1);
+	kfree_skb(skb2);
+
+	if (!handle_fragment(skb3, VERDICT_CONTINUE, &pkt, &held))
+		goto fail;
+	kfree_skb_queue(held);
+	success &= ASSERT_UINT(1212, pkt.tuple.src.addr6.l4, "src port");
+	success &= ASSERT_UINT(3434, pkt.tuple.dst.addr6.l4, "dst port");
+	success &= validate_vr_database(0);
+	kfree_skb(skb3);
+
+	virtual_mode = false;
+	return success;
+
+fail:
+	virtual_mode = false;
+	return false;
+}
+
+/**
+ * Virtual reassembly: if Filtering and Updating rejects the first fragment, the
+ * held fragments die and the later ones are dropped as well.
+ */
+static bool test_virtual_rejected(void)
+{
+	struct sk_buff *skb2, *skb3, *first;
+	struct sk_buff *held;
+	struct packet pkt;
+	struct tuple tuple6;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "1::3", 1313, "3::4", 3434, L4PROTO_UDP))
+		return false;
+
+	virtual_mode = true;
+
+	if (create_skb6_udp_frag(&tuple6, &skb2, 128, 384, true, true, 64, 32))
+		goto fail;
+	if (!handle_fragment(skb2, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+
+	if (create_skb6_udp_frag(&tuple6, &first, 64 - sizeof(struct udphdr),
+			384, true, true, 0, 32))
+		goto fail;
+	if (!handle_fragment(first, VERDICT_CONTINUE, &pkt, &held))
+		goto fail;
+	fragdb_filtered(db, &pkt, VERDICT_DROP, &held);
+	kfree_skb(first);
+	success &= ASSERT_PTR(NULL, held, "held after rejection");
+	success &= validate_vr_database(1);
+
+	if (create_skb6_udp_frag(&tuple6, &skb3, 192, 384, true, false, 192,
+			32))
+		goto fail;
+	if (!handle_fragment(skb3, VERDICT_DROP, &pkt, &held))
+		goto fail;
+	kfree_skb(skb3);
+	success &= validate_vr_database(0);
+
+	virtual_mode = false;
+	return success;
+
+fail:
+	virtual_mode = false;
+	return false;
+}
+
+/**
+ * Virtual reassembly: ICMP fragments are held until the datagram is complete,
+ * and then come back as a single packet, sorted.
+ */
+static bool test_virtual_icmp(void)
+{
+	struct sk_buff *skb2, *skb3, *first;
+	struct sk_buff *held;
+	struct packet pkt;
+	struct tuple tuple6;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "1::4", 1414, "3::4", 1414, L4PROTO_ICMP))
+		return false;
+
+	virtual_mode = true;
+
+	if (create_skb6_icmp_info_frag(&tuple6, &skb2, 128, 384, true, true,
+			64, 32))
+		goto fail;
+	if (!handle_fragment(skb2, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+	success &= ASSERT_PTR(NULL, held, "held after the second fragment");
+
+	if (create_skb6_icmp_info_frag(&tuple6, &first,
+			64 - sizeof(struct icmp6hdr), 384, true, true, 0, 32))
+		goto fail;
+	if (!handle_fragment(first, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+	success &= ASSERT_PTR(NULL, held, "held after the first fragment");
+
+	/* An overlapping duplicate. */
+	if (create_skb6_icmp_info_frag(&tuple6, &skb3, 128, 384, true, true,
+			128, 32))
+		goto fail;
+	if (!handle_fragment(skb3, VERDICT_DROP, &pkt, &held))
+		goto fail;
+	kfree_skb(skb3);
+
+	if (create_skb6_icmp_info_frag(&tuple6, &skb3, 192, 384, true, false,
+			192, 32))
+		goto fail;
+	if (!handle_fragment(skb3, VERDICT_STOLEN, &pkt, &held))
+		goto fail;
+
+	success &= ASSERT_PTR(first, held, "reassembled packet");
+	success &= ASSERT_PTR(NULL, first->next, "reassembled packet count");
+	success &= ASSERT_PTR(skb2, skb_shinfo(first)->frag_list,
+			"second fragment");
+	success &= ASSERT_PTR(skb3, skb2->next, "third fragment");
+	success &= ASSERT_UINT(40 + 8 + 384, first->len, "reassembled length");
+	success &= ASSERT_UINT(first->len - 40,
+			be16_to_cpu(ipv6_hdr(first)->payload_len),
+			"payload length");
+	success &= ASSERT_BOOL(false, is_fragmented_ipv6(hdr_iterator_find(
+			ipv6_hdr(first), NEXTHDR_FRAGMENT)),
+			"fragment header is atomic");
+	success &= validate_vr_database(0);
+	kfree_skb(first);
+
+	virtual_mode = false;
+	return success;
+
+fail:
+	virtual_mode = false;
+	return false;
+}
+
+/**
+ * Once the memory limit is reached, an older datagram makes room for the new
+ * one.
+ */
+static bool test_memory_limit(void)
+{
+	struct tuple tuples[3];
+	struct sk_buff *skbs[3];
+	struct sk_buff *held;
+	struct packet pkt;
+	struct fragdb_stats_usr stats;
+	struct fragdb_entry *entry;
+	unsigned int old_max;
+	unsigned int i;
+	bool success = true;
+	int error;
+
+	error = init_tuple6(&tuples[0], "1::1", 1111, "3::4", 3434, L4PROTO_UDP);
+	error |= init_tuple6(&tuples[1], "1::2", 1212, "3::4", 3434, L4PROTO_UDP);
+	error |= init_tuple6(&tuples[2], "1::3", 1313, "3::4", 3434, L4PROTO_UDP);
+	if (error)
+		return false;
+	for (i = 0; i < 3; i++) {
+		error = create_skb6_udp_frag(&tuples[i], &skbs[i], 128, 384,
+				true, true, 64, 32);
+		if (error)
+			goto fail;
+	}
+
+	virtual_mode = true;
+	old_max = db->max_bytes;
+	/* Room for two held fragments (and their entries), but not three. */
+	db->max_bytes = 2 * (sizeof(struct fragdb_entry) + skbs[0]->truesize);
+
+	for (i = 0; i < 3; i++) {
+		success &= handle_fragment(skbs[i], VERDICT_STOLEN, &pkt, &held);
+		kfree_skb_queue(held);
+	}
+
+	fragdb_stats(db, &stats);
+	success &= ASSERT_U64(2ULL, stats.entries, "entries");
+	success &= ASSERT_U64(1ULL, stats.evictions, "evictions");
+	success &= ASSERT_BOOL(true, stats.bytes <= db->max_bytes, "bytes");
+	/* (Which of the older two dies depends on the stripes they landed in.) */
+	success &= ASSERT_BOOL(true, !!find_entry(&tuples[2].src.addr6.l3),
+			"the newest datagram survived");
+
+	/* Let the timer release the rest. */
+	for (i = 0; i < 3; i++) {
+		entry = find_entry(&tuples[i].src.addr6.l3);
+		if (entry)
+			entry->dying_time = jiffies - 1;
+	}
+	fragdb_clean(db);
+	success &= validate_vr_database(0);
+
+	db->max_bytes = old_max;
+	virtual_mode = false;
+	return success;
+
+fail:
+	while (i-- > 0)
+		kfree_skb(skbs[i]);
+	return false;
+}
+
 int init_module(void)
 {
 	START_TESTS("Fragment database");
 
-	if (fragdb_init())
+	if (fragdb_init(false))
 		return -EINVAL;
 	db = fragdb_create();
 	if (!db) {
@@ -351,6 +698,10 @@ int init_module(void)
 	CALL_TEST(test_happy_path(), "Happy defragmentation.");
 	CALL_TEST(test_timer(), "Timer test.");
 #endif
+	CALL_TEST(test_virtual(), "Virtual reassembly.");
+	CALL_TEST(test_virtual_rejected(), "Virtual reassembly, rejected.");
+	CALL_TEST(test_virtual_icmp(), "Virtual reassembly, ICMP.");
+	CALL_TEST(test_memory_limit(), "Memory limit.");
 
 	fragdb_put(db);
 	fragdb_destroy();
@@ -0,0 +1,391 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Unit tests for the NAT64 hairpinning shortcut");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/types.h"
+#include "nat64/unit/unit_test.h"
+#include "nat64/unit/skb_generator.h"
+#include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/rfc6145/core.h"
+#include "nat64/mod/stateful/bib/db.h"
+#include "nat64/mod/stateful/pool4/rfc6056.h"
+#include "stateful/handling_hairpinning.c"
+
+/*
+ * Node A (2001:db8::1#5000) talks to node B (2001:db8::2#6000) through B's
+ * IPv4 mask. Both masks are static, so every run translates A's packet into
+ * the same thing, and the two ways of hairpinning can be compared.
+ */
+
+#define MAX_SESSIONS 4
+
+/** What a hairpinning attempt left behind. */
+struct hairpin_result {
+	verdict status;
+	/** The final IPv6 packet, if one was produced. */
+	struct sk_buff *skb;
+	/** Number of ICMP errors that were sent. */
+	int icmp;
+
+	struct session_entry sessions[MAX_SESSIONS];
+	unsigned int session_count;
+	unsigned int bib_count;
+};
+
+static struct xlator jool;
+/** The packet handling_hairpinning() handed over to sendpkt_send(). */
+static struct sk_buff *sent;
+
+verdict sendpkt_send(struct xlation *state)
+{
+	log_debug("Pretending I'm sending a packet.");
+	sent = state->out.skb;
+	return VERDICT_CONTINUE;
+}
+
+static int add_static_bib(char *addr6, u16 port6, char *addr4, u16 port4,
+		l4_protocol proto)
+{
+	struct bib_entry bib;
+	int error;
+
+	error = str_to_addr6(addr6, &bib.ipv6.l3);
+	if (error)
+		return error;
+	bib.ipv6.l4 = port6;
+	error = str_to_addr4(addr4, &bib.ipv4.l3);
+	if (error)
+		return error;
+	bib.ipv4.l4 = port4;
+	bib.l4_proto = proto;
+
+	return bib_add_static(jool.nat64.bib, &bib, NULL);
+}
+
+static bool init(l4_protocol proto, bool in_place)
+{
+	struct ipv6_prefix prefix6;
+	struct ipv4_range range;
+
+	if (bib_init(1))
+		return false;
+	if (rfc6056_init())
+		goto fail2;
+
+	if (xlator_init())
+		goto fail3;
+	if (xlator_add(&jool))
+		goto fail4;
+	jool.global->cfg.xlat_in_place = in_place;
+
+	if (str_to_addr6("64:ff9b::", &prefix6.address))
+		goto fail5;
+	prefix6.len = 96;
+	if (pool6_add(jool.pool6, &prefix6))
+		goto fail5;
+
+	if (str_to_addr4("192.0.2.1", &range.prefix.address))
+		goto fail5;
+	range.prefix.len = 32;
+	range.ports.min = 1000;
+	range.ports.max = 1010;
+	if (pool4db_add(jool.nat64.pool4, 0, proto, &range))
+		goto fail5;
+
+	if (add_static_bib("2001:db8::1", 5000, "192.0.2.1", 1001, proto))
+		goto fail5;
+	if (add_static_bib("2001:db8::2", 6000, "192.0.2.1", 1002, proto))
+		goto fail5;
+
+	return true;
+
+fail5:
+	xlator_put(&jool);
+fail4:
+	xlator_destroy();
+fail3:
+	rfc6056_destroy();
+fail2:
+	bib_destroy();
+	return false;
+}
+
+static void end(void)
+{
+	icmp64_pop();
+	xlator_put(&jool);
+	xlator_destroy();
+	rfc6056_destroy();
+	bib_destroy();
+}
+
+static int collect_bib(struct bib_entry *bib, bool is_static, void *arg)
+{
+	struct hairpin_result *result = arg;
+	result->bib_count++;
+	return 0;
+}
+
+static int collect_session(struct session_entry *session, void *arg)
+{
+	struct hairpin_result *result = arg;
+
+	if (result->session_count >= MAX_SESSIONS)
+		return -ENOSPC;
+	result->sessions[result->session_count++] = *session;
+	return 0;
+}
+
+static bool collect_tables(l4_protocol proto, struct hairpin_result *result)
+{
+	struct bib_foreach_func bib_func = {
+			.cb = collect_bib,
+			.arg = result,
+	};
+	struct session_foreach_func session_func = {
+			.cb = collect_session,
+			.arg = result,
+	};
+	bool success = true;
+
+	result->bib_count = 0;
+	result->session_count = 0;
+	success &= ASSERT_INT(0, bib_foreach(jool.nat64.bib, proto, &bib_func,
+			NULL), "BIB foreach");
+	success &= ASSERT_INT(0, bib_foreach_session(jool.nat64.bib, proto,
+			&session_func, NULL), "session foreach");
+	return success;
+}
+
+/**
+ * Sends A's packet to B through an instance that hairpins @shortcut-ly, and
+ * stores the outcome in @result.
+ */
+static bool hairpin(l4_protocol proto, bool shortcut, bool in_place,
+		u8 hop_limit, struct hairpin_result *result)
+{
+	struct xlation state;
+	struct sk_buff *skb;
+	bool success = true;
+	int error;
+
+	memset(result, 0, sizeof(*result));
+	if (!init(proto, in_place))
+		return false;
+
+	xlation_init(&state);
+	state.jool = jool;
+	if (init_tuple6(&state.in.tuple, "2001:db8::1", 5000,
+			"64:ff9b::192.0.2.1", 1002, proto))
+		goto fail;
+	error = (proto == L4PROTO_TCP)
+			? create_skb6_tcp(&state.in.tuple, &skb, 100, hop_limit)
+			: create_skb6_udp(&state.in.tuple, &skb, 100, hop_limit);
+	if (error)
+		goto fail;
+	if (pkt_init_ipv6(&state.in, skb))
+		goto fail_skb;
+
+	success &= ASSERT_INT(VERDICT_CONTINUE, filtering_and_updating(&state),
+			"6-to-4 filtering");
+	success &= ASSERT_INT(VERDICT_CONTINUE, compute_out_tuple(&state),
+			"6-to-4 outgoing tuple");
+	success &= ASSERT_BOOL(true, is_hairpin(&state), "is hairpin");
+	if (!success)
+		goto fail_skb;
+
+	if (shortcut) {
+		success &= ASSERT_BOOL(true, hairpin_shortcut_possible(&state),
+				"shortcut possible");
+		result->status = hairpin_shortcut(&state);
+		if (result->status == VERDICT_CONTINUE)
+			result->skb = state.out.skb;
+	} else {
+		sent = NULL;
+		result->status = translating_the_packet(&state);
+		if (result->status == VERDICT_CONTINUE) {
+			result->status = handling_hairpinning(&state);
+			/* The intermediate IPv4 packet. */
+			kfree_skb(state.out.skb);
+			result->skb = sent;
+		}
+	}
+
+	if (result->skb != skb)
+		kfree_skb(skb);
+	result->icmp = icmp64_pop();
+	success &= collect_tables(proto, result);
+	end();
+	return success;
+
+fail_skb:
+	kfree_skb(skb);
+fail:
+	end();
+	return false;
+}
+
+static bool compare_packets(struct sk_buff *expected, struct sk_buff *actual)
+{
+	unsigned int len;
+	bool success = true;
+
+	success &= ASSERT_BOOL(false, skb_is_nonlinear(expected),
+			"expected is linear");
+	success &= ASSERT_BOOL(false, skb_is_nonlinear(actual),
+			"actual is linear");
+	if (!success)
+		return false;
+
+	len = skb_tail_pointer(expected) - skb_network_header(expected);
+	success &= ASSERT_UINT(len, skb_tail_pointer(actual)
+			- skb_network_header(actual), "packet length");
+	if (!success)
+		return false;
+
+	/* Headers (checksums included) and payload. */
+	return ASSERT_INT(0, memcmp(skb_network_header(expected),
+			skb_network_header(actual), len), "packet contents");
+}
+
+static bool find_session(struct hairpin_result *result,
+		struct session_entry *expected)
+{
+	struct session_entry *session;
+	unsigned int i;
+	bool success = true;
+
+	for (i = 0; i < result->session_count; i++) {
+		session = &result->sessions[i];
+		if (!session_equals(expected, session))
+			continue;
+
+		success &= ASSERT_UINT(expected->state, session->state,
+				"session state");
+		success &= ASSERT_UINT(expected->timer_type,
+				session->timer_type, "session timer");
+		success &= ASSERT_ULONG(expected->timeout, session->timeout,
+				"session timeout");
+		return success;
+	}
+
+	return ASSERT_BOOL(true, false, "session found");
+}
+
+static bool compare_results(struct hairpin_result *expected,
+		struct hairpin_result *actual)
+{
+	unsigned int i;
+	bool success = true;
+
+	success &= ASSERT_INT(expected->status, actual->status, "verdict");
+	success &= ASSERT_INT(expected->icmp, actual->icmp, "ICMP errors");
+	success &= ASSERT_UINT(expected->bib_count, actual->bib_count,
+			"BIB count");
+	success &= ASSERT_UINT(expected->session_count, actual->session_count,
+			"session count");
+	for (i = 0; i < expected->session_count; i++)
+		success &= find_session(actual, &expected->sessions[i]);
+
+	if (expected->skb && actual->skb)
+		success &= compare_packets(expected->skb, actual->skb);
+	else
+		success &= ASSERT_BOOL(!!expected->skb, !!actual->skb,
+				"packet produced");
+
+	return success;
+}
+
+static void release(struct hairpin_result *result)
+{
+	if (result->skb)
+		kfree_skb(result->skb);
+}
+
+/**
+ * Hairpins the same packet through handling_hairpinning() and
+ * hairpin_shortcut() (both copying and in place), and expects the same
+ * packet and tables out of all of them.
+ */
+static bool test_same_result(l4_protocol proto, u8 hop_limit,
+		verdict expected_verdict, int expected_icmp)
+{
+	struct hairpin_result two_pass;
+	struct hairpin_result copy;
+	struct hairpin_result in_place;
+	bool success = true;
+
+	if (!hairpin(proto, false, false, hop_limit, &two_pass))
+		return false;
+	success &= ASSERT_INT(expected_verdict, two_pass.status,
+			"two-pass verdict");
+	success &= ASSERT_INT(expected_icmp, two_pass.icmp,
+			"two-pass ICMP errors");
+
+	if (hairpin(proto, true, false, hop_limit, &copy)) {
+		success &= compare_results(&two_pass, &copy);
+		release(&copy);
+	} else {
+		success = false;
+	}
+
+	if (hairpin(proto, true, true, hop_limit, &in_place)) {
+		success &= compare_results(&two_pass, &in_place);
+		release(&in_place);
+	} else {
+		success = false;
+	}
+
+	release(&two_pass);
+	return success;
+}
+
+static bool test_udp(void)
+{
+	return test_same_result(L4PROTO_UDP, 64, VERDICT_CONTINUE, 0);
+}
+
+static bool test_tcp(void)
+{
+	return test_same_result(L4PROTO_TCP, 64, VERDICT_CONTINUE, 0);
+}
+
+/**
+ * Hop limit 2 survives the first translation, but not the second one. Either
+ * way, icmp64_send() answers the original IPv6 packet, so A gets an ICMPv6
+ * Time Exceeded from both paths.
+ */
+static bool test_hop_limit_2(void)
+{
+	return test_same_result(L4PROTO_UDP, 2, VERDICT_DROP, 1);
+}
+
+/** Hop limit 1 does not even survive the first translation. */
+static bool test_hop_limit_1(void)
+{
+	return test_same_result(L4PROTO_UDP, 1, VERDICT_DROP, 1);
+}
+
+static int hairpin_test_init(void)
+{
+	START_TESTS("Hairpinning");
+
+	CALL_TEST(test_udp(), "UDP");
+	CALL_TEST(test_tcp(), "TCP");
+	CALL_TEST(test_hop_limit_2(), "Hop limit 2");
+	CALL_TEST(test_hop_limit_1(), "Hop limit 1");
+
+	END_TESTS;
+}
+
+static void hairpin_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(hairpin_test_init);
+module_exit(hairpin_test_exit);
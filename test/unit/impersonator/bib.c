@@ -7,8 +7,8 @@ struct fake_pktqueue {
 } dummy;
 
 int mask_domain_next(struct mask_domain *masks,
-		struct ipv4_transport_addr *addr,
-		bool *consecutive)
+		struct ipv4_transport_addr *first,
+		__u16 *last)
 {
 	return broken_unit_call(__func__);
 }
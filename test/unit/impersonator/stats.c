@@ -14,3 +14,34 @@ void inc_stats_skb4(struct sk_buff *skb, int field)
 {
 	/* No code. */
 }
+
+struct jool_stats {
+	int junk;
+};
+
+static struct jool_stats dummy;
+
+struct jool_stats *jstat_create(void)
+{
+	return &dummy;
+}
+
+void jstat_get(struct jool_stats *stats)
+{
+	/* No code. */
+}
+
+void jstat_put(struct jool_stats *stats)
+{
+	/* No code. */
+}
+
+void jstat_inc(struct jool_stats *stats, enum jool_stat_id id)
+{
+	/* No code. */
+}
+
+void jstat_query(struct jool_stats *stats, __u64 *result)
+{
+	memset(result, 0, JSTAT_COUNT * sizeof(*result));
+}
@@ -128,6 +128,31 @@ static bool krefs_test(int ns_kref)
 	return success;
 }
 
+/**
+ * The packet path's lookup should not touch the refcounters at all.
+ */
+static bool rcu_test(struct net *ns, int ns_kref)
+{
+	struct xlator jool;
+	int error;
+	bool success = true;
+
+	rcu_read_lock_bh();
+
+	error = xlator_find_rcu(ns, &jool);
+	if (error) {
+		rcu_read_unlock_bh();
+		log_info("xlator_find_rcu() threw %d", error);
+		return false;
+	}
+
+	success &= ASSERT_INT(ns_kref, atomic_read(&jool.ns->count), "ns kref");
+	success &= ASSERT_INT(1, atomic_read(&jool.pool6->refcount.refcount), "pool6 kref");
+
+	rcu_read_unlock_bh();
+	return success;
+}
+
 /**
  * Test the previous test handled krefs correctly. Assumes the xlator has been
  * deinitialized.
@@ -219,6 +244,7 @@ int init_module(void)
 	CALL_TEST(krefs_test(old + 1), "kfref checks 1");
 	CALL_TEST(atomic_test(), "atomic config API");
 	CALL_TEST(krefs_test(old + 1), "kfref checks 2");
+	CALL_TEST(rcu_test(ns, old + 1), "RCU lookup");
 	CALL_TEST(destroy(), "destroy");
 	CALL_TEST(ns_only_krefs_test(old, ns), "kfref checks 3");
 
@@ -2,7 +2,6 @@
 #include <linux/kernel.h> /* Needed for KERN_INFO */
 #include <linux/init.h> /* Needed for the macros */
 #include <linux/printk.h> /* pr_* */
-#include <linux/time.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("dhernandez");
@@ -13,54 +12,84 @@ MODULE_DESCRIPTION("Unit tests for the log_time_module");
 #include "nat64/unit/unit_test.h"
 #include "common/log_time.c"
 
-static bool init(void)
+static bool test_buckets(void)
 {
-	int error;
+	bool success = true;
+
+	/* Small durations get a bucket each. */
+	success &= ASSERT_UINT(0, logtime_bucket(0), "0");
+	success &= ASSERT_UINT(7, logtime_bucket(7), "7");
+	success &= ASSERT_UINT(8, logtime_bucket(8), "8");
+	success &= ASSERT_UINT(15, logtime_bucket(15), "15");
+
+	/* From then on, each power of two is split in eight. */
+	success &= ASSERT_UINT(16, logtime_bucket(16), "16");
+	success &= ASSERT_UINT(16, logtime_bucket(17), "17");
+	success &= ASSERT_UINT(17, logtime_bucket(18), "18");
+	success &= ASSERT_UINT(23, logtime_bucket(31), "31");
+	success &= ASSERT_UINT(24, logtime_bucket(32), "32");
+	success &= ASSERT_UINT(24, logtime_bucket(35), "35");
+	success &= ASSERT_UINT(25, logtime_bucket(36), "36");
+
+	/* The last bucket swallows everything else. */
+	success &= ASSERT_UINT(LOGTIME_BUCKETS - 8,
+			logtime_bucket(1ULL << (LOGTIME_MAX_BITS - 1)),
+			"2^(max - 1)");
+	success &= ASSERT_UINT(LOGTIME_BUCKETS - 1,
+			logtime_bucket((1ULL << LOGTIME_MAX_BITS) - 1),
+			"2^max - 1");
+	success &= ASSERT_UINT(LOGTIME_BUCKETS - 1,
+			logtime_bucket(1ULL << LOGTIME_MAX_BITS), "2^max");
+	success &= ASSERT_UINT(LOGTIME_BUCKETS - 1,
+			logtime_bucket(U64_MAX), "u64 max");
+
+	return success;
+}
 
-	error = logtime_init();
-	if (error)
-		goto fail;
+static u64 count_samples(enum logtime_stage stage)
+{
+	struct logtime_usr histogram;
+	u64 total = 0;
+	unsigned int i;
 
-	return true;
+	logtime_query(stage, &histogram);
+	for (i = 0; i < LOGTIME_BUCKETS; i++)
+		total += histogram.buckets[i];
 
-fail:
-	return false;
+	return total;
 }
 
-static void end(void)
+static bool test_record(void)
 {
-	logtime_destroy();
-}
+	bool success = true;
 
-static bool simple_substraction(void)
-{
-	bool result = true;
-	struct timespec start;
-	struct timespec end;
-	struct log_node *node;
-
-	logtime_create_node(&node);
-	if (!node)
-		return false;
-
-	start.tv_sec = 1L;
-	start.tv_nsec = 999999999L;
-	end.tv_sec = 2L;
-	end.tv_nsec = 0L;
-
-	subtract_timespec(&start, &end, node);
-	result &= ASSERT_U64(0ULL, node->time.tv_sec, "node tv_sec");
-	result &= ASSERT_U64(1ULL, node->time.tv_nsec, "node tv_nsec");
-
-	logtime_delete_node(node);
-	return result;
+	logtime_flush();
+
+	logtime_record(LOGTIME_TRANSLATE, ktime_to_ns(ktime_get()));
+	logtime_record(LOGTIME_TRANSLATE, ktime_to_ns(ktime_get()));
+	logtime_record(LOGTIME_SEND, ktime_to_ns(ktime_get()));
+
+	success &= ASSERT_U64(0ULL, count_samples(LOGTIME_FILTERING),
+			"filtering");
+	success &= ASSERT_U64(2ULL, count_samples(LOGTIME_TRANSLATE),
+			"translate");
+	success &= ASSERT_U64(1ULL, count_samples(LOGTIME_SEND), "send");
+
+	logtime_flush();
+	success &= ASSERT_U64(0ULL, count_samples(LOGTIME_TRANSLATE),
+			"flushed translate");
+	success &= ASSERT_U64(0ULL, count_samples(LOGTIME_SEND),
+			"flushed send");
+
+	return success;
 }
 
 static int logtime_test_init(void)
 {
 	START_TESTS("Log time test");
 
-	INIT_CALL_END(init(), simple_substraction(), end(), "test_log_time substraction 1");
+	CALL_TEST(test_buckets(), "Bucket indexes");
+	CALL_TEST(test_record(), "Record, query and flush");
 
 	END_TESTS;
 }
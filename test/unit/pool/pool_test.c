@@ -0,0 +1,161 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Unit tests for the IPv4 address pools");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/types.h"
+#include "nat64/unit/unit_test.h"
+#include "stateless/pool.c"
+
+static struct addr4_pool *pool;
+
+static int init_prefix(char *addr, __u8 len, struct ipv4_prefix *prefix)
+{
+	prefix->len = len;
+	return str_to_addr4(addr, &prefix->address);
+}
+
+static bool add(char *addr, __u8 len)
+{
+	struct ipv4_prefix prefix;
+
+	if (init_prefix(addr, len, &prefix))
+		return false;
+	return ASSERT_INT(0, pool_add(pool, &prefix, true), "add %s/%u",
+			addr, len);
+}
+
+static bool rm(char *addr, __u8 len, int expected)
+{
+	struct ipv4_prefix prefix;
+
+	if (init_prefix(addr, len, &prefix))
+		return false;
+	return ASSERT_INT(expected, pool_rm(pool, &prefix), "rm %s/%u",
+			addr, len);
+}
+
+static bool assert_contains(char *addr, bool expected)
+{
+	struct in_addr addr4;
+
+	if (str_to_addr4(addr, &addr4))
+		return false;
+	return ASSERT_BOOL(expected, pool_contains(pool, &addr4),
+			"contains %s", addr);
+}
+
+static bool assert_count(__u64 expected)
+{
+	__u64 count;
+	bool success = true;
+
+	success &= ASSERT_INT(0, pool_count(pool, &count), "count result");
+	success &= ASSERT_U64(expected, count, "address count");
+	success &= ASSERT_BOOL(expected == 0, pool_is_empty(pool), "empty");
+	return success;
+}
+
+/**
+ * Removing a prefix must not take the prefixes it overlaps with along. (Their
+ * trie leaves can share nodes.)
+ */
+static bool test_overlapping(void)
+{
+	bool success = true;
+
+	success &= add("192.0.2.0", 24);
+	success &= add("192.0.2.128", 25);
+	success &= add("192.0.2.130", 32);
+	if (!success)
+		return false;
+
+	success &= assert_count(256 + 128 + 1);
+	success &= assert_contains("192.0.2.1", true);
+	success &= assert_contains("192.0.2.200", true);
+	success &= assert_contains("192.0.3.0", false);
+
+	/* Only exact matches are removed. */
+	success &= rm("192.0.2.192", 26, -ESRCH);
+	success &= rm("192.0.2.0", 23, -ESRCH);
+
+	success &= rm("192.0.2.128", 25, 0);
+	success &= assert_count(256 + 1);
+	success &= assert_contains("192.0.2.200", true);
+	success &= assert_contains("192.0.2.130", true);
+
+	success &= rm("192.0.2.0", 24, 0);
+	success &= assert_count(1);
+	success &= assert_contains("192.0.2.1", false);
+	success &= assert_contains("192.0.2.200", false);
+	success &= assert_contains("192.0.2.130", true);
+
+	success &= rm("192.0.2.130", 32, 0);
+	success &= assert_count(0);
+	success &= assert_contains("192.0.2.130", false);
+
+	return success;
+}
+
+/**
+ * The pool tolerates duplicates, but the trie holds one leaf per prefix. The
+ * leaf must survive until the last copy is gone.
+ */
+static bool test_duplicates(void)
+{
+	bool success = true;
+
+	success &= add("198.51.100.0", 24);
+	success &= add("203.0.113.0", 24);
+	success &= add("198.51.100.0", 24);
+	if (!success)
+		return false;
+
+	success &= assert_count(3 * 256);
+	success &= assert_contains("198.51.100.7", true);
+
+	success &= rm("198.51.100.0", 24, 0);
+	success &= assert_count(2 * 256);
+	success &= assert_contains("198.51.100.7", true);
+
+	success &= rm("198.51.100.0", 24, 0);
+	success &= assert_count(256);
+	success &= assert_contains("198.51.100.7", false);
+	success &= assert_contains("203.0.113.7", true);
+
+	success &= rm("198.51.100.0", 24, -ESRCH);
+	success &= assert_count(256);
+
+	return success;
+}
+
+static bool init(void)
+{
+	return pool_init(&pool) ? false : true;
+}
+
+static void end(void)
+{
+	pool_put(pool);
+}
+
+static int pool_test_init(void)
+{
+	START_TESTS("IPv4 Pool");
+
+	INIT_CALL_END(init(), test_overlapping(), end(), "Overlapping prefixes");
+	INIT_CALL_END(init(), test_duplicates(), end(), "Duplicate prefixes");
+
+	END_TESTS;
+}
+
+static void pool_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(pool_test_init);
+module_exit(pool_test_exit);
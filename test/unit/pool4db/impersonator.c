@@ -1,7 +1,11 @@
 #include "nat64/mod/stateful/pool4/rfc6056.h"
 #include "nat64/unit/unit_test.h"
 
+/* The tests set this to choose the mask domains' starting point. */
+unsigned int rfc6056_result;
+
 int rfc6056_f(const struct tuple *tuple6, __u8 fields, unsigned int *result)
 {
-	return broken_unit_call(__func__);
+	*result = rfc6056_result;
+	return 0;
 }
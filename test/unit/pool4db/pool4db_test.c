@@ -514,6 +514,66 @@ static bool test_flush(void)
 	return success;
 }
 
+extern unsigned int rfc6056_result;
+
+static bool assert_first_mask(unsigned int offset, __u32 addr, __u16 port,
+		__u16 last)
+{
+	struct tuple tuple6 = { .l4_proto = L4PROTO_TCP };
+	struct route4_args args = { .mark = 1 };
+	struct mask_domain masks;
+	struct ipv4_transport_addr mask;
+	__u16 max;
+	unsigned int total;
+	bool success = true;
+
+	rfc6056_result = offset;
+	if (!ASSERT_INT(0, mask_domain_find(pool, &tuple6, 0, &args, &masks),
+			"find (offset %u)", offset))
+		return false;
+
+	success &= ASSERT_INT(0, mask_domain_next(&masks, &mask, &max),
+			"first run");
+	success &= ASSERT_BE32(addr, mask.l3.s_addr, "first addr (%u)", offset);
+	success &= ASSERT_UINT(port, mask.l4, "first port (%u)", offset);
+	success &= ASSERT_UINT(last, max, "first run's end (%u)", offset);
+
+	/* The rest of the runs have to add up to the rest of the domain. */
+	total = max - mask.l4 + 1;
+	while (!mask_domain_next(&masks, &mask, &max))
+		total += max - mask.l4 + 1;
+	success &= ASSERT_UINT(16, total, "mask count (%u)", offset);
+
+	mask_domain_put(&masks);
+	return success;
+}
+
+static bool test_mask_domain(void)
+{
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+
+	/*
+	 * The domain is (in order)
+	 * 192.0.2.0 6-7, 192.0.2.1 6-7, 192.0.2.16 15-19, 192.0.2.16 22-23,
+	 * 192.0.2.17 19, 192.0.2.32-35 1.
+	 */
+	success &= assert_first_mask(0, 0xc0000200U, 6, 7);
+	success &= assert_first_mask(1, 0xc0000200U, 7, 7);
+	success &= assert_first_mask(2, 0xc0000201U, 6, 7);
+	success &= assert_first_mask(4, 0xc0000210U, 15, 19);
+	success &= assert_first_mask(8, 0xc0000210U, 19, 19);
+	success &= assert_first_mask(9, 0xc0000210U, 22, 23);
+	success &= assert_first_mask(11, 0xc0000211U, 19, 19);
+	success &= assert_first_mask(12, 0xc0000220U, 1, 1);
+	success &= assert_first_mask(15, 0xc0000223U, 1, 1);
+	success &= assert_first_mask(16 + 5, 0xc0000210U, 16, 19);
+
+	return success;
+}
+
 static bool init(void)
 {
 	int error;
@@ -553,6 +613,7 @@ int init_module(void)
 	INIT_CALL_END(init(), test_add(), destroy(), "Add");
 	INIT_CALL_END(init(), test_rm(), destroy(), "Rm");
 	INIT_CALL_END(init(), test_flush(), destroy(), "Flush");
+	INIT_CALL_END(init(), test_mask_domain(), destroy(), "Mask domain");
 
 	END_TESTS;
 }
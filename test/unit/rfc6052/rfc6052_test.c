@@ -69,11 +69,117 @@ static bool test_rfc6052_table(void)
 	return success;
 }
 
+static int add_prefix(struct pool6 *pool, char *addr, __u8 len)
+{
+	struct ipv6_prefix prefix;
+
+	if (str_to_addr6(addr, &prefix.address))
+		return -EINVAL;
+	prefix.len = len;
+
+	return pool6_add(pool, &prefix);
+}
+
+static int rm_prefix(struct pool6 *pool, char *addr, __u8 len)
+{
+	struct ipv6_prefix prefix;
+
+	if (str_to_addr6(addr, &prefix.address))
+		return -EINVAL;
+	prefix.len = len;
+
+	return pool6_rm(pool, &prefix);
+}
+
+static bool test_6to4(struct pool6 *pool, char *addr6_str, char *addr4_str)
+{
+	struct in6_addr addr6;
+	struct in_addr addr4;
+	bool success = true;
+
+	if (str_to_addr6(addr6_str, &addr6))
+		return false;
+
+	if (addr4_str) {
+		success &= ASSERT_INT(0, rfc6052_6to4(pool, &addr6, &addr4),
+				"6to4 result code of %s", addr6_str);
+		success &= ASSERT_ADDR4(addr4_str, &addr4, addr6_str);
+	} else {
+		success &= ASSERT_INT(-ESRCH, rfc6052_6to4(pool, &addr6, &addr4),
+				"6to4 result code of %s", addr6_str);
+	}
+
+	return success;
+}
+
+static bool test_4to6(struct pool6 *pool, char *addr4_str, char *addr6_str)
+{
+	struct in_addr addr4;
+	struct in6_addr addr6;
+	bool success = true;
+
+	if (str_to_addr4(addr4_str, &addr4))
+		return false;
+
+	success &= ASSERT_INT(0, rfc6052_4to6(pool, &addr4, &addr6),
+			"4to6 result code of %s", addr4_str);
+	success &= ASSERT_ADDR6(addr6_str, &addr6, addr4_str);
+	return success;
+}
+
+/**
+ * Several prefixes, some of them nested. The most specific one has to win, and
+ * 4to6 has to default to the first one.
+ */
+static bool test_pool(void)
+{
+	struct pool6 *pool;
+	bool success = true;
+
+	if (pool6_init(&pool))
+		return false;
+
+	success &= ASSERT_INT(0, add_prefix(pool, "64:ff9b::", 96), "add /96");
+	success &= ASSERT_INT(0, add_prefix(pool, "2001:db8::", 32), "add /32");
+	success &= ASSERT_INT(0, add_prefix(pool, "2001:db8:122:300::", 56),
+			"add /56");
+	success &= ASSERT_INT(0, add_prefix(pool, "2001:db8:122:344::", 64),
+			"add /64");
+	if (!success)
+		goto end;
+	success &= ASSERT_INT(-EEXIST, add_prefix(pool, "2001:db8::", 32),
+			"add /32 again");
+
+	success &= test_6to4(pool, "64:ff9b::192.0.2.33", "192.0.2.33");
+	success &= test_6to4(pool, "2001:db8:c000:221::", "192.0.2.33");
+	success &= test_6to4(pool, "2001:db8:122:3c0:0:221::", "192.0.2.33");
+	success &= test_6to4(pool, "2001:db8:122:344:c0:2:2100::",
+			"192.0.2.33");
+	success &= test_6to4(pool, "2001:db9::", NULL);
+	success &= test_4to6(pool, "192.0.2.33", "64:ff9b::192.0.2.33");
+
+	/* Removing the most specific prefix exposes the one above it. */
+	success &= ASSERT_INT(0, rm_prefix(pool, "2001:db8:122:344::", 64),
+			"rm /64");
+	success &= test_6to4(pool, "2001:db8:122:344:c0:2:2100::",
+			"68.192.0.2");
+
+	/* Removing the first prefix makes the next one the default. */
+	success &= ASSERT_INT(0, rm_prefix(pool, "64:ff9b::", 96), "rm /96");
+	success &= test_6to4(pool, "64:ff9b::192.0.2.33", NULL);
+	success &= test_4to6(pool, "192.0.2.33", "2001:db8:c000:221::");
+
+end:
+	pool6_put(pool);
+	return success;
+}
+
 int init_module(void)
 {
 	START_TESTS("rfc6052.c");
 
 	CALL_TEST(test_rfc6052_table(), "Translation tests");
+	CALL_TEST(test_pool(), "Multiple prefixes");
 
 	END_TESTS;
 }
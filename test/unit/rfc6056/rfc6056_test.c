@@ -7,55 +7,21 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Alberto Leiva");
 MODULE_DESCRIPTION("Port allocator module test.");
 
-static bool test_md5(void)
+static bool test_siphash(void)
 {
-	struct tuple tuple6;
-	unsigned int result;
+	const u64 key[2] = { 0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL };
+	u8 data[15];
+	unsigned int i;
 	bool success = true;
 
-	memset(&tuple6, 0, sizeof(tuple6));
-
-	tuple6.src.addr6.l3.s6_addr[0] = 'a';
-	tuple6.src.addr6.l3.s6_addr[1] = 'b';
-	tuple6.src.addr6.l3.s6_addr[2] = 'c';
-	tuple6.src.addr6.l3.s6_addr[3] = 'd';
-	tuple6.src.addr6.l3.s6_addr[4] = 'e';
-	tuple6.src.addr6.l3.s6_addr[5] = 'f';
-	tuple6.src.addr6.l3.s6_addr[6] = 'g';
-	tuple6.src.addr6.l3.s6_addr[7] = 'h';
-	tuple6.src.addr6.l3.s6_addr[8] = 'i';
-	tuple6.src.addr6.l3.s6_addr[9] = 'j';
-	tuple6.src.addr6.l3.s6_addr[10] = 'k';
-	tuple6.src.addr6.l3.s6_addr[11] = 'l';
-	tuple6.src.addr6.l3.s6_addr[12] = 'm';
-	tuple6.src.addr6.l3.s6_addr[13] = 'n';
-	tuple6.src.addr6.l3.s6_addr[14] = 'o';
-	tuple6.src.addr6.l3.s6_addr[15] = 'p';
-	tuple6.dst.addr6.l3.s6_addr[0] = 'q';
-	tuple6.dst.addr6.l3.s6_addr[1] = 'r';
-	tuple6.dst.addr6.l3.s6_addr[2] = 's';
-	tuple6.dst.addr6.l3.s6_addr[3] = 't';
-	tuple6.dst.addr6.l3.s6_addr[4] = 'u';
-	tuple6.dst.addr6.l3.s6_addr[5] = 'v';
-	tuple6.dst.addr6.l3.s6_addr[6] = 'w';
-	tuple6.dst.addr6.l3.s6_addr[7] = 'x';
-	tuple6.dst.addr6.l3.s6_addr[8] = 'y';
-	tuple6.dst.addr6.l3.s6_addr[9] = 'z';
-	tuple6.dst.addr6.l3.s6_addr[10] = 'A';
-	tuple6.dst.addr6.l3.s6_addr[11] = 'B';
-	tuple6.dst.addr6.l3.s6_addr[12] = 'C';
-	tuple6.dst.addr6.l3.s6_addr[13] = 'D';
-	tuple6.dst.addr6.l3.s6_addr[14] = 'E';
-	tuple6.dst.addr6.l3.s6_addr[15] = 'F';
-	tuple6.dst.addr6.l4 = (__force __u16)cpu_to_be16(('G' << 8) | 'H');
-
-	secret_key[0] = 'I';
-	secret_key[1] = 'J';
-	secret_key_len = 2;
-
-	success &= ASSERT_INT(0, rfc6056_f(&tuple6, 0b1011, &result), "errcode");
-	/* Expected value gotten from DuckDuckGo. Look up "md5 abcdefg...". */
-	success &= ASSERT_BE32(0xb6a824a9u, (__force __be32)result, "hash");
+	for (i = 0; i < ARRAY_SIZE(data); i++)
+		data[i] = i;
+
+	/* Expected values taken from the SipHash paper's reference vectors. */
+	success &= ASSERT_U64(0x726fdb47dd0e0e31ULL, siphash24(data, 0, key),
+			"empty input");
+	success &= ASSERT_U64(0xa129ca6149be45e5ULL, siphash24(data, 15, key),
+			"15 bytes");
 
 	return success;
 }
@@ -111,6 +77,36 @@ static bool f_args_test(void)
 	return success;
 }
 
+static bool rotation_test(void)
+{
+	struct tuple tuple6;
+	unsigned int result1;
+	unsigned int result2;
+	struct rfc6056_secret *old;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
+		return false;
+
+	success &= ASSERT_INT(0, rfc6056_f(&tuple6, 0b1111, &result1), "before");
+
+	rfc6056_clean();
+	success &= ASSERT_INT(0, rfc6056_f(&tuple6, 0b1111, &result2), "young");
+	success &= ASSERT_UINT(result1, result2, "Young key survives");
+
+	old = rcu_dereference_protected(secret, true);
+	old->birth = jiffies - SECRET_LIFETIME - 1;
+	rfc6056_clean();
+	success &= ASSERT_BOOL(true, old != rcu_dereference_protected(secret,
+			true), "Old key was replaced");
+
+	/* Same false negative chance as in f_args_test(). */
+	success &= ASSERT_INT(0, rfc6056_f(&tuple6, 0b1111, &result2), "after");
+	success &= ASSERT_BOOL(true, result1 != result2, "New key, new result");
+
+	return success;
+}
+
 int init_module(void)
 {
 	int error;
@@ -120,8 +116,9 @@ int init_module(void)
 	if (error)
 		return error;
 
-	CALL_TEST(test_md5(), "MD5 Test");
+	CALL_TEST(test_siphash(), "SipHash Test");
 	CALL_TEST(f_args_test(), "F() arguments test");
+	CALL_TEST(rotation_test(), "Secret rotation test");
 
 	rfc6056_destroy();
 
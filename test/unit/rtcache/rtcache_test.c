@@ -0,0 +1,226 @@
+#include <linux/module.h>
+#include <linux/bottom_half.h>
+#include <net/net_namespace.h>
+
+#include "nat64/unit/skb_generator.h"
+#include "nat64/unit/types.h"
+#include "nat64/unit/unit_test.h"
+#include "common/route_cache.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Route cache test.");
+
+static struct route_cache *cache;
+
+/* The netdevice notifier is never registered here. */
+int xlator_foreach(xlator_foreach_cb cb, void *args)
+{
+	return 0;
+}
+
+static struct sk_buff *create_skb6(char *src, u16 sport, char *dst, u16 dport)
+{
+	struct tuple tuple6;
+	struct sk_buff *skb;
+
+	if (init_tuple6(&tuple6, src, sport, dst, dport, L4PROTO_TCP))
+		return NULL;
+	if (create_skb6_tcp(&tuple6, &skb, 100, 32))
+		return NULL;
+	return skb;
+}
+
+static struct sk_buff *create_skb4(char *src, u16 sport, char *dst, u16 dport)
+{
+	struct tuple tuple4;
+	struct sk_buff *skb;
+
+	if (init_tuple4(&tuple4, src, sport, dst, dport, L4PROTO_TCP))
+		return NULL;
+	if (create_skb4_tcp(&tuple4, &skb, 100, 32))
+		return NULL;
+	return skb;
+}
+
+/**
+ * Computes @skb's cache key. Also releases @skb, since it's no longer needed.
+ */
+static bool compute_key(struct sk_buff *skb, struct rtcache_key *key)
+{
+	struct packet pkt;
+	int error;
+
+	if (!skb)
+		return false;
+
+	error = skb->protocol == htons(ETH_P_IPV6)
+			? pkt_init_ipv6(&pkt, skb)
+			: pkt_init_ipv4(&pkt, skb);
+	if (!error)
+		error = init_key(key, &pkt);
+
+	kfree_skb(skb);
+	return ASSERT_INT(0, error, "key init");
+}
+
+static bool same_key(struct rtcache_key *k1, struct rtcache_key *k2)
+{
+	return !memcmp(k1, k2, sizeof(*k1));
+}
+
+/**
+ * The key should care about exactly the fields the routing functions hand to
+ * the FIB: everything in IPv6, only the destination (and friends) in IPv4.
+ */
+static bool test_keys(void)
+{
+	struct rtcache_key base;
+	struct rtcache_key key;
+	bool success = true;
+
+	if (!compute_key(create_skb6("64:ff9b::192.0.2.1", 80,
+			"2001:db8::1", 1234), &base))
+		return false;
+
+	if (compute_key(create_skb6("64:ff9b::192.0.2.1", 80,
+			"2001:db8::1", 1234), &key))
+		success &= ASSERT_BOOL(true, same_key(&base, &key),
+				"same flow");
+	else
+		success = false;
+
+	if (compute_key(create_skb6("64:ff9b::192.0.2.1", 80,
+			"2001:db8::1", 4321), &key))
+		success &= ASSERT_BOOL(false, same_key(&base, &key),
+				"different destination port");
+	else
+		success = false;
+
+	if (compute_key(create_skb6("64:ff9b::192.0.2.1", 8080,
+			"2001:db8::1", 1234), &key))
+		success &= ASSERT_BOOL(false, same_key(&base, &key),
+				"different source port");
+	else
+		success = false;
+
+	if (compute_key(create_skb6("64:ff9b::198.51.100.7", 80,
+			"2001:db8::1", 1234), &key))
+		success &= ASSERT_BOOL(false, same_key(&base, &key),
+				"different source");
+	else
+		success = false;
+
+	if (compute_key(create_skb6("64:ff9b::192.0.2.1", 80,
+			"2001:db8::2", 1234), &key))
+		success &= ASSERT_BOOL(false, same_key(&base, &key),
+				"different destination");
+	else
+		success = false;
+
+	if (!compute_key(create_skb4("192.0.2.1", 1234,
+			"203.0.113.5", 80), &base))
+		return false;
+
+	if (compute_key(create_skb4("192.0.2.2", 5678,
+			"203.0.113.5", 443), &key))
+		success &= ASSERT_BOOL(true, same_key(&base, &key),
+				"IPv4, different source and ports");
+	else
+		success = false;
+
+	if (compute_key(create_skb4("192.0.2.1", 1234,
+			"203.0.113.6", 80), &key))
+		success &= ASSERT_BOOL(false, same_key(&base, &key),
+				"IPv4, different destination");
+	else
+		success = false;
+
+	return success;
+}
+
+/**
+ * Routes a packet towards @dport of the loopback through the cache.
+ */
+static bool route_loopback(u16 dport)
+{
+	struct sk_buff *skb;
+	struct packet pkt;
+	bool success;
+
+	skb = create_skb6("::1", 5000, "::1", dport);
+	if (!skb)
+		return false;
+	if (pkt_init_ipv6(&pkt, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	success = rtcache_route(cache, &init_net, &pkt) != NULL;
+	kfree_skb(skb);
+	return ASSERT_BOOL(true, success, "routing towards port %u", dport);
+}
+
+static bool assert_stats(u64 hits, u64 misses, char *name)
+{
+	struct rtcache_stats_usr stats;
+	bool success = true;
+
+	rtcache_stats(cache, &stats);
+	success &= ASSERT_U64(hits, stats.hits, "%s hits", name);
+	success &= ASSERT_U64(misses, stats.misses, "%s misses", name);
+	return success;
+}
+
+static bool test_lookups(void)
+{
+	bool success = true;
+
+	/* Same CPU for all of them, so they share a cache. */
+	local_bh_disable();
+	success &= route_loopback(1000);
+	success &= route_loopback(1000);
+	success &= route_loopback(1000);
+	local_bh_enable();
+	success &= assert_stats(2, 1, "same flow");
+
+	local_bh_disable();
+	success &= route_loopback(1001);
+	local_bh_enable();
+	success &= assert_stats(2, 2, "different flow");
+
+	rtcache_flush(cache);
+
+	local_bh_disable();
+	success &= route_loopback(1000);
+	local_bh_enable();
+	success &= assert_stats(2, 3, "after flush");
+
+	return success;
+}
+
+static bool init(void)
+{
+	cache = rtcache_create();
+	return cache != NULL;
+}
+
+static void end(void)
+{
+	rtcache_put(cache);
+}
+
+int init_module(void)
+{
+	START_TESTS("Route cache");
+
+	CALL_TEST(test_keys(), "Keys");
+	INIT_CALL_END(init(), test_lookups(), end(), "Lookups");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -103,8 +103,8 @@ static bool test_db(void)
 	return success;
 }
 
-static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
-		__u32 dst_addr, __u16 dst_id)
+static bool __inject(unsigned int index, __u32 src_addr, __u16 src_id,
+		__u32 dst_addr, __u16 dst_id, unsigned long update_time)
 {
 	struct session_entry *entry;
 	int error;
@@ -119,7 +119,7 @@ static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
 	entry->proto = L4PROTO_UDP;
 	entry->state = ESTABLISHED;
 	entry->timer_type = SESSION_TIMER_EST;
-	entry->update_time = jiffies;
+	entry->update_time = update_time;
 	entry->timeout = UDP_DEFAULT;
 	entry->has_stored = false;
 
@@ -132,6 +132,12 @@ static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
 	return true;
 }
 
+static bool inject(unsigned int index, __u32 src_addr, __u16 src_id,
+		__u32 dst_addr, __u16 dst_id)
+{
+	return __inject(index, src_addr, src_id, dst_addr, dst_id, jiffies);
+}
+
 static bool insert_test_sessions(void)
 {
 	bool success = true;
@@ -254,6 +260,172 @@ static bool simple_session(void)
 	return success;
 }
 
+/**
+ * Packets belonging to existing sessions should only refresh them.
+ * (These normally go through the lockless path.)
+ */
+static bool refresh_session(void)
+{
+	struct tuple tuple6;
+	struct tuple tuple4;
+	struct ipv4_transport_addr dst4;
+	struct bib_session result;
+	__u64 count;
+	bool success = true;
+
+	if (!insert_test_sessions())
+		return false;
+
+	init_src6(&tuple6.src.addr6, 1, 2);
+	init_dst6(&tuple6.dst.addr6, 2, 2);
+	tuple6.l3_proto = L3PROTO_IPV6;
+	tuple6.l4_proto = PROTO;
+	init_dst4(&dst4, 2, 2);
+
+	memset(&result, 0, sizeof(result));
+	success &= ASSERT_INT(0, bib_add6(db, NULL, &tuple6, &dst4, &result),
+			"6-to-4 result");
+	success &= ASSERT_BOOL(true, result.session_set, "6-to-4 session set");
+	success &= ASSERT_BOOL(true, session_equals(&session_instances[0],
+			&result.session), "6-to-4 session");
+
+	init_dst4(&tuple4.src.addr4, 2, 1);
+	init_src4(&tuple4.dst.addr4, 2, 1);
+	tuple4.l3_proto = L3PROTO_IPV4;
+	tuple4.l4_proto = PROTO;
+
+	memset(&result, 0, sizeof(result));
+	success &= ASSERT_INT(0, bib_add4(db, &session_instances[2].dst6,
+			&tuple4, &result), "4-to-6 result");
+	success &= ASSERT_BOOL(true, result.session_set, "4-to-6 session set");
+	success &= ASSERT_BOOL(true, session_equals(&session_instances[2],
+			&result.session), "4-to-6 session");
+
+	success &= ASSERT_INT(0, bib_count_sessions(db, PROTO, &count),
+			"count result");
+	success &= ASSERT_U64(16ULL, count, "session count");
+	success &= test_db();
+
+	success &= flush();
+	return success;
+}
+
+/**
+ * A BIB entry's sessions should all reach the IPv4 side through the prefix its
+ * IPv6 node started with, even if pool6 has others.
+ */
+static bool prefix_sessions(void)
+{
+	struct tuple tuple6;
+	struct tuple tuple4;
+	struct ipv4_transport_addr dst4;
+	struct ipv6_transport_addr dst6;
+	struct ipv6_transport_addr expected;
+	struct bib_session result;
+	__u64 count;
+	bool success = true;
+
+	if (!insert_test_sessions())
+		return false;
+
+	/* 192.0.2.2 through 2001:db8::/32, while the session uses the /96. */
+	init_src6(&tuple6.src.addr6, 1, 2);
+	tuple6.dst.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8u);
+	tuple6.dst.addr6.l3.s6_addr32[1] = cpu_to_be32(0xc0000202u);
+	tuple6.dst.addr6.l3.s6_addr32[2] = 0;
+	tuple6.dst.addr6.l3.s6_addr32[3] = 0;
+	tuple6.dst.addr6.l4 = 2;
+	tuple6.l3_proto = L3PROTO_IPV6;
+	tuple6.l4_proto = PROTO;
+	init_dst4(&dst4, 2, 2);
+
+	success &= ASSERT_INT(-EEXIST, bib_add6(db, NULL, &tuple6, &dst4, NULL),
+			"6-to-4 through another prefix");
+
+	/* New 4-to-6 session; the caller only knows about the /32. */
+	init_dst4(&tuple4.src.addr4, 3, 7);
+	init_src4(&tuple4.dst.addr4, 1, 2);
+	tuple4.l3_proto = L3PROTO_IPV4;
+	tuple4.l4_proto = PROTO;
+	dst6.l3 = tuple6.dst.addr6.l3;
+	dst6.l3.s6_addr32[1] = cpu_to_be32(0xc0000203u);
+	dst6.l4 = 7;
+
+	memset(&result, 0, sizeof(result));
+	success &= ASSERT_INT(0, bib_add4(db, &dst6, &tuple4, &result),
+			"4-to-6 result");
+	success &= ASSERT_BOOL(true, result.session_set, "4-to-6 session set");
+	init_dst6(&expected, 3, 7);
+	success &= ASSERT_TADDR6(&expected, &result.session.dst6,
+			"4-to-6 session inherited the BIB's prefix");
+
+	success &= ASSERT_INT(0, bib_count_sessions(db, PROTO, &count),
+			"count result");
+	success &= ASSERT_U64(17ULL, count, "session count");
+
+	success &= flush();
+	return success;
+}
+
+/**
+ * Expired sessions should be removed in batches no bigger than the budget,
+ * and the ones that are still alive should be left alone.
+ */
+static bool expire_sessions(void)
+{
+	struct bib_config config;
+	unsigned long old;
+	unsigned int rounds;
+	bool success = true;
+
+	bib_config_copy(db, &config);
+	config.clean_budget = 3;
+	bib_config_set(db, &config);
+	old = jiffies - 2 * config.ttl.udp;
+
+	memset(session_instances, 0, sizeof(session_instances));
+	memset(sessions, 0, sizeof(sessions));
+
+	success &= inject(0, 1, 2, 2, 2);
+	success &= __inject(1, 1, 1, 2, 1, old);
+	success &= inject(2, 2, 1, 2, 1);
+	success &= __inject(3, 2, 2, 2, 2, old);
+	success &= __inject(4, 1, 1, 2, 2, old);
+	success &= inject(5, 2, 2, 1, 1);
+	success &= __inject(6, 2, 1, 1, 1, old);
+	success &= __inject(7, 1, 1, 1, 1, old);
+	success &= inject(8, 2, 2, 1, 2);
+	success &= __inject(9, 1, 2, 1, 1, old);
+	success &= inject(10, 2, 1, 1, 2);
+	success &= __inject(11, 1, 2, 1, 2, old);
+	success &= inject(12, 2, 1, 2, 2);
+	success &= __inject(13, 1, 1, 1, 2, old);
+	success &= inject(14, 1, 2, 2, 1);
+	success &= inject(15, 2, 2, 2, 1);
+	if (!success || !test_db())
+		return false;
+
+	/* 8 expired sessions, 3 per round. */
+	success &= ASSERT_BOOL(true, bib_clean(db, NULL), "round 1 pending");
+	success &= ASSERT_BOOL(true, bib_clean(db, NULL), "round 2 pending");
+	for (rounds = 2; rounds < 10 && bib_clean(db, NULL); rounds++)
+		;
+	success &= ASSERT_BOOL(true, rounds < 10, "cleaner finished");
+
+	sessions[1][1][2][1] = NULL;
+	sessions[2][2][2][2] = NULL;
+	sessions[1][1][2][2] = NULL;
+	sessions[2][1][1][1] = NULL;
+	sessions[1][1][1][1] = NULL;
+	sessions[1][2][1][1] = NULL;
+	sessions[1][2][1][2] = NULL;
+	sessions[1][1][1][2] = NULL;
+	success &= test_db();
+
+	success &= flush();
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -261,7 +433,7 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 
 static bool init(void)
 {
-	if (bib_init())
+	if (bib_init(1))
 		return false;
 	db = bib_create();
 	if (!db)
@@ -280,6 +452,9 @@ int init_module(void)
 	START_TESTS("Session");
 
 	INIT_CALL_END(init(), simple_session(), end(), "Single Session");
+	INIT_CALL_END(init(), refresh_session(), end(), "Refresh");
+	INIT_CALL_END(init(), prefix_sessions(), end(), "Prefixes");
+	INIT_CALL_END(init(), expire_sessions(), end(), "Expiration");
 
 	END_TESTS;
 }
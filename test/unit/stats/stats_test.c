@@ -0,0 +1,122 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/smp.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Unit tests for Jool's own counters");
+
+#include "nat64/unit/unit_test.h"
+#include "common/stats.c"
+
+static struct jool_stats *stats;
+
+/**
+ * Asserts that every counter other than the ones in @expected is zero.
+ * @expected is indexed by enum jool_stat_id.
+ */
+static bool assert_counters(__u64 *expected)
+{
+	__u64 actual[JSTAT_COUNT];
+	unsigned int i;
+	bool success = true;
+
+	jstat_query(stats, actual);
+	for (i = 0; i < JSTAT_COUNT; i++)
+		success &= ASSERT_U64(expected[i], actual[i], "counter %u", i);
+
+	return success;
+}
+
+static bool test_verdicts(void)
+{
+	__u64 expected[JSTAT_COUNT] = { 0 };
+
+	local_bh_disable();
+	jstat_inc_verdict(stats, VERDICT_CONTINUE, false);
+	jstat_inc_verdict(stats, VERDICT_ACCEPT, false);
+	jstat_inc_verdict(stats, VERDICT_ACCEPT, false);
+	jstat_inc_verdict(stats, VERDICT_DROP, false);
+	jstat_inc_verdict(stats, VERDICT_STOLEN, false);
+	/* Stolen while translated in place = died in dst_output(). */
+	jstat_inc_verdict(stats, VERDICT_STOLEN, true);
+	jstat_inc(stats, JSTAT_SUCCESS);
+	jstat_inc(stats, JSTAT_HOP_LIMIT);
+	local_bh_enable();
+
+	expected[JSTAT_SUCCESS] = 1;
+	expected[JSTAT_ACCEPT] = 2;
+	expected[JSTAT_DROP] = 2;
+	expected[JSTAT_HELD] = 1;
+	expected[JSTAT_HOP_LIMIT] = 1;
+	return assert_counters(expected);
+}
+
+/** How many times each CPU bumps the DROP counter. */
+static unsigned int drops(unsigned int cpu)
+{
+	return cpu + 1;
+}
+
+static void account_batch(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < drops(smp_processor_id()); i++)
+		jstat_inc_verdict(stats, VERDICT_DROP, false);
+	jstat_inc_verdict(stats, VERDICT_ACCEPT, false);
+	jstat_inc_verdict(stats, VERDICT_STOLEN, false);
+	jstat_inc(stats, JSTAT_POOL6_MISMATCH);
+}
+
+/**
+ * Every CPU counts on its own copy; the query has to add all of them up.
+ */
+static bool test_merge(void)
+{
+	__u64 expected[JSTAT_COUNT] = { 0 };
+	unsigned int cpu;
+
+	for_each_online_cpu(cpu) {
+		if (smp_call_function_single(cpu, account_batch, NULL, 1)) {
+			log_err("Could not run the batch on CPU %u.", cpu);
+			return false;
+		}
+
+		expected[JSTAT_DROP] += drops(cpu);
+		expected[JSTAT_ACCEPT]++;
+		expected[JSTAT_HELD]++;
+		expected[JSTAT_POOL6_MISMATCH]++;
+	}
+
+	return assert_counters(expected);
+}
+
+static bool init(void)
+{
+	stats = jstat_create();
+	return stats != NULL;
+}
+
+static void end(void)
+{
+	jstat_put(stats);
+}
+
+static int stats_test_init(void)
+{
+	START_TESTS("Stats");
+
+	INIT_CALL_END(init(), test_verdicts(), end(), "Verdicts");
+	INIT_CALL_END(init(), test_merge(), end(), "Per-CPU merge");
+
+	END_TESTS;
+}
+
+static void stats_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(stats_test_init);
+module_exit(stats_test_exit);
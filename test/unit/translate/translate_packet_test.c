@@ -374,6 +374,422 @@ static bool test_function_icmp4_minimum_mtu(void)
 	return success;
 }
 
+/**
+ * Translates @skb in place, validates the result with @validate_fn, then undoes
+ * the translation and checks the packet is back to how it was.
+ */
+static bool test_inplace(struct xlation *state, struct sk_buff *skb,
+		bool (*validate_fn)(struct packet *))
+{
+	unsigned char original[sizeof(struct ipv6hdr) + sizeof(struct tcphdr)];
+	unsigned int hdrs_len;
+	unsigned int len;
+	bool success = true;
+
+	hdrs_len = pkt_hdrs_len(&state->in);
+	memcpy(original, skb_network_header(skb), hdrs_len);
+	len = skb->len;
+
+	config->cfg.xlat_in_place = true;
+	success &= ASSERT_BOOL(true, ttpcomm_inplace_possible(state),
+			"In-place possible");
+	success &= ASSERT_INT(VERDICT_CONTINUE, translating_the_packet(state),
+			"Translation result");
+	config->cfg.xlat_in_place = false;
+	if (!success)
+		return false;
+
+	success &= ASSERT_PTR(skb, state->out.skb, "Same skb");
+	success &= ASSERT_BOOL(true, state->backup.active, "Backup active");
+	success &= validate_fn(&state->out);
+
+	ttpcomm_inplace_undo(state);
+	success &= ASSERT_BOOL(false, state->backup.active, "Backup inactive");
+	success &= ASSERT_UINT(len, skb->len, "Undone length");
+	success &= ASSERT_UINT(hdrs_len, pkt_hdrs_len(&state->in),
+			"Undone headers length");
+	success &= ASSERT_INT(0, memcmp(original, skb_network_header(skb),
+			hdrs_len), "Undone headers");
+
+	return success;
+}
+
+static bool validate_inplace4(struct packet *pkt)
+{
+	struct iphdr *hdr4 = pkt_ip4_hdr(pkt);
+	struct tcphdr *hdr_tcp = pkt_tcp_hdr(pkt);
+	unsigned int l4_len = sizeof(*hdr_tcp) + 100;
+	unsigned int len = sizeof(*hdr4) + l4_len;
+	bool success = true;
+
+	success &= ASSERT_UINT(L3PROTO_IPV4, pkt_l3_proto(pkt), "l3 proto");
+	success &= ASSERT_BE16(ETH_P_IP, pkt->skb->protocol, "skb proto");
+	success &= ASSERT_UINT(len, pkt->skb->len, "skb len");
+	success &= ASSERT_UINT(4, hdr4->version, "version");
+	success &= ASSERT_BE16(len, hdr4->tot_len, "tot len");
+	success &= ASSERT_UINT(31, hdr4->ttl, "ttl");
+	success &= ASSERT_UINT(IPPROTO_TCP, hdr4->protocol, "protocol");
+	success &= ASSERT_UINT(0, ip_fast_csum(hdr4, hdr4->ihl), "l3 csum");
+	success &= ASSERT_BE16(5678, hdr_tcp->source, "src port");
+	success &= ASSERT_BE16(80, hdr_tcp->dest, "dst port");
+	success &= ASSERT_UINT(0, csum_tcpudp_magic(hdr4->saddr, hdr4->daddr,
+			l4_len, IPPROTO_TCP, csum_partial(hdr_tcp, l4_len, 0)),
+			"l4 csum");
+
+	return success;
+}
+
+static bool validate_inplace6(struct packet *pkt)
+{
+	struct ipv6hdr *hdr6 = pkt_ip6_hdr(pkt);
+	struct tcphdr *hdr_tcp = pkt_tcp_hdr(pkt);
+	unsigned int l4_len = sizeof(*hdr_tcp) + 100;
+	unsigned int len = sizeof(*hdr6) + l4_len;
+	bool success = true;
+
+	success &= ASSERT_UINT(L3PROTO_IPV6, pkt_l3_proto(pkt), "l3 proto");
+	success &= ASSERT_BE16(ETH_P_IPV6, pkt->skb->protocol, "skb proto");
+	success &= ASSERT_UINT(len, pkt->skb->len, "skb len");
+	success &= ASSERT_UINT(6, hdr6->version, "version");
+	success &= ASSERT_BE16(l4_len, hdr6->payload_len, "payload len");
+	success &= ASSERT_UINT(31, hdr6->hop_limit, "hop limit");
+	success &= ASSERT_UINT(NEXTHDR_TCP, hdr6->nexthdr, "next header");
+	success &= ASSERT_BE16(1234, hdr_tcp->source, "src port");
+	success &= ASSERT_BE16(5678, hdr_tcp->dest, "dst port");
+	success &= ASSERT_UINT(0, csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr,
+			l4_len, NEXTHDR_TCP, csum_partial(hdr_tcp, l4_len, 0)),
+			"l4 csum");
+
+	return success;
+}
+
+static bool test_inplace_6to4(void)
+{
+	struct xlation state = { .jool.global = config };
+	struct tuple tuple6;
+	struct sk_buff *skb;
+	bool success;
+
+	if (init_tuple6(&tuple6, "2001:db8::1", 1234, "64:ff9b::c000:205", 80,
+			L4PROTO_TCP))
+		return false;
+	if (init_tuple4(&state.out.tuple, "192.0.2.1", 5678, "192.0.2.5", 80,
+			L4PROTO_TCP))
+		return false;
+	if (create_skb6_tcp(&tuple6, &skb, 100, 32))
+		return false;
+	if (pkt_init_ipv6(&state.in, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	success = test_inplace(&state, skb, validate_inplace4);
+
+	kfree_skb(skb);
+	return success;
+}
+
+static bool test_inplace_4to6(void)
+{
+	struct xlation state = { .jool.global = config };
+	struct tuple tuple4;
+	struct sk_buff *skb;
+	bool success;
+
+	if (init_tuple4(&tuple4, "192.0.2.5", 80, "192.0.2.1", 5678,
+			L4PROTO_TCP))
+		return false;
+	if (init_tuple6(&state.out.tuple, "64:ff9b::c000:205", 1234,
+			"2001:db8::1", 5678, L4PROTO_TCP))
+		return false;
+	if (create_skb4_tcp(&tuple4, &skb, 100, 32))
+		return false;
+	if (pkt_init_ipv4(&state.in, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	success = test_inplace(&state, skb, validate_inplace6);
+
+	kfree_skb(skb);
+	return success;
+}
+
+static bool test_gso(void)
+{
+	struct tuple tuple6;
+	struct packet pkt;
+	struct sk_buff *skb;
+	struct skb_shared_info *shinfo;
+	unsigned int len;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "2001:db8::1", 1234, "64:ff9b::c000:205", 80,
+			L4PROTO_TCP))
+		return false;
+	if (create_skb6_tcp(&tuple6, &skb, 3000, 32))
+		return false;
+	if (pkt_init_ipv6(&pkt, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	success &= ASSERT_UINT(0, ttpcomm_xlat_gso_type(&pkt, L3PROTO_IPV4),
+			"Not GSO");
+	len = pkt_len(&pkt);
+	success &= ASSERT_UINT(len, pkt_seglen(&pkt), "Not GSO seglen");
+
+	shinfo = skb_shinfo(skb);
+	shinfo->gso_size = 1000;
+	shinfo->gso_type = SKB_GSO_TCPV6 | SKB_GSO_TCP_ECN;
+	shinfo->gso_segs = 3;
+
+	success &= ASSERT_UINT(0, ttpcomm_xlat_gso_type(&pkt, L3PROTO_IPV4),
+			"Unfinished checksum");
+
+	skb->ip_summed = CHECKSUM_PARTIAL;
+	success &= ASSERT_UINT(SKB_GSO_TCPV4 | SKB_GSO_TCP_ECN,
+			ttpcomm_xlat_gso_type(&pkt, L3PROTO_IPV4), "6to4 type");
+	success &= ASSERT_UINT(SKB_GSO_TCPV6 | SKB_GSO_TCP_ECN,
+			ttpcomm_xlat_gso_type(&pkt, L3PROTO_IPV6), "6to6 type");
+	len = sizeof(struct ipv6hdr) + sizeof(struct tcphdr) + 1000;
+	success &= ASSERT_UINT(len, pkt_seglen(&pkt), "GSO seglen");
+
+	shinfo->gso_type = SKB_GSO_UDP;
+	success &= ASSERT_UINT(0, ttpcomm_xlat_gso_type(&pkt, L3PROTO_IPV4),
+			"Unknown type");
+
+	kfree_skb(skb);
+	return success;
+}
+
+/**
+ * Builds the packet fragment_db.c would have assembled out of a 56-byte first
+ * fragment and a 128-byte second fragment.
+ */
+static int create_skb6_reassembled(struct tuple *tuple6, struct sk_buff **result)
+{
+	struct sk_buff *first;
+	struct sk_buff *second;
+	struct ipv6hdr *hdr6;
+	int error;
+
+	error = create_skb6_udp_frag(tuple6, &first, 56, 192, true, true, 0, 32);
+	if (error)
+		return error;
+	error = create_skb6_udp_frag(tuple6, &second, 128, 192, true, false, 64,
+			32);
+	if (error) {
+		kfree_skb(first);
+		return error;
+	}
+
+	skb_pull(second, sizeof(struct ipv6hdr) + sizeof(struct frag_hdr));
+	skb_shinfo(first)->frag_list = second;
+	first->len += second->len;
+	first->data_len += second->len;
+	first->truesize += second->truesize;
+
+	hdr6 = ipv6_hdr(first);
+	hdr6->payload_len = cpu_to_be16(first->len - sizeof(*hdr6));
+	((struct frag_hdr *)(hdr6 + 1))->frag_off &= cpu_to_be16(~IP6_MF);
+
+	*result = first;
+	return 0;
+}
+
+/**
+ * Copies @frag the way translate_subsequent() used to: a new skb, and all of
+ * @frag's payload copied into it.
+ */
+static struct sk_buff *copy_subsequent(struct sk_buff *frag)
+{
+	struct sk_buff *result;
+
+	result = alloc_skb(LL_MAX_HEADER + frag->len, GFP_KERNEL);
+	if (!result)
+		return NULL;
+	skb_reserve(result, LL_MAX_HEADER);
+	skb_put(result, frag->len);
+	if (skb_copy_bits(frag, 0, result->data, frag->len)) {
+		kfree_skb(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/**
+ * Compares @len bytes of @expected (a linear buffer) to @actual's.
+ */
+static bool assert_payload(unsigned char *expected, struct sk_buff *actual,
+		unsigned int len, char *name)
+{
+	unsigned char *buffer;
+	bool success = true;
+
+	if (!ASSERT_UINT(len, actual->len, "%s length", name))
+		return false;
+
+	buffer = kmalloc(len, GFP_KERNEL);
+	if (!buffer)
+		return false;
+	success &= ASSERT_INT(0, skb_copy_bits(actual, 0, buffer, len),
+			"%s copy", name);
+	success &= ASSERT_INT(0, memcmp(expected, buffer, len),
+			"%s bytes", name);
+	kfree(buffer);
+
+	return success;
+}
+
+/**
+ * Translates a reassembled packet and compares its subsequent fragment to the
+ * one the translator used to build by copying.
+ *
+ * Both must carry the same bytes, but the new one must not have allocated (nor
+ * be charged for) a buffer of its own; it is the input fragment's.
+ */
+static bool test_subsequent_zero_copy(void)
+{
+	struct xlation state = { .jool.global = config };
+	struct tuple tuple6;
+	struct sk_buff *skb;
+	struct sk_buff *frag_in;
+	struct sk_buff *frag_out;
+	struct sk_buff *frag_copy;
+	unsigned int len;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "2001:db8::1", 1234, "64:ff9b::c000:205", 80,
+			L4PROTO_UDP))
+		return false;
+	if (init_tuple4(&state.out.tuple, "192.0.2.1", 5678, "192.0.2.5", 80,
+			L4PROTO_UDP))
+		return false;
+	if (create_skb6_reassembled(&tuple6, &skb))
+		return false;
+	if (pkt_init_ipv6(&state.in, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	/* Before: what the old code would have produced. */
+	frag_in = skb_shinfo(skb)->frag_list;
+	frag_copy = copy_subsequent(frag_in);
+	if (!frag_copy) {
+		kfree_skb(skb);
+		return false;
+	}
+
+	if (!ASSERT_INT(VERDICT_CONTINUE, translating_the_packet(&state),
+			"Translation result")) {
+		kfree_skb(frag_copy);
+		kfree_skb(skb);
+		return false;
+	}
+
+	/* After. */
+	frag_out = skb_shinfo(state.out.skb)->frag_list;
+	if (!ASSERT_BOOL(true, frag_out != NULL, "Out has fragments"))
+		goto end;
+
+	success &= ASSERT_PTR(NULL, frag_out->next, "Fragment count");
+	success &= ASSERT_BE16(ETH_P_IP, frag_out->protocol, "Fragment proto");
+	len = skb->len - pkt_hdrs_len(&state.in) + pkt_hdrs_len(&state.out);
+	success &= ASSERT_UINT(len, state.out.skb->len, "Packet length");
+
+	/* Same bytes as the copy, and the input was left alone. */
+	success &= assert_payload(frag_copy->data, frag_out, frag_copy->len,
+			"Translated fragment");
+	success &= assert_payload(frag_copy->data, frag_in, frag_copy->len,
+			"Original fragment");
+
+	/* But they live in the input's buffer; nothing was copied. */
+	success &= ASSERT_BOOL(true, skb_cloned(frag_out), "Cloned fragment");
+	success &= ASSERT_PTR(frag_in->head, frag_out->head, "Shared buffer");
+	success &= ASSERT_PTR(frag_in->data, frag_out->data, "Shared payload");
+	success &= ASSERT_BOOL(false, frag_copy->head == frag_out->head,
+			"Copy has its own buffer");
+	/*
+	 * A clone reports its parent's truesize, since it pins the same
+	 * buffer. The copy would have been charged for a second one.
+	 */
+	success &= ASSERT_UINT(frag_in->truesize, frag_out->truesize,
+			"Fragment truesize");
+
+end:
+	kfree_skb(frag_copy);
+	kfree_skb(state.out.skb);
+	kfree_skb(skb);
+	return success;
+}
+
+/**
+ * Checks the CHECKSUM_COMPLETE sum of @skb matches its contents.
+ */
+static bool validate_complete(struct sk_buff *skb)
+{
+	bool success = true;
+
+	success &= ASSERT_UINT(CHECKSUM_COMPLETE, skb->ip_summed, "ip_summed");
+	success &= ASSERT_UINT(csum_fold(skb_checksum(skb, 0, skb->len, 0)),
+			csum_fold(skb->csum), "Sum");
+
+	return success;
+}
+
+/**
+ * Translates a CHECKSUM_COMPLETE packet both ways (copying and in place), and
+ * checks the sums of the results are still complete.
+ */
+static bool test_complete_csum(void)
+{
+	struct xlation state = { .jool.global = config };
+	struct tuple tuple6;
+	struct sk_buff *skb;
+	bool success = true;
+
+	if (init_tuple6(&tuple6, "2001:db8::1", 1234, "64:ff9b::c000:205", 80,
+			L4PROTO_TCP))
+		return false;
+	if (init_tuple4(&state.out.tuple, "192.0.2.1", 5678, "192.0.2.5", 80,
+			L4PROTO_TCP))
+		return false;
+	if (create_skb6_tcp(&tuple6, &skb, 101, 32))
+		return false;
+	if (pkt_init_ipv6(&state.in, skb)) {
+		kfree_skb(skb);
+		return false;
+	}
+	skb->ip_summed = CHECKSUM_COMPLETE;
+	skb->csum = skb_checksum(skb, 0, skb->len, 0);
+
+	/* Copy */
+	if (!ASSERT_INT(VERDICT_CONTINUE, translating_the_packet(&state),
+			"Copy translation result")) {
+		kfree_skb(skb);
+		return false;
+	}
+	success &= validate_complete(state.out.skb);
+	kfree_skb(state.out.skb);
+
+	/* In place */
+	config->cfg.xlat_in_place = true;
+	success &= ASSERT_INT(VERDICT_CONTINUE, translating_the_packet(&state),
+			"In-place translation result");
+	config->cfg.xlat_in_place = false;
+	if (success) {
+		success &= ASSERT_PTR(skb, state.out.skb, "Same skb");
+		success &= validate_complete(skb);
+		ttpcomm_inplace_undo(&state);
+		success &= validate_complete(skb);
+	}
+
+	kfree_skb(skb);
+	return success;
+}
+
 int init_module(void)
 {
 	START_TESTS("Translating the Packet");
@@ -393,6 +809,12 @@ int init_module(void)
 	CALL_TEST(test_function_has_nonzero_segments_left(), "Segments left indicator function");
 	CALL_TEST(test_function_icmp4_minimum_mtu(), "ICMP4 Minimum MTU function");
 
+	CALL_TEST(test_inplace_6to4(), "In-place 6->4 translation");
+	CALL_TEST(test_inplace_4to6(), "In-place 4->6 translation");
+	CALL_TEST(test_gso(), "GSO metadata translation");
+	CALL_TEST(test_subsequent_zero_copy(), "Subsequent fragments are not copied");
+	CALL_TEST(test_complete_csum(), "CHECKSUM_COMPLETE survives translation");
+
 	config_put(config);
 
 	END_TESTS;
@@ -82,16 +82,14 @@ static const struct argp_option pool6791_opt = {
 };
 
 
-#ifdef BENCHMARK
-static const struct argp_option benchmark_opt = {
+static const struct argp_option logtime_opt = {
 		.name = "logTime",
 		.key = ARGP_LOGTIME,
 		.arg = NULL,
 		.flags = 0,
-		.doc = "The command will operate on the logs times database.",
+		.doc = "The command will operate on the translation step latency histograms.",
 		.group = 0,
 };
-#endif
 
 static const struct argp_option global_opt = {
 		.name = "global",
@@ -117,6 +115,15 @@ static const struct argp_option instance_opt = {
 		.group = 0,
 };
 
+static const struct argp_option stats_opt = {
+		.name = "stats",
+		.key = ARGP_STATS,
+		.arg = NULL,
+		.flags = 0,
+		.doc = "The command will print the translator's counters.",
+		.group = 0,
+};
+
 static const struct argp_option display_opt = {
 		.name = "display",
 		.key = ARGP_DISPLAY,
@@ -345,6 +352,16 @@ static const struct argp_option plateaus_opt = {
 		.group = 0,
 };
 
+static const struct argp_option in_place_opt = {
+		.name = OPTNAME_XLAT_IN_PLACE,
+		.key = ARGP_XLAT_IN_PLACE,
+		.arg = BOOL_FORMAT,
+		.flags = 0,
+		.doc = "Rewrite the headers of TCP and UDP packets in place, "
+				"instead of copying them into new packets?\n",
+		.group = 0,
+};
+
 static const struct argp_option adf_opt = {
 		.name = OPTNAME_DROP_BY_ADDR,
 		.key = ARGP_DROP_ADDR,
@@ -421,6 +438,17 @@ static const struct argp_option ttl_frag_opt = {
 		.group = 0,
 };
 
+static const struct argp_option frag_max_bytes_opt = {
+		.name = OPTNAME_FRAG_MAX_BYTES,
+		.key = ARGP_FRAG_MAX_BYTES,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Set the maximum number of bytes the fragment database "
+				"can hold before it starts evicting its oldest "
+				"entries.\n",
+		.group = 0,
+};
+
 static const struct argp_option max_so_opt = {
 		.name = OPTNAME_MAX_SO,
 		.key = ARGP_STORED_PKTS,
@@ -431,6 +459,16 @@ static const struct argp_option max_so_opt = {
 		.group = 0,
 };
 
+static const struct argp_option clean_budget_opt = {
+		.name = OPTNAME_CLEAN_BUDGET,
+		.key = ARGP_CLEAN_BUDGET,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Set the maximum number of sessions the cleaner can "
+				"handle in one go, per BIB shard.\n",
+		.group = 0,
+};
+
 static const struct argp_option icmp_src_opt = {
 		.name = OPTNAME_SRC_ICMP6E_BETTER,
 		.key = ARGP_SRC_ICMP6ERRS_BETTER,
@@ -582,11 +620,10 @@ static const struct argp_option *opts_siit[] = {
 	&blacklist_opt,
 	&pool6791_opt,
 	&global_opt,
-#ifdef BENCHMARK
-	&benchmark_opt,
-#endif
+	&logtime_opt,
 	&parse_file_opt,
 	&instance_opt,
+	&stats_opt,
 
 	&operations_hdr_opt,
 	&display_opt,
@@ -607,6 +644,7 @@ static const struct argp_option *opts_siit[] = {
 	&override_tos_opt,
 	&tos_opt,
 	&plateaus_opt,
+	&in_place_opt,
 	&csum_fix_opt,
 	&hairpin_mode_opt,
 	&random_pool6791_opt,
@@ -621,11 +659,10 @@ static const struct argp_option *opts_nat64[] = {
 	&session_opt,
 	&joold_opt,
 	&global_opt,
-#ifdef BENCHMARK
-	&benchmark_opt,
-#endif
+	&logtime_opt,
 	&parse_file_opt,
 	&instance_opt,
+	&stats_opt,
 
 	&operations_hdr_opt,
 	&display_opt,
@@ -655,7 +692,10 @@ static const struct argp_option *opts_nat64[] = {
 	&override_tos_opt,
 	&tos_opt,
 	&plateaus_opt,
+	&in_place_opt,
 	&max_so_opt,
+	&clean_budget_opt,
+	&frag_max_bytes_opt,
 	&icmp_src_opt,
 	&f_args_opt,
 	&rst_during_fin_rcv_opt,
@@ -709,6 +749,7 @@ static const struct argp_option *opts_global_siit[] = {
 	&override_tos_opt,
 	&tos_opt,
 	&plateaus_opt,
+	&in_place_opt,
 	&csum_fix_opt,
 	&hairpin_mode_opt,
 	&random_pool6791_opt,
@@ -721,7 +762,10 @@ static const struct argp_option *opts_global_nat64[] = {
 	&override_tos_opt,
 	&tos_opt,
 	&plateaus_opt,
+	&in_place_opt,
 	&max_so_opt,
+	&clean_budget_opt,
+	&frag_max_bytes_opt,
 	&icmp_src_opt,
 	&f_args_opt,
 	&rst_during_fin_rcv_opt,
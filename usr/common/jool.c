@@ -26,6 +26,7 @@
 #include "nat64/usr/pool4.h"
 #include "nat64/usr/bib.h"
 #include "nat64/usr/session.h"
+#include "nat64/usr/stats.h"
 #include "nat64/usr/eam.h"
 #include "nat64/usr/global.h"
 #include "nat64/usr/log_time.h"
@@ -404,6 +405,9 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 	case ARGP_INSTANCE:
 		error = update_state(args, MODE_INSTANCE, INSTANCE_OPS);
 		break;
+	case ARGP_STATS:
+		error = update_state(args, MODE_STATS, STATS_OPS);
+		break;
 
 	case ARGP_DISPLAY:
 		error = update_state(args, DISPLAY_MODES, OP_DISPLAY);
@@ -475,6 +479,7 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 		break;
 	case ARGP_RESET_TCLASS:
 	case ARGP_RESET_TOS:
+	case ARGP_XLAT_IN_PLACE:
 	case ARGP_COMPUTE_CSUM_ZERO:
 	case ARGP_RANDOMIZE_RFC6791:
 	case ARGP_DROP_ADDR:
@@ -520,6 +525,12 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 	case ARGP_STORED_PKTS:
 		error = set_global_u32(args, key, str, 0, MAX_U32);
 		break;
+	case ARGP_CLEAN_BUDGET:
+		error = set_global_u32(args, key, str, 1, MAX_U32);
+		break;
+	case ARGP_FRAG_MAX_BYTES:
+		error = set_global_u32(args, key, str, 0, MAX_U32);
+		break;
 	case ARGP_SS_FLUSH_DEADLINE:
 		error = set_global_u64(args, key, str, 0, MAX_U32, 1);
 		break;
@@ -847,18 +858,14 @@ static int handle_addr4_pool(struct arguments *args)
 
 static int handle_logtime(struct arguments *args)
 {
-#ifdef BENCHMARK
 	switch (args->op) {
 	case OP_DISPLAY:
 		return logtime_display();
+	case OP_FLUSH:
+		return logtime_flush();
 	default:
-		log_err("Unknown operation for logtime mode: %u.", args->op);
-		break;
+		return unknown_op("logtime", args->op);
 	}
-#else
-	log_err("Benchmark mode was disabled during compilation.");
-	return -EINVAL;
-#endif
 }
 
 static int handle_global(struct arguments *args)
@@ -896,6 +903,16 @@ static int handle_instance(struct arguments *args)
 	}
 }
 
+static int handle_stats(struct arguments *args)
+{
+	switch (args->op) {
+	case OP_DISPLAY:
+		return stats_display();
+	default:
+		return unknown_op("stats", args->op);
+	}
+}
+
 static int main_wrapped(struct arguments *args)
 {
 	switch (args->mode) {
@@ -922,6 +939,8 @@ static int main_wrapped(struct arguments *args)
 		return handle_joold(args);
 	case MODE_INSTANCE:
 		return handle_instance(args);
+	case MODE_STATS:
+		return handle_stats(args);
 	}
 
 	log_err("Unknown configuration mode: %u", args->mode);
@@ -78,11 +78,12 @@ static void print_rfc6791v6_prefix(struct full_config *config, bool csv)
 
 static int handle_display_response(struct jool_response *response, void *arg)
 {
-	struct full_config *conf = response->payload;
+	struct global_display_usr *display = response->payload;
+	struct full_config *conf = &display->config;
 
-	if (response->payload_len != sizeof(struct full_config)) {
+	if (response->payload_len != sizeof(struct global_display_usr)) {
 		log_err("Jool's response has a bogus length. (expected %zu, got %zu)",
-				sizeof(struct full_config),
+				sizeof(struct global_display_usr),
 				response->payload_len);
 		return -EINVAL;
 	}
@@ -103,11 +104,17 @@ static int handle_display_response(struct jool_response *response, void *arg)
 	printf("  --%s: ", OPTNAME_MTU_PLATEAUS);
 	print_plateaus(&conf->global, ",");
 	printf("\n");
+	printf("  --%s: %s\n", OPTNAME_XLAT_IN_PLACE,
+			print_bool(conf->global.xlat_in_place));
 
 	if (xlat_is_nat64()) {
 
 		printf("  --%s: %u\n", OPTNAME_MAX_SO,
 				conf->bib.max_stored_pkts);
+		printf("  --%s: %u\n", OPTNAME_CLEAN_BUDGET,
+				conf->bib.clean_budget);
+		printf("  --%s: %u\n", OPTNAME_FRAG_MAX_BYTES,
+				conf->frag.max_bytes);
 		printf("  --%s: %s\n", OPTNAME_SRC_ICMP6E_BETTER,
 				print_bool(conf->global.nat64.src_icmp6errs_better));
 		printf("  --%s: %s\n", OPTNAME_HANDLE_FIN_RCV_RST,
@@ -173,6 +180,13 @@ static int handle_display_response(struct jool_response *response, void *arg)
 		print_time_friendly(conf->joold.flush_deadline);
 		printf("    --%s: %u\n", OPTNAME_SS_CAPACITY, conf->joold.capacity);
 		printf("    --%s: %u\n", OPTNAME_SS_MAX_PAYLOAD, conf->joold.max_payload);
+		printf("\n");
+
+		printf("  Fragment database:\n");
+		printf("    Entries: %llu\n", display->fragdb.entries);
+		printf("    Bytes: %llu\n", display->fragdb.bytes);
+		printf("    Evictions: %llu\n", display->fragdb.evictions);
+		printf("    Timeouts: %llu\n", display->fragdb.timeouts);
 	}
 
 	return 0;
@@ -180,12 +194,13 @@ static int handle_display_response(struct jool_response *response, void *arg)
 
 static int handle_display_response_csv(struct jool_response *response, void *arg)
 {
-	struct full_config *conf = response->payload;
+	struct global_display_usr *display = response->payload;
+	struct full_config *conf = &display->config;
 	struct global_config_usr *global = &conf->global;
 
-	if (response->payload_len != sizeof(struct full_config)) {
+	if (response->payload_len != sizeof(struct global_display_usr)) {
 		log_err("Jool's response has a bogus length. (expected %zu, got %zu)",
-				sizeof(struct full_config),
+				sizeof(struct global_display_usr),
 				response->payload_len);
 		return -EINVAL;
 	}
@@ -203,6 +218,8 @@ static int handle_display_response_csv(struct jool_response *response, void *arg
 	printf("\"");
 	print_plateaus(global, ",");
 	printf("\"\n");
+	printf("%s,%s\n", OPTNAME_XLAT_IN_PLACE,
+			print_csv_bool(global->xlat_in_place));
 
 	if (xlat_is_siit()) {
 		printf("%s,%s\n", OPTNAME_AMEND_UDP_CSUM,
@@ -234,6 +251,10 @@ static int handle_display_response_csv(struct jool_response *response, void *arg
 
 		printf("%s,%u\n", OPTNAME_MAX_SO,
 				conf->bib.max_stored_pkts);
+		printf("%s,%u\n", OPTNAME_CLEAN_BUDGET,
+				conf->bib.clean_budget);
+		printf("%s,%u\n", OPTNAME_FRAG_MAX_BYTES,
+				conf->frag.max_bytes);
 
 		printf("joold Enabled,%s\n",
 				print_csv_bool(conf->joold.enabled));
@@ -257,6 +278,11 @@ static int handle_display_response_csv(struct jool_response *response, void *arg
 		printf("\n%s,", OPTNAME_FRAG_TIMEOUT);
 		print_time_csv(conf->frag.ttl);
 		printf("\n");
+
+		printf("Fragment entries,%llu\n", display->fragdb.entries);
+		printf("Fragment bytes,%llu\n", display->fragdb.bytes);
+		printf("Fragment evictions,%llu\n", display->fragdb.evictions);
+		printf("Fragment timeouts,%llu\n", display->fragdb.timeouts);
 	}
 
 	return 0;
@@ -355,6 +355,8 @@ static int write_number(struct nl_buffer *buffer, enum global_type type,
 		msg.payload16 = json->valueint;
 		break;
 	case MAX_PKTS:
+	case CLEAN_BUDGET:
+	case FRAGMENT_MAX_BYTES:
 	case SS_CAPACITY:
 	case UDP_TIMEOUT:
 	case ICMP_TIMEOUT:
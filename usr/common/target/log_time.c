@@ -1,111 +1,125 @@
-#ifdef BENCHMARK
-
 #include "nat64/usr/log_time.h"
 
 #include <errno.h>
-#include <time.h>
 #include "nat64/common/config.h"
-#include "nat64/common/str_utils.h"
 #include "nat64/common/types.h"
 #include "nat64/usr/netlink.h"
 
 #define HDR_LEN sizeof(struct request_hdr)
 #define PAYLOAD_LEN sizeof(struct request_logtime)
 
-struct display_params {
-	struct request_logtime *req_payload;
-	int row_count;
+static const char *stage_names[] = {
+	[LOGTIME_DETERMINE_IN_TUPLE] = "Determine incoming tuple",
+	[LOGTIME_FILTERING] = "Filtering and updating",
+	[LOGTIME_COMPUTE_OUT_TUPLE] = "Compute outgoing tuple",
+	[LOGTIME_TRANSLATE] = "Translate",
+	[LOGTIME_SEND] = "Send",
 };
 
-static int logtime_display_response(struct nl_msg *msg, void *arg)
+/** Percentiles to print, in tenths of a percent. */
+static const unsigned int percentiles[] = { 500, 900, 990, 999 };
+#define PERCENTILE_COUNT (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/**
+ * Returns the largest duration (in nanoseconds) that falls in bucket @index.
+ * This is the inverse of the kernel's logtime_bucket().
+ */
+static __u64 bucket_max(unsigned int index)
 {
-	struct nlmsghdr *hdr;
-	struct logtime_entry_usr *entries;
-	struct display_params *params = arg;
-	const char *l3_proto_out, *l4_proto;
-	char *l3_proto_in;
-	__u16 entry_count, i;
-
-	hdr = nlmsg_hdr(msg);
-	entries = nlmsg_data(hdr);
-	entry_count = nlmsg_datalen(hdr) / sizeof(*entries);
-
-	if (params->req_payload->l3_proto == L3PROTO_IPV4) {
-		l3_proto_in = "IPv6";
-	} else {
-		l3_proto_in = "IPv4";
+	unsigned int group = index >> LOGTIME_SUB_BITS;
+	unsigned int sub = index & ((1 << LOGTIME_SUB_BITS) - 1);
+
+	if (group == 0)
+		return index;
+	return ((((__u64)1 << LOGTIME_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+}
+
+/**
+ * Returns the duration below which @tenths per mille of @histogram's samples
+ * fall. @total is the number of samples.
+ */
+static __u64 percentile(struct logtime_usr *histogram, __u64 total,
+		unsigned int tenths)
+{
+	__u64 rank;
+	__u64 seen = 0;
+	unsigned int i;
+
+	rank = (total * tenths + 999) / 1000;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < LOGTIME_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			return bucket_max(i);
 	}
-	l3_proto_out = l3proto_to_string(params->req_payload->l3_proto);
-	l4_proto = l4proto_to_string(params->req_payload->l4_proto);
 
-	for (i = 0; i < entry_count; i++) {
-		printf ("%s->%s,", l3_proto_in, l3_proto_out);
-		printf ("%s,", l4_proto);
-		printf ("%ld,%ld\n", entries[i].time.tv_sec, entries[i].time.tv_nsec);
+	return bucket_max(LOGTIME_BUCKETS - 1);
+}
+
+static int logtime_display_response(struct jool_response *response, void *arg)
+{
+	struct logtime_usr *histogram = response->payload;
+	enum logtime_stage *stage = arg;
+	__u64 total = 0;
+	unsigned int i;
+	int last = -1;
+
+	if (response->payload_len != sizeof(*histogram)) {
+		log_err("Jool's response is not the expected structure.");
+		return -EINVAL;
 	}
 
-	params->row_count += entry_count;
+	for (i = 0; i < LOGTIME_BUCKETS; i++) {
+		if (histogram->buckets[i]) {
+			total += histogram->buckets[i];
+			last = i;
+		}
+	}
 
-	if (hdr->nlmsg_flags & NLM_F_MULTI) {
-		params->req_payload->display.iterate = true;
-	} else {
-		params->req_payload->display.iterate = false;
+	printf("%-25s %12llu", stage_names[*stage], total);
+	if (!total) {
+		printf("\n");
+		return 0;
 	}
+
+	for (i = 0; i < PERCENTILE_COUNT; i++)
+		printf(" %10llu", percentile(histogram, total, percentiles[i]));
+	printf(" %10llu\n", bucket_max(last));
 	return 0;
 }
 
-
-static bool display_single_db(l3_protocol l3_proto, l4_protocol l4_proto)
+int logtime_display(void)
 {
 	unsigned char request[HDR_LEN + PAYLOAD_LEN];
-	struct request_hdr *hdr = (struct request_hdr *) request;
-	struct request_logtime *payload = (struct request_logtime *) (request + HDR_LEN);
-	struct display_params params;
-	bool error;
-
-	init_request_hdr(hdr, sizeof(request), MODE_LOGTIME, OP_DISPLAY);
-	payload->l3_proto = (__u8) l3_proto;
-	payload->l4_proto = (__u8) l4_proto;
-	payload->display.iterate = false;
-
-	params.row_count = 0;
-	params.req_payload = payload;
-
-	do {
-		error = netlink_request(request, hdr->length, logtime_display_response, &params);
+	struct request_hdr *hdr = (struct request_hdr *)request;
+	struct request_logtime *payload = (struct request_logtime *)
+			(request + HDR_LEN);
+	enum logtime_stage stage;
+	int error;
+
+	init_request_hdr(hdr, MODE_LOGTIME, OP_DISPLAY);
+
+	printf("All durations are in nanoseconds, and approximate to %u%%.\n",
+			100 >> LOGTIME_SUB_BITS);
+	printf("%-25s %12s %10s %10s %10s %10s %10s\n", "Step", "Samples",
+			"p50", "p90", "p99", "p99.9", "Max");
+
+	for (stage = 0; stage < LOGTIME_STAGE_COUNT; stage++) {
+		payload->display.stage = stage;
+		error = netlink_request(request, sizeof(request),
+				logtime_display_response, &stage);
 		if (error)
-			break;
-	} while (params.req_payload->display.iterate);
-
-	if (!error) {
-		if (params.row_count > 0)
-			printf("  (Fetched %u entries.)\n", params.row_count);
-		else
-			printf("  (empty)\n");
+			return error;
 	}
 
-	return error;
+	return 0;
 }
 
-int logtime_display()
+int logtime_flush(void)
 {
-	int tcp_ip6_error = 0;
-	int udp_ip6_error = 0;
-	int icmp_ip6_error = 0;
-	int tcp_ip4_error = 0;
-	int udp_ip4_error = 0;
-	int icmp_ip4_error = 0;
-
-	printf("L3 protocol,L4 Protocol,seconds,nanoseconds\n");
-	tcp_ip6_error = display_single_db(L3PROTO_IPV6, L4PROTO_TCP);
-	udp_ip6_error = display_single_db(L3PROTO_IPV6, L4PROTO_UDP);
-	icmp_ip6_error = display_single_db(L3PROTO_IPV6, L4PROTO_ICMP);
-	tcp_ip4_error = display_single_db(L3PROTO_IPV4, L4PROTO_TCP);
-	udp_ip4_error = display_single_db(L3PROTO_IPV4, L4PROTO_UDP);
-	icmp_ip4_error = display_single_db(L3PROTO_IPV4, L4PROTO_ICMP);
-
-	return (tcp_ip6_error || udp_ip6_error || icmp_ip6_error || tcp_ip4_error || udp_ip4_error
-			|| icmp_ip4_error ) ? -EINVAL : 0;
+	struct request_hdr hdr;
+	init_request_hdr(&hdr, MODE_LOGTIME, OP_FLUSH);
+	return netlink_request(&hdr, sizeof(hdr), NULL, NULL);
 }
-
-#endif /* BENCHMARK */
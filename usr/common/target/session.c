@@ -175,12 +175,19 @@ int session_display(bool use_tcp, bool use_udp, bool use_icmp, bool numeric_host
 
 static int session_count_response(struct jool_response *response, void *arg)
 {
-	if (response->payload_len != sizeof(__u64)) {
-		log_err("Jool's response is not the expected integer.");
+	struct session_count_usr *result = response->payload;
+
+	if (response->payload_len != sizeof(*result)) {
+		log_err("Jool's response is not the expected structure.");
 		return -EINVAL;
 	}
 
-	printf("%llu\n", *((__u64 *)response->payload));
+	printf("%llu\n", result->count);
+	/* stderr, so scripts that parse the count are not disturbed. */
+	if (result->count)
+		fprintf(stderr, "  (%llu bytes per session; %llu KiB total.)\n",
+				result->bytes / result->count,
+				result->bytes / 1024);
 	return 0;
 }
 
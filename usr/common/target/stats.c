@@ -0,0 +1,110 @@
+#include "nat64/usr/stats.h"
+
+#include <errno.h>
+#include "nat64/common/config.h"
+#include "nat64/common/xlat.h"
+#include "nat64/usr/netlink.h"
+
+static const char *jstat_names[] = {
+	[JSTAT_SUCCESS] = "Translated",
+	[JSTAT_ACCEPT] = "Returned to the kernel",
+	[JSTAT_DROP] = "Dropped",
+	[JSTAT_HELD] = "Stored for later",
+	[JSTAT_POOL6_MISMATCH] = "Destination not in pool6",
+	[JSTAT_POOL4_MISMATCH] = "Destination not in pool4",
+	[JSTAT_BIB4_NOT_FOUND] = "No BIB entry",
+	[JSTAT_UNTRANSLATABLE] = "Untranslatable address",
+	[JSTAT_ROUTE_FAILED] = "Route failed",
+	[JSTAT_MALFORMED] = "Malformed",
+	[JSTAT_UNKNOWN_L4] = "Unknown layer 4 protocol",
+	[JSTAT_UNKNOWN_ICMP] = "Untranslatable ICMP type/code",
+	[JSTAT_ICMP_CSUM] = "Bad ICMP error checksum",
+	[JSTAT_HOP_LIMIT] = "Hop limit exceeded",
+	[JSTAT_TOO_BIG] = "Packet too big",
+	[JSTAT_ENOMEM] = "Out of memory",
+	[JSTAT_HAIRPIN_LOOP] = "Hairpin loop",
+	[JSTAT_POOL4_EXHAUSTED] = "pool4 exhausted",
+	[JSTAT_ADF] = "Address-Dependent Filtering",
+	[JSTAT_SESSION_REJECTED] = "Rejected by Filtering and Updating",
+	[JSTAT_PING_PROHIBITED] = "ICMPv6 info dropped by policy",
+	[JSTAT_FRAG_REJECTED] = "Fragment rejected",
+	[JSTAT_XMIT_FAILED] = "Transmission failed",
+};
+
+static unsigned int percentage(__u64 part, __u64 total)
+{
+	return total ? (100 * part / total) : 0;
+}
+
+/**
+ * Prints the nonzero counters from @first to @last (both inclusive), and
+ * whatever part of @total they do not explain.
+ */
+static void print_reasons(__u64 *jstats, enum jool_stat_id first,
+		enum jool_stat_id last, __u64 total)
+{
+	enum jool_stat_id id;
+	__u64 explained = 0;
+
+	for (id = first; id <= last; id++) {
+		if (jstats[id]) {
+			printf("    %s: %llu\n", jstat_names[id], jstats[id]);
+			explained += jstats[id];
+		}
+	}
+
+	if (total > explained)
+		printf("    Other: %llu\n", total - explained);
+}
+
+static int stats_display_response(struct jool_response *response, void *arg)
+{
+	struct stats_usr *stats = response->payload;
+	struct rtcache_stats_usr *rtcache;
+	struct csum_stats_usr *csum;
+	__u64 total;
+
+	if (response->payload_len != sizeof(*stats)) {
+		log_err("Jool's response is not the expected structure.");
+		return -EINVAL;
+	}
+
+	printf("Packets:\n");
+	printf("  %s: %llu\n", jstat_names[JSTAT_SUCCESS],
+			stats->jstats[JSTAT_SUCCESS]);
+	printf("  %s: %llu\n", jstat_names[JSTAT_ACCEPT],
+			stats->jstats[JSTAT_ACCEPT]);
+	print_reasons(stats->jstats, JSTAT_POOL6_MISMATCH, JSTAT_ROUTE_FAILED,
+			stats->jstats[JSTAT_ACCEPT]);
+	printf("  %s: %llu\n", jstat_names[JSTAT_DROP],
+			stats->jstats[JSTAT_DROP]);
+	print_reasons(stats->jstats, JSTAT_MALFORMED, JSTAT_XMIT_FAILED,
+			stats->jstats[JSTAT_DROP]);
+	if (xlat_is_nat64())
+		printf("  %s: %llu\n", jstat_names[JSTAT_HELD],
+				stats->jstats[JSTAT_HELD]);
+
+	rtcache = &stats->rtcache;
+	total = rtcache->hits + rtcache->misses;
+	printf("Route cache:\n");
+	printf("  Hits: %llu (%u%%)\n", rtcache->hits,
+			percentage(rtcache->hits, total));
+	printf("  Misses: %llu (%u%%)\n", rtcache->misses,
+			percentage(rtcache->misses, total));
+	printf("    Stale: %llu\n", rtcache->stale);
+
+	csum = &stats->csum;
+	printf("Layer 4 checksums:\n");
+	printf("  Left to the NIC: %llu\n", csum->partial);
+	printf("  CHECKSUM_COMPLETE kept: %llu\n", csum->complete);
+	printf("  Computed in software: %llu\n", csum->full);
+
+	return 0;
+}
+
+int stats_display(void)
+{
+	struct request_hdr hdr;
+	init_request_hdr(&hdr, MODE_STATS, OP_DISPLAY);
+	return netlink_request(&hdr, sizeof(hdr), stats_display_response, NULL);
+}
@@ -0,0 +1,240 @@
+/*
+ * jool_fastpath: Translates the packets of established NAT64 sessions in a BPF
+ * program, instead of Jool.
+ *
+ * Usage: jool_fastpath [-o <BPF object>] [-i <seconds>] <interface>...
+ *
+ * It attaches xlat.bpf.c to the TC ingress hook of the given interfaces (the
+ * ones where the IPv6 and IPv4 traffic of the Jool instance of the current
+ * network namespace arrive), and then, every <seconds> (default 1):
+ *
+ * - Copies the instance's established TCP and UDP sessions into the BPF maps,
+ *   and drops the ones it no longer has.
+ * - Reports the activity the BPF program has seen to Jool, so the sessions do
+ *   not expire.
+ *
+ * Keep <seconds> well below the session timeouts. The BPF program keeps
+ * translating the packets of a session Jool has dropped for up to one interval.
+ *
+ * Needs Linux 5.12 or newer. (See xlat.bpf.c.) Jool's statistics do not count
+ * the packets the BPF program translates.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <bpf/libbpf.h>
+#include "nat64/usr/fastpath/sync.h"
+#include "nat64/usr/log.h"
+#include "nat64/usr/netlink.h"
+
+#ifndef FASTPATH_OBJ
+#define FASTPATH_OBJ "jool_fastpath.o"
+#endif
+
+struct hook {
+	struct bpf_tc_hook hook;
+	struct bpf_tc_opts opts;
+	/* Did we add the clsact qdisc? (Otherwise somebody else owns it.) */
+	bool qdisc_created;
+};
+
+static struct hook *hooks;
+static unsigned int hook_count;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int signal)
+{
+	stop = 1;
+}
+
+static int attach(struct hook *hook, char *dev, int prog_fd)
+{
+	int ifindex;
+	int error;
+
+	ifindex = if_nametoindex(dev);
+	if (!ifindex) {
+		error = errno;
+		log_perror(dev, error);
+		return -error;
+	}
+
+	memset(hook, 0, sizeof(*hook));
+	hook->hook.sz = sizeof(hook->hook);
+	hook->hook.ifindex = ifindex;
+	hook->hook.attach_point = BPF_TC_INGRESS;
+	hook->opts.sz = sizeof(hook->opts);
+	hook->opts.prog_fd = prog_fd;
+
+	error = bpf_tc_hook_create(&hook->hook);
+	if (error && error != -EEXIST) {
+		log_perror("Could not create the clsact qdisc", -error);
+		return error;
+	}
+	hook->qdisc_created = !error;
+
+	error = bpf_tc_attach(&hook->hook, &hook->opts);
+	if (error) {
+		log_perror("Could not attach the BPF program", -error);
+		if (hook->qdisc_created)
+			bpf_tc_hook_destroy(&hook->hook);
+		return error;
+	}
+
+	log_info("Attached to %s.", dev);
+	return 0;
+}
+
+static void detach(struct hook *hook)
+{
+	/* bpf_tc_detach() wants the handle and priority only. */
+	hook->opts.flags = 0;
+	hook->opts.prog_fd = 0;
+	hook->opts.prog_id = 0;
+	bpf_tc_detach(&hook->hook, &hook->opts);
+
+	if (hook->qdisc_created)
+		bpf_tc_hook_destroy(&hook->hook);
+}
+
+static void detach_all(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < hook_count; i++)
+		detach(&hooks[i]);
+	hook_count = 0;
+}
+
+static int attach_all(char **devs, unsigned int dev_count, int prog_fd)
+{
+	unsigned int i;
+	int error;
+
+	hooks = calloc(dev_count, sizeof(*hooks));
+	if (!hooks)
+		return -ENOMEM;
+
+	for (i = 0; i < dev_count; i++) {
+		error = attach(&hooks[i], devs[i], prog_fd);
+		if (error) {
+			detach_all();
+			return error;
+		}
+		hook_count++;
+	}
+
+	return 0;
+}
+
+static void print_usage(char *program)
+{
+	log_err("Usage: %s [-o <BPF object>] [-i <seconds>] <interface>...",
+			program);
+}
+
+int main(int argc, char **argv)
+{
+	char *obj_path = FASTPATH_OBJ;
+	unsigned int interval = 1;
+	struct bpf_object *obj;
+	struct bpf_program *prog;
+	struct sigaction sa;
+	int opt;
+	int error;
+
+	while ((opt = getopt(argc, argv, "o:i:")) != -1) {
+		switch (opt) {
+		case 'o':
+			obj_path = optarg;
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 10);
+			if (interval == 0) {
+				log_err("The interval has to be a positive number of seconds.");
+				return -EINVAL;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+	if (optind == argc) {
+		print_usage(argv[0]);
+		return -EINVAL;
+	}
+
+	obj = bpf_object__open_file(obj_path, NULL);
+	error = libbpf_get_error(obj);
+	if (error) {
+		log_err("Could not open %s.", obj_path);
+		return error;
+	}
+	error = bpf_object__load(obj);
+	if (error) {
+		log_err("Could not load %s into the kernel.", obj_path);
+		goto end;
+	}
+	prog = bpf_object__find_program_by_name(obj, "jool_fastpath");
+	if (!prog) {
+		log_err("%s lacks the jool_fastpath program.", obj_path);
+		error = -EINVAL;
+		goto end;
+	}
+
+	error = sync_init(obj);
+	if (error)
+		goto end;
+	error = netlink_init();
+	if (error)
+		goto sync;
+
+	/* Fill the maps before the program can see any traffic. */
+	error = sync_cycle();
+	if (error)
+		goto netlink;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	error = attach_all(&argv[optind], argc - optind,
+			bpf_program__fd(prog));
+	if (error)
+		goto netlink;
+
+	while (!stop) {
+		sleep(interval);
+		error = sync_cycle();
+		if (error)
+			break;
+	}
+
+	detach_all();
+	/* Don't lose the activity of the last interval. */
+	if (!error)
+		error = sync_cycle();
+	/* Fall through. */
+
+netlink:
+	netlink_destroy();
+	/* Fall through. */
+
+sync:
+	sync_destroy();
+	/* Fall through. */
+
+end:
+	free(hooks);
+	bpf_object__close(obj);
+	return error;
+}
@@ -0,0 +1,391 @@
+#include "nat64/usr/fastpath/sync.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <bpf/bpf.h>
+#include "nat64/common/config.h"
+#include "nat64/common/session.h"
+#include "nat64/common/types.h"
+#include "nat64/usr/fastpath/maps.h"
+#include "nat64/usr/netlink.h"
+
+#define HDR_LEN sizeof(struct request_hdr)
+#define PAYLOAD_LEN sizeof(struct request_session)
+
+struct sync_state {
+	/** Number of the current cycle. */
+	__u32 gen;
+	/** When the previous cycle started. (CLOCK_MONOTONIC, nanoseconds.) */
+	__u64 since;
+
+	/** Table being synced. (L4PROTO_TCP or L4PROTO_UDP.) */
+	__u8 l4_proto;
+	/** The session display request being paged. */
+	struct request_session *request;
+
+	/** Sessions from the current page the BPF program translated for. */
+	struct session_refresh_usr *refreshes;
+	unsigned int refresh_count;
+	unsigned int refresh_capacity;
+
+	/** Sessions that could not be added to the maps (they're full?). */
+	unsigned int failed;
+};
+
+static int sessions6_fd;
+static int sessions4_fd;
+static int config_fd;
+static struct sync_state state;
+
+static int get_fd(struct bpf_object *obj, char *name)
+{
+	int fd;
+
+	fd = bpf_object__find_map_fd_by_name(obj, name);
+	if (fd < 0)
+		log_err("The BPF object lacks the '%s' map.", name);
+	return fd;
+}
+
+int sync_init(struct bpf_object *obj)
+{
+	sessions6_fd = get_fd(obj, "sessions6");
+	if (sessions6_fd < 0)
+		return sessions6_fd;
+	sessions4_fd = get_fd(obj, "sessions4");
+	if (sessions4_fd < 0)
+		return sessions4_fd;
+	config_fd = get_fd(obj, "config");
+	if (config_fd < 0)
+		return config_fd;
+
+	memset(&state, 0, sizeof(state));
+	return 0;
+}
+
+void sync_destroy(void)
+{
+	free(state.refreshes);
+	state.refreshes = NULL;
+}
+
+/**
+ * Same clock as bpf_ktime_get_ns().
+ */
+static __u64 now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int config_response(struct jool_response *response, void *arg)
+{
+	struct global_display_usr *display = response->payload;
+	struct global_config_usr *global;
+	struct fastpath_config config;
+	__u32 zero = 0;
+
+	if (response->payload_len != sizeof(*display)) {
+		log_err("Jool's response is not the expected structure.");
+		return -EINVAL;
+	}
+	global = &display->config.global;
+
+	config.enabled = global->status;
+	config.reset_traffic_class = global->reset_traffic_class;
+	config.reset_tos = global->reset_tos;
+	config.new_tos = global->new_tos;
+
+	if (bpf_map_update_elem(config_fd, &zero, &config, BPF_ANY)) {
+		log_perror("Could not update the config map", errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int sync_config(void)
+{
+	struct request_hdr request;
+
+	init_request_hdr(&request, MODE_GLOBAL, OP_DISPLAY);
+	return netlink_request(&request, sizeof(request), config_response,
+			NULL);
+}
+
+static void init_flow6(struct fastpath_flow6 *flow,
+		struct ipv6_transport_addr *src,
+		struct ipv6_transport_addr *dst,
+		__u8 proto)
+{
+	memset(flow, 0, sizeof(*flow));
+	memcpy(flow->src, &src->l3, sizeof(flow->src));
+	memcpy(flow->dst, &dst->l3, sizeof(flow->dst));
+	flow->sport = htons(src->l4);
+	flow->dport = htons(dst->l4);
+	flow->proto = proto;
+}
+
+static void init_flow4(struct fastpath_flow4 *flow,
+		struct ipv4_transport_addr *src,
+		struct ipv4_transport_addr *dst,
+		__u8 proto)
+{
+	memset(flow, 0, sizeof(*flow));
+	flow->src = src->l3.s_addr;
+	flow->dst = dst->l3.s_addr;
+	flow->sport = htons(src->l4);
+	flow->dport = htons(dst->l4);
+	flow->proto = proto;
+}
+
+/**
+ * Adds @session to the maps, or marks it as still alive if it already was
+ * there.
+ * Also returns, in @last_seen, the last time the BPF program translated one of
+ * its packets.
+ *
+ * The BPF program might write last_seen between the lookup and the update, in
+ * which case the older value wins. That costs the activity of a few
+ * microseconds at most, which the next packet will fix.
+ */
+static int export_session(struct session_entry_usr *session, __u64 *last_seen)
+{
+	struct fastpath_flow6 key6;
+	struct fastpath_session6 value6;
+	struct fastpath_flow4 key4;
+	struct fastpath_session4 value4;
+	__u8 proto;
+
+	proto = (state.l4_proto == L4PROTO_TCP) ? IPPROTO_TCP : IPPROTO_UDP;
+
+	init_flow6(&key6, &session->src6, &session->dst6, proto);
+	if (bpf_map_lookup_elem(sessions6_fd, &key6, &value6)) {
+		memset(&value6, 0, sizeof(value6));
+		init_flow4(&value6.xlat, &session->src4, &session->dst4, proto);
+	}
+	value6.gen = state.gen;
+
+	init_flow4(&key4, &session->dst4, &session->src4, proto);
+	if (bpf_map_lookup_elem(sessions4_fd, &key4, &value4)) {
+		memset(&value4, 0, sizeof(value4));
+		init_flow6(&value4.xlat, &session->dst6, &session->src6, proto);
+	}
+	value4.gen = state.gen;
+
+	if (bpf_map_update_elem(sessions6_fd, &key6, &value6, BPF_ANY))
+		return -errno;
+	if (bpf_map_update_elem(sessions4_fd, &key4, &value4, BPF_ANY)) {
+		bpf_map_delete_elem(sessions6_fd, &key6);
+		return -errno;
+	}
+
+	*last_seen = (value6.last_seen > value4.last_seen)
+			? value6.last_seen
+			: value4.last_seen;
+	return 0;
+}
+
+static int add_refresh(struct session_entry_usr *session, __u64 last_seen,
+		__u64 now)
+{
+	struct session_refresh_usr *refresh;
+	unsigned int capacity;
+
+	if (state.refresh_count == state.refresh_capacity) {
+		capacity = state.refresh_capacity ? (2 * state.refresh_capacity)
+				: 64;
+		refresh = realloc(state.refreshes, capacity * sizeof(*refresh));
+		if (!refresh)
+			return -ENOMEM;
+		state.refreshes = refresh;
+		state.refresh_capacity = capacity;
+	}
+
+	refresh = &state.refreshes[state.refresh_count];
+	refresh->src6 = session->src6;
+	refresh->dst4 = session->dst4;
+	/* The BPF program might have written after we sampled the clock. */
+	refresh->idle = (now > last_seen) ? ((now - last_seen) / 1000000) : 0;
+	state.refresh_count++;
+	return 0;
+}
+
+static int session_response(struct jool_response *response, void *arg)
+{
+	struct session_entry_usr *entries = response->payload;
+	struct session_entry_usr *entry;
+	__u16 entry_count, i;
+	__u64 last_seen;
+	__u64 now;
+	int error;
+
+	entry_count = response->payload_len / sizeof(*entries);
+	now = now_ns();
+
+	for (i = 0; i < entry_count; i++) {
+		entry = &entries[i];
+
+		/* The others still need Jool's state machine. */
+		if (state.l4_proto == L4PROTO_TCP && entry->state != ESTABLISHED)
+			continue;
+
+		if (export_session(entry, &last_seen)) {
+			state.failed++;
+			continue;
+		}
+
+		if (last_seen > state.since) {
+			error = add_refresh(entry, last_seen, now);
+			if (error)
+				return error;
+		}
+	}
+
+	state.request->display.offset_set = response->hdr->pending_data;
+	if (entry_count > 0) {
+		state.request->display.offset.src = entries[entry_count - 1].src4;
+		state.request->display.offset.dst = entries[entry_count - 1].dst4;
+	}
+	return 0;
+}
+
+/**
+ * Tells Jool about the activity of the sessions the last page yielded, so it
+ * does not expire them.
+ */
+static int send_refreshes(void)
+{
+	struct request_hdr *hdr;
+	struct request_session *payload;
+	size_t len;
+	int error;
+
+	if (state.refresh_count == 0)
+		return 0;
+
+	len = HDR_LEN + PAYLOAD_LEN
+			+ state.refresh_count * sizeof(*state.refreshes);
+	hdr = malloc(len);
+	if (!hdr)
+		return -ENOMEM;
+	payload = (struct request_session *)(hdr + 1);
+
+	init_request_hdr(hdr, MODE_SESSION, OP_UPDATE);
+	memset(payload, 0, sizeof(*payload));
+	payload->l4_proto = state.l4_proto;
+	memcpy(payload + 1, state.refreshes,
+			state.refresh_count * sizeof(*state.refreshes));
+
+	error = netlink_request(hdr, len, NULL, NULL);
+	free(hdr);
+	state.refresh_count = 0;
+	return error;
+}
+
+static int sync_table(__u8 l4_proto)
+{
+	unsigned char request[HDR_LEN + PAYLOAD_LEN];
+	struct request_hdr *hdr = (struct request_hdr *)request;
+	struct request_session *payload;
+	int error;
+
+	payload = (struct request_session *)(request + HDR_LEN);
+
+	init_request_hdr(hdr, MODE_SESSION, OP_DISPLAY);
+	memset(payload, 0, sizeof(*payload));
+	payload->l4_proto = l4_proto;
+	payload->display.offset_set = false;
+
+	state.l4_proto = l4_proto;
+	state.request = payload;
+
+	do {
+		error = netlink_request(request, sizeof(request),
+				session_response, NULL);
+		if (error)
+			return error;
+		error = send_refreshes();
+		if (error)
+			return error;
+	} while (payload->display.offset_set);
+
+	return 0;
+}
+
+/**
+ * Removes the entries of @fd the current cycle did not find in Jool.
+ * @key and @next are buffers of @key_len bytes. @value is a buffer whose gen
+ * field sits @gen_offset bytes in.
+ */
+static unsigned int sweep(int fd, void *key, void *next, size_t key_len,
+		void *value, size_t gen_offset)
+{
+	unsigned int removed = 0;
+	int error;
+
+	error = bpf_map_get_next_key(fd, NULL, key);
+	while (!error) {
+		/* Fetch the next key first, since this one might die. */
+		error = bpf_map_get_next_key(fd, key, next);
+
+		if (!bpf_map_lookup_elem(fd, key, value)
+				&& *(__u32 *)((char *)value + gen_offset) != state.gen) {
+			bpf_map_delete_elem(fd, key);
+			removed++;
+		}
+
+		memcpy(key, next, key_len);
+	}
+
+	return removed;
+}
+
+/**
+ * Copies Jool's configuration and established sessions into the maps, drops
+ * the sessions Jool no longer has, and reports the activity the BPF program
+ * has seen since the previous cycle.
+ */
+int sync_cycle(void)
+{
+	struct fastpath_flow6 key6, next6;
+	struct fastpath_session6 value6;
+	struct fastpath_flow4 key4, next4;
+	struct fastpath_session4 value4;
+	unsigned int removed;
+	__u64 start;
+	int error;
+
+	start = now_ns();
+	state.gen++;
+	state.failed = 0;
+
+	error = sync_config();
+	if (error)
+		return error;
+	error = sync_table(L4PROTO_TCP);
+	if (error)
+		return error;
+	error = sync_table(L4PROTO_UDP);
+	if (error)
+		return error;
+
+	removed = sweep(sessions6_fd, &key6, &next6, sizeof(key6), &value6,
+			offsetof(struct fastpath_session6, gen));
+	sweep(sessions4_fd, &key4, &next4, sizeof(key4), &value4,
+			offsetof(struct fastpath_session4, gen));
+
+	if (state.failed)
+		log_err("%u sessions did not fit in the BPF maps.", state.failed);
+	if (removed)
+		log_debug("%u sessions left the BPF maps.", removed);
+
+	state.since = start;
+	return 0;
+}
@@ -0,0 +1,416 @@
+/*
+ * jool_fastpath's BPF program.
+ *
+ * It is attached to the TC ingress hook of the translator's interfaces. It
+ * translates the TCP and UDP packets of the sessions jool_fastpath copied into
+ * its maps, and forwards them itself.
+ *
+ * Anything it is not sure about is returned to the kernel untouched
+ * (TC_ACT_OK), which means Jool will see it as usual. That includes unknown
+ * flows, TCP SYNs, FINs and RSTs (so Jool's state machine sees them), IPv6
+ * extension headers, IPv4 options and fragments, zero UDP checksums, expiring
+ * hop limits and TTLs, hairpinning, and anything the FIB cannot route out of
+ * the box or whose translation would not fit the egress MTU.
+ *
+ * The checks are done before the packet is touched. Once a packet starts
+ * changing, it is either forwarded or dropped.
+ *
+ * Needs Linux 5.12 or newer, because older bpf_fib_lookup()s ignore tot_len
+ * in this context, and so cannot tell whether the translated packet fits.
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/pkt_cls.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+#include "nat64/usr/fastpath/maps.h"
+
+/* <sys/socket.h> and <netinet/ip.h> cannot be included from BPF code. */
+#define AF_INET 2
+#define AF_INET6 10
+#define IP_DF 0x4000
+#define IP_MF 0x2000
+#define IP_OFFSET 0x1FFF
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, FASTPATH_MAX_SESSIONS);
+	__type(key, struct fastpath_flow6);
+	__type(value, struct fastpath_session6);
+} sessions6 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, FASTPATH_MAX_SESSIONS);
+	__type(key, struct fastpath_flow4);
+	__type(value, struct fastpath_session4);
+} sessions4 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct fastpath_config);
+} config SEC(".maps");
+
+/** The first four bytes of both TCP and UDP headers. */
+struct ports {
+	__be16 src;
+	__be16 dst;
+};
+
+/**
+ * A packet that has already been approved for translation, and the changes
+ * that translating it involves.
+ */
+struct rewrite {
+	/** Protocol of the new layer 3 header. (ETH_P_IP or ETH_P_IPV6.) */
+	__be16 eth_proto;
+	__u8 l4_proto;
+	/** struct fastpath_flow4.sport and dport, or fastpath_flow6's. */
+	struct ports *ports;
+	/** Checksum difference caused by the ports. */
+	__s64 ports_diff;
+	/** Checksum difference caused by the pseudoheader. */
+	__s64 pseudo_diff;
+	/** Where the packet is leaving from, and to which neighbor. */
+	struct bpf_fib_lookup fib;
+	/** The session's last_seen field. */
+	__u64 *last_seen;
+};
+
+static __always_inline __u16 csum_fold(__s64 csum)
+{
+	__u32 sum = csum;
+
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return ~sum;
+}
+
+/**
+ * Validates the layer 4 header that starts at @l4.
+ * Also returns its length in @l4hdr_len.
+ *
+ * Returns nonzero if the packet has to be left to Jool.
+ */
+static __always_inline int punt_l4(__u8 proto, void *l4, void *data_end,
+		__u32 *l4hdr_len)
+{
+	struct tcphdr *tcp;
+	struct udphdr *udp;
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		tcp = l4;
+		if ((void *)(tcp + 1) > data_end)
+			return 1;
+		/* Jool's state machine needs to see these. */
+		if (tcp->syn || tcp->fin || tcp->rst)
+			return 1;
+		*l4hdr_len = tcp->doff << 2;
+		return 0;
+
+	case IPPROTO_UDP:
+		udp = l4;
+		if ((void *)(udp + 1) > data_end)
+			return 1;
+		/* Might need to be computed from scratch. */
+		if (udp->check == 0)
+			return 1;
+		*l4hdr_len = sizeof(*udp);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Second half of the translation: Writes @l3hdr (whose length is
+ * @l3hdr_len) and @rw into the packet, and sends it to the neighbor.
+ *
+ * bpf_skb_change_proto() has to have been called already.
+ */
+static __always_inline int rewrite(struct __sk_buff *skb, void *l3hdr,
+		__u32 l3hdr_len, struct rewrite *rw)
+{
+	__u32 l4_offset = ETH_HLEN + l3hdr_len;
+	__u32 csum_offset;
+	__u64 mangled_0;
+
+	if (rw->l4_proto == IPPROTO_TCP) {
+		csum_offset = l4_offset + offsetof(struct tcphdr, check);
+		mangled_0 = 0;
+	} else {
+		csum_offset = l4_offset + offsetof(struct udphdr, check);
+		/* A translated zero UDP checksum means "no checksum." */
+		mangled_0 = BPF_F_MARK_MANGLED_0;
+	}
+
+	/*
+	 * bpf_skb_change_proto() kept the CHECKSUM_COMPLETE sum in line with
+	 * the bytes it removed or inserted. BPF_F_RECOMPUTE_CSUM does the same
+	 * for the ones the new header overrides.
+	 */
+	if (bpf_skb_store_bytes(skb, ETH_HLEN, l3hdr, l3hdr_len,
+			BPF_F_RECOMPUTE_CSUM))
+		return TC_ACT_SHOT;
+	/*
+	 * The ports and the checksum change by opposite amounts, so the
+	 * CHECKSUM_COMPLETE sum stays the same.
+	 */
+	if (bpf_skb_store_bytes(skb, l4_offset, rw->ports, sizeof(*rw->ports),
+			0))
+		return TC_ACT_SHOT;
+	if (bpf_l4_csum_replace(skb, csum_offset, 0, rw->ports_diff, mangled_0))
+		return TC_ACT_SHOT;
+	if (bpf_l4_csum_replace(skb, csum_offset, 0, rw->pseudo_diff,
+			BPF_F_PSEUDO_HDR | mangled_0))
+		return TC_ACT_SHOT;
+
+	if (bpf_skb_store_bytes(skb, offsetof(struct ethhdr, h_dest),
+			rw->fib.dmac, ETH_ALEN, 0))
+		return TC_ACT_SHOT;
+	if (bpf_skb_store_bytes(skb, offsetof(struct ethhdr, h_source),
+			rw->fib.smac, ETH_ALEN, 0))
+		return TC_ACT_SHOT;
+	if (bpf_skb_store_bytes(skb, offsetof(struct ethhdr, h_proto),
+			&rw->eth_proto, sizeof(rw->eth_proto), 0))
+		return TC_ACT_SHOT;
+
+	*rw->last_seen = bpf_ktime_get_ns();
+	return bpf_redirect(rw->fib.ifindex, 0);
+}
+
+/**
+ * Mirrors ttp64_inplace().
+ */
+static __always_inline int xlat64(struct __sk_buff *skb,
+		struct fastpath_config *cfg)
+{
+	void *data = (void *)(long)skb->data;
+	void *data_end = (void *)(long)skb->data_end;
+	struct ipv6hdr *hdr6 = data + ETH_HLEN;
+	struct ports *ports;
+	struct fastpath_flow6 key;
+	struct fastpath_session6 *session;
+	struct iphdr hdr4;
+	struct rewrite rw;
+	__u32 l4hdr_len;
+	__u32 seglen;
+	__u32 tot_len;
+
+	if ((void *)(hdr6 + 1) > data_end)
+		return TC_ACT_OK;
+	if (hdr6->version != 6 || hdr6->hop_limit <= 1)
+		return TC_ACT_OK;
+	/* This also rules out extension headers. */
+	if (punt_l4(hdr6->nexthdr, hdr6 + 1, data_end, &l4hdr_len))
+		return TC_ACT_OK;
+	ports = (struct ports *)(hdr6 + 1);
+	if ((void *)(ports + 1) > data_end)
+		return TC_ACT_OK;
+
+	/* Aggregated packets can be as big as IPv6 allows. */
+	tot_len = sizeof(hdr4) + bpf_ntohs(hdr6->payload_len);
+	if (tot_len > 0xFFFF)
+		return TC_ACT_OK;
+	if (skb->len < ETH_HLEN + sizeof(*hdr6) + bpf_ntohs(hdr6->payload_len))
+		return TC_ACT_OK;
+
+	__builtin_memset(&key, 0, sizeof(key));
+	__builtin_memcpy(key.src, &hdr6->saddr, sizeof(key.src));
+	__builtin_memcpy(key.dst, &hdr6->daddr, sizeof(key.dst));
+	key.sport = ports->src;
+	key.dport = ports->dst;
+	key.proto = hdr6->nexthdr;
+
+	session = bpf_map_lookup_elem(&sessions6, &key);
+	if (!session)
+		return TC_ACT_OK;
+
+	/* Same as ttp64_inplace(); GSO segments are smaller than tot_len. */
+	seglen = skb->gso_size
+			? (sizeof(hdr4) + l4hdr_len + skb->gso_size)
+			: tot_len;
+
+	__builtin_memset(&hdr4, 0, sizeof(hdr4));
+	hdr4.version = 4;
+	hdr4.ihl = 5;
+	hdr4.tos = cfg->reset_tos
+			? cfg->new_tos
+			: ((hdr6->priority << 4) | (hdr6->flow_lbl[0] >> 4));
+	hdr4.tot_len = bpf_htons(tot_len);
+	hdr4.id = bpf_get_prandom_u32();
+	hdr4.frag_off = (seglen > 1260) ? bpf_htons(IP_DF) : 0;
+	hdr4.ttl = hdr6->hop_limit - 1;
+	hdr4.protocol = key.proto;
+	hdr4.saddr = session->xlat.src;
+	hdr4.daddr = session->xlat.dst;
+	hdr4.check = csum_fold(bpf_csum_diff(NULL, 0, (__be32 *)&hdr4,
+			sizeof(hdr4), 0));
+
+	__builtin_memset(&rw, 0, sizeof(rw));
+	rw.fib.family = AF_INET;
+	rw.fib.tos = hdr4.tos;
+	rw.fib.l4_protocol = hdr4.protocol;
+	rw.fib.sport = session->xlat.sport;
+	rw.fib.dport = session->xlat.dport;
+	/* GSO packets are checked by segment, which is bpf_fib_lookup()'s 0. */
+	rw.fib.tot_len = skb->gso_size ? 0 : tot_len;
+	rw.fib.ifindex = skb->ingress_ifindex;
+	rw.fib.ipv4_src = hdr4.saddr;
+	rw.fib.ipv4_dst = hdr4.daddr;
+	/* Hairpins get BPF_FIB_LKUP_RET_NOT_FWDED, among other things. */
+	if (bpf_fib_lookup(skb, &rw.fib, sizeof(rw.fib), 0)
+			!= BPF_FIB_LKUP_RET_SUCCESS)
+		return TC_ACT_OK;
+
+	rw.eth_proto = bpf_htons(ETH_P_IP);
+	rw.l4_proto = key.proto;
+	rw.ports = (struct ports *)&session->xlat.sport;
+	rw.ports_diff = bpf_csum_diff((__be32 *)&key.sport, sizeof(struct ports),
+			(__be32 *)&session->xlat.sport, sizeof(struct ports), 0);
+	/* The length and protocol fields sum up the same in both. */
+	rw.pseudo_diff = bpf_csum_diff(key.src,
+			sizeof(key.src) + sizeof(key.dst),
+			&session->xlat.src,
+			sizeof(session->xlat.src) + sizeof(session->xlat.dst),
+			0);
+	rw.last_seen = &session->last_seen;
+
+	if (bpf_skb_change_proto(skb, rw.eth_proto, 0))
+		return TC_ACT_OK;
+	return rewrite(skb, &hdr4, sizeof(hdr4), &rw);
+}
+
+/**
+ * Mirrors ttp46_inplace().
+ */
+static __always_inline int xlat46(struct __sk_buff *skb,
+		struct fastpath_config *cfg)
+{
+	void *data = (void *)(long)skb->data;
+	void *data_end = (void *)(long)skb->data_end;
+	struct iphdr *hdr4 = data + ETH_HLEN;
+	struct iphdr copy4;
+	struct ports *ports;
+	struct fastpath_flow4 key;
+	struct fastpath_session4 *session;
+	struct ipv6hdr hdr6;
+	struct rewrite rw;
+	__u32 l4hdr_len;
+	__u32 tot_len;
+
+	if ((void *)(hdr4 + 1) > data_end)
+		return TC_ACT_OK;
+	__builtin_memcpy(&copy4, hdr4, sizeof(copy4));
+
+	if (copy4.version != 4 || copy4.ihl != 5 || copy4.ttl <= 1)
+		return TC_ACT_OK;
+	if (copy4.frag_off & bpf_htons(IP_MF | IP_OFFSET))
+		return TC_ACT_OK;
+	/* The kernel has not validated it yet; this is ingress. */
+	if (csum_fold(bpf_csum_diff(NULL, 0, (__be32 *)&copy4, sizeof(copy4),
+			0)) != 0)
+		return TC_ACT_OK;
+	tot_len = bpf_ntohs(copy4.tot_len);
+	if (tot_len < sizeof(copy4) || skb->len < ETH_HLEN + tot_len)
+		return TC_ACT_OK;
+	if (punt_l4(copy4.protocol, hdr4 + 1, data_end, &l4hdr_len))
+		return TC_ACT_OK;
+	ports = (struct ports *)(hdr4 + 1);
+	if ((void *)(ports + 1) > data_end)
+		return TC_ACT_OK;
+
+	__builtin_memset(&key, 0, sizeof(key));
+	key.src = copy4.saddr;
+	key.dst = copy4.daddr;
+	key.sport = ports->src;
+	key.dport = ports->dst;
+	key.proto = copy4.protocol;
+
+	session = bpf_map_lookup_elem(&sessions4, &key);
+	if (!session)
+		return TC_ACT_OK;
+
+	__builtin_memset(&hdr6, 0, sizeof(hdr6));
+	hdr6.version = 6;
+	if (!cfg->reset_traffic_class) {
+		hdr6.priority = copy4.tos >> 4;
+		hdr6.flow_lbl[0] = copy4.tos << 4;
+	}
+	hdr6.payload_len = bpf_htons(tot_len - sizeof(copy4));
+	hdr6.nexthdr = copy4.protocol;
+	hdr6.hop_limit = copy4.ttl - 1;
+	__builtin_memcpy(&hdr6.saddr, session->xlat.src, sizeof(hdr6.saddr));
+	__builtin_memcpy(&hdr6.daddr, session->xlat.dst, sizeof(hdr6.daddr));
+
+	__builtin_memset(&rw, 0, sizeof(rw));
+	rw.fib.family = AF_INET6;
+	rw.fib.l4_protocol = hdr6.nexthdr;
+	rw.fib.sport = session->xlat.sport;
+	rw.fib.dport = session->xlat.dport;
+	rw.fib.tot_len = skb->gso_size ? 0 : (sizeof(hdr6) + tot_len
+			- sizeof(copy4));
+	rw.fib.ifindex = skb->ingress_ifindex;
+	rw.fib.flowinfo = *(__be32 *)&hdr6 & bpf_htonl(0x0FFFFFFF);
+	__builtin_memcpy(rw.fib.ipv6_src, session->xlat.src,
+			sizeof(rw.fib.ipv6_src));
+	__builtin_memcpy(rw.fib.ipv6_dst, session->xlat.dst,
+			sizeof(rw.fib.ipv6_dst));
+	if (bpf_fib_lookup(skb, &rw.fib, sizeof(rw.fib), 0)
+			!= BPF_FIB_LKUP_RET_SUCCESS)
+		return TC_ACT_OK;
+
+	rw.eth_proto = bpf_htons(ETH_P_IPV6);
+	rw.l4_proto = key.proto;
+	rw.ports = (struct ports *)&session->xlat.sport;
+	rw.ports_diff = bpf_csum_diff((__be32 *)&key.sport, sizeof(struct ports),
+			(__be32 *)&session->xlat.sport, sizeof(struct ports), 0);
+	rw.pseudo_diff = bpf_csum_diff(&key.src,
+			sizeof(key.src) + sizeof(key.dst),
+			session->xlat.src,
+			sizeof(session->xlat.src) + sizeof(session->xlat.dst),
+			0);
+	rw.last_seen = &session->last_seen;
+
+	if (bpf_skb_change_proto(skb, rw.eth_proto, 0))
+		return TC_ACT_OK;
+	return rewrite(skb, &hdr6, sizeof(hdr6), &rw);
+}
+
+SEC("tc")
+int jool_fastpath(struct __sk_buff *skb)
+{
+	void *data = (void *)(long)skb->data;
+	void *data_end = (void *)(long)skb->data_end;
+	struct ethhdr *eth = data;
+	struct fastpath_config *cfg;
+	__u32 zero = 0;
+
+	if ((void *)(eth + 1) > data_end)
+		return TC_ACT_OK;
+
+	cfg = bpf_map_lookup_elem(&config, &zero);
+	if (!cfg || !cfg->enabled)
+		return TC_ACT_OK;
+
+	switch (eth->h_proto) {
+	case bpf_htons(ETH_P_IPV6):
+		return xlat64(skb, cfg);
+	case bpf_htons(ETH_P_IP):
+		return xlat46(skb, cfg);
+	}
+
+	return TC_ACT_OK;
+}
+
+char _license[] SEC("license") = "GPL";